@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "calib.h"
+#include <string.h>
+
+#if defined(__ICCARM__)
+#include <intrinsics.h>
+#endif
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Places the table in use in the internal SRAM0, filled at runtime.
+#if defined(__ICCARM__)
+    #define CALIB_SRAM  _Pragma("location=\".sram0\"") __no_init
+#else
+    #define CALIB_SRAM
+#endif
+
+/// (a * b[15:0]) / 2^16 + acc, b signed, in one SMLAWB instruction.
+#if defined(__ICCARM__)
+    #define SMLAWB(a, b, acc)   __SMLAWB(a, b, acc)
+#else
+    #define SMLAWB(a, b, acc)   ((int) (((long long) (a) * (short) (b)) >> 16) + (acc))
+#endif
+
+/// Shift of the raw time giving t * scale / 2^CALIB_SCALE_BITS with SMLAWB.
+#define TIME_SHIFT      (16 - CALIB_SCALE_BITS)
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// Calibration of a channel.
+typedef struct {
+
+    /// Offset term -t0 * scale, in calibrated counts.
+    int offset;
+    /// Relative bin width, Q14.
+    int scale;
+    /// Offset in raw counts, as set.
+    int t0;
+
+} CalibEntry;
+
+/// Calibration table.
+typedef struct {
+
+    /// Table ID.
+    unsigned int id;
+    /// Channels.
+    CalibEntry pEntries[TDC_NUM_CHANNELS];
+
+} CalibTable;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Table in use.
+CALIB_SRAM static CalibTable activeTable;
+
+/// Table being edited, and committed table waiting for the next run.
+static CalibTable stagedTable;
+static CalibTable committedTable;
+static unsigned char pending = 0;
+
+/// Run of the last events calibrated, ~0 before the first one.
+static unsigned int activeRun = 0xFFFFFFFF;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sets every channel to no correction, in the staged table and the one in
+/// use, with table ID 0.
+//------------------------------------------------------------------------------
+void CALIB_Initialize(void)
+{
+    unsigned int i;
+
+    stagedTable.id = 0;
+    for (i = 0; i < TDC_NUM_CHANNELS; i++) {
+
+        CALIB_SetChannel(i, 0, CALIB_SCALE_ONE);
+    }
+    memcpy(&activeTable, &stagedTable, sizeof(CalibTable));
+    pending = 0;
+    activeRun = 0xFFFFFFFF;
+}
+
+//------------------------------------------------------------------------------
+/// Sets the calibration of a channel in the staged table.
+/// \param channel  Channel number.
+/// \param t0  Offset in raw TDC counts.
+/// \param scale  Bin width relative to the nominal one, Q14, up to
+///               CALIB_SCALE_MAX.
+/// \return 1 if the values are valid.
+//------------------------------------------------------------------------------
+unsigned char CALIB_SetChannel(unsigned int channel, int t0, unsigned int scale)
+{
+    CalibEntry *pEntry;
+
+    if ((channel >= TDC_NUM_CHANNELS) || (scale > CALIB_SCALE_MAX)
+        || (t0 > TDC_TIME_MASK) || (t0 < -TDC_TIME_MASK)) {
+
+        return 0;
+    }
+
+    pEntry = &stagedTable.pEntries[channel];
+    pEntry->t0 = t0;
+    pEntry->scale = scale;
+    pEntry->offset = -((t0 * (int) scale) >> CALIB_SCALE_BITS);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the calibration of a channel.
+/// \param staged  1 for the staged table, 0 for the one in use.
+/// \param channel  Channel number, below TDC_NUM_CHANNELS.
+/// \param pT0  Offset in raw TDC counts.
+/// \param pScale  Relative bin width, Q14.
+//------------------------------------------------------------------------------
+void CALIB_GetChannel(
+    unsigned char staged,
+    unsigned int channel,
+    int *pT0,
+    unsigned int *pScale)
+{
+    const CalibEntry *pEntry;
+
+    pEntry = staged ? &stagedTable.pEntries[channel] : &activeTable.pEntries[channel];
+    *pT0 = pEntry->t0;
+    *pScale = pEntry->scale;
+}
+
+//------------------------------------------------------------------------------
+/// Commits the staged table: it is used from the next run on. The staged
+/// table is kept for further edits.
+/// \param id  Table ID, written in the record flags (16 bits).
+//------------------------------------------------------------------------------
+void CALIB_Commit(unsigned int id)
+{
+    stagedTable.id = id & 0xFFFF;
+    memcpy(&committedTable, &stagedTable, sizeof(CalibTable));
+    pending = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the ID of a table.
+/// \param staged  1 for the table committed last, 0 for the one in use.
+//------------------------------------------------------------------------------
+unsigned int CALIB_GetId(unsigned char staged)
+{
+    return staged ? committedTable.id : activeTable.id;
+}
+
+//------------------------------------------------------------------------------
+/// Calibrates the hit words of an event in place. The table committed last
+/// replaces the one in use when the run number changes.
+/// \param run  Run number of the event.
+/// \param pHits  Hit words.
+/// \param size  Number of hit words.
+/// \return ID of the table used.
+//------------------------------------------------------------------------------
+unsigned int CALIB_Apply(unsigned int run, unsigned int *pHits, unsigned int size)
+{
+    const CalibEntry *pEntry;
+    unsigned int word;
+    int time;
+    int excess;
+
+    if ((run != activeRun) && pending) {
+
+        memcpy(&activeTable, &committedTable, sizeof(CalibTable));
+        pending = 0;
+    }
+    activeRun = run;
+
+    while (size > 0) {
+
+        word = *pHits;
+        pEntry = &activeTable.pEntries[TDC_GET_CHANNEL(word)];
+        time = SMLAWB(TDC_GET_TIME(word) << TIME_SHIFT, pEntry->scale, pEntry->offset);
+
+        // Clamp to the time field without branches
+        time &= ~(time >> 31);
+        excess = time - TDC_TIME_MASK;
+        time -= excess & ~(excess >> 31);
+
+        *pHits++ = (word & ~TDC_TIME_MASK) | time;
+        size--;
+    }
+
+    return activeTable.id;
+}
+
@@ -0,0 +1,75 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Per-channel TDC time calibration on the board, so that the offline chain
+/// gets times corrected for the channel t0 and bin width. Each hit time (see
+/// tdc.h) is replaced in place by
+///
+///     t = (raw - t0) * scale / 2^14
+///
+/// in fixed point, clamped to the time field, where scale is the bin width
+/// of the channel relative to the nominal one in Q14 (16384 = 1.0). The
+/// offset term is folded at load time, so that each hit costs a single
+/// 32x16-bit multiply-accumulate (SMLAWB of the ARMv5TE DSP extension).
+///
+/// The table in use sits in the internal SRAM0 (section .sram0 of the linker
+/// file). Changes are made to a staged copy and committed with an ID; the
+/// committed table replaces the one in use at the next run boundary, so that
+/// all the events of a run are calibrated with the same table.
+///
+/// !Usage
+///
+/// -# Call CALIB_Initialize() at startup: all the channels are uncalibrated
+///    (t0 0, scale 1.0) with table ID 0.
+/// -# Edit the staged table with CALIB_SetChannel(), then call
+///    CALIB_Commit() with its ID.
+/// -# Call CALIB_Apply() on the hit words of each event, with its run number.
+///    It returns the table ID used, for the record header.
+//------------------------------------------------------------------------------
+
+#ifndef CALIB_H
+#define CALIB_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <tdc/tdc.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Number of fractional bits of the scales.
+#define CALIB_SCALE_BITS        14
+
+/// Scale of 1.0.
+#define CALIB_SCALE_ONE         (1 << CALIB_SCALE_BITS)
+
+/// Largest scale (just below 2.0, the most a signed halfword holds in Q14).
+#define CALIB_SCALE_MAX         0x7FFF
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void CALIB_Initialize(void);
+
+extern unsigned char CALIB_SetChannel(unsigned int channel, int t0, unsigned int scale);
+
+extern void CALIB_GetChannel(
+    unsigned char staged,
+    unsigned int channel,
+    int *pT0,
+    unsigned int *pScale);
+
+extern void CALIB_Commit(unsigned int id);
+
+extern unsigned int CALIB_GetId(unsigned char staged);
+
+extern unsigned int CALIB_Apply(unsigned int run, unsigned int *pHits, unsigned int size);
+
+#endif //#ifndef CALIB_H
+
@@ -0,0 +1,334 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   CLOCK
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "clock.h"
+#include <board.h>
+#include <utility/assert.h>
+#include <utility/critical.h>
+#include <utility/trace.h>
+#include <stdio.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Slow clock frequency.
+#define SLOW_CLOCK          32768
+
+/// PLLA startup time (in slow clock ticks).
+#define PLLA_COUNT          (AT91C_CKGR_PLLACOUNT & (63 << 8))
+
+/// PLLA register value for the given multiplier and divider. The output
+/// range must be OUTA_2 above 190 MHz and OUTA_0 below.
+#define PLLA_VALUE(mul, div, out)   (AT91C_CKGR_SRCA | (out) | PLLA_COUNT \
+                                     | (AT91C_CKGR_MULA & (((mul) - 1) << 16)) \
+                                     | (AT91C_CKGR_DIVA & (div)))
+
+/// PLLA fields compared to decide if the PLL must be reprogrammed.
+#define PLLA_FIELDS         (AT91C_CKGR_MULA | AT91C_CKGR_DIVA | AT91C_CKGR_OUTA)
+
+/// MCKR fields set by a profile.
+#define MCKR_FIELDS         (AT91C_PMC_CSS | AT91C_PMC_PRES | AT91C_PMC_MDIV)
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// Register values of a clock profile.
+typedef struct {
+
+    /// Name displayed in printouts.
+    const char *name;
+    /// CKGR_PLLAR value, 0 if PLLA is not used.
+    unsigned int pllar;
+    /// PMC_MCKR value.
+    unsigned int mckr;
+
+} ClockProfile;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Profiles, indexed by CLOCK_PROFILE_xxx.
+static const ClockProfile profiles[CLOCK_NUM_PROFILES] = {
+
+    {"default", PLLA_VALUE(97, 9, AT91C_CKGR_OUTA_2),
+                AT91C_PMC_CSS_PLLA_CLK | AT91C_PMC_PRES_CLK | AT91C_PMC_MDIV_2},
+    {"bus",     PLLA_VALUE(97, 9, AT91C_CKGR_OUTA_2),
+                AT91C_PMC_CSS_PLLA_CLK | AT91C_PMC_PRES_CLK_2 | AT91C_PMC_MDIV_1},
+    {"half",    PLLA_VALUE(97, 18, AT91C_CKGR_OUTA_0),
+                AT91C_PMC_CSS_PLLA_CLK | AT91C_PMC_PRES_CLK | AT91C_PMC_MDIV_2},
+    {"main",    0,
+                AT91C_PMC_CSS_MAIN_CLK | AT91C_PMC_PRES_CLK | AT91C_PMC_MDIV_1}
+};
+
+/// List of the registered listeners.
+static ClockListener *pListeners;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the output frequency of a PLL from its register value.
+/// \param pllr  CKGR_PLLAR or CKGR_PLLBR value.
+//------------------------------------------------------------------------------
+static unsigned int PllClock(unsigned int pllr)
+{
+    unsigned int mul = (pllr & AT91C_CKGR_MULA) >> 16;
+    unsigned int div = pllr & AT91C_CKGR_DIVA;
+
+    if ((mul == 0) || (div == 0)) {
+
+        return 0;
+    }
+
+    return (unsigned int) (((unsigned long long) BOARD_MAINOSC * (mul + 1)) / div);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the processor clock frequency for the given register values.
+/// \param pllar  CKGR_PLLAR value.
+/// \param mckr  PMC_MCKR value.
+//------------------------------------------------------------------------------
+static unsigned int CpuClock(unsigned int pllar, unsigned int mckr)
+{
+    unsigned int source;
+
+    switch (mckr & AT91C_PMC_CSS) {
+
+        case AT91C_PMC_CSS_SLOW_CLK: source = SLOW_CLOCK; break;
+        case AT91C_PMC_CSS_MAIN_CLK: source = BOARD_MAINOSC; break;
+        case AT91C_PMC_CSS_PLLA_CLK: source = PllClock(pllar); break;
+        default: source = PllClock(AT91C_BASE_PMC->PMC_PLLBR); break;
+    }
+
+    return source >> ((mckr & AT91C_PMC_PRES) >> 2);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the processor to master clock division factor.
+/// \param mckr  PMC_MCKR value.
+//------------------------------------------------------------------------------
+static unsigned int MasterDivider(unsigned int mckr)
+{
+    return 1 << ((mckr & AT91C_PMC_MDIV) >> 8);
+}
+
+//------------------------------------------------------------------------------
+/// Programs the SDRAM refresh period (7 us) for the given master clock.
+/// \param mck  Master clock frequency.
+//------------------------------------------------------------------------------
+static void SetSdramRefresh(unsigned int mck)
+{
+    AT91C_BASE_SDRAMC->SDRAMC_TR = (mck * 7) / 1000000;
+}
+
+//------------------------------------------------------------------------------
+/// Writes PMC_MCKR and waits for the master clock to be ready.
+/// \param mckr  PMC_MCKR value.
+//------------------------------------------------------------------------------
+static void WriteMckr(unsigned int mckr)
+{
+    AT91C_BASE_PMC->PMC_MCKR = mckr;
+    while (!(AT91C_BASE_PMC->PMC_SR & AT91C_PMC_MCKRDY));
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes a listener and adds it to the list of drivers reconfigured on
+/// each profile switch.
+/// \param pListener  Listener to initialize.
+/// \param prepare  Function called before the switch (can be 0).
+/// \param update  Function called after the switch with the new MCK.
+//------------------------------------------------------------------------------
+void CLOCK_RegisterListener(
+    ClockListener *pListener,
+    void (*prepare)(void),
+    void (*update)(unsigned int mck))
+{
+    SANITY_CHECK(update);
+
+    pListener->prepare = prepare;
+    pListener->update = update;
+    pListener->pNext = pListeners;
+    pListeners = pListener;
+}
+
+//------------------------------------------------------------------------------
+/// Switches to the given clock profile and reconfigures the registered
+/// drivers. The master clock runs from the main oscillator while PLLA is
+/// reprogrammed, with the SDRAM refresh set for the slowest clock of the
+/// sequence.
+/// \param profile  Profile index (CLOCK_PROFILE_xxx).
+/// \return 1 if the profile is applied, 0 if it is invalid.
+//------------------------------------------------------------------------------
+unsigned char CLOCK_SetProfile(unsigned int profile)
+{
+    const ClockProfile *pProfile;
+    ClockListener *pListener;
+    CriticalState state;
+    unsigned int mckr;
+    unsigned int mck;
+    unsigned int mainMck;
+    unsigned int newMainMck;
+
+    if (profile >= CLOCK_NUM_PROFILES) {
+
+        TRACE_WARNING("CLOCK_SetProfile: invalid profile %u\n\r", profile);
+        return 0;
+    }
+
+    pProfile = &profiles[profile];
+    mck = CpuClock(pProfile->pllar, pProfile->mckr) / MasterDivider(pProfile->mckr);
+    if (mck > BOARD_MCK) {
+
+        TRACE_WARNING("CLOCK_SetProfile: MCK %u above SDRAM timings\n\r", mck);
+        return 0;
+    }
+
+    for (pListener = pListeners; pListener; pListener = pListener->pNext) {
+
+        if (pListener->prepare) {
+
+            pListener->prepare();
+        }
+    }
+
+    state = CRITICAL_Enter();
+
+    // Refresh for the slowest MCK of the sequence (main clock with either
+    // the old or the new prescalers); refreshing too often is harmless
+    mckr = AT91C_BASE_PMC->PMC_MCKR;
+    mainMck = CpuClock(0, (mckr & ~AT91C_PMC_CSS) | AT91C_PMC_CSS_MAIN_CLK) / MasterDivider(mckr);
+    newMainMck = CpuClock(0, (pProfile->mckr & ~AT91C_PMC_CSS) | AT91C_PMC_CSS_MAIN_CLK)
+                 / MasterDivider(pProfile->mckr);
+    SetSdramRefresh((newMainMck < mainMck) ? newMainMck : mainMck);
+
+    // Run from the main oscillator, switching the source before the prescalers
+    if ((mckr & AT91C_PMC_CSS) != AT91C_PMC_CSS_MAIN_CLK) {
+
+        WriteMckr((mckr & ~AT91C_PMC_CSS) | AT91C_PMC_CSS_MAIN_CLK);
+    }
+    mckr = (AT91C_BASE_PMC->PMC_MCKR & ~MCKR_FIELDS)
+           | (pProfile->mckr & ~AT91C_PMC_CSS) | AT91C_PMC_CSS_MAIN_CLK;
+    WriteMckr(mckr);
+
+    // Reprogram PLLA only if needed, relocking takes up to 2 ms
+    if (pProfile->pllar
+        && ((AT91C_BASE_CKGR->CKGR_PLLAR & PLLA_FIELDS) != (pProfile->pllar & PLLA_FIELDS))) {
+
+        AT91C_BASE_CKGR->CKGR_PLLAR = pProfile->pllar;
+        while (!(AT91C_BASE_PMC->PMC_SR & AT91C_PMC_LOCKA));
+    }
+
+    // Switch to the final source, prescalers being already set
+    if ((pProfile->mckr & AT91C_PMC_CSS) != AT91C_PMC_CSS_MAIN_CLK) {
+
+        WriteMckr((mckr & ~AT91C_PMC_CSS) | (pProfile->mckr & AT91C_PMC_CSS));
+    }
+    SetSdramRefresh(mck);
+
+    CRITICAL_Exit(state);
+
+    for (pListener = pListeners; pListener; pListener = pListener->pNext) {
+
+        pListener->update(mck);
+    }
+
+    TRACE_DEBUG("Clock profile %s: CPU %u Hz, MCK %u Hz\n\r",
+               pProfile->name, CLOCK_GetCpuClock(), CLOCK_GetMck());
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the index of the profile matching the current PMC settings, or
+/// CLOCK_NUM_PROFILES if the clocks were set up otherwise (e.g. by the
+/// bootloader).
+//------------------------------------------------------------------------------
+unsigned int CLOCK_GetProfile(void)
+{
+    unsigned int mckr = AT91C_BASE_PMC->PMC_MCKR & MCKR_FIELDS;
+    unsigned int pllar = AT91C_BASE_CKGR->CKGR_PLLAR & PLLA_FIELDS;
+    unsigned int i;
+
+    for (i = 0; i < CLOCK_NUM_PROFILES; i++) {
+
+        if ((profiles[i].mckr == mckr)
+            && (!profiles[i].pllar || ((profiles[i].pllar & PLLA_FIELDS) == pllar))) {
+
+            return i;
+        }
+    }
+
+    return CLOCK_NUM_PROFILES;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the name of a profile, or "custom" for an invalid index.
+/// \param profile  Profile index (CLOCK_PROFILE_xxx).
+//------------------------------------------------------------------------------
+const char * CLOCK_GetProfileName(unsigned int profile)
+{
+    if (profile >= CLOCK_NUM_PROFILES) {
+
+        return "custom";
+    }
+
+    return profiles[profile].name;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the current PLLA output frequency (0 if disabled).
+//------------------------------------------------------------------------------
+unsigned int CLOCK_GetPllaClock(void)
+{
+    return PllClock(AT91C_BASE_CKGR->CKGR_PLLAR);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the current processor clock frequency.
+//------------------------------------------------------------------------------
+unsigned int CLOCK_GetCpuClock(void)
+{
+    return CpuClock(AT91C_BASE_CKGR->CKGR_PLLAR, AT91C_BASE_PMC->PMC_MCKR);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the current master clock frequency.
+//------------------------------------------------------------------------------
+unsigned int CLOCK_GetMck(void)
+{
+    unsigned int mckr = AT91C_BASE_PMC->PMC_MCKR;
+
+    return CpuClock(AT91C_BASE_CKGR->CKGR_PLLAR, mckr) / MasterDivider(mckr);
+}
+
+//------------------------------------------------------------------------------
+/// Prints the available profiles on the DBGU, the current one being marked.
+//------------------------------------------------------------------------------
+void CLOCK_PrintProfiles(void)
+{
+    unsigned int current = CLOCK_GetProfile();
+    unsigned int i;
+
+    for (i = 0; i < CLOCK_NUM_PROFILES; i++) {
+
+        printf(" %c %u %-8s CPU %9u Hz, MCK %9u Hz\n\r",
+               (i == current) ? '*' : ' ',
+               i,
+               profiles[i].name,
+               CpuClock(profiles[i].pllar, profiles[i].mckr),
+               CpuClock(profiles[i].pllar, profiles[i].mckr) / MasterDivider(profiles[i].mckr));
+    }
+}
+
@@ -0,0 +1,88 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Clock profiles: switches PLLA and the processor/master clock prescalers
+/// between a few predefined settings, and reports the actual clock
+/// frequencies computed from the PMC registers instead of BOARD_MCK.
+///
+/// The SDRAM refresh is kept valid during and after the switch by the module
+/// itself. Every other driver whose timing depends on MCK (DBGU baudrate, PIT,
+/// TC, SMC...) registers a listener to be reconfigured.
+///
+/// !Usage
+///
+/// -# Register a ClockListener for each MCK dependent driver with
+///    CLOCK_RegisterListener(), once the driver is configured.
+/// -# Switch profile with CLOCK_SetProfile() (CLOCK_PROFILE_xxx).
+/// -# Read the clocks with CLOCK_GetMck(), CLOCK_GetCpuClock() and
+///    CLOCK_GetPllaClock(), or print them with CLOCK_PrintProfiles().
+///
+/// \note Profiles never raise MCK above BOARD_MCK, the frequency the SDRAM
+/// timings (in MCK cycles) were programmed for.
+//------------------------------------------------------------------------------
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Eval-kit default: PLLA 198.7 MHz, CPU 198.7 MHz, MCK 99.3 MHz.
+#define CLOCK_PROFILE_DEFAULT       0
+/// Bus at full speed with a slower core: CPU = MCK = 99.3 MHz.
+#define CLOCK_PROFILE_BUS           1
+/// Half speed: PLLA 99.3 MHz, CPU 99.3 MHz, MCK 49.7 MHz.
+#define CLOCK_PROFILE_HALF          2
+/// PLL bypassed: CPU = MCK = main oscillator (18.4 MHz).
+#define CLOCK_PROFILE_MAIN          3
+/// Number of profiles.
+#define CLOCK_NUM_PROFILES          4
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// A driver to reconfigure when MCK changes. Instances are owned by the
+/// caller and must stay valid for the whole program lifetime.
+//------------------------------------------------------------------------------
+typedef struct _ClockListener {
+
+    /// Called before the switch, with interrupts enabled (e.g. to let a
+    /// transfer complete). Can be 0.
+    void (*prepare)(void);
+    /// Called after the switch with the new MCK frequency.
+    void (*update)(unsigned int mck);
+    /// Next registered listener.
+    struct _ClockListener *pNext;
+
+} ClockListener;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void CLOCK_RegisterListener(
+    ClockListener *pListener,
+    void (*prepare)(void),
+    void (*update)(unsigned int mck));
+
+extern unsigned char CLOCK_SetProfile(unsigned int profile);
+
+extern unsigned int CLOCK_GetProfile(void);
+
+extern const char * CLOCK_GetProfileName(unsigned int profile);
+
+extern unsigned int CLOCK_GetPllaClock(void);
+
+extern unsigned int CLOCK_GetCpuClock(void);
+
+extern unsigned int CLOCK_GetMck(void);
+
+extern void CLOCK_PrintProfiles(void);
+
+#endif //#ifndef CLOCK_H
+
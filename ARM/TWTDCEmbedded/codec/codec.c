@@ -0,0 +1,644 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "codec.h"
+#include <tdc/tdc.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Reads 4 bytes as a little-endian word, at any alignment.
+#define READ32(p)       ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((unsigned int) (p)[3] << 24))
+
+/// Hash of 4 bytes.
+#define HASH(v)         (((v) * 2654435761U) >> (32 - CODEC_LZ_HASH_BITS))
+
+/// Rice contexts: channel changes, time changes on the same channel and on a
+/// new one.
+#define CONTEXT_CHANNEL 0
+#define CONTEXT_SAME    1
+#define CONTEXT_NEW     2
+#define NUM_CONTEXTS    3
+
+/// Number of values after which a Rice context halves its statistics.
+#define CONTEXT_RESET   64
+
+/// Number of reserved bits of the hit words.
+#define RESERVED_BITS   (TDC_CHANNEL_SHIFT - TDC_TIME_BITS)
+#define RESERVED_MASK   ((1 << RESERVED_BITS) - 1)
+
+/// Maps a signed value to an unsigned one: 0, -1, 1, -2, 2...
+#define ZIGZAG(v)       ((((unsigned int) (v)) << 1) ^ (unsigned int) ((v) >> 31))
+#define UNZIGZAG(u)     ((int) ((u) >> 1) ^ -(int) ((u) & 1))
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// Adaptive Rice context: sum and number of the recent values.
+typedef struct {
+
+    unsigned int sum;
+    unsigned int count;
+
+} Context;
+
+/// Bit packer, LSB first.
+typedef struct {
+
+    unsigned long long bits;
+    unsigned int numBits;
+    unsigned int *pWord;
+    unsigned int *pEnd;
+    unsigned char overflow;
+
+} BitWriter;
+
+/// Bit unpacker, LSB first.
+typedef struct {
+
+    unsigned long long bits;
+    unsigned int numBits;
+    const unsigned int *pWord;
+    const unsigned int *pEnd;
+    unsigned char underflow;
+
+} BitReader;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Names of the codecs.
+static const char * const pNames[CODEC_NUM] = {"none", "lz", "rice"};
+
+/// LZ hash table: position + 1 of the last 4 bytes with each hash, plus the
+/// base of the current payload; older entries are below the base, so the
+/// table needs no clearing between payloads.
+static unsigned int pHashTable[1 << CODEC_LZ_HASH_BITS];
+static unsigned int hashBase = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Writes an LZ length extension (bytes of 255, then the remainder).
+//------------------------------------------------------------------------------
+static unsigned char * WriteLength(unsigned char *pOut, unsigned int length)
+{
+    while (length >= 255) {
+
+        *pOut++ = 255;
+        length -= 255;
+    }
+    *pOut++ = length;
+    return pOut;
+}
+
+//------------------------------------------------------------------------------
+/// Writes an LZ sequence: literals, then a match unless length is 0.
+/// \return End of the sequence, 0 if it does not fit before pEnd.
+//------------------------------------------------------------------------------
+static unsigned char * WriteSequence(
+    unsigned char *pOut,
+    const unsigned char *pEnd,
+    const unsigned char *pLiterals,
+    unsigned int numLiterals,
+    unsigned int offset,
+    unsigned int length)
+{
+    unsigned char *pToken = pOut;
+
+    if ((unsigned int) (pEnd - pOut) < numLiterals + numLiterals / 255 + length / 255 + 5) {
+
+        return 0;
+    }
+    pOut++;
+
+    if (numLiterals >= 15) {
+
+        *pToken = 15 << 4;
+        pOut = WriteLength(pOut, numLiterals - 15);
+    }
+    else {
+
+        *pToken = numLiterals << 4;
+    }
+    memcpy(pOut, pLiterals, numLiterals);
+    pOut += numLiterals;
+
+    if (length != 0) {
+
+        *pOut++ = offset & 0xFF;
+        *pOut++ = offset >> 8;
+        length -= CODEC_LZ_MIN_MATCH;
+        if (length >= 15) {
+
+            *pToken |= 15;
+            pOut = WriteLength(pOut, length - 15);
+        }
+        else {
+
+            *pToken |= length;
+        }
+    }
+    return pOut;
+}
+
+//------------------------------------------------------------------------------
+/// LZ encoder.
+/// \return Number of bytes written, 0 if they do not fit.
+//------------------------------------------------------------------------------
+static unsigned int EncodeLz(
+    const unsigned char *pIn,
+    unsigned int size,
+    unsigned char *pOut,
+    unsigned int capacity)
+{
+    unsigned char *pStart = pOut;
+    const unsigned char *pEnd = pOut + capacity;
+    unsigned int base;
+    unsigned int anchor = 0;
+    unsigned int i = 0;
+    unsigned int value;
+    unsigned int entry;
+    unsigned int match;
+    unsigned int length;
+
+    if ((0xFFFFFFFF - hashBase) <= size) {
+
+        memset(pHashTable, 0, sizeof(pHashTable));
+        hashBase = 0;
+    }
+    base = hashBase;
+    hashBase += size + 1;
+
+    while ((i + CODEC_LZ_MIN_MATCH) <= size) {
+
+        value = READ32(pIn + i);
+        entry = pHashTable[HASH(value)];
+        pHashTable[HASH(value)] = base + i + 1;
+        match = entry - base - 1;
+        if ((entry <= base) || ((i - match) > CODEC_LZ_WINDOW) || (READ32(pIn + match) != value)) {
+
+            // Step faster through data that does not compress
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        length = CODEC_LZ_MIN_MATCH;
+        while (((i + length) < size) && (pIn[match + length] == pIn[i + length])) {
+
+            length++;
+        }
+        pOut = WriteSequence(pOut, pEnd, pIn + anchor, i - anchor, i - match, length);
+        if (pOut == 0) {
+
+            return 0;
+        }
+        i += length;
+        anchor = i;
+    }
+
+    if (anchor < size) {
+
+        pOut = WriteSequence(pOut, pEnd, pIn + anchor, size - anchor, 0, 0);
+        if (pOut == 0) {
+
+            return 0;
+        }
+    }
+    return pOut - pStart;
+}
+
+//------------------------------------------------------------------------------
+/// Reads an LZ length extension.
+/// \return 1 if it is complete.
+//------------------------------------------------------------------------------
+static unsigned char ReadLength(const unsigned char **ppIn, const unsigned char *pEnd, unsigned int *pLength)
+{
+    unsigned int byte;
+
+    do {
+
+        if (*ppIn == pEnd) {
+
+            return 0;
+        }
+        byte = *(*ppIn)++;
+        *pLength += byte;
+    } while (byte == 255);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// LZ decoder.
+/// \return 1 if the stream is valid and gives exactly size bytes.
+//------------------------------------------------------------------------------
+static unsigned char DecodeLz(
+    const unsigned char *pIn,
+    unsigned int inSize,
+    unsigned char *pOut,
+    unsigned int size)
+{
+    const unsigned char *pEnd = pIn + inSize;
+    unsigned int out = 0;
+    unsigned int token;
+    unsigned int length;
+    unsigned int offset;
+
+    while (out < size) {
+
+        if (pIn == pEnd) {
+
+            return 0;
+        }
+        token = *pIn++;
+        length = token >> 4;
+        if ((length == 15) && !ReadLength(&pIn, pEnd, &length)) {
+
+            return 0;
+        }
+        if ((length > (unsigned int) (pEnd - pIn)) || (length > (size - out))) {
+
+            return 0;
+        }
+        memcpy(pOut + out, pIn, length);
+        pIn += length;
+        out += length;
+        if (out == size) {
+
+            break;
+        }
+
+        if ((pEnd - pIn) < 2) {
+
+            return 0;
+        }
+        offset = pIn[0] | (pIn[1] << 8);
+        pIn += 2;
+        length = token & 15;
+        if ((length == 15) && !ReadLength(&pIn, pEnd, &length)) {
+
+            return 0;
+        }
+        length += CODEC_LZ_MIN_MATCH;
+        if ((offset == 0) || (offset > out) || (length > (size - out))) {
+
+            return 0;
+        }
+        // Byte by byte: the match may overlap the bytes it produces
+        while (length > 0) {
+
+            pOut[out] = pOut[out - offset];
+            out++;
+            length--;
+        }
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the Rice parameter of a context.
+//------------------------------------------------------------------------------
+static unsigned int GetParameter(const Context *pContext)
+{
+    unsigned int k = 0;
+
+    while ((pContext->count << k) < pContext->sum) {
+
+        k++;
+    }
+    return k;
+}
+
+//------------------------------------------------------------------------------
+/// Adds a value to the statistics of a context.
+//------------------------------------------------------------------------------
+static void UpdateContext(Context *pContext, unsigned int value)
+{
+    pContext->sum += value;
+    pContext->count++;
+    if (pContext->count == CONTEXT_RESET) {
+
+        pContext->sum >>= 1;
+        pContext->count >>= 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sets the initial statistics of the Rice contexts.
+//------------------------------------------------------------------------------
+static void InitializeContexts(Context *pContexts)
+{
+    pContexts[CONTEXT_CHANNEL].sum = 1;
+    pContexts[CONTEXT_SAME].sum = 256;
+    pContexts[CONTEXT_NEW].sum = 8192;
+    pContexts[CONTEXT_CHANNEL].count = 1;
+    pContexts[CONTEXT_SAME].count = 1;
+    pContexts[CONTEXT_NEW].count = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Packs up to 24 bits.
+//------------------------------------------------------------------------------
+static void PutBits(BitWriter *pWriter, unsigned int value, unsigned int numBits)
+{
+    pWriter->bits |= (unsigned long long) value << pWriter->numBits;
+    pWriter->numBits += numBits;
+    if (pWriter->numBits >= 32) {
+
+        if (pWriter->pWord == pWriter->pEnd) {
+
+            pWriter->overflow = 1;
+            pWriter->bits = 0;
+            pWriter->numBits = 0;
+            return;
+        }
+        *pWriter->pWord++ = (unsigned int) pWriter->bits;
+        pWriter->bits >>= 32;
+        pWriter->numBits -= 32;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Codes a value with the Rice parameter of a context, and updates it.
+//------------------------------------------------------------------------------
+static void PutRice(BitWriter *pWriter, Context *pContext, unsigned int value)
+{
+    unsigned int k = GetParameter(pContext);
+    unsigned int quotient = value >> k;
+
+    if (quotient < CODEC_RICE_ESCAPE) {
+
+        PutBits(pWriter, (1 << quotient) - 1, quotient + 1);
+        PutBits(pWriter, value & ((1 << k) - 1), k);
+    }
+    else {
+
+        PutBits(pWriter, (1 << CODEC_RICE_ESCAPE) - 1, CODEC_RICE_ESCAPE);
+        PutBits(pWriter, value, CODEC_RICE_RAW_BITS);
+    }
+    UpdateContext(pContext, value);
+}
+
+//------------------------------------------------------------------------------
+/// Rice encoder.
+/// \return Number of words written, 0 if they do not fit.
+//------------------------------------------------------------------------------
+static unsigned int EncodeRice(
+    const unsigned int *pIn,
+    unsigned int size,
+    unsigned int *pOut,
+    unsigned int capacity)
+{
+    Context pContexts[NUM_CONTEXTS];
+    BitWriter writer;
+    unsigned int previous = 0;
+    unsigned int word;
+    unsigned int channel;
+    unsigned int reserved;
+    int delta;
+
+    InitializeContexts(pContexts);
+    writer.bits = 0;
+    writer.numBits = 0;
+    writer.pWord = pOut;
+    writer.pEnd = pOut + capacity;
+    writer.overflow = 0;
+
+    while ((size > 0) && !writer.overflow) {
+
+        word = *pIn++;
+        channel = (TDC_GET_CHANNEL(word) - TDC_GET_CHANNEL(previous)) & TDC_CHANNEL_MASK;
+        delta = (channel > (TDC_CHANNEL_MASK >> 1)) ? (int) channel - (TDC_CHANNEL_MASK + 1) : (int) channel;
+        PutRice(&writer, &pContexts[CONTEXT_CHANNEL], ZIGZAG(delta));
+
+        reserved = (word >> TDC_TIME_BITS) & RESERVED_MASK;
+        if (reserved == 0) {
+
+            PutBits(&writer, 0, 1);
+        }
+        else {
+
+            PutBits(&writer, (reserved << 1) | 1, RESERVED_BITS + 1);
+        }
+
+        delta = (short) (TDC_GET_TIME(word) - TDC_GET_TIME(previous));
+        PutRice(&writer, &pContexts[(channel == 0) ? CONTEXT_SAME : CONTEXT_NEW], ZIGZAG(delta));
+        previous = word;
+        size--;
+    }
+
+    if ((writer.numBits > 0) && !writer.overflow) {
+
+        PutBits(&writer, 0, 32 - writer.numBits);
+    }
+    return writer.overflow ? 0 : (writer.pWord - pOut);
+}
+
+//------------------------------------------------------------------------------
+/// Unpacks up to 24 bits.
+//------------------------------------------------------------------------------
+static unsigned int GetBits(BitReader *pReader, unsigned int numBits)
+{
+    unsigned int value;
+
+    if (pReader->numBits < numBits) {
+
+        if (pReader->pWord == pReader->pEnd) {
+
+            pReader->underflow = 1;
+            return 0;
+        }
+        pReader->bits |= (unsigned long long) *pReader->pWord++ << pReader->numBits;
+        pReader->numBits += 32;
+    }
+    value = (unsigned int) pReader->bits & ((1 << numBits) - 1);
+    pReader->bits >>= numBits;
+    pReader->numBits -= numBits;
+    return value;
+}
+
+//------------------------------------------------------------------------------
+/// Decodes a value with the Rice parameter of a context, and updates it.
+//------------------------------------------------------------------------------
+static unsigned int GetRice(BitReader *pReader, Context *pContext)
+{
+    unsigned int k = GetParameter(pContext);
+    unsigned int quotient = 0;
+    unsigned int value;
+
+    while ((quotient < CODEC_RICE_ESCAPE) && GetBits(pReader, 1)) {
+
+        quotient++;
+    }
+    if (quotient < CODEC_RICE_ESCAPE) {
+
+        value = (quotient << k) | GetBits(pReader, k);
+    }
+    else {
+
+        value = GetBits(pReader, CODEC_RICE_RAW_BITS);
+    }
+    UpdateContext(pContext, value);
+    return value;
+}
+
+//------------------------------------------------------------------------------
+/// Rice decoder.
+/// \return 1 if the stream is valid.
+//------------------------------------------------------------------------------
+static unsigned char DecodeRice(
+    const unsigned int *pIn,
+    unsigned int inSize,
+    unsigned int *pOut,
+    unsigned int size)
+{
+    Context pContexts[NUM_CONTEXTS];
+    BitReader reader;
+    unsigned int previous = 0;
+    unsigned int channel;
+    unsigned int reserved;
+    unsigned int time;
+    unsigned int value;
+
+    InitializeContexts(pContexts);
+    reader.bits = 0;
+    reader.numBits = 0;
+    reader.pWord = pIn;
+    reader.pEnd = pIn + inSize;
+    reader.underflow = 0;
+
+    while ((size > 0) && !reader.underflow) {
+
+        value = GetRice(&reader, &pContexts[CONTEXT_CHANNEL]);
+        channel = UNZIGZAG(value) & TDC_CHANNEL_MASK;
+        reserved = GetBits(&reader, 1) ? GetBits(&reader, RESERVED_BITS) : 0;
+        value = GetRice(&reader, &pContexts[(channel == 0) ? CONTEXT_SAME : CONTEXT_NEW]);
+        time = UNZIGZAG(value);
+        previous = (((TDC_GET_CHANNEL(previous) + channel) & TDC_CHANNEL_MASK) << TDC_CHANNEL_SHIFT)
+                   | (reserved << TDC_TIME_BITS) | ((TDC_GET_TIME(previous) + time) & TDC_TIME_MASK);
+        *pOut++ = previous;
+        size--;
+    }
+
+    return !reader.underflow;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the name of a codec, 0 if there is no such codec.
+/// \param codec  CODEC_xxx.
+//------------------------------------------------------------------------------
+const char * CODEC_GetName(unsigned int codec)
+{
+    return (codec < CODEC_NUM) ? pNames[codec] : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Compresses a payload.
+/// \param codec  CODEC_xxx.
+/// \param pSource  Payload.
+/// \param size  Payload size in words.
+/// \param pDestination  Compressed payload.
+/// \param capacity  Size of the destination in words.
+/// \return Size of the compressed payload in words, 0 if it is not smaller
+///         than the payload or does not fit in the destination.
+//------------------------------------------------------------------------------
+unsigned int CODEC_Encode(
+    unsigned int codec,
+    const unsigned int *pSource,
+    unsigned int size,
+    unsigned int *pDestination,
+    unsigned int capacity)
+{
+    unsigned int words = 0;
+
+    if ((size < 3) || (codec == CODEC_NONE) || (codec >= CODEC_NUM)) {
+
+        return 0;
+    }
+    if (capacity >= size) {
+
+        capacity = size - 1;
+    }
+    if (capacity < 2) {
+
+        return 0;
+    }
+
+    pDestination[0] = size;
+    if (codec == CODEC_LZ) {
+
+        words = EncodeLz((const unsigned char *) pSource, size * 4,
+                         (unsigned char *) (pDestination + 1), (capacity - 1) * 4);
+        if (words != 0) {
+
+            // Pad to a whole word
+            while ((words & 3) != 0) {
+
+                ((unsigned char *) (pDestination + 1))[words++] = 0;
+            }
+            words /= 4;
+        }
+    }
+    else {
+
+        words = EncodeRice(pSource, size, pDestination + 1, capacity - 1);
+    }
+
+    return (words != 0) ? (words + 1) : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Decompresses a payload.
+/// \param codec  CODEC_xxx.
+/// \param pSource  Compressed payload.
+/// \param size  Size of the compressed payload in words.
+/// \param pDestination  Payload.
+/// \param capacity  Size of the destination in words.
+/// \param pSize  Size of the payload in words.
+/// \return 1 if the compressed payload is valid and the payload fits.
+//------------------------------------------------------------------------------
+unsigned char CODEC_Decode(
+    unsigned int codec,
+    const unsigned int *pSource,
+    unsigned int size,
+    unsigned int *pDestination,
+    unsigned int capacity,
+    unsigned int *pSize)
+{
+    if (codec == CODEC_NONE) {
+
+        if (size > capacity) {
+
+            return 0;
+        }
+        memcpy(pDestination, pSource, size * 4);
+        *pSize = size;
+        return 1;
+    }
+    if ((codec >= CODEC_NUM) || (size == 0) || (pSource[0] > capacity)) {
+
+        return 0;
+    }
+
+    *pSize = pSource[0];
+    if (codec == CODEC_LZ) {
+
+        return DecodeLz((const unsigned char *) (pSource + 1), (size - 1) * 4,
+                        (unsigned char *) pDestination, *pSize * 4);
+    }
+    return DecodeRice(pSource + 1, size - 1, pDestination, *pSize);
+}
+
@@ -0,0 +1,87 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Lossless compression of event payloads, to trade spare CPU time for link
+/// bandwidth. Codecs:
+/// - CODEC_NONE: payload sent as it is;
+/// - CODEC_LZ: byte-oriented LZ77 in the spirit of LZ4, for any payload.
+///   Each sequence is a token byte (literal count in the high nibble, match
+///   length minus CODEC_LZ_MIN_MATCH in the low one, 15 meaning that bytes
+///   of 255 and a last smaller one follow), the literals, then the match
+///   offset on 2 bytes, little-endian; the last sequence has no match;
+/// - CODEC_RICE: bit-packed adaptive Rice coding of the fields of the TDC hit
+///   words (see tdc.h): the channel change, and the time change from the
+///   previous hit, either on the same channel or on a new one, each in its
+///   own context, with the reserved bits flagged. Best on hits sorted by
+///   channel and time (see hitsort.h), where the deltas are small; any
+///   payload is still coded losslessly.
+///
+/// The Rice parameter of each context follows the running mean of its values
+/// (as in LOCO-I), so the coder adapts to the multiplicity without any table
+/// to send. Bits are packed LSB first into little-endian words; values whose
+/// quotient reaches CODEC_RICE_ESCAPE are written raw after the escape code.
+///
+/// Compressed payload: the number of words of the original payload, then the
+/// codec stream padded to a whole number of words.
+///
+/// !Usage
+///
+/// -# Call CODEC_Encode() with a destination at most as large as the
+///    payload: it returns 0 when the compressed payload would not be smaller,
+///    and the payload is then sent as it is.
+/// -# Call CODEC_Decode() on the received payload.
+///
+/// \note This module is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef CODEC_H
+#define CODEC_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Codecs.
+#define CODEC_NONE              0
+#define CODEC_LZ                1
+#define CODEC_RICE              2
+#define CODEC_NUM               3
+
+/// Shortest match of the LZ codec, in bytes.
+#define CODEC_LZ_MIN_MATCH      4
+/// Largest match offset of the LZ codec, in bytes.
+#define CODEC_LZ_WINDOW         0xFFFF
+/// Number of bits of the LZ hash, 2^CODEC_LZ_HASH_BITS words of table.
+#define CODEC_LZ_HASH_BITS      12
+
+/// Rice quotient written as an escape code, followed by the raw value.
+#define CODEC_RICE_ESCAPE       16
+/// Number of bits of the raw values after an escape code.
+#define CODEC_RICE_RAW_BITS     16
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern const char * CODEC_GetName(unsigned int codec);
+
+extern unsigned int CODEC_Encode(
+    unsigned int codec,
+    const unsigned int *pSource,
+    unsigned int size,
+    unsigned int *pDestination,
+    unsigned int capacity);
+
+extern unsigned char CODEC_Decode(
+    unsigned int codec,
+    const unsigned int *pSource,
+    unsigned int size,
+    unsigned int *pDestination,
+    unsigned int capacity,
+    unsigned int *pSize);
+
+#endif //#ifndef CODEC_H
+
@@ -0,0 +1,192 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "counters.h"
+#include <timer/timer.h>
+#include <utility/assert.h>
+#include <stdio.h>
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Registered counters, in registration order.
+static Counter *pCounters = 0;
+
+/// Number of registered counters.
+static unsigned int numCounters = 0;
+
+/// Timer tick count at the last snapshot.
+static unsigned int snapshotTicks;
+
+/// Length of the last snapshot interval, in microseconds.
+static unsigned int intervalUs = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Reads the current value of a counter.
+/// \param pCounter  Counter to read.
+//------------------------------------------------------------------------------
+static unsigned long long ReadValue(Counter *pCounter)
+{
+    CriticalState state;
+    unsigned int low;
+    unsigned int high;
+
+    if (pCounter->type != COUNTER_TYPE_COUNT64) {
+
+        return pCounter->value;
+    }
+
+    state = CRITICAL_Enter();
+    low = pCounter->value;
+    high = pCounter->valueHigh;
+    CRITICAL_Exit(state);
+
+    return ((unsigned long long) high << 32) | low;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Resets a counter and adds it to the registry, which holds up to
+/// COUNTERS_MAX of them. Must be called from the main program, before the
+/// counter is used by interrupt handlers.
+/// \param pCounter  Counter instance.
+/// \param name  Name displayed in printouts.
+/// \param type  Counter type (COUNTER_TYPE_xxx).
+//------------------------------------------------------------------------------
+void COUNTERS_Register(Counter *pCounter, const char *name, unsigned char type)
+{
+    Counter **ppLast = &pCounters;
+
+    SANITY_CHECK(numCounters < COUNTERS_MAX);
+
+    pCounter->value = 0;
+    pCounter->valueHigh = 0;
+    pCounter->name = name;
+    pCounter->pNext = 0;
+    pCounter->type = type;
+    pCounter->snapshot = 0;
+    pCounter->rate = 0;
+
+    while (*ppLast != 0) {
+
+        ppLast = &(*ppLast)->pNext;
+    }
+    *ppLast = pCounter;
+    numCounters++;
+
+    // The first snapshot interval starts with the first counter
+    if (numCounters == 1) {
+
+        snapshotTicks = TIMER_GetTicks();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Takes a snapshot of all the counters, and computes their rates since the
+/// previous snapshot. Must be called from a single task context.
+//------------------------------------------------------------------------------
+void COUNTERS_Snapshot(void)
+{
+    Counter *pCounter;
+    unsigned long long value;
+    unsigned int ticks;
+    unsigned int elapsed;
+
+    ticks = TIMER_GetTicks();
+    elapsed = ticks - snapshotTicks;
+    snapshotTicks = ticks;
+    intervalUs = TIMER_TicksToUs(elapsed);
+
+    for (pCounter = pCounters; pCounter != 0; pCounter = pCounter->pNext) {
+
+        value = ReadValue(pCounter);
+        if ((pCounter->type == COUNTER_TYPE_GAUGE) || (elapsed == 0)) {
+
+            pCounter->rate = 0;
+        }
+        else if (pCounter->type == COUNTER_TYPE_COUNT) {
+
+            pCounter->rate = (unsigned int) (((unsigned long long)
+                                              ((unsigned int) value - (unsigned int) pCounter->snapshot)
+                                              * TIMER_GetFrequency()) / elapsed);
+        }
+        else {
+
+            pCounter->rate = (unsigned int) (((value - pCounter->snapshot)
+                                              * TIMER_GetFrequency()) / elapsed);
+        }
+        pCounter->snapshot = value;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Prints the last snapshot on the standard output, one counter per line.
+//------------------------------------------------------------------------------
+void COUNTERS_Print(void)
+{
+    Counter *pCounter;
+
+    printf("-- Counters over %u ms --\n\r", intervalUs / 1000);
+    for (pCounter = pCounters; pCounter != 0; pCounter = pCounter->pNext) {
+
+        if (pCounter->type == COUNTER_TYPE_GAUGE) {
+
+            printf("  %-16s %10u\n\r", pCounter->name, (unsigned int) pCounter->snapshot);
+        }
+        else if (pCounter->snapshot >> 32) {
+
+            printf("  %-16s %10u%09u %10u/s\n\r", pCounter->name,
+                   (unsigned int) (pCounter->snapshot / 1000000000),
+                   (unsigned int) (pCounter->snapshot % 1000000000), pCounter->rate);
+        }
+        else {
+
+            printf("  %-16s %10u %10u/s\n\r", pCounter->name,
+                   (unsigned int) pCounter->snapshot, pCounter->rate);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Writes the last snapshot in binary form: a CounterHeader followed by one
+/// CounterRecord per counter, in registration order.
+/// \param pBuffer  Destination buffer (word aligned).
+/// \param size  Size of the buffer in bytes.
+/// \return Number of bytes written, 0 if the buffer is too small.
+//------------------------------------------------------------------------------
+unsigned int COUNTERS_Export(void *pBuffer, unsigned int size)
+{
+    CounterHeader *pHeader = (CounterHeader *) pBuffer;
+    CounterRecord *pRecord = (CounterRecord *) (pHeader + 1);
+    Counter *pCounter;
+    unsigned int length;
+
+    length = sizeof(CounterHeader) + numCounters * sizeof(CounterRecord);
+    if (size < length) {
+
+        return 0;
+    }
+
+    pHeader->magic = COUNTERS_MAGIC;
+    pHeader->count = numCounters;
+    pHeader->ticks = snapshotTicks;
+    pHeader->intervalUs = intervalUs;
+    for (pCounter = pCounters; pCounter != 0; pCounter = pCounter->pNext) {
+
+        pRecord->valueLow = (unsigned int) pCounter->snapshot;
+        pRecord->valueHigh = (unsigned int) (pCounter->snapshot >> 32);
+        pRecord->rate = pCounter->rate;
+        pRecord++;
+    }
+
+    return length;
+}
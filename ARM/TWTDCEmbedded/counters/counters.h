@@ -0,0 +1,171 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Registry of named performance counters and gauges. Modules own their
+/// Counter instances and update them directly with the inline COUNTER_xxx()
+/// functions, which are safe from interrupt handlers and cost a few
+/// instructions. A snapshot of all the registered counters computes their
+/// rates over the interval since the previous snapshot; it can then be
+/// printed as text or exported in a compact binary form.
+///
+/// !Usage
+///
+/// -# Declare a Counter and register it with COUNTERS_Register(), giving its
+///    name and type (COUNTER_TYPE_xxx).
+/// -# Update it with COUNTER_Add(), COUNTER_Increment() (32-bit counters),
+///    COUNTER_Add64() (64-bit counters) or COUNTER_Set() (gauges).
+/// -# Call COUNTERS_Snapshot() periodically, then COUNTERS_Print() or
+///    COUNTERS_Export(). Snapshots must be less than 2^32 timer ticks apart
+///    (see timer.h) for the rates to be right.
+//------------------------------------------------------------------------------
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <utility/critical.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Counter type: 32-bit count, wraps around.
+#define COUNTER_TYPE_COUNT      0
+/// Counter type: 64-bit count.
+#define COUNTER_TYPE_COUNT64    1
+/// Counter type: 32-bit level (occupancy, temperature...), no rate.
+#define COUNTER_TYPE_GAUGE      2
+
+/// Maximum number of registered counters.
+#define COUNTERS_MAX            48
+
+/// Identifies a binary counter export ("CNTR").
+#define COUNTERS_MAGIC          0x52544E43
+
+/// Size of a binary export of COUNTERS_MAX counters, in words.
+#define COUNTERS_EXPORT_WORDS   ((sizeof(CounterHeader) + COUNTERS_MAX * sizeof(CounterRecord)) / 4)
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// A counter or gauge. Instances are owned by the caller and must stay valid
+/// for the whole program lifetime.
+//------------------------------------------------------------------------------
+typedef struct _Counter {
+
+    /// Current value (low word of 64-bit counters).
+    volatile unsigned int value;
+    /// High word of 64-bit counters.
+    volatile unsigned int valueHigh;
+    /// Name displayed in printouts.
+    const char *name;
+    /// Next registered counter.
+    struct _Counter *pNext;
+    /// Counter type (COUNTER_TYPE_xxx).
+    unsigned char type;
+    /// Value at the last snapshot.
+    unsigned long long snapshot;
+    /// Rate over the last snapshot interval, per second.
+    unsigned int rate;
+
+} Counter;
+
+//------------------------------------------------------------------------------
+/// Header of a binary export, followed by one CounterRecord per counter in
+/// registration order.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// COUNTERS_MAGIC.
+    unsigned int magic;
+    /// Number of records.
+    unsigned int count;
+    /// Timer tick count at the snapshot.
+    unsigned int ticks;
+    /// Length of the snapshot interval, in microseconds.
+    unsigned int intervalUs;
+
+} CounterHeader;
+
+//------------------------------------------------------------------------------
+/// One counter in a binary export.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Value at the snapshot, low and high words.
+    unsigned int valueLow;
+    unsigned int valueHigh;
+    /// Rate over the snapshot interval, per second (0 for gauges).
+    unsigned int rate;
+
+} CounterRecord;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Adds a value to a 32-bit counter.
+/// \param pCounter  Counter to update.
+/// \param n  Value to add.
+//------------------------------------------------------------------------------
+static inline void COUNTER_Add(Counter *pCounter, unsigned int n)
+{
+    CriticalState state = CRITICAL_Enter();
+    pCounter->value += n;
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Adds one to a 32-bit counter.
+/// \param pCounter  Counter to update.
+//------------------------------------------------------------------------------
+static inline void COUNTER_Increment(Counter *pCounter)
+{
+    COUNTER_Add(pCounter, 1);
+}
+
+//------------------------------------------------------------------------------
+/// Adds a value to a 64-bit counter.
+/// \param pCounter  Counter to update.
+/// \param n  Value to add.
+//------------------------------------------------------------------------------
+static inline void COUNTER_Add64(Counter *pCounter, unsigned int n)
+{
+    CriticalState state = CRITICAL_Enter();
+    unsigned int low = pCounter->value + n;
+    if (low < n) {
+
+        pCounter->valueHigh++;
+    }
+    pCounter->value = low;
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Sets the level of a gauge; a single store, so no critical section.
+/// \param pCounter  Gauge to update.
+/// \param value  New level.
+//------------------------------------------------------------------------------
+static inline void COUNTER_Set(Counter *pCounter, unsigned int value)
+{
+    pCounter->value = value;
+}
+
+extern void COUNTERS_Register(Counter *pCounter, const char *name, unsigned char type);
+
+extern void COUNTERS_Snapshot(void);
+
+extern void COUNTERS_Print(void);
+
+extern unsigned int COUNTERS_Export(void *pBuffer, unsigned int size);
+
+#endif //#ifndef COUNTERS_H
+
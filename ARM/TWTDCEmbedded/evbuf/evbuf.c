@@ -0,0 +1,295 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   EVBUF
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "evbuf.h"
+#include <counters/counters.h>
+#include <board.h>
+#include <utility/assert.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Length word marking the unused end of the ring; the next block starts at
+/// the beginning of the buffer.
+#define EVBUF_WRAP          0xFFFFFFFF
+
+/// Stage whose progress frees the buffer memory.
+#define EVBUF_LAST_STAGE    (EVBUF_NUM_STAGES - 1)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Start of the ring.
+static unsigned int *pBuffer;
+
+/// Ring size in words.
+static unsigned int bufferSize;
+
+/// Offset where the next block will be written.
+static unsigned int head;
+
+/// Offset of the next block to hand to each stage.
+static unsigned int cursors[EVBUF_NUM_STAGES];
+
+/// Number of blocks waiting for each stage.
+static unsigned int pending[EVBUF_NUM_STAGES];
+
+/// Number of words in use, including length words and the wrap padding.
+static unsigned int used;
+
+/// Offset of the block reserved by EVBUF_Reserve().
+static unsigned int reservedAt;
+
+/// Size of the block reserved by EVBUF_Reserve(), 0 if none.
+static unsigned int reservedSize;
+
+/// Number of words in use, and its maximum since initialization.
+static Counter usedGauge;
+static Counter peakGauge;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the offset of the block at the given position, skipping the wrap
+/// padding at the end of the ring if needed.
+/// \param offset  Position of a stage cursor.
+//------------------------------------------------------------------------------
+static unsigned int BlockOffset(unsigned int offset)
+{
+    if ((offset >= bufferSize) || (pBuffer[offset] == EVBUF_WRAP)) {
+
+        return 0;
+    }
+
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes the event buffer in the given memory area.
+/// \param pBase  Start of the area (word aligned).
+/// \param size  Size of the area in words.
+//------------------------------------------------------------------------------
+void EVBUF_Initialize(unsigned int *pBase, unsigned int size)
+{
+    SANITY_CHECK(pBase);
+    SANITY_CHECK(size > 1);
+
+    pBuffer = pBase;
+    bufferSize = size;
+    COUNTERS_Register(&usedGauge, "evbuf used", COUNTER_TYPE_GAUGE);
+    COUNTERS_Register(&peakGauge, "evbuf peak", COUNTER_TYPE_GAUGE);
+    EVBUF_Reset();
+}
+
+//------------------------------------------------------------------------------
+/// Discards every block, whatever stage it is in.
+//------------------------------------------------------------------------------
+void EVBUF_Reset(void)
+{
+    unsigned int i;
+
+    head = 0;
+    used = 0;
+    COUNTER_Set(&usedGauge, 0);
+    reservedSize = 0;
+    for (i = 0; i < EVBUF_NUM_STAGES; i++) {
+
+        cursors[i] = 0;
+        pending[i] = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reserves a contiguous block of the given size at the head of the ring.
+/// Nothing is visible to the consumers until EVBUF_Commit() is called.
+/// \param size  Payload size in words.
+/// \return Pointer to the payload area, or 0 if the buffer is full.
+//------------------------------------------------------------------------------
+unsigned int * EVBUF_Reserve(unsigned int size)
+{
+    unsigned int need = size + 1;
+    unsigned int tail;
+
+    reservedSize = 0;
+
+    // Restart from the beginning when empty, to get the largest free area
+    if (used == 0) {
+
+        EVBUF_Reset();
+    }
+    tail = cursors[EVBUF_LAST_STAGE];
+
+    if ((head > tail) || (used == 0)) {
+
+        // Free space is [head, end) and [0, tail)
+        if ((bufferSize - head) >= need) {
+
+            reservedAt = head;
+        }
+        else if (tail >= need) {
+
+            reservedAt = 0;
+        }
+        else {
+
+            return 0;
+        }
+    }
+    else if ((head < tail) && ((tail - head) >= need)) {
+
+        reservedAt = head;
+    }
+    else {
+
+        return 0;
+    }
+
+    reservedSize = size;
+    return &pBuffer[reservedAt + 1];
+}
+
+//------------------------------------------------------------------------------
+/// Publishes the block previously reserved with EVBUF_Reserve() to the first
+/// stage.
+/// \param size  Actual payload size in words, at most the reserved size.
+//------------------------------------------------------------------------------
+void EVBUF_Commit(unsigned int size)
+{
+    SANITY_CHECK(size <= reservedSize);
+
+    // Pad the end of the ring if the block wrapped around
+    if (reservedAt != head) {
+
+        if (head < bufferSize) {
+
+            pBuffer[head] = EVBUF_WRAP;
+        }
+        used += bufferSize - head;
+    }
+
+    pBuffer[reservedAt] = size;
+    head = reservedAt + size + 1;
+    used += size + 1;
+    pending[0]++;
+    reservedSize = 0;
+
+    COUNTER_Set(&usedGauge, used);
+    if (used > peakGauge.value) {
+
+        COUNTER_Set(&peakGauge, used);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the oldest block waiting for the given stage.
+/// \param stage  Consumer stage (EVBUF_STAGE_xxx).
+/// \param pSize  Filled with the payload size in words.
+/// \return Pointer to the payload, or 0 if no block is waiting.
+//------------------------------------------------------------------------------
+unsigned int * EVBUF_Peek(unsigned int stage, unsigned int *pSize)
+{
+    unsigned int offset;
+
+    SANITY_CHECK(stage < EVBUF_NUM_STAGES);
+
+    if (pending[stage] == 0) {
+
+        return 0;
+    }
+
+    offset = BlockOffset(cursors[stage]);
+    *pSize = pBuffer[offset];
+
+    return &pBuffer[offset + 1];
+}
+
+//------------------------------------------------------------------------------
+/// Hands the oldest block of a stage over to the next one. When called for the
+/// last stage, the block memory is released.
+/// \param stage  Consumer stage (EVBUF_STAGE_xxx).
+//------------------------------------------------------------------------------
+void EVBUF_Advance(unsigned int stage)
+{
+    unsigned int offset;
+
+    SANITY_CHECK(stage < EVBUF_NUM_STAGES);
+    SANITY_CHECK(pending[stage] > 0);
+
+    offset = BlockOffset(cursors[stage]);
+    if (stage == EVBUF_LAST_STAGE) {
+
+        if (offset != cursors[stage]) {
+
+            used -= bufferSize - cursors[stage];
+        }
+        used -= pBuffer[offset] + 1;
+        COUNTER_Set(&usedGauge, used);
+    }
+    else {
+
+        pending[stage + 1]++;
+    }
+
+    cursors[stage] = offset + pBuffer[offset] + 1;
+    pending[stage]--;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the block following a given one in the ring, whatever stage it is
+/// in. The caller must know that there is one, from EVBUF_GetPending().
+/// \param pPayload  Payload of a block returned by EVBUF_Peek() or
+///                  EVBUF_Next().
+/// \param pSize  Filled with the payload size in words.
+/// \return Pointer to the payload of the next block.
+//------------------------------------------------------------------------------
+unsigned int * EVBUF_Next(const unsigned int *pPayload, unsigned int *pSize)
+{
+    unsigned int offset = pPayload - pBuffer;
+
+    SANITY_CHECK((offset > 0) && (offset < bufferSize));
+
+    offset = BlockOffset(offset + pPayload[-1]);
+    *pSize = pBuffer[offset];
+
+    return &pBuffer[offset + 1];
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of words in use.
+//------------------------------------------------------------------------------
+unsigned int EVBUF_GetUsed(void)
+{
+    return used;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the buffer size in words.
+//------------------------------------------------------------------------------
+unsigned int EVBUF_GetSize(void)
+{
+    return bufferSize;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of blocks waiting for the given stage.
+/// \param stage  Consumer stage (EVBUF_STAGE_xxx).
+//------------------------------------------------------------------------------
+unsigned int EVBUF_GetPending(unsigned int stage)
+{
+    SANITY_CHECK(stage < EVBUF_NUM_STAGES);
+
+    return pending[stage];
+}
+
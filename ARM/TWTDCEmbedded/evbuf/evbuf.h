@@ -0,0 +1,71 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Event buffer: a ring of variable-length data blocks in SDRAM, shared by the
+/// successive stages of the data path (readout, processing, transmission,
+/// acknowledgement).
+///
+/// Each block is stored as one length word followed by its payload, always
+/// contiguous in memory so that stages can work on it in place. A block goes
+/// through the stages in order: it is written by the readout, then handed to
+/// EVBUF_STAGE_PROCESS, then to EVBUF_STAGE_TRANSMIT, then to
+/// EVBUF_STAGE_ACK, where sent blocks wait until the receiver has them; its
+/// memory is reclaimed once the last stage is done with it.
+///
+/// !Usage
+///
+/// -# Initialize the buffer with EVBUF_Initialize().
+/// -# Producer: get room for a block with EVBUF_Reserve(), fill it, then make
+///    it visible with EVBUF_Commit() (which may shrink the block).
+/// -# Consumers: get the oldest block available to a stage with EVBUF_Peek(),
+///    then hand it over to the next stage with EVBUF_Advance(). The blocks
+///    after the oldest one can be walked with EVBUF_Next().
+///
+/// \note All the functions must be called from task context; the scheduler
+/// being non-preemptive, no locking is needed between stages.
+//------------------------------------------------------------------------------
+
+#ifndef EVBUF_H
+#define EVBUF_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Processing stage (decoding, calibration, filtering...).
+#define EVBUF_STAGE_PROCESS         0
+/// Transmission stage (data link).
+#define EVBUF_STAGE_TRANSMIT        1
+/// Acknowledgement stage (blocks sent, kept for retransmission).
+#define EVBUF_STAGE_ACK             2
+/// Number of consumer stages.
+#define EVBUF_NUM_STAGES            3
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void EVBUF_Initialize(unsigned int *pBase, unsigned int size);
+
+extern void EVBUF_Reset(void);
+
+extern unsigned int * EVBUF_Reserve(unsigned int size);
+
+extern void EVBUF_Commit(unsigned int size);
+
+extern unsigned int * EVBUF_Peek(unsigned int stage, unsigned int *pSize);
+
+extern void EVBUF_Advance(unsigned int stage);
+
+extern unsigned int * EVBUF_Next(const unsigned int *pPayload, unsigned int *pSize);
+
+extern unsigned int EVBUF_GetUsed(void);
+
+extern unsigned int EVBUF_GetSize(void);
+
+extern unsigned int EVBUF_GetPending(unsigned int stage);
+
+#endif //#ifndef EVBUF_H
+
@@ -0,0 +1,215 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "evbuild.h"
+#include <tdc/tdc.h>
+#include <counters/counters.h>
+#include <utility/crc32.h>
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// DPRAM segment.
+typedef struct {
+
+    /// Offset from the start of the DPRAM, in words.
+    unsigned int offset;
+    /// Size in words, fragment header included.
+    unsigned int size;
+
+} Segment;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// DPRAM window.
+static const volatile unsigned int *pDpram;
+static unsigned int dpramSize;
+
+/// Segments, and number of them in use.
+static Segment pSegments[EVBUILD_MAX_SEGMENTS];
+static unsigned int numSegments = 0;
+
+/// Trigger number of the last event, ~0 before the first one.
+static unsigned int lastTrigger = 0xFFFFFFFF;
+
+/// Error counters.
+static Counter missingCounter;
+static Counter outOfSyncCounter;
+static Counter triggerGapCounter;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes the event builder, with no segment.
+/// \param pBase  Start of the DPRAM.
+/// \param size  Size of the DPRAM in words.
+//------------------------------------------------------------------------------
+void EVBUILD_Initialize(const volatile unsigned int *pBase, unsigned int size)
+{
+    pDpram = pBase;
+    dpramSize = size;
+    numSegments = 0;
+    lastTrigger = 0xFFFFFFFF;
+    COUNTERS_Register(&missingCounter, "evb missing", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&outOfSyncCounter, "evb out of sync", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&triggerGapCounter, "evb trigger gaps", COUNTER_TYPE_COUNT);
+}
+
+//------------------------------------------------------------------------------
+/// Describes a segment.
+/// \param index  Segment index, below EVBUILD_MAX_SEGMENTS.
+/// \param offset  Offset from the start of the DPRAM, in words.
+/// \param size  Size in words, fragment header included (at least 1).
+/// \return 1 if the segment is within the DPRAM.
+//------------------------------------------------------------------------------
+unsigned char EVBUILD_SetSegment(unsigned int index, unsigned int offset, unsigned int size)
+{
+    if ((index >= EVBUILD_MAX_SEGMENTS) || (size == 0)
+        || (offset >= dpramSize) || (size > (dpramSize - offset))) {
+
+        return 0;
+    }
+
+    pSegments[index].offset = offset;
+    pSegments[index].size = size;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Sets the number of segments in use (the first ones), 0 to turn the event
+/// builder off.
+/// \param count  Number of segments, up to EVBUILD_MAX_SEGMENTS.
+/// \return 1 if the count is valid.
+//------------------------------------------------------------------------------
+unsigned char EVBUILD_SetNumSegments(unsigned int count)
+{
+    unsigned int i;
+
+    if (count > EVBUILD_MAX_SEGMENTS) {
+
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+
+        if (pSegments[i].size == 0) {
+
+            return 0;
+        }
+    }
+
+    numSegments = count;
+    lastTrigger = 0xFFFFFFFF;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of segments in use, 0 if the event builder is off.
+//------------------------------------------------------------------------------
+unsigned int EVBUILD_GetNumSegments(void)
+{
+    return numSegments;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the description of a segment.
+/// \param index  Segment index, below EVBUILD_MAX_SEGMENTS.
+/// \param pOffset  Offset from the start of the DPRAM, in words.
+/// \param pSize  Size in words, 0 if not set.
+//------------------------------------------------------------------------------
+void EVBUILD_GetSegment(unsigned int index, unsigned int *pOffset, unsigned int *pSize)
+{
+    *pOffset = pSegments[index].offset;
+    *pSize = pSegments[index].size;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the fragment headers of the next event and checks them.
+/// \param pEvent  Event description.
+/// \return Size of the event payload in words.
+//------------------------------------------------------------------------------
+unsigned int EVBUILD_Scan(EvBuildEvent *pEvent)
+{
+    unsigned char haveTrigger = 0;
+    unsigned int header;
+    unsigned int i;
+
+    pEvent->trigger = 0;
+    pEvent->status = 0;
+    pEvent->numSegments = numSegments;
+    pEvent->size = numSegments;
+
+    for (i = 0; i < numSegments; i++) {
+
+        header = pDpram[pSegments[i].offset];
+        if (!TDC_IS_FRAGMENT(header)
+            || (TDC_GET_FRAGMENT_SIZE(header) > (pSegments[i].size - 1))) {
+
+            // Missing or garbled fragment
+            pEvent->pHeaders[i] = 0;
+            pEvent->status |= EVBUILD_MISSING;
+            COUNTER_Increment(&missingCounter);
+            continue;
+        }
+
+        if (!haveTrigger) {
+
+            pEvent->trigger = TDC_GET_TRIGGER(header);
+            haveTrigger = 1;
+        }
+        else if (TDC_GET_TRIGGER(header) != pEvent->trigger) {
+
+            pEvent->status |= EVBUILD_OUT_OF_SYNC;
+            COUNTER_Increment(&outOfSyncCounter);
+        }
+        pEvent->pHeaders[i] = header;
+        pEvent->size += TDC_GET_FRAGMENT_SIZE(header);
+    }
+
+    // Triggers skipped since the last event
+    if (haveTrigger) {
+
+        if ((lastTrigger != 0xFFFFFFFF)
+            && (pEvent->trigger != ((lastTrigger + 1) & TDC_TRIGGER_MASK))) {
+
+            COUNTER_Increment(&triggerGapCounter);
+        }
+        lastTrigger = pEvent->trigger;
+    }
+
+    return pEvent->size;
+}
+
+//------------------------------------------------------------------------------
+/// Gathers the fragments of an event scanned by EVBUILD_Scan() into a
+/// contiguous payload, and updates a CRC-32 with it.
+/// \param pEvent  Event description.
+/// \param pDestination  Payload, of pEvent->size words.
+/// \param crc  CRC of the previous data (e.g. the record header).
+/// \return The CRC updated with the payload.
+//------------------------------------------------------------------------------
+unsigned int EVBUILD_Gather(const EvBuildEvent *pEvent, unsigned int *pDestination, unsigned int crc)
+{
+    unsigned int size;
+    unsigned int i;
+
+    crc = CRC32_Copy(crc, pDestination, pEvent->pHeaders, pEvent->numSegments);
+    pDestination += pEvent->numSegments;
+
+    for (i = 0; i < pEvent->numSegments; i++) {
+
+        size = TDC_GET_FRAGMENT_SIZE(pEvent->pHeaders[i]);
+        crc = CRC32_Copy(crc, pDestination, pDpram + pSegments[i].offset + 1, size);
+        pDestination += size;
+    }
+
+    return crc;
+}
+
@@ -0,0 +1,88 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Event builder for boards whose TDC chips write their fragments to
+/// separate segments of the DPRAM. The fragments of a trigger are gathered
+/// straight from the DPRAM into one contiguous event, with the CRC of the
+/// event record computed on the way, so the data is read once and written
+/// once. The first fragment header (see tdc.h) gives the trigger number of
+/// the event; a segment without a valid header is a missing fragment, one
+/// with another trigger number is out of sync. Both are counted, and
+/// marked in the event.
+///
+/// Built event payload: the fragment header of each segment in order (0 for
+/// a missing fragment), then the hit words of the fragments in order.
+///
+/// !Usage
+///
+/// -# Call EVBUILD_Initialize() with the DPRAM window, then describe the
+///    segments with EVBUILD_SetSegment() and EVBUILD_SetNumSegments(). With
+///    no segment, the event builder is off.
+/// -# For each event, call EVBUILD_Scan() to read the fragment headers and
+///    get the event size, reserve the space, then call EVBUILD_Gather().
+//------------------------------------------------------------------------------
+
+#ifndef EVBUILD_H
+#define EVBUILD_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Maximum number of segments.
+#define EVBUILD_MAX_SEGMENTS    8
+
+/// Event status bits.
+#define EVBUILD_MISSING         (1 << 0)
+#define EVBUILD_OUT_OF_SYNC     (1 << 1)
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Event being built, filled by EVBUILD_Scan().
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Trigger number, from the first valid fragment.
+    unsigned int trigger;
+    /// EVBUILD_MISSING and EVBUILD_OUT_OF_SYNC bits.
+    unsigned int status;
+    /// Number of segments.
+    unsigned int numSegments;
+    /// Fragment header of each segment, 0 if missing.
+    unsigned int pHeaders[EVBUILD_MAX_SEGMENTS];
+    /// Size of the event payload in words.
+    unsigned int size;
+
+} EvBuildEvent;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void EVBUILD_Initialize(const volatile unsigned int *pBase, unsigned int size);
+
+extern unsigned char EVBUILD_SetSegment(
+    unsigned int index,
+    unsigned int offset,
+    unsigned int size);
+
+extern unsigned char EVBUILD_SetNumSegments(unsigned int count);
+
+extern unsigned int EVBUILD_GetNumSegments(void);
+
+extern void EVBUILD_GetSegment(unsigned int index, unsigned int *pOffset, unsigned int *pSize);
+
+extern unsigned int EVBUILD_Scan(EvBuildEvent *pEvent);
+
+extern unsigned int EVBUILD_Gather(
+    const EvBuildEvent *pEvent,
+    unsigned int *pDestination,
+    unsigned int crc);
+
+#endif //#ifndef EVBUILD_H
+
@@ -0,0 +1,216 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "evrec.h"
+#include <utility/crc32.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Index of the header words.
+#define MAGIC           0
+#define VERSION         1
+#define HEADER_SIZE     2
+#define CRC             3
+#define BOARD_ID        4
+#define RUN             5
+#define SPILL           6
+#define EVENT           7
+#define TIME_LOW        8
+#define TIME_HIGH       9
+#define FLAGS           10
+#define SIZE            11
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the CRC of the header of a record, without the CRC word.
+/// \param pRecord  Record.
+/// \param headerSize  Header size in words.
+//------------------------------------------------------------------------------
+static unsigned int ComputeHeaderCrc(const unsigned int *pRecord, unsigned int headerSize)
+{
+    unsigned int crc;
+
+    crc = CRC32_Update(0, pRecord, CRC * 4);
+    return CRC32_Update(crc, pRecord + CRC + 1, (headerSize - CRC - 1) * 4);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the CRC of a record (see evrec.h).
+/// \param pRecord  Record.
+/// \param headerSize  Header size in words.
+/// \param size  Payload size in words.
+//------------------------------------------------------------------------------
+static unsigned int ComputeCrc(
+    const unsigned int *pRecord,
+    unsigned int headerSize,
+    unsigned int size)
+{
+    return CRC32_Update(ComputeHeaderCrc(pRecord, headerSize), pRecord + headerSize, size * 4);
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Writes the header of a record; the CRC is left to EVREC_Seal().
+/// \param pRecord  Record, EVREC_HEADER_WORDS words followed by the payload.
+/// \param pInfo  Content of the header.
+//------------------------------------------------------------------------------
+void EVREC_Encode(unsigned int *pRecord, const EvRecInfo *pInfo)
+{
+    pRecord[MAGIC] = EVREC_MAGIC;
+    pRecord[VERSION] = EVREC_VERSION;
+    pRecord[HEADER_SIZE] = EVREC_HEADER_WORDS;
+    pRecord[CRC] = 0;
+    pRecord[BOARD_ID] = pInfo->boardId;
+    pRecord[RUN] = pInfo->run;
+    pRecord[SPILL] = pInfo->spill;
+    pRecord[EVENT] = pInfo->event;
+    pRecord[TIME_LOW] = (unsigned int) pInfo->timestamp;
+    pRecord[TIME_HIGH] = (unsigned int) (pInfo->timestamp >> 32);
+    pRecord[FLAGS] = pInfo->flags;
+    pRecord[SIZE] = pInfo->size;
+}
+
+//------------------------------------------------------------------------------
+/// Computes the CRC of a record written by EVREC_Encode(); must be called
+/// after the last change to the header or the payload.
+/// \param pRecord  Record.
+//------------------------------------------------------------------------------
+void EVREC_Seal(unsigned int *pRecord)
+{
+    pRecord[CRC] = ComputeCrc(pRecord, EVREC_HEADER_WORDS, pRecord[SIZE]);
+}
+
+//------------------------------------------------------------------------------
+/// Copies the payload of a record written by EVREC_Encode() and computes the
+/// CRC in the same pass, so that the source is read only once.
+/// \param pRecord  Record.
+/// \param pSource  Payload to copy, of the size given in the header.
+//------------------------------------------------------------------------------
+void EVREC_SealCopy(unsigned int *pRecord, const volatile unsigned int *pSource)
+{
+    pRecord[CRC] = CRC32_Copy(ComputeHeaderCrc(pRecord, EVREC_HEADER_WORDS),
+                              pRecord + EVREC_HEADER_WORDS, pSource, pRecord[SIZE]);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the CRC of the header of a record written by EVREC_Encode(), to
+/// be continued over the payload.
+/// \param pRecord  Record.
+//------------------------------------------------------------------------------
+unsigned int EVREC_GetHeaderCrc(const unsigned int *pRecord)
+{
+    return ComputeHeaderCrc(pRecord, EVREC_HEADER_WORDS);
+}
+
+//------------------------------------------------------------------------------
+/// Sets the CRC of a record, computed from EVREC_GetHeaderCrc() and the
+/// payload.
+/// \param pRecord  Record.
+/// \param crc  CRC.
+//------------------------------------------------------------------------------
+void EVREC_SetCrc(unsigned int *pRecord, unsigned int crc)
+{
+    pRecord[CRC] = crc;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the address of the payload of a record.
+/// \param pRecord  Record.
+//------------------------------------------------------------------------------
+unsigned int * EVREC_GetPayload(unsigned int *pRecord)
+{
+    return pRecord + EVREC_HEADER_WORDS;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the flags of a record written by EVREC_Encode(), without checking
+/// the record.
+/// \param pRecord  Record.
+//------------------------------------------------------------------------------
+unsigned int EVREC_GetFlags(const unsigned int *pRecord)
+{
+    return pRecord[FLAGS];
+}
+
+//------------------------------------------------------------------------------
+/// Returns the length in words, header included, of a record written by
+/// EVREC_Encode(), without checking the record.
+/// \param pRecord  Record.
+//------------------------------------------------------------------------------
+unsigned int EVREC_GetLength(const unsigned int *pRecord)
+{
+    return EVREC_HEADER_WORDS + pRecord[SIZE];
+}
+
+//------------------------------------------------------------------------------
+/// Checks the record at the given address. Headers of later versions are
+/// accepted as long as they keep the fields of this one.
+/// \param pData  Start of the record.
+/// \param available  Number of words available at pData.
+/// \param pInfo  Decoded header (valid unless EVREC_BAD_HEADER is returned),
+///               can be 0.
+/// \param pLength  Length of the record in words, header included (valid
+///                 unless EVREC_BAD_HEADER is returned).
+/// \return EVREC_OK, EVREC_INCOMPLETE, EVREC_BAD_HEADER or EVREC_BAD_CRC.
+//------------------------------------------------------------------------------
+unsigned char EVREC_Decode(
+    const unsigned int *pData,
+    unsigned int available,
+    EvRecInfo *pInfo,
+    unsigned int *pLength)
+{
+    unsigned int headerSize;
+
+    // Check the fixed part of the header first
+    if (available < EVREC_HEADER_WORDS) {
+
+        if ((available > MAGIC) && (pData[MAGIC] != EVREC_MAGIC)) {
+
+            return EVREC_BAD_HEADER;
+        }
+        return EVREC_INCOMPLETE;
+    }
+    headerSize = pData[HEADER_SIZE];
+    if ((pData[MAGIC] != EVREC_MAGIC)
+        || (pData[VERSION] < EVREC_VERSION)
+        || (headerSize < EVREC_HEADER_WORDS)
+        || (headerSize > 0x100)
+        || (pData[SIZE] > (0xFFFFFFFF - headerSize))) {
+
+        return EVREC_BAD_HEADER;
+    }
+
+    if (pInfo) {
+
+        pInfo->boardId = pData[BOARD_ID];
+        pInfo->run = pData[RUN];
+        pInfo->spill = pData[SPILL];
+        pInfo->event = pData[EVENT];
+        pInfo->timestamp = ((unsigned long long) pData[TIME_HIGH] << 32)
+                           | pData[TIME_LOW];
+        pInfo->flags = pData[FLAGS];
+        pInfo->size = pData[SIZE];
+    }
+    *pLength = headerSize + pData[SIZE];
+
+    if (available < *pLength) {
+
+        return EVREC_INCOMPLETE;
+    }
+    if (ComputeCrc(pData, headerSize, pData[SIZE]) != pData[CRC]) {
+
+        return EVREC_BAD_CRC;
+    }
+
+    return EVREC_OK;
+}
+
@@ -0,0 +1,149 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Self-describing event record, the unit of data sent on every data link and
+/// written to the SD card log. A record is a header of EVREC_HEADER_WORDS
+/// 32-bit words followed by the payload; all the words are little-endian.
+///
+/// Header layout (word index):
+/// - 0: EVREC_MAGIC ("EVRC"), to find records again in a stream;
+/// - 1: EVREC_VERSION of the layout;
+/// - 2: header size in words, so that later versions can extend the header
+///   while older readers still find the payload;
+/// - 3: CRC-32 (see crc32.h) of the header without this word, then of the
+///   payload;
+/// - 4: board ID;
+/// - 5: run number;
+/// - 6: spill number;
+/// - 7: event number in the run;
+/// - 8, 9: timestamp, microseconds since startup (low word first);
+/// - 10: payload format flags (EVREC_FLAGS_xxx);
+/// - 11: payload size in words.
+///
+/// !Usage
+///
+/// -# Reserve EVREC_HEADER_WORDS words before the payload, fill the payload
+///    at EVREC_GetPayload().
+/// -# Write the header with EVREC_Encode(), then compute the CRC with
+///    EVREC_Seal() once the payload is final. Alternatively, fill the payload
+///    and compute the CRC in a single pass with EVREC_SealCopy(), or from
+///    several pieces with EVREC_GetHeaderCrc(), CRC32_Copy() and
+///    EVREC_SetCrc().
+/// -# CRC32_Initialize() must have been called before sealing or decoding.
+/// -# On the receiving side, call EVREC_Decode() on the stream: it tells
+///    whether a complete valid record starts at the given address, and its
+///    length.
+///
+/// \note This module is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef EVREC_H
+#define EVREC_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Identifies a record header ("EVRC").
+#define EVREC_MAGIC             0x43525645
+
+/// Version of the layout.
+#define EVREC_VERSION           1
+
+/// Size of the header in words.
+#define EVREC_HEADER_WORDS      12
+
+/// Payload format: raw TDC words, as read from the DPRAM.
+#define EVREC_FLAGS_RAW         0
+/// Payload format: TDC times calibrated on the board (see calib.h), with the
+/// ID of the calibration table in the upper 16 bits of the flags.
+#define EVREC_FLAGS_CALIBRATED  (1 << 0)
+#define EVREC_FLAGS_CALIB_SHIFT 16
+/// Payload format: event built from DPRAM segments (see evbuild.h). The
+/// payload starts with the fragment header of each segment, their number
+/// being given by EVREC_GET_SEGMENTS(), followed by the hit words.
+#define EVREC_FLAGS_BUILT       (1 << 1)
+/// Built event with missing or out-of-sync fragments.
+#define EVREC_FLAGS_MISMATCH    (1 << 2)
+/// Hits sorted by channel and time (see hitsort.h); in built events, the
+/// fragment headers then only give the number of hits of each fragment.
+#define EVREC_FLAGS_SORTED      (1 << 3)
+/// Event rejected by the level-2 filter (see l2filter.h).
+#define EVREC_FLAGS_REJECTED    (1 << 4)
+/// Rejected event to be dropped, decided when it was filtered: the record is
+/// not sent on the data links.
+#define EVREC_FLAGS_DROPPED     (1 << 5)
+#define EVREC_FLAGS_SEGMENTS_SHIFT 8
+#define EVREC_GET_SEGMENTS(flags) (((flags) >> EVREC_FLAGS_SEGMENTS_SHIFT) & 0xF)
+/// Payload compressed with the codec EVREC_GET_CODEC() (see codec.h), 0 for
+/// none; the other flags describe the payload once decompressed.
+#define EVREC_FLAGS_CODEC_SHIFT 12
+#define EVREC_FLAGS_CODEC_MASK  (0xF << EVREC_FLAGS_CODEC_SHIFT)
+#define EVREC_GET_CODEC(flags)  (((flags) >> EVREC_FLAGS_CODEC_SHIFT) & 0xF)
+
+/// Results of EVREC_Decode().
+#define EVREC_OK                0
+/// Not enough data yet for the whole record.
+#define EVREC_INCOMPLETE        1
+/// No valid header at the given address.
+#define EVREC_BAD_HEADER        2
+/// Valid header, but the CRC does not match.
+#define EVREC_BAD_CRC           3
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Decoded content of a record header.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Board ID.
+    unsigned int boardId;
+    /// Run number.
+    unsigned int run;
+    /// Spill number.
+    unsigned int spill;
+    /// Event number in the run.
+    unsigned int event;
+    /// Payload format flags.
+    unsigned int flags;
+    /// Timestamp in microseconds since startup.
+    unsigned long long timestamp;
+    /// Payload size in words.
+    unsigned int size;
+
+} EvRecInfo;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void EVREC_Encode(unsigned int *pRecord, const EvRecInfo *pInfo);
+
+extern void EVREC_Seal(unsigned int *pRecord);
+
+extern void EVREC_SealCopy(unsigned int *pRecord, const volatile unsigned int *pSource);
+
+extern unsigned int EVREC_GetHeaderCrc(const unsigned int *pRecord);
+
+extern void EVREC_SetCrc(unsigned int *pRecord, unsigned int crc);
+
+extern unsigned int * EVREC_GetPayload(unsigned int *pRecord);
+
+extern unsigned int EVREC_GetFlags(const unsigned int *pRecord);
+
+extern unsigned int EVREC_GetLength(const unsigned int *pRecord);
+
+extern unsigned char EVREC_Decode(
+    const unsigned int *pData,
+    unsigned int available,
+    EvRecInfo *pInfo,
+    unsigned int *pLength);
+
+#endif //#ifndef EVREC_H
+
@@ -0,0 +1,187 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "hist.h"
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Places the banks in the internal SRAM0, cleared at runtime.
+#if defined(__ICCARM__)
+    #define HIST_SRAM   _Pragma("location=\".sram0\"") __no_init
+#else
+    #define HIST_SRAM
+#endif
+
+/// Shifts from a channel number to its group, and from a time to its bin.
+#if HIST_GROUP_SIZE == 4
+    #define GROUP_SHIFT 2
+#elif HIST_GROUP_SIZE == 8
+    #define GROUP_SHIFT 3
+#elif HIST_GROUP_SIZE == 16
+    #define GROUP_SHIFT 4
+#else
+    #error Unsupported HIST_GROUP_SIZE
+#endif
+
+#if HIST_TIME_BINS == 16
+    #define TIME_SHIFT  (TDC_TIME_BITS - 4)
+#elif HIST_TIME_BINS == 32
+    #define TIME_SHIFT  (TDC_TIME_BITS - 5)
+#elif HIST_TIME_BINS == 64
+    #define TIME_SHIFT  (TDC_TIME_BITS - 6)
+#else
+    #error Unsupported HIST_TIME_BINS
+#endif
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Bank being filled, and bank of the last complete spill.
+HIST_SRAM static HistBank filling;
+static HistBank last;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Clears the histograms.
+//------------------------------------------------------------------------------
+void HIST_Initialize(void)
+{
+    memset(&filling, 0, sizeof(HistBank));
+    memset(&last, 0, sizeof(HistBank));
+}
+
+//------------------------------------------------------------------------------
+/// Fills the histograms of the spill being filled with the hit words of an
+/// event.
+/// \param spill  Spill number of the event.
+/// \param pHits  Hit words.
+/// \param size  Number of hit words.
+//------------------------------------------------------------------------------
+void HIST_Fill(unsigned int spill, const unsigned int *pHits, unsigned int size)
+{
+    HistBank *pBank = &filling;
+    unsigned int word;
+    unsigned int channel;
+
+    pBank->spill = spill;
+    pBank->events++;
+    pBank->hits += size;
+    while (size > 0) {
+
+        word = *pHits++;
+        channel = TDC_GET_CHANNEL(word);
+        pBank->pOccupancy[channel]++;
+        pBank->pTime[channel >> GROUP_SHIFT][TDC_GET_TIME(word) >> TIME_SHIFT]++;
+        size--;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Closes a spill: the bank being filled becomes the last complete one, and
+/// is cleared for the next spill.
+/// \param spill  Number of the spill closed.
+//------------------------------------------------------------------------------
+void HIST_EndSpill(unsigned int spill)
+{
+    filling.spill = spill;
+    memcpy(&last, &filling, sizeof(HistBank));
+    memset(&filling, 0, sizeof(HistBank));
+}
+
+//------------------------------------------------------------------------------
+/// Returns a histogram bank.
+/// \param current  1 for the spill being filled, 0 for the last complete one.
+//------------------------------------------------------------------------------
+const HistBank * HIST_GetBank(unsigned char current)
+{
+    return current ? &filling : &last;
+}
+
+//------------------------------------------------------------------------------
+/// Prints the event and hit counts and the occupancy of a bank.
+/// \param pBank  Histogram bank.
+//------------------------------------------------------------------------------
+void HIST_Print(const HistBank *pBank)
+{
+    unsigned int i;
+
+    printf("-- Spill %u: %u events, %u hits --\n\r", pBank->spill, pBank->events, pBank->hits);
+    for (i = 0; i < TDC_NUM_CHANNELS; i++) {
+
+        if ((i % 8) == 0) {
+
+            printf("  %2u:", i);
+        }
+        printf(" %9u", pBank->pOccupancy[i]);
+        if ((i % 8) == 7) {
+
+            printf("\n\r");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Prints the time spectrum of a group of channels.
+/// \param pBank  Histogram bank.
+/// \param group  Group of channels, below HIST_NUM_GROUPS.
+//------------------------------------------------------------------------------
+void HIST_PrintTime(const HistBank *pBank, unsigned int group)
+{
+    unsigned int i;
+
+    printf("-- Spill %u, channels %u to %u, %u counts per bin --\n\r", pBank->spill,
+           group * HIST_GROUP_SIZE, (group + 1) * HIST_GROUP_SIZE - 1, 1 << TIME_SHIFT);
+    for (i = 0; i < HIST_TIME_BINS; i++) {
+
+        if ((i % 8) == 0) {
+
+            printf("  %5u:", i << TIME_SHIFT);
+        }
+        printf(" %9u", pBank->pTime[group][i]);
+        if ((i % 8) == 7) {
+
+            printf("\n\r");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Writes a bank in binary form: a HistExportHeader followed by the occupancy
+/// and the time spectra.
+/// \param pBank  Histogram bank.
+/// \param pBuffer  Destination buffer (word aligned).
+/// \param size  Size of the buffer in bytes.
+/// \return Number of bytes written, 0 if the buffer is too small.
+//------------------------------------------------------------------------------
+unsigned int HIST_Export(const HistBank *pBank, unsigned int *pBuffer, unsigned int size)
+{
+    HistExportHeader *pHeader = (HistExportHeader *) pBuffer;
+
+    if (size < (HIST_EXPORT_WORDS * 4)) {
+
+        return 0;
+    }
+
+    pHeader->magic = HIST_MAGIC;
+    pHeader->spill = pBank->spill;
+    pHeader->events = pBank->events;
+    pHeader->hits = pBank->hits;
+    pHeader->numChannels = TDC_NUM_CHANNELS;
+    pHeader->numGroups = HIST_NUM_GROUPS;
+    pHeader->numBins = HIST_TIME_BINS;
+    pBuffer += sizeof(HistExportHeader) / 4;
+    memcpy(pBuffer, pBank->pOccupancy, sizeof(pBank->pOccupancy));
+    memcpy(pBuffer + TDC_NUM_CHANNELS, pBank->pTime, sizeof(pBank->pTime));
+
+    return HIST_EXPORT_WORDS * 4;
+}
+
@@ -0,0 +1,115 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Online monitoring histograms filled on the board from the calibrated hit
+/// words of the buffered events (see tdc.h), between spills: the occupancy
+/// of each channel, and a coarse time spectrum of each group of
+/// HIST_GROUP_SIZE channels, so that the detector health can be followed
+/// without the raw data.
+///
+/// The histograms are kept in the internal SRAM0 (section .sram0 of the
+/// linker file), where an increment costs a few cycles instead of a
+/// read-modify-write in SDRAM, and filled without any branch per word. Once
+/// all the events of a spill are in, this bank is copied to the last spill
+/// bank in SDRAM, the one read out, and cleared for the next spill.
+///
+/// !Usage
+///
+/// -# Call HIST_Initialize() at startup.
+/// -# Feed the hit words of each event with HIST_Fill(), from a single task,
+///    and call HIST_EndSpill() from the same task once the last event of the
+///    spill has been filled (or periodically, without spills).
+/// -# Read a bank with HIST_GetBank(), print it with HIST_Print() and
+///    HIST_PrintTime(), or write it in binary form with HIST_Export().
+//------------------------------------------------------------------------------
+
+#ifndef HIST_H
+#define HIST_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <tdc/tdc.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Number of channels per time spectrum (a power of 2), and number of
+/// spectra.
+#define HIST_GROUP_SIZE         8
+#define HIST_NUM_GROUPS         (TDC_NUM_CHANNELS / HIST_GROUP_SIZE)
+
+/// Number of bins of a time spectrum (a power of 2 up to 2^TDC_TIME_BITS).
+#define HIST_TIME_BINS          32
+
+/// Identifies a binary export ("HIST").
+#define HIST_MAGIC              0x54534948
+
+/// Size of a binary export in words.
+#define HIST_EXPORT_WORDS       (sizeof(HistExportHeader) / 4 + TDC_NUM_CHANNELS \
+                                 + HIST_NUM_GROUPS * HIST_TIME_BINS)
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Histograms of one spill.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Spill number.
+    unsigned int spill;
+    /// Number of events and hit words.
+    unsigned int events;
+    unsigned int hits;
+    /// Number of hits of each channel.
+    unsigned int pOccupancy[TDC_NUM_CHANNELS];
+    /// Time spectrum of each group of channels.
+    unsigned int pTime[HIST_NUM_GROUPS][HIST_TIME_BINS];
+
+} HistBank;
+
+//------------------------------------------------------------------------------
+/// Header of a binary export, little-endian, followed by the occupancy and
+/// the time spectra of the bank (as in HistBank).
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// HIST_MAGIC.
+    unsigned int magic;
+    /// Spill number, number of events and hit words.
+    unsigned int spill;
+    unsigned int events;
+    unsigned int hits;
+    /// TDC_NUM_CHANNELS, HIST_NUM_GROUPS and HIST_TIME_BINS.
+    unsigned int numChannels;
+    unsigned int numGroups;
+    unsigned int numBins;
+
+} HistExportHeader;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void HIST_Initialize(void);
+
+extern void HIST_Fill(unsigned int spill, const unsigned int *pHits, unsigned int size);
+
+extern void HIST_EndSpill(unsigned int spill);
+
+extern const HistBank * HIST_GetBank(unsigned char current);
+
+extern void HIST_Print(const HistBank *pBank);
+
+extern void HIST_PrintTime(const HistBank *pBank, unsigned int group);
+
+extern unsigned int HIST_Export(const HistBank *pBank, unsigned int *pBuffer, unsigned int size);
+
+#endif //#ifndef HIST_H
+
@@ -0,0 +1,181 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "hitsort.h"
+#include <tdc/tdc.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Places the bucket counts in the internal SRAM0, filled at runtime.
+#if defined(__ICCARM__)
+    #define HITSORT_SRAM _Pragma("location=\".sram0\"") __no_init
+#else
+    #define HITSORT_SRAM
+#endif
+
+/// Number of passes, and shift and number of buckets of each one: time bits
+/// 7..0, time bits 15..8, then the channel.
+#define NUM_PASSES      3
+#define TIME_BUCKETS    256
+#define CHANNEL_BUCKETS TDC_NUM_CHANNELS
+
+/// Returns the sort key of a hit word.
+#define KEY(word)       ((TDC_GET_CHANNEL(word) << TDC_TIME_BITS) | TDC_GET_TIME(word))
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Bucket counts, then start offsets, of each pass.
+HITSORT_SRAM static unsigned short pLowCounts[TIME_BUCKETS];
+HITSORT_SRAM static unsigned short pHighCounts[TIME_BUCKETS];
+HITSORT_SRAM static unsigned short pChannelCounts[CHANNEL_BUCKETS];
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sorts a few hits by insertion.
+//------------------------------------------------------------------------------
+static void InsertionSort(unsigned int *pHits, unsigned int size)
+{
+    unsigned int word;
+    unsigned int key;
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 1; i < size; i++) {
+
+        word = pHits[i];
+        key = KEY(word);
+        for (j = i; (j > 0) && (KEY(pHits[j - 1]) > key); j--) {
+
+            pHits[j] = pHits[j - 1];
+        }
+        pHits[j] = word;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Turns bucket counts into start offsets.
+/// \param pCounts  Bucket counts.
+/// \param numBuckets  Number of buckets.
+/// \param size  Number of hits.
+/// \return 1 if the hits are spread over several buckets, 0 if the pass can
+///         be skipped.
+//------------------------------------------------------------------------------
+static unsigned char PrefixSum(unsigned short *pCounts, unsigned int numBuckets, unsigned int size)
+{
+    unsigned int offset = 0;
+    unsigned int count;
+    unsigned int i;
+
+    for (i = 0; i < numBuckets; i++) {
+
+        count = pCounts[i];
+        if (count == size) {
+
+            return 0;
+        }
+        pCounts[i] = offset;
+        offset += count;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sorts hit words by channel, then time, keeping the order of equal ones.
+/// \param pHits  Hit words.
+/// \param size  Number of hits, up to HITSORT_MAX_HITS.
+/// \param pScratch  Scratch buffer of size words.
+/// \return 1 if the hits are sorted, 0 if there are too many of them.
+//------------------------------------------------------------------------------
+unsigned char HITSORT_Sort(unsigned int *pHits, unsigned int size, unsigned int *pScratch)
+{
+    unsigned int *pSource = pHits;
+    unsigned int *pDestination = pScratch;
+    unsigned int *pSwap;
+    unsigned short *pOffsets;
+    unsigned int word;
+    unsigned int pass;
+    unsigned int i;
+
+    if (size > HITSORT_MAX_HITS) {
+
+        return 0;
+    }
+    if (size <= HITSORT_SMALL) {
+
+        InsertionSort(pHits, size);
+        return 1;
+    }
+
+    // Bucket counts of the three passes at once
+    memset(pLowCounts, 0, sizeof(pLowCounts));
+    memset(pHighCounts, 0, sizeof(pHighCounts));
+    memset(pChannelCounts, 0, sizeof(pChannelCounts));
+    for (i = 0; i < size; i++) {
+
+        word = pHits[i];
+        pLowCounts[word & 0xFF]++;
+        pHighCounts[(word >> 8) & 0xFF]++;
+        pChannelCounts[TDC_GET_CHANNEL(word)]++;
+    }
+
+    for (pass = 0; pass < NUM_PASSES; pass++) {
+
+        if (pass == 0) {
+
+            pOffsets = pLowCounts;
+            if (!PrefixSum(pOffsets, TIME_BUCKETS, size)) continue;
+            for (i = 0; i < size; i++) {
+
+                word = pSource[i];
+                pDestination[pOffsets[word & 0xFF]++] = word;
+            }
+        }
+        else if (pass == 1) {
+
+            pOffsets = pHighCounts;
+            if (!PrefixSum(pOffsets, TIME_BUCKETS, size)) continue;
+            for (i = 0; i < size; i++) {
+
+                word = pSource[i];
+                pDestination[pOffsets[(word >> 8) & 0xFF]++] = word;
+            }
+        }
+        else {
+
+            pOffsets = pChannelCounts;
+            if (!PrefixSum(pOffsets, CHANNEL_BUCKETS, size)) continue;
+            for (i = 0; i < size; i++) {
+
+                word = pSource[i];
+                pDestination[pOffsets[TDC_GET_CHANNEL(word)]++] = word;
+            }
+        }
+
+        pSwap = pSource;
+        pSource = pDestination;
+        pDestination = pSwap;
+    }
+
+    // After an odd number of passes, the result is in the scratch buffer
+    if (pSource != pHits) {
+
+        memcpy(pHits, pSource, size * 4);
+    }
+
+    return 1;
+}
+
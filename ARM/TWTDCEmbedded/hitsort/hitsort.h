@@ -0,0 +1,46 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Sorts the hit words of an event (see tdc.h) by channel, then by time, as
+/// the tracking expects them, instead of the FIFO order of the FPGA. The
+/// order of hits with the same channel and time is kept.
+///
+/// Small events use an insertion sort. Larger ones use an LSD radix sort on
+/// the 22-bit (channel, time) key in three passes of 8, 8 and 6 bits,
+/// alternating between the event and a scratch buffer. The bucket counts of
+/// the three passes are computed in a single read of the hits, kept as 16-bit
+/// values in the internal SRAM0 (section .sram0 of the linker file), and a
+/// pass is skipped when all the hits fall in the same bucket (e.g. the
+/// channel pass of a single-channel event). The cost is about 3 reads and 3
+/// writes of each hit, linear in the multiplicity; the "bench sort" shell
+/// command measures it.
+///
+/// !Usage
+///
+/// -# Call HITSORT_Sort() on the hit words of each event, with a scratch
+///    buffer of the same size.
+//------------------------------------------------------------------------------
+
+#ifndef HITSORT_H
+#define HITSORT_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Largest number of hits of an event (the bucket counts are 16-bit).
+#define HITSORT_MAX_HITS        0xFFFF
+
+/// Events up to this size are sorted by insertion.
+#define HITSORT_SMALL           16
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern unsigned char HITSORT_Sort(unsigned int *pHits, unsigned int size, unsigned int *pScratch);
+
+#endif //#ifndef HITSORT_H
+
@@ -0,0 +1,265 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "l2filter.h"
+#include <tdc/tdc.h>
+#include <hitsort/hitsort.h>
+#include <counters/counters.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Set tags of the gathered times, in bits ignored by the hit sort.
+#define TAG_A           (1 << 16)
+#define TAG_B           (1 << 17)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Rules, and number of them.
+static L2FilterRule pRules[L2FILTER_MAX_RULES];
+static unsigned int numRules = 0;
+
+/// Events rejected by each rule.
+static unsigned int pRejected[L2FILTER_MAX_RULES];
+
+/// Filter mode.
+static unsigned char mode = L2FILTER_MODE_OFF;
+
+/// Decision counters.
+static Counter acceptedCounter;
+static Counter rejectedCounter;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the number of hits in a channel set.
+/// \param pCounts  Hits per channel.
+/// \param set  Channel set.
+//------------------------------------------------------------------------------
+static unsigned int CountHits(const unsigned int *pCounts, unsigned long long set)
+{
+    unsigned int count = 0;
+    unsigned int i;
+
+    for (i = 0; i < TDC_NUM_CHANNELS; i++) {
+
+        if ((set >> i) & 1) {
+
+            count += pCounts[i];
+        }
+    }
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+/// Looks for a coincidence between the two sets of a rule.
+/// \param pRule  Coincidence rule.
+/// \param pHits  Hit words.
+/// \param size  Number of hit words.
+/// \param pScratch  Scratch buffer of 2 * size words.
+/// \return 1 if there is a coincidence.
+//------------------------------------------------------------------------------
+static unsigned char FindCoincidence(
+    const L2FilterRule *pRule,
+    const unsigned int *pHits,
+    unsigned int size,
+    unsigned int *pScratch)
+{
+    unsigned int pTags[TDC_NUM_CHANNELS];
+    unsigned int numTimes = 0;
+    unsigned int haveA = 0;
+    unsigned int haveB = 0;
+    unsigned int lastA = 0;
+    unsigned int lastB = 0;
+    unsigned int word;
+    unsigned int time;
+    unsigned int i;
+
+    for (i = 0; i < TDC_NUM_CHANNELS; i++) {
+
+        pTags[i] = (((pRule->setA >> i) & 1) ? TAG_A : 0) | (((pRule->setB >> i) & 1) ? TAG_B : 0);
+    }
+
+    // Times of the hits of both sets, with channel 0 so they sort by time
+    for (i = 0; i < size; i++) {
+
+        word = pTags[TDC_GET_CHANNEL(pHits[i])];
+        if (word != 0) {
+
+            pScratch[numTimes++] = word | TDC_GET_TIME(pHits[i]);
+        }
+    }
+    if (!HITSORT_Sort(pScratch, numTimes, pScratch + numTimes)) {
+
+        return 1;
+    }
+
+    // In time order, the closest earlier hit of the other set is the last
+    // one; a hit on a channel of both sets only pairs with another hit
+    for (i = 0; i < numTimes; i++) {
+
+        word = pScratch[i];
+        time = TDC_GET_TIME(word);
+        if (((word & TAG_A) && haveB && ((time - lastB) <= pRule->window))
+            || ((word & TAG_B) && haveA && ((time - lastA) <= pRule->window))) {
+
+            return 1;
+        }
+        if (word & TAG_A) {
+
+            lastA = time;
+            haveA = 1;
+        }
+        if (word & TAG_B) {
+
+            lastB = time;
+            haveB = 1;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes the filter, off and with no rule.
+//------------------------------------------------------------------------------
+void L2FILTER_Initialize(void)
+{
+    L2FILTER_Clear();
+    mode = L2FILTER_MODE_OFF;
+    COUNTERS_Register(&acceptedCounter, "l2 accepted", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&rejectedCounter, "l2 rejected", COUNTER_TYPE_COUNT);
+}
+
+//------------------------------------------------------------------------------
+/// Removes all the rules.
+//------------------------------------------------------------------------------
+void L2FILTER_Clear(void)
+{
+    numRules = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Adds a rule at the end of the list.
+/// \param pRule  Rule, copied.
+/// \return 1 if the rule is valid and there was room for it.
+//------------------------------------------------------------------------------
+unsigned char L2FILTER_AddRule(const L2FilterRule *pRule)
+{
+    if ((numRules == L2FILTER_MAX_RULES) || (pRule->type > L2FILTER_RULE_COINCIDENCE)
+        || ((pRule->type != L2FILTER_RULE_HITS) && (pRule->setA == 0))
+        || ((pRule->type == L2FILTER_RULE_COINCIDENCE) && (pRule->setB == 0))) {
+
+        return 0;
+    }
+
+    pRules[numRules] = *pRule;
+    pRejected[numRules] = 0;
+    numRules++;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns a rule and the number of events it rejected.
+/// \param index  Rule index.
+/// \param pCount  Number of events rejected by the rule, can be 0.
+/// \return The rule, 0 past the last one.
+//------------------------------------------------------------------------------
+const L2FilterRule * L2FILTER_GetRule(unsigned int index, unsigned int *pCount)
+{
+    if (index >= numRules) {
+
+        return 0;
+    }
+    if (pCount) {
+
+        *pCount = pRejected[index];
+    }
+    return &pRules[index];
+}
+
+//------------------------------------------------------------------------------
+/// Sets the filter mode.
+/// \param newMode  L2FILTER_MODE_OFF, L2FILTER_MODE_MARK or L2FILTER_MODE_DROP.
+//------------------------------------------------------------------------------
+void L2FILTER_SetMode(unsigned char newMode)
+{
+    mode = newMode;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the filter mode.
+//------------------------------------------------------------------------------
+unsigned char L2FILTER_GetMode(void)
+{
+    return mode;
+}
+
+//------------------------------------------------------------------------------
+/// Evaluates the rules on the hits of an event.
+/// \param pHits  Hit words.
+/// \param size  Number of hit words, up to HITSORT_MAX_HITS.
+/// \param pScratch  Scratch buffer of 2 * size words.
+/// \return 1 if the event is accepted.
+//------------------------------------------------------------------------------
+unsigned char L2FILTER_Apply(const unsigned int *pHits, unsigned int size, unsigned int *pScratch)
+{
+    unsigned int pCounts[TDC_NUM_CHANNELS];
+    const L2FilterRule *pRule;
+    unsigned int i;
+
+    memset(pCounts, 0, sizeof(pCounts));
+    for (i = 0; i < size; i++) {
+
+        pCounts[TDC_GET_CHANNEL(pHits[i])]++;
+    }
+
+    // Counting rules first, then the coincidences of the events they pass
+    for (i = 0; i < numRules; i++) {
+
+        pRule = &pRules[i];
+        if (((pRule->type == L2FILTER_RULE_HITS) && (size < pRule->count))
+            || ((pRule->type == L2FILTER_RULE_REQUIRE)
+                && (CountHits(pCounts, pRule->setA) < pRule->count))
+            || ((pRule->type == L2FILTER_RULE_COINCIDENCE)
+                && ((CountHits(pCounts, pRule->setA) == 0)
+                    || (CountHits(pCounts, pRule->setB) == 0)))) {
+
+            break;
+        }
+    }
+    if (i == numRules) {
+
+        for (i = 0; i < numRules; i++) {
+
+            pRule = &pRules[i];
+            if ((pRule->type == L2FILTER_RULE_COINCIDENCE)
+                && !FindCoincidence(pRule, pHits, size, pScratch)) {
+
+                break;
+            }
+        }
+    }
+
+    if (i == numRules) {
+
+        COUNTER_Increment(&acceptedCounter);
+        return 1;
+    }
+    pRejected[i]++;
+    COUNTER_Increment(&rejectedCounter);
+    return 0;
+}
+
@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Software level-2 trigger: a list of rules evaluated on the decoded hit
+/// words of each event (see tdc.h). An event is accepted when it passes all
+/// the rules, or when there is no rule. Rules:
+///   - L2FILTER_RULE_HITS: at least count hits in the event;
+///   - L2FILTER_RULE_REQUIRE: at least count hits in the channel set A;
+///   - L2FILTER_RULE_COINCIDENCE: a hit in set A and another hit in set B at
+///     most window TDC counts apart (the sets may share channels).
+///
+/// One read of the hits counts them per channel, which settles the first two
+/// kinds of rules. The coincidence rules, evaluated last and only if the
+/// others pass, gather the times of the hits of both sets, sort them with
+/// the hit sort (see hitsort.h) and scan them once. Rejected events are
+/// counted per rule (the first failing one) and in the "l2 accepted" and
+/// "l2 rejected" counters.
+///
+/// The filter only decides: in L2FILTER_MODE_MARK, the rejected events are
+/// flagged and still sent, in L2FILTER_MODE_DROP they are not sent at all;
+/// this is up to the caller.
+///
+/// !Usage
+///
+/// -# Call L2FILTER_Initialize() at startup, then set the rules with
+///    L2FILTER_Clear() and L2FILTER_AddRule(), and the mode with
+///    L2FILTER_SetMode().
+/// -# Unless the mode is L2FILTER_MODE_OFF, call L2FILTER_Apply() on the hit
+///    words of each event.
+//------------------------------------------------------------------------------
+
+#ifndef L2FILTER_H
+#define L2FILTER_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Maximum number of rules.
+#define L2FILTER_MAX_RULES      8
+
+/// Rule types.
+#define L2FILTER_RULE_HITS          0
+#define L2FILTER_RULE_REQUIRE       1
+#define L2FILTER_RULE_COINCIDENCE   2
+
+/// Filter modes.
+#define L2FILTER_MODE_OFF       0
+#define L2FILTER_MODE_MARK      1
+#define L2FILTER_MODE_DROP      2
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// A filter rule.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Rule type (L2FILTER_RULE_xxx).
+    unsigned int type;
+    /// Minimum number of hits (L2FILTER_RULE_HITS and L2FILTER_RULE_REQUIRE).
+    unsigned int count;
+    /// Largest time difference in TDC counts (L2FILTER_RULE_COINCIDENCE).
+    unsigned int window;
+    /// Channel sets, bit n for channel n.
+    unsigned long long setA;
+    unsigned long long setB;
+
+} L2FilterRule;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void L2FILTER_Initialize(void);
+
+extern void L2FILTER_Clear(void);
+
+extern unsigned char L2FILTER_AddRule(const L2FilterRule *pRule);
+
+extern const L2FilterRule * L2FILTER_GetRule(unsigned int index, unsigned int *pCount);
+
+extern void L2FILTER_SetMode(unsigned char mode);
+
+extern unsigned char L2FILTER_GetMode(void);
+
+extern unsigned char L2FILTER_Apply(
+    const unsigned int *pHits,
+    unsigned int size,
+    unsigned int *pScratch);
+
+#endif //#ifndef L2FILTER_H
+
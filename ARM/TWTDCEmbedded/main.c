@@ -1,3 +1,6 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   MAIN
+
 //------------------------------------------------------------------------------
 //         Headers
 //------------------------------------------------------------------------------
@@ -9,19 +12,141 @@
 #include <pit/pit.h>
 #include <aic/aic.h>
 #include <tc/tc.h>
+#include <dbgu/dbgu.h>
+#include <emac/emac.h>
 #include <utility/led.h>
 #include <utility/trace.h>
+#include <utility/tracelog.h>
+#include <utility/crc32.h>
+#include <clock/clock.h>
+#include <timer/timer.h>
+#include <sched/sched.h>
+#include <spill/spill.h>
+#include <evbuf/evbuf.h>
+#include <shell/shell.h>
+#include <counters/counters.h>
+#include <serlink/serlink.h>
+#include <usbstream/usbstream.h>
+#include <sdcard/sdcard.h>
+#include <sdlog/sdlog.h>
+#include <evrec/evrec.h>
+#include <memtest/memtest.h>
+#include <hist/hist.h>
+#include <calib/calib.h>
+#include <evbuild/evbuild.h>
+#include <hitsort/hitsort.h>
+#include <l2filter/l2filter.h>
+#include <codec/codec.h>
+#include <net/net.h>
+#include <udplink/udplink.h>
+#include <slowctl/slowctl.h>
 #include <stdio.h>
+#include <string.h>
 
 //------------------------------------------------------------------------------
 //         Local definitions
 //------------------------------------------------------------------------------
+/// Clock profile selected at boot (CLOCK_PROFILE_xxx).
+#define BOOT_CLOCK_PROFILE  CLOCK_PROFILE_DEFAULT
+
+/// DBGU baudrate.
+#define DBGU_BAUDRATE       115200
+
 /// Delay for pushbutton debouncing (in milliseconds).
 #define DEBOUNCE_TIME       500
 
 /// PIT period value in seconds.
 #define PIT_PERIOD          1000
 
+/// Default period of the DPRAM readout during a spill (in milliseconds),
+/// can be changed from the shell.
+#define READOUT_PERIOD      100
+
+/// Follow the beam spill gate (1) or take data continuously (0).
+#define SPILL_GATE          1
+
+/// Default maximum number of blocks handled by one run of the processing or
+/// transmit task, so that a BOS is never delayed by more than one batch. Can
+/// be changed from the shell.
+#define DRAIN_BATCH         8
+
+/// Data links: the processed blocks are only reported on the DBGU, or sent
+/// on the USART data link, or streamed on USB, or logged to the SD card, or
+/// streamed in UDP datagrams on the Ethernet port.
+#define DATA_LINK_DBGU      0
+#define DATA_LINK_USART     1
+#define DATA_LINK_USB       2
+#define DATA_LINK_SD        3
+#define DATA_LINK_UDP       4
+
+/// Data link used at boot (DATA_LINK_xxx), can be changed from the shell.
+#define DATA_LINK           DATA_LINK_DBGU
+
+/// IP address, subnet mask and gateway of the board, and address of the DAQ
+/// PC receiving the UDP data link, until changed from the shell.
+#define NET_IP_ADDRESS      NET_ADDRESS(192, 168, 0, 100 + BOARD_ID)
+#define NET_IP_MASK         NET_ADDRESS(255, 255, 255, 0)
+#define NET_IP_GATEWAY      0
+#define NET_DAQ_ADDRESS     NET_ADDRESS(192, 168, 0, 1)
+
+/// Maximum number of received Ethernet frames handled by one run of the
+/// network task.
+#define NET_POLL_BATCH      8
+
+/// Event buffer occupancy (in percent) above which the blocks sent on the UDP
+/// data link are released without waiting for their acknowledgement, so that
+/// a slow or lost receiver never stalls the readout.
+#define UDP_HOLD_LIMIT      75
+
+/// Period of the housekeeping task (in milliseconds).
+#define HOUSEKEEPING_PERIOD 1000
+
+/// Number of housekeeping periods between two scheduler statistics printouts.
+#define STATS_PERIOD        10
+
+/// Number of housekeeping periods between two closings of the monitoring
+/// histograms without spill gate, where no end of spill closes them.
+#define HIST_PERIOD         10
+
+/// Board ID written in the event records, until changed from the shell.
+#define BOARD_ID            0
+
+/// Base address of the DPRAM (CS4).
+#define DPRAM_BASE          0x50000000
+
+/// Number of 32-bit words in the DPRAM (32Kx32 bits).
+#define DPRAM_NWORDS        (32*1024)
+
+/// Base address of the readout buffer in SDRAM, away from u-boot.
+#define SDRAM_BUFFER        0x21000000
+
+/// Size of the readout buffer in 32-bit words (16MB).
+#define SDRAM_BUFFER_NWORDS (4*1024*1024)
+
+/// Memory tests run at startup, and size of the SDRAM tested (the start of
+/// the readout buffer; the shell "memtest" command tests all of it).
+#define BOOT_MEMTEST        MEMTEST_ALL
+#define BOOT_MEMTEST_NWORDS (1024*1024)
+
+/// Binary trace log area in SDRAM, right after the readout buffer.
+#define TRACELOG_BUFFER     0x22000000
+
+/// Size of the binary trace log area in bytes (1MB).
+#define TRACELOG_SIZE       (1024*1024)
+
+/// Maximum number of trace log records printed by one housekeeping run.
+#define TRACELOG_BATCH      32
+
+/// DPRAM access timings (in nanoseconds), converted to MCK cycles by
+/// ConfigureDPRam().
+#define DPRAM_NRD_PULSE     20
+#define DPRAM_NCS_RD_PULSE  30
+#define DPRAM_NRD_CYCLE     50
+#define DPRAM_NWE_PULSE     20
+#define DPRAM_NCS_WR_PULSE  20
+#define DPRAM_NWE_CYCLE     20
+#define DPRAM_TDF           10
+
 //------------------------------------------------------------------------------
 //         Local variables
 //------------------------------------------------------------------------------
@@ -37,37 +162,194 @@ unsigned char pLedStates[2] = {1, 1};
 /// Global timestamp in milliseconds since start of application.
 volatile unsigned int timestamp = 0;
 
+/// Period of the DPRAM readout (in milliseconds).
+static volatile unsigned int readoutPeriod = READOUT_PERIOD;
+
+/// Maximum number of blocks handled by one run of the processing or transmit
+/// task.
+static unsigned int drainBatch = DRAIN_BATCH;
+
+/// Data link of the processed blocks (DATA_LINK_xxx).
+static unsigned char dataLink = DATA_LINK;
+
+/// Board ID and run number written in the event records.
+static unsigned int boardId = BOARD_ID;
+static unsigned int runNumber = 0;
+
+/// Number of the next event in the run.
+static unsigned int eventNumber = 0;
+
+/// Sort the hits of each event by channel and time.
+static unsigned char sortHits = 1;
+
+/// Codec of the event payloads (CODEC_xxx), applied from the next run.
+static unsigned char payloadCodec = CODEC_NONE;
+
+/// Scratch buffer of the hit sort and of the level-2 filter.
+static unsigned int pScratch[2 * DPRAM_NWORDS];
+
+/// Names of the data links.
+static const char * const pLinkNames[] = {"DBGU", "USART", "USB", "SD", "UDP"};
+
+/// MAC address, locally administered, ending with the board ID at boot.
+static unsigned char pMacAddress[6] = {0x02, 0x00, 0xE9, 0x06, 0x00, BOARD_ID};
+
+/// EMAC as the driver of the IP stack.
+static const NetDriver emacDriver = {EMAC_AllocateTx, EMAC_Transmit, EMAC_Receive};
+
+/// Stream offset of the UDP data link at the start of the oldest block
+/// waiting for its acknowledgement.
+static unsigned int heldOffset = 0;
+
+/// Last block copied by FetchHeld(), with its size, its stream offset and its
+/// rank from the oldest held block; fetchBlock is 0 when unknown.
+static unsigned long *fetchBlock = 0;
+static unsigned int fetchSize;
+static unsigned int fetchOffset;
+static unsigned int fetchIndex;
+
+/// Ethernet link state (EMAC_LINK_xxx), and its names.
+static unsigned char linkState = EMAC_LINK_DOWN;
+static const char * const pEmacLinkNames[] = {"down", "10 Mbit/s half duplex",
+    "10 Mbit/s full duplex", "100 Mbit/s half duplex", "100 Mbit/s full duplex"};
+
+/// SD card as block device of the event log.
+static SdLogDevice sdDevice = {0, SDCARD_Write, SDCARD_Read, SDCARD_IsBusy, SDCARD_GetErrors};
+
+/// Names of the event log states.
+static const char * const pSdLogStates[] = {"not mounted", "closed", "open", "full", "failed"};
+
+/// Drains the DPRAM into the event buffer.
+static SchedTask readoutTask;
+
+/// Processes the buffered events between spills.
+static SchedTask processingTask;
+
+/// Starts the processing at the end of each spill.
+static SchedTask endOfSpillTask;
+
+/// Sends the processed events and the spill summary between spills.
+static SchedTask transmitTask;
+
+/// LED, statistics and other slow periodic jobs.
+static SchedTask housekeepingTask;
+
+/// Handles the received Ethernet frames.
+static SchedTask netTask;
+
+/// Drivers reconfigured when the clock profile changes.
+static ClockListener dbguListener;
+static ClockListener timerListener;
+static ClockListener pitListener;
+static ClockListener tcListener;
+static ClockListener dpramListener;
+static ClockListener serlinkListener;
+static ClockListener sdcardListener;
+
+/// Application shell commands.
+static ShellCommandTable shellCommands;
+
+/// Registers and memories open to the slow-control protocol: the bus and
+/// SDRAM controllers, as for the "reg" command, and the DPRAM shared with the
+/// FPGA.
+static const SlowCtlRegion pSlowCtlRegions[] = {
+
+    {(unsigned int) AT91C_BASE_SMC, sizeof(AT91S_SMC), (volatile unsigned int *) AT91C_BASE_SMC, 1},
+    {(unsigned int) AT91C_BASE_SDRAMC, sizeof(AT91S_SDRAMC), (volatile unsigned int *) AT91C_BASE_SDRAMC, 1},
+    {DPRAM_BASE, DPRAM_NWORDS * 4, (volatile unsigned int *) DPRAM_BASE, 1}
+};
+
+/// Slow-control frames received on the DBGU, among the shell input.
+static SlowCtlPort slowCtlPort;
+
+/// Performance counters.
+static Counter pitIrqCounter;
+static Counter readoutWordsCounter;
+static Counter readoutBlocksCounter;
+static Counter overflowCounter;
+static Counter crcErrorCounter;
+static Counter transmitBytesCounter;
+static Counter codecInCounter;
+static Counter codecOutCounter;
+static Counter unackedCounter;
+static Counter sdDroppedCounter;
+
+/// Buffer for the binary counter export.
+static unsigned int pCounterExport[COUNTERS_EXPORT_WORDS];
+
+/// Buffer for the binary histogram export.
+static unsigned int pHistExport[HIST_EXPORT_WORDS];
+
+/// Set by the housekeeping task when the monitoring histograms are to be
+/// closed without spill gate.
+static unsigned char histDue = 0;
+
 
 //------------------------------------------------------------------------------
-/// Handler for PIT interrupt. Increments the timestamp counter.
+/// Handler for PIT interrupt. Increments the timestamp counter and posts the
+/// periodic tasks when they are due.
 //------------------------------------------------------------------------------
 void ISR_Pit(void)
 {
+    static unsigned int lastReadout = 0;
+    static unsigned int lastHousekeeping = 0;
     unsigned int status;
 
     // Read the PIT status register
     status = PIT_GetStatus() & AT91C_PITC_PITS;
     if(status != 0) // 1 indicates the Periodic Interval timer reached PIV since the last read of PIT_PIVR
     {
+        COUNTER_Increment(&pitIrqCounter);
+
+        // Ethernet at high rates: poll every tick rather than take an
+        // interrupt per frame
+        if(EMAC_Moderate()) SCHED_Post(&netTask);
+
         // Read the PIVR to acknowledge interrupt and get number of ticks
         // Returns the number of occurrences of periodic intervals since the last read of PIT_PIVR
         // Right shift by 20 bits to get milliseconds
         timestamp += (PIT_GetPIVR() >> 20);
+
+        // Readout cycle, only while the run is enabled (LED #1 active) and
+        // the beam is on (or continuously without spill gate)
+        if((timestamp - lastReadout) >= readoutPeriod)
+        {
+            lastReadout = timestamp;
+            if(pLedStates[0] && (SPILL_IsActive() || !SPILL_IsGated())) SCHED_Post(&readoutTask);
+        }
+
+        if((timestamp - lastHousekeeping) >= HOUSEKEEPING_PERIOD)
+        {
+            lastHousekeeping = timestamp;
+            SCHED_Post(&housekeepingTask);
+        }
     }
 }
 
+//------------------------------------------------------------------------------
+/// Handler for the system interrupt, shared by the PIT and the DBGU.
+//------------------------------------------------------------------------------
+void ISR_System(void)
+{
+    ISR_Pit();
+    DBGU_InterruptHandler();
+}
+
 //------------------------------------------------------------------------------
 /// Configure the periodic interval timer to generate an interrupt every
 /// millisecond.
+/// \param mck  Master clock frequency.
 //------------------------------------------------------------------------------
-void ConfigurePit(void)
+void ConfigurePit(unsigned int mck)
 {
-    // Initialize the PIT to the desired frequency
-    PIT_Init(PIT_PERIOD, BOARD_MCK / 1000000);
+    // Initialize the PIT to the desired frequency, PIT_Init() only takes
+    // whole MHz so the exact period is set afterwards
+    PIT_Init(PIT_PERIOD, mck / 1000000);
+    PIT_SetPIV((mck / 16) / (1000000 / PIT_PERIOD) - 1);
 
     // Configure interrupt on PIT
     AIC_DisableIT(AT91C_ID_SYS);
-    AIC_ConfigureIT(AT91C_ID_SYS, AT91C_AIC_PRIOR_LOWEST, ISR_Pit);
+    AIC_ConfigureIT(AT91C_ID_SYS, AT91C_AIC_PRIOR_LOWEST, ISR_System);
     AIC_EnableIT(AT91C_ID_SYS);
     PIT_EnableIT();
 
@@ -173,8 +455,9 @@ void ISR_Tc0(void)
 
 //------------------------------------------------------------------------------
 /// Configure Timer Counter 0 to generate an interrupt every 250ms.
+/// \param mck  Master clock frequency.
 //------------------------------------------------------------------------------
-void ConfigureTc(void)
+void ConfigureTc(unsigned int mck)
 {
     unsigned int div;
     unsigned int tcclks;
@@ -183,9 +466,9 @@ void ConfigureTc(void)
     AT91C_BASE_PMC->PMC_PCER = 1 << AT91C_ID_TC0;
 
     // Configure TC for a 4Hz frequency and trigger on RC compare
-    TC_FindMckDivisor(4, BOARD_MCK, &div, &tcclks);
+    TC_FindMckDivisor(4, mck, &div, &tcclks);
     TC_Configure(AT91C_BASE_TC0, tcclks | AT91C_TC_CPCTRG);
-    AT91C_BASE_TC0->TC_RC = (BOARD_MCK / div) / 4; // timerFreq / desiredFreq
+    AT91C_BASE_TC0->TC_RC = (mck / div) / 4; // timerFreq / desiredFreq
 
     // Configure and enable interrupt on RC compare
     AIC_ConfigureIT(AT91C_ID_TC0, AT91C_AIC_PRIOR_LOWEST, ISR_Tc0);
@@ -196,6 +479,50 @@ void ConfigureTc(void)
     if(pLedStates[1]) TC_Start(AT91C_BASE_TC0);
 }
 
+//------------------------------------------------------------------------------
+/// Configures the DBGU for traces.
+/// \param mck  Master clock frequency.
+//------------------------------------------------------------------------------
+void ConfigureDbgu(unsigned int mck)
+{
+    TRACE_CONFIGURE(DBGU_STANDARD, DBGU_BAUDRATE, mck);
+}
+
+//------------------------------------------------------------------------------
+/// Handler for the EMAC interrupt: received frames go to the network task,
+/// and sent ones free transmit buffers for the UDP data link. At high rates
+/// these interrupts are masked and ISR_Pit() polls instead (see
+/// EMAC_Moderate()).
+//------------------------------------------------------------------------------
+void ISR_Emac(void)
+{
+    unsigned int status = EMAC_GetStatus();
+
+    if(status & (AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR | AT91C_EMAC_ROVR)) SCHED_Post(&netTask);
+    if((status & AT91C_EMAC_TCOMP) && (dataLink == DATA_LINK_UDP)) SCHED_Post(&transmitTask);
+}
+
+//------------------------------------------------------------------------------
+/// Configures the EMAC, its interrupt and the IP stack, and looks for the
+/// PHY.
+//------------------------------------------------------------------------------
+void ConfigureEmac(void)
+{
+    static const Pin pEmacPins[] = {BOARD_EMAC_RUN_PINS};
+
+    PIO_Configure(pEmacPins, PIO_LISTSIZE(pEmacPins));
+    AT91C_BASE_PMC->PMC_PCER = 1 << AT91C_ID_EMAC;
+    EMAC_Initialize(pMacAddress, BOARD_EMAC_MODE_RMII);
+    if(!EMAC_FindPhy()) printf("-- EMAC: no PHY found\n\r");
+
+    NET_Initialize(&emacDriver, pMacAddress, NET_IP_ADDRESS, NET_IP_MASK, NET_IP_GATEWAY);
+    UDPLINK_Configure(NET_DAQ_ADDRESS, UDPLINK_PORT);
+
+    AIC_ConfigureIT(AT91C_ID_EMAC, AT91C_AIC_PRIOR_LOWEST, ISR_Emac);
+    AIC_EnableIT(AT91C_ID_EMAC);
+    AT91C_BASE_EMAC->EMAC_IER = EMAC_INTERRUPTS;
+}
+
 //------------------------------------------------------------------------------
 /// Waits for the given number of milliseconds (using the timestamp generated
 /// by the PIT).
@@ -222,7 +549,21 @@ void Wait(unsigned long delay)
 const Pin pinCE4 = {1 << 8, AT91C_BASE_PIOC, AT91C_ID_PIOC, PIO_PERIPH_A, PIO_DEFAULT};
 const Pin pinCE5 = {1 << 9, AT91C_BASE_PIOC, AT91C_ID_PIOC, PIO_PERIPH_A, PIO_DEFAULT};
 
-void ConfigureDPRam()
+//------------------------------------------------------------------------------
+/// Converts a duration to a number of MCK cycles, rounded up.
+/// \param ns  Duration in nanoseconds.
+/// \param mck  Master clock frequency.
+//------------------------------------------------------------------------------
+static unsigned int NsToCycles(unsigned int ns, unsigned int mck)
+{
+    return (ns * (mck / 1000) + 999999) / 1000000;
+}
+
+//------------------------------------------------------------------------------
+/// Configures the SMC for the DPRAM on CS4, with the DPRAM_xxx timings.
+/// \param mck  Master clock frequency.
+//------------------------------------------------------------------------------
+void ConfigureDPRam(unsigned int mck)
 {
     // Configure PIO pins for DP control
     PIO_Configure(&pinCE4, 1);
@@ -235,108 +576,1595 @@ void ConfigureDPRam()
     AT91C_BASE_CCFG->CCFG_EBICSA |= (AT91C_EBI_SUPPLY);
     
     // Configure SMC for CS4
+    // At 99.3MHz: NCS_RD=0x03, NRD=0x02, NCS_WR=Ox02, NWE=0x02, NRDCYCLE=005, NWECYCLE=002, TDF=1
     AT91C_BASE_SMC->SMC_SETUP4 = 0x00000000;  
-    AT91C_BASE_SMC->SMC_PULSE4 = 0x03020202;  // NCS_RD=0x03, NRD=0x02, NCS_WR=Ox02, NWE=0x02
-    AT91C_BASE_SMC->SMC_CYCLE4 = 0x00050002;  // NRDCYCLE=005, NWECYCLE=002
+    AT91C_BASE_SMC->SMC_PULSE4 = (NsToCycles(DPRAM_NCS_RD_PULSE, mck) << 24) |
+                                 (NsToCycles(DPRAM_NRD_PULSE, mck) << 16)    |
+                                 (NsToCycles(DPRAM_NCS_WR_PULSE, mck) << 8)  |
+                                 NsToCycles(DPRAM_NWE_PULSE, mck);
+    AT91C_BASE_SMC->SMC_CYCLE4 = (NsToCycles(DPRAM_NRD_CYCLE, mck) << 16) |
+                                 NsToCycles(DPRAM_NWE_CYCLE, mck);
     AT91C_BASE_SMC->SMC_CTRL4  = (AT91C_SMC_READMODE   |              
                                   AT91C_SMC_WRITEMODE  |
                                   AT91C_SMC_NWAITM_NWAIT_DISABLE |
-                                  ((0x1 << 16) & AT91C_SMC_TDF)  |
+                                  ((NsToCycles(DPRAM_TDF, mck) << 16) & AT91C_SMC_TDF)  |
                                   AT91C_SMC_DBW_WIDTH_THIRTY_TWO_BITS);
 }
 
 
 
 //------------------------------------------------------------------------------
-/// Application entry point. 
+/// Identifies the SD card and mounts its event log.
+/// \return 1 if the log is mounted.
+//------------------------------------------------------------------------------
+static unsigned char MountSdLog(void)
+{
+    if(!SDCARD_Identify())
+    {
+        printf("-- No SD card --\n\r");
+        return 0;
+    }
+    sdDevice.numBlocks = SDCARD_GetNumBlocks();
+    if(!SDLOG_Mount(&sdDevice))
+    {
+        printf("-- SD card: %u blocks, no event log (sdlog format) --\n\r", sdDevice.numBlocks);
+        return 0;
+    }
+    printf("-- SD card: %u blocks, event log with %u sessions --\n\r",
+           sdDevice.numBlocks, SDLOG_GetSuper()->numSessions);
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+//         Tasks
 //------------------------------------------------------------------------------
 
 typedef unsigned short* sPTR;
 typedef unsigned long*  lPTR;    // int and long on ARM are both 32-bit, learnt sth new
 
-int main(void)
+//------------------------------------------------------------------------------
+/// Copies the beginning of the DPRAM to memory.
+/// \param tAddr  Destination address.
+/// \param nWords  Number of 32-bit words to copy.
+//------------------------------------------------------------------------------
+static void CopyDPRam(lPTR tAddr, unsigned int nWords)
 {
-    // DBGU output configuration
-    TRACE_CONFIGURE(DBGU_STANDARD, 115200, BOARD_MCK);
-    printf("-- SeaQuest VME TDC Embedded Project %s --\n\r", SOFTPACK_VERSION);
-    printf("-- %s\n\r", BOARD_NAME);
-    printf("-- Compiled: %s %s --\n\r", __DATE__, __TIME__);
-
-    // Configuration
-    ConfigurePit();
-    ConfigureTc();
-    ConfigureButtons();
-    ConfigureLeds();
-    BOARD_ConfigureSdram(32);
-    ConfigureDPRam();
-    
-    // Base addresses of DPRAM and SDRAM
-    lPTR dpAddr = (lPTR)0x50000000;
-    lPTR sdAddr = (lPTR)0x21000000;   //just to be safe so that we don't overwrite u-boot
-    
-    // Initialize DP to a bunch or dummy values
-    printf("Initialize DP to a bunch or dummy values\n\r");
+    lPTR fAddr = (lPTR)DPRAM_BASE;
     unsigned int i;
-    unsigned int nWords = 32*1024;   // DP is 32Kx32 bits
-    lPTR i_dpaddr = dpAddr;
+
     for(i = nWords; i != 0; i--) 
     {
-    	// write with some dummy data
-    	unsigned int data = 0xDEAD0000 + nWords - i;
-        *i_dpaddr = data;
+        *tAddr = *fAddr;
+        ++fAddr; ++tAddr;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Readout task: copies the DP, or the event fragments of its segments, into
+/// a new event record in the event buffer, computing the record CRC on the
+/// fly. Nothing else is done during the spill; the processing of the buffered
+/// records is started at the EOS (see EndOfSpillTask()), or after each readout
+/// in continuous mode.
+//------------------------------------------------------------------------------
+static void ReadoutTask(void *pArg)
+{
+    unsigned long long time = TIMER_GetMicroseconds();
+    EvRecInfo info;
+    EvBuildEvent event;
+    unsigned int size = DPRAM_NWORDS;
+    lPTR tAddr;
+
+    // Toggle LED state if active
+    if(pLedStates[0]) LED_Toggle(0);
+
+    // With DPRAM segments, only the fragments of the event are read
+    if(EVBUILD_GetNumSegments() != 0) size = EVBUILD_Scan(&event);
 
-        // readout the data and check consistency
-        unsigned int readout = *i_dpaddr;
-        if(i % 1000 == 0)
+    tAddr = (lPTR)EVBUF_Reserve(EVREC_HEADER_WORDS + size);
+    if(tAddr == 0)
+    {
+        // Buffer full: drop the event, the DP will be read again next time
+        SPILL_CountOverflow();
+        COUNTER_Increment(&overflowCounter);
+        TRACE_LOG_WARNING("Readout: buffer full, %u words used\n\r", EVBUF_GetUsed());
+    }
+    else
+    {
+        info.boardId = boardId;
+        info.run = runNumber;
+        info.spill = SPILL_GetNumber();
+        info.event = eventNumber++;
+        info.flags = EVREC_FLAGS_RAW;
+        info.timestamp = time;
+        info.size = size;
+        if(EVBUILD_GetNumSegments() == 0)
         {
-            printf(" -- %d DPRam address %08X: input = %08X, readout = %08X \n\r", nWords - i, i_dpaddr, data, readout);
+            EVREC_Encode((unsigned int *)tAddr, &info);
+            EVREC_SealCopy((unsigned int *)tAddr, (unsigned int *)DPRAM_BASE);
         }
-        
-        //increment addr pointers by 4 bytes
-        ++i_dpaddr;
+        else
+        {
+            info.flags |= EVREC_FLAGS_BUILT | (event.numSegments << EVREC_FLAGS_SEGMENTS_SHIFT);
+            if(event.status != 0) info.flags |= EVREC_FLAGS_MISMATCH;
+            EVREC_Encode((unsigned int *)tAddr, &info);
+            EVREC_SetCrc((unsigned int *)tAddr,
+                         EVBUILD_Gather(&event, EVREC_GetPayload((unsigned int *)tAddr),
+                                        EVREC_GetHeaderCrc((unsigned int *)tAddr)));
+        }
+        EVBUF_Commit(EVREC_HEADER_WORDS + size);
+        SPILL_CountEvent(size);
+        COUNTER_Add64(&readoutWordsCounter, size);
+        COUNTER_Increment(&readoutBlocksCounter);
+        TRACE_LOG_DEBUG("Readout: spill %u, %u words\n\r", SPILL_GetNumber(), size);
     }
-    
-    // Main loop
-    while(1) 
+
+    if(!SPILL_IsActive()) SCHED_Post(&processingTask);
+}
+
+//------------------------------------------------------------------------------
+/// End-of-spill task, posted at each EOS: starts the processing of the records
+/// buffered during the spill. The spill is not read out again, its last event
+/// is already in the buffer; nothing is done while the run is stopped, unless
+/// records are still waiting.
+//------------------------------------------------------------------------------
+static void EndOfSpillTask(void *pArg)
+{
+    if(pLedStates[0] || (EVBUF_GetPending(EVBUF_STAGE_PROCESS) != 0)) SCHED_Post(&processingTask);
+}
+
+//------------------------------------------------------------------------------
+/// Processing task: checks the CRC of up to drainBatch buffered records. The
+/// hit times of the valid ones are calibrated and filled in the monitoring
+/// histograms, then the hits are sorted, run through the level-2 filter and
+/// compressed with the codec of the run, and the records are sealed again.
+/// Re-posts itself until the buffer is processed, and closes the histograms
+/// of the spill then. Stops as soon as a new spill begins; the EOS resumes it.
+//------------------------------------------------------------------------------
+static void ProcessingTask(void *pArg)
+{
+    static unsigned int codecRun = 0xFFFFFFFF;
+    static unsigned char runCodec = CODEC_NONE;
+    static unsigned int histSpill = 0;
+    unsigned int *pRecord;
+    unsigned int size;
+    unsigned int length;
+    unsigned int id;
+    unsigned int skip;
+    unsigned int words;
+    EvRecInfo info;
+    unsigned int n;
+
+    for(n = drainBatch; n != 0; n--) 
     {
-        // Wait for LED to be active
-        while(!pLedStates[0]);
-        
-        // Toggle LED state if active
-        if(pLedStates[0]) LED_Toggle(0);
+        if(SPILL_IsActive()) return;
 
-        // Read from DP, increment by 1 and write to SDRAM
-        printf("Reading from DP and writing to SDRAM \n\r");
-        lPTR fAddr = dpAddr;
-        lPTR tAddr = sdAddr;
-        for(i = nWords; i != 0; i--) 
+        pRecord = EVBUF_Peek(EVBUF_STAGE_PROCESS, &size);
+        if(pRecord == 0) break;
+
+        // Corrupted records are passed on as they are, for the CRC to show
+        if(EVREC_Decode(pRecord, size, &info, &length) != EVREC_OK)
+        {
+            COUNTER_Increment(&crcErrorCounter);
+            TRACE_LOG_ERROR("Processing: corrupted record at %08X\n\r", pRecord);
+        }
+        else if(!(info.flags & EVREC_FLAGS_CALIBRATED))
         {
-            *tAddr = *fAddr + 1;
+            // Hit words, after the fragment headers of built events
+            skip = (info.flags & EVREC_FLAGS_BUILT) ? EVREC_GET_SEGMENTS(info.flags) : 0;
+            id = CALIB_Apply(info.run, EVREC_GetPayload(pRecord) + skip, info.size - skip);
+            HIST_Fill(info.spill, EVREC_GetPayload(pRecord) + skip, info.size - skip);
+            info.flags |= EVREC_FLAGS_CALIBRATED | (id << EVREC_FLAGS_CALIB_SHIFT);
+            if(sortHits && HITSORT_Sort(EVREC_GetPayload(pRecord) + skip, info.size - skip, pScratch))
+            {
+                info.flags |= EVREC_FLAGS_SORTED;
+            }
+            // Whether a rejected event is sent is decided here once, so that a
+            // change of mode leaves the records already processed as they are
+            if((L2FILTER_GetMode() != L2FILTER_MODE_OFF)
+               && !L2FILTER_Apply(EVREC_GetPayload(pRecord) + skip, info.size - skip, pScratch))
+            {
+                info.flags |= EVREC_FLAGS_REJECTED;
+                if(L2FILTER_GetMode() == L2FILTER_MODE_DROP) info.flags |= EVREC_FLAGS_DROPPED;
+            }
 
-            if(i % 1000 == 0)
+            // The codec only changes with the run, so that a run is coded uniformly
+            if(info.run != codecRun)
+            {
+                codecRun = info.run;
+                runCodec = payloadCodec;
+            }
+            if((runCodec != CODEC_NONE) && !(info.flags & EVREC_FLAGS_DROPPED))
             {
-            	printf(" -- %d DP: %08X = %08X, SD: %08X = %08X \n\r", nWords - i, fAddr, *fAddr, tAddr, *tAddr);
+                COUNTER_Add64(&codecInCounter, info.size * 4);
+                words = CODEC_Encode(runCodec, EVREC_GetPayload(pRecord), info.size, pScratch, info.size);
+                if(words != 0)
+                {
+                    memcpy(EVREC_GetPayload(pRecord), pScratch, words * 4);
+                    info.size = words;
+                    info.flags |= runCodec << EVREC_FLAGS_CODEC_SHIFT;
+                }
+                COUNTER_Add64(&codecOutCounter, info.size * 4);
             }
-            ++fAddr; ++tAddr;
+            EVREC_Encode(pRecord, &info);
+            EVREC_Seal(pRecord);
         }
-        
-        // Read from SDRAM, increment by 1 and write back to DP
-        printf("Reading from SDRAM and writing to DP\n\r");
-        fAddr = sdAddr;
-        tAddr = dpAddr;
-        for(i = nWords; i != 0; i--) 
+        EVBUF_Advance(EVBUF_STAGE_PROCESS);
+    }
+
+    // Every event of the last spill is in: its histograms are complete.
+    // Without spill gate, they are closed when the housekeeping task says so
+    if(histDue || ((EVBUF_GetPending(EVBUF_STAGE_PROCESS) == 0) && SPILL_IsGated()
+                   && !SPILL_IsActive() && (SPILL_GetNumber() != histSpill)))
+    {
+        histDue = 0;
+        histSpill = SPILL_GetNumber();
+        HIST_EndSpill(histSpill);
+    }
+
+    if(EVBUF_GetPending(EVBUF_STAGE_PROCESS) != 0) SCHED_Post(&processingTask);
+    SCHED_Post(&transmitTask);
+}
+
+//------------------------------------------------------------------------------
+/// Called at the end of each USART frame, USB transfer or SD card write, and
+/// when the USB host configures the device, in interrupt context.
+//------------------------------------------------------------------------------
+static void OnLinkDone(void)
+{
+    SCHED_Post(&transmitTask);
+}
+
+//------------------------------------------------------------------------------
+/// Starts sending a block on a data link.
+/// \param link  DATA_LINK_USART, DATA_LINK_USB or DATA_LINK_SD.
+/// \param addr  Block payload.
+/// \param size  Payload size in words.
+/// \return 1 if the transfer is started.
+//------------------------------------------------------------------------------
+static unsigned char LinkSend(unsigned char link, lPTR addr, unsigned int size)
+{
+    if(link == DATA_LINK_USART) return SERLINK_Send((unsigned int *)addr, size);
+    if(link == DATA_LINK_SD) return SDLOG_Append((unsigned int *)addr, size);
+    return USBSTREAM_Send((unsigned int *)addr, size);
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if the SD card event log can take records; traces it once when it
+/// no longer can (not mounted, full or failed).
+//------------------------------------------------------------------------------
+static unsigned char SdLogIsWritable(void)
+{
+    static unsigned char lastState = SDLOG_STATE_CLOSED;
+    unsigned char state = SDLOG_GetState();
+
+    if((state != lastState) && (state != SDLOG_STATE_CLOSED) && (state != SDLOG_STATE_OPEN))
+    {
+        TRACE_LOG_WARNING("Transmit: SD card event log %s, blocks dropped\n\r", pSdLogStates[state]);
+    }
+    lastState = state;
+
+    return (state == SDLOG_STATE_CLOSED) || (state == SDLOG_STATE_OPEN);
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a data link is still sending a block.
+/// \param link  DATA_LINK_USART, DATA_LINK_USB or DATA_LINK_SD.
+//------------------------------------------------------------------------------
+static unsigned char LinkIsBusy(unsigned char link)
+{
+    if(link == DATA_LINK_USART) return SERLINK_IsBusy();
+    if(link == DATA_LINK_SD) return SDLOG_IsBusy();
+    return USBSTREAM_IsBusy();
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of words to send for a block: compressed records are
+/// shorter than the block that was reserved for them.
+/// \param addr  Block payload.
+/// \param size  Block size in words.
+//------------------------------------------------------------------------------
+static unsigned int RecordLength(lPTR addr, unsigned int size)
+{
+    unsigned int length = EVREC_GetLength((unsigned int *)addr);
+
+    return (length < size) ? length : size;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of bytes of a block in the stream of the UDP data link:
+/// none for the records dropped by the level-2 filter.
+/// \param addr  Block payload.
+/// \param size  Block size in words.
+//------------------------------------------------------------------------------
+static unsigned int StreamLength(lPTR addr, unsigned int size)
+{
+    if(EVREC_GetFlags((unsigned int *)addr) & EVREC_FLAGS_DROPPED) return 0;
+
+    return RecordLength(addr, size) * 4;
+}
+
+//------------------------------------------------------------------------------
+/// Releases the blocks of the UDP data link acknowledged by the receiver, and
+/// the oldest unacknowledged ones while the event buffer is fuller than
+/// UDP_HOLD_LIMIT percent.
+/// \param all  Release all the blocks, acknowledged or not.
+//------------------------------------------------------------------------------
+static void ReleaseAcked(unsigned char all)
+{
+    unsigned int acked = UDPLINK_GetAcked();
+    unsigned int limit = EVBUF_GetSize() / 100 * UDP_HOLD_LIMIT;
+    lPTR addr;
+    unsigned int size;
+    unsigned int length;
+
+    while((addr = (lPTR)EVBUF_Peek(EVBUF_STAGE_ACK, &size)) != 0)
+    {
+        length = StreamLength(addr, size);
+        if((int)(acked - (heldOffset + length)) < 0)
         {
-            *tAddr = *fAddr + 1;
+            if(!all && (EVBUF_GetUsed() <= limit)) break;
+            COUNTER_Increment(&unackedCounter);
+        }
+        EVBUF_Advance(EVBUF_STAGE_ACK);
+        heldOffset += length;
+        fetchBlock = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Copies bytes of the UDP data link stream from the blocks still in the event
+/// buffer, for a retransmission (see UdpLinkFetch). The blocks are walked on
+/// from the last one copied, since the receiver asks for the missing
+/// datagrams in order.
+//------------------------------------------------------------------------------
+static unsigned char FetchHeld(unsigned int offset, unsigned char *pData, unsigned int size)
+{
+    unsigned int held = EVBUF_GetPending(EVBUF_STAGE_ACK);
+    unsigned int count = held + ((EVBUF_GetPending(EVBUF_STAGE_TRANSMIT) != 0) ? 1 : 0);
+    unsigned int position;
+    unsigned int length;
+    unsigned int chunk;
 
-            if(i % 1000 == 0)
+    if(((int)(offset - heldOffset) < 0) || (count == 0)) return 0;
+
+    // The block being sent, partly in datagrams, follows the held ones
+    if((fetchBlock == 0) || ((int)(offset - fetchOffset) < 0))
+    {
+        fetchBlock = (lPTR)EVBUF_Peek((held != 0) ? EVBUF_STAGE_ACK : EVBUF_STAGE_TRANSMIT, &fetchSize);
+        fetchOffset = heldOffset;
+        fetchIndex = 0;
+    }
+
+    while(size != 0)
+    {
+        position = offset - fetchOffset;
+        length = StreamLength(fetchBlock, fetchSize);
+        if(position >= length)
+        {
+            if(++fetchIndex >= count)
             {
-            	printf(" -- %d DP: %08X = %08X, SD: %08X = %08X \n\r", nWords - i, tAddr, *tAddr, fAddr, *fAddr);
+                fetchBlock = 0;
+                return 0;
             }
-            ++fAddr; ++tAddr;
+            fetchOffset += length;
+            fetchBlock = (lPTR)EVBUF_Next((unsigned int *)fetchBlock, &fetchSize);
+            continue;
         }
+        chunk = length - position;
+        if(chunk > size) chunk = size;
+        memcpy(pData, (unsigned char *)fetchBlock + position, chunk);
+        pData += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Shell input filter: takes the slow-control frames out of the DBGU input.
+/// The requests are applied from the shell task, so never in the middle of a
+/// readout.
+//------------------------------------------------------------------------------
+static unsigned char SlowCtlFilter(unsigned char c)
+{
+    return SLOWCTL_Input(&slowCtlPort, c);
+}
+
+//------------------------------------------------------------------------------
+/// Slow-control port output: the host waits for every response, so unlike
+/// the diagnostics it waits for room in the DBGU buffer rather than being
+/// cut short. A response frame is at most SLOWCTL_MAX_FRAME bytes.
+//------------------------------------------------------------------------------
+static unsigned int SlowCtlWrite(const unsigned char *pData, unsigned int size)
+{
+    DBGU_SetTxPolicy(DBGU_TX_BLOCK);
+    size = DBGU_Write(pData, size);
+    DBGU_SetTxPolicy(DBGU_TX_DROP);
+
+    return size;
+}
+
+//------------------------------------------------------------------------------
+/// Starts a new stream on the UDP data link, releasing the blocks waiting for
+/// their acknowledgement first: for a new destination, or when the held
+/// blocks can no longer be matched with the stream.
+/// \param address  Destination IP address.
+/// \param port  Destination port.
+//------------------------------------------------------------------------------
+static void RestartUdpLink(unsigned int address, unsigned short port)
+{
+    UDPLINK_Flush();
+    ReleaseAcked(1);
+    UDPLINK_Configure(address, port);
+    heldOffset = 0;
+    fetchBlock = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Transmit task: sends the processed records on the USART or USB data link
+/// or logs them to the SD card one at a time, or reports up to drainBatch of
+/// them on the DBGU (only the event number and the first and last words of
+/// each payload are printed), then the spill summary once everything is sent.
+/// Does not start anything new once a spill begins. On the UDP data link, the
+/// datagrams asked again by the receiver go first, then up to drainBatch
+/// records are packed into datagrams at once, and the last datagram is sent
+/// when nothing is left to pack. Sent records are released at once, except on
+/// the UDP data link where they wait in the acknowledgement stage of the event
+/// buffer (see ReleaseAcked()). Records the level-2 filter dropped when they
+/// were processed are not sent, and neither are the ones the SD card event
+/// log cannot take once it is full or failed.
+//------------------------------------------------------------------------------
+static void TransmitTask(void *pArg)
+{
+    static unsigned int reportedSpill = 0;
+    static unsigned char linkBlock = DATA_LINK_DBGU;
+    lPTR addr;
+    unsigned int size;
+    unsigned int n;
+    SpillStats stats;
+    EvRecInfo info;
+    unsigned int length;
+    unsigned char status;
+
+    // Release the block sent on a link, the end of transfer posts the task
+    if(linkBlock != DATA_LINK_DBGU)
+    {
+        if(LinkIsBusy(linkBlock)) return;
+
+        addr = (lPTR)EVBUF_Peek(EVBUF_STAGE_TRANSMIT, &size);
+        EVBUF_Advance(EVBUF_STAGE_TRANSMIT);
+        EVBUF_Advance(EVBUF_STAGE_ACK);
+        COUNTER_Add64(&transmitBytesCounter, RecordLength(addr, size) * 4);
+        linkBlock = DATA_LINK_DBGU;
+    }
 
-        // Wait for 10s
-        printf("One cycle finished. \n\r");
-        Wait(10000);
+    // Retransmissions first on the UDP link, in the window of the receiver
+    if((dataLink == DATA_LINK_UDP) && !SPILL_IsActive())
+    {
+        ReleaseAcked(0);
+        UDPLINK_SetOccupancy(EVBUF_GetUsed() / ((EVBUF_GetSize() >> 16) + 1));
+        if(!UDPLINK_Service()) return;
     }
+
+    for(n = drainBatch; n != 0; n--) 
+    {
+        if(SPILL_IsActive())
+        {
+            UDPLINK_Flush();
+            return;
+        }
+
+        addr = (lPTR)EVBUF_Peek(EVBUF_STAGE_TRANSMIT, &size);
+        if(addr == 0) break;
+
+        // Events dropped by the level-2 filter go no further
+        if(EVREC_GetFlags((unsigned int *)addr) & EVREC_FLAGS_DROPPED)
+        {
+            EVBUF_Advance(EVBUF_STAGE_TRANSMIT);
+            if(dataLink != DATA_LINK_UDP) EVBUF_Advance(EVBUF_STAGE_ACK);
+            continue;
+        }
+
+        // The UDP link copies the records into datagrams; without a free
+        // transmit buffer it resumes on the next EMAC transmit interrupt, with
+        // the window full on the next control message of the receiver
+        if(dataLink == DATA_LINK_UDP)
+        {
+            length = RecordLength(addr, size);
+            if(!UDPLINK_Send((unsigned int *)addr, length * 4)) return;
+            EVBUF_Advance(EVBUF_STAGE_TRANSMIT);
+            COUNTER_Add64(&transmitBytesCounter, length * 4);
+            continue;
+        }
+
+        // One block at a time on the other links; the USB one waits for the
+        // host. The blocks the SD card event log cannot take are dropped, so
+        // that the event buffer does not fill up behind them
+        if(dataLink != DATA_LINK_DBGU)
+        {
+            if(LinkSend(dataLink, addr, RecordLength(addr, size)))
+            {
+                linkBlock = dataLink;
+                return;
+            }
+            if((dataLink != DATA_LINK_SD) || SdLogIsWritable()) return;
+
+            EVBUF_Advance(EVBUF_STAGE_TRANSMIT);
+            EVBUF_Advance(EVBUF_STAGE_ACK);
+            COUNTER_Increment(&sdDroppedCounter);
+            continue;
+        }
+
+        status = EVREC_Decode((unsigned int *)addr, size, &info, &length);
+        size = RecordLength(addr, size);
+        printf(" -- Event %u%s: %08X = %08X, %08X = %08X \n\r", info.event,
+               (status == EVREC_OK) ? "" : " (bad record)",
+               addr + EVREC_HEADER_WORDS, addr[EVREC_HEADER_WORDS], addr + size - 1, addr[size - 1]);
+        EVBUF_Advance(EVBUF_STAGE_TRANSMIT);
+        EVBUF_Advance(EVBUF_STAGE_ACK);
+        COUNTER_Add64(&transmitBytesCounter, size * 4);
+    }
+
+    if(EVBUF_GetPending(EVBUF_STAGE_TRANSMIT) != 0)
+    {
+        SCHED_Post(&transmitTask);
+    }
+    else
+    {
+        UDPLINK_Flush();
+    }
+
+    if((EVBUF_GetPending(EVBUF_STAGE_TRANSMIT) == 0) && SPILL_IsGated()
+       && (EVBUF_GetPending(EVBUF_STAGE_PROCESS) == 0))
+    {
+        SPILL_GetLast(&stats);
+        if(stats.number != reportedSpill)
+        {
+            reportedSpill = stats.number;
+            printf("-- Spill %u: %u ms, %u events, %u words, %u dropped \n\r",
+                   stats.number, TIMER_TicksToUs(stats.durationTicks) / 1000,
+                   stats.events, stats.words, stats.overflows);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Network task: answers ARP and ping and takes the control messages of the
+/// UDP data link receiver, then releases the acknowledged blocks and lets the
+/// link send what was asked again or was waiting for an ARP reply or for the
+/// window.
+//------------------------------------------------------------------------------
+static void NetTask(void *pArg)
+{
+    if(NET_Poll(NET_POLL_BATCH) == NET_POLL_BATCH) SCHED_Post(&netTask);
+    if(dataLink == DATA_LINK_UDP)
+    {
+        ReleaseAcked(0);
+        SCHED_Post(&transmitTask);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Housekeeping task: prints the pending trace log records, updates the index
+/// of the event log, follows the Ethernet link, and prints the CPU load, task
+/// statistics and counters periodically. Without spill gate, also has the
+/// monitoring histograms closed every HIST_PERIOD periods.
+//------------------------------------------------------------------------------
+static void HousekeepingTask(void *pArg)
+{
+    static unsigned int count = 0;
+    static unsigned int histCount = 0;
+    unsigned char state;
+
+    TRACELOG_Drain(TRACELOG_BATCH);
+    SDLOG_Sync();
+
+    // ARP cache aging and retries, receiver of the UDP link, speed and duplex
+    // mode of the EMAC
+    NET_Tick();
+    UDPLINK_Tick();
+    if(dataLink == DATA_LINK_UDP) SCHED_Post(&transmitTask);
+    state = EMAC_UpdateLink();
+    if(state != linkState)
+    {
+        linkState = state;
+        printf("-- Ethernet link %s\n\r", pEmacLinkNames[linkState]);
+    }
+
+    // Keep the microsecond clock of the event records across tick wrap-arounds
+    TIMER_GetMicroseconds();
+
+    // Without spill gate, the processing task closes the monitoring histograms
+    // periodically
+    if(!SPILL_IsGated() && (++histCount >= HIST_PERIOD))
+    {
+        histCount = 0;
+        histDue = 1;
+        SCHED_Post(&processingTask);
+    }
+
+    if(++count == STATS_PERIOD)
+    {
+        count = 0;
+        SCHED_PrintStats();
+        COUNTERS_Snapshot();
+        COUNTERS_Print();
+        printf("-- DBGU: %u characters dropped, trace log: %u records lost\n\r",
+               DBGU_GetTxDropped(), TRACELOG_GetLost());
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Shell commands
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Starts or stops the run, like pushbutton #1.
+//------------------------------------------------------------------------------
+static void RunCommand(int argc, char **argv)
+{
+    if((argc == 2) && (strcmp(argv[1], "start") == 0))
+    {
+        pLedStates[0] = 1;
+    }
+    else if((argc == 2) && (strcmp(argv[1], "stop") == 0))
+    {
+        pLedStates[0] = 0;
+        LED_Clear(0);
+    }
+    else if(argc != 1)
+    {
+        printf("Usage: run [start|stop]\n\r");
+        return;
+    }
+    printf("Run %s, spill %u%s\n\r", pLedStates[0] ? "started" : "stopped",
+           SPILL_GetNumber(), SPILL_IsActive() ? " in progress" : "");
+}
+
+//------------------------------------------------------------------------------
+/// Prints the scheduler, spill, buffer and diagnostics counters, or exports
+/// the performance counters in binary form as hexadecimal words.
+//------------------------------------------------------------------------------
+static void StatsCommand(int argc, char **argv)
+{
+    SpillStats stats;
+    const SlowCtlStats *pSlowCtl;
+    unsigned int size;
+    unsigned int i;
+
+    COUNTERS_Snapshot();
+    if((argc == 2) && (strcmp(argv[1], "bin") == 0))
+    {
+        size = COUNTERS_Export(pCounterExport, sizeof(pCounterExport));
+        for(i = 0; i < size / 4; i++)
+        {
+            printf("%08X%s", pCounterExport[i], ((i % 8) == 7) ? "\n\r" : " ");
+        }
+        printf("\n\r");
+        return;
+    }
+
+    SCHED_PrintStats();
+    COUNTERS_Print();
+    SPILL_GetLast(&stats);
+    printf("Spill %u: %u ms, %u events, %u words, %u dropped\n\r",
+           stats.number, TIMER_TicksToUs(stats.durationTicks) / 1000,
+           stats.events, stats.words, stats.overflows);
+    printf("Event buffer: %u / %u words used, %u to process, %u to send, %u to be acknowledged\n\r",
+           EVBUF_GetUsed(), EVBUF_GetSize(), EVBUF_GetPending(EVBUF_STAGE_PROCESS),
+           EVBUF_GetPending(EVBUF_STAGE_TRANSMIT), EVBUF_GetPending(EVBUF_STAGE_ACK));
+    printf("DBGU: %u characters dropped, trace log: %u records lost\n\r",
+           DBGU_GetTxDropped(), TRACELOG_GetLost());
+    pSlowCtl = SLOWCTL_GetStats();
+    printf("Slow control: %u requests, %u operations, %u words, %u rejected, %u bad frames, %u truncated\n\r",
+           pSlowCtl->requests, pSlowCtl->operations, pSlowCtl->words,
+           pSlowCtl->rejected, pSlowCtl->badFrames, pSlowCtl->truncated);
+}
+
+//------------------------------------------------------------------------------
+/// Prints the monitoring histograms of the last complete spill (of the last
+/// HIST_PERIOD housekeeping periods without spill gate), or of the one being
+/// processed: the channel occupancy, the time spectrum of a group of channels,
+/// or the binary export of both.
+//------------------------------------------------------------------------------
+static void HistCommand(int argc, char **argv)
+{
+    const HistBank *pBank;
+    unsigned char live;
+    unsigned int group;
+    unsigned int size;
+    unsigned int i;
+
+    live = (argc >= 2) && (strcmp(argv[1], "live") == 0);
+    if(live)
+    {
+        argc--;
+        argv++;
+    }
+    pBank = HIST_GetBank(live);
+
+    if(argc == 1)
+    {
+        HIST_Print(pBank);
+    }
+    else if((argc == 2) && (strcmp(argv[1], "bin") == 0))
+    {
+        size = HIST_Export(pBank, pHistExport, sizeof(pHistExport));
+        for(i = 0; i < size / 4; i++)
+        {
+            printf("%08X%s", pHistExport[i], ((i % 8) == 7) ? "\n\r" : " ");
+        }
+        printf("\n\r");
+    }
+    else if((argc == 2) && SHELL_ParseUnsigned(argv[1], &group) && (group < HIST_NUM_GROUPS))
+    {
+        HIST_PrintTime(pBank, group);
+    }
+    else
+    {
+        printf("Usage: hist [live] [<group 0-%u>|bin]\n\r", HIST_NUM_GROUPS - 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Prints the calibration tables, sets a channel of the staged one, or
+/// commits it for the next run.
+//------------------------------------------------------------------------------
+static void CalibCommand(int argc, char **argv)
+{
+    unsigned int channel;
+    unsigned int scale;
+    unsigned int id;
+    int t0;
+    unsigned int i;
+
+    if((argc == 4) && SHELL_ParseUnsigned(argv[1], &channel) && SHELL_ParseSigned(argv[2], &t0)
+        && SHELL_ParseUnsigned(argv[3], &scale))
+    {
+        if(!CALIB_SetChannel(channel, t0, scale))
+        {
+            printf("Channel below %u, t0 within +-%u, scale up to %u (%u = 1.0)\n\r",
+                   TDC_NUM_CHANNELS, TDC_TIME_MASK, CALIB_SCALE_MAX, CALIB_SCALE_ONE);
+            return;
+        }
+    }
+    else if((argc == 3) && (strcmp(argv[1], "commit") == 0) && SHELL_ParseUnsigned(argv[2], &id)
+            && (id <= 0xFFFF))
+    {
+        CALIB_Commit(id);
+    }
+    else if(argc != 1)
+    {
+        printf("Usage: calib [<channel> <t0> <scale>|commit <id>]\n\r");
+        return;
+    }
+
+    printf("Calibration table %u in use, table %u committed for the next run\n\r",
+           CALIB_GetId(0), CALIB_GetId(1));
+    printf("Staged table, t0/scale (%u = 1.0):\n\r", CALIB_SCALE_ONE);
+    for(i = 0; i < TDC_NUM_CHANNELS; i++)
+    {
+        CALIB_GetChannel(1, i, &t0, &scale);
+        printf("%s%6d/%-5u", ((i % 8) == 0) ? "  " : " ", t0, scale);
+        if((i % 8) == 7) printf("\n\r");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Prints the event builder segments, changes one of them, or sets how many
+/// are used (0 to copy the whole DPRAM).
+//------------------------------------------------------------------------------
+static void EvbCommand(int argc, char **argv)
+{
+    unsigned int index;
+    unsigned int offset;
+    unsigned int size;
+
+    if((argc == 4) && SHELL_ParseUnsigned(argv[1], &index) && SHELL_ParseUnsigned(argv[2], &offset)
+        && SHELL_ParseUnsigned(argv[3], &size))
+    {
+        if(!EVBUILD_SetSegment(index, offset, size)) argc = 0;
+    }
+    else if((argc == 2) && SHELL_ParseUnsigned(argv[1], &index))
+    {
+        if(!EVBUILD_SetNumSegments(index)) argc = 0;
+    }
+    else if(argc != 1)
+    {
+        argc = 0;
+    }
+
+    if(argc == 0)
+    {
+        printf("Usage: evb [<count>|<segment> <offset> <words>], up to %u segments of the %u words\n\r",
+               EVBUILD_MAX_SEGMENTS, DPRAM_NWORDS);
+        return;
+    }
+    printf("Event builder: %u segments\n\r", EVBUILD_GetNumSegments());
+    for(index = 0; index < EVBUILD_MAX_SEGMENTS; index++)
+    {
+        EVBUILD_GetSegment(index, &offset, &size);
+        if(size != 0)
+        {
+            printf("  segment %u: offset %u, %u words%s\n\r", index, offset, size,
+                   (index < EVBUILD_GetNumSegments()) ? "" : " (unused)");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the set of channels first to last.
+/// \return The channel set, 0 if the range is not valid.
+//------------------------------------------------------------------------------
+static unsigned long long ParseChannels(char *pFirst, char *pLast)
+{
+    unsigned int first;
+    unsigned int last;
+
+    if(!SHELL_ParseUnsigned(pFirst, &first) || !SHELL_ParseUnsigned(pLast, &last)
+       || (first > last) || (last >= TDC_NUM_CHANNELS))
+    {
+        return 0;
+    }
+    return (0xFFFFFFFFFFFFFFFFULL >> (TDC_NUM_CHANNELS - 1 - last)) & ~((1ULL << first) - 1);
+}
+
+//------------------------------------------------------------------------------
+/// Prints the level-2 filter rules, adds one, removes them all, or sets the
+/// filter mode.
+//------------------------------------------------------------------------------
+static void L2Command(int argc, char **argv)
+{
+    static const char * const pModes[] = {"off", "mark", "drop"};
+    const L2FilterRule *pRule;
+    L2FilterRule rule;
+    unsigned int count;
+    unsigned int i;
+
+    memset(&rule, 0, sizeof(rule));
+    rule.count = 1;
+    if((argc == 2) && (strcmp(argv[1], "clear") == 0))
+    {
+        L2FILTER_Clear();
+    }
+    else if(argc == 2)
+    {
+        for(i = 0; (i < 3) && (strcmp(argv[1], pModes[i]) != 0); i++);
+        if(i == 3) argc = 0;
+        else L2FILTER_SetMode(i);
+    }
+    else if((argc == 3) && (strcmp(argv[1], "hits") == 0) && SHELL_ParseUnsigned(argv[2], &rule.count))
+    {
+        rule.type = L2FILTER_RULE_HITS;
+        if(!L2FILTER_AddRule(&rule)) argc = 0;
+    }
+    else if(((argc == 4) || (argc == 5)) && (strcmp(argv[1], "require") == 0)
+            && ((argc == 4) || SHELL_ParseUnsigned(argv[4], &rule.count)))
+    {
+        rule.type = L2FILTER_RULE_REQUIRE;
+        rule.setA = ParseChannels(argv[2], argv[3]);
+        if(!L2FILTER_AddRule(&rule)) argc = 0;
+    }
+    else if((argc == 7) && (strcmp(argv[1], "coinc") == 0) && SHELL_ParseUnsigned(argv[6], &rule.window))
+    {
+        rule.type = L2FILTER_RULE_COINCIDENCE;
+        rule.setA = ParseChannels(argv[2], argv[3]);
+        rule.setB = ParseChannels(argv[4], argv[5]);
+        if(!L2FILTER_AddRule(&rule)) argc = 0;
+    }
+    else if(argc != 1)
+    {
+        argc = 0;
+    }
+
+    if(argc == 0)
+    {
+        printf("Usage: l2 [off|mark|drop|clear|hits <n>|require <first> <last> [hits]\n\r"
+               "          |coinc <first> <last> <first> <last> <window>], up to %u rules\n\r",
+               L2FILTER_MAX_RULES);
+        return;
+    }
+    printf("Level-2 filter %s, events passing all the rules are accepted\n\r",
+           pModes[L2FILTER_GetMode()]);
+    for(i = 0; (pRule = L2FILTER_GetRule(i, &count)) != 0; i++)
+    {
+        if(pRule->type == L2FILTER_RULE_HITS)
+        {
+            printf("  %u: at least %u hits", i, pRule->count);
+        }
+        else if(pRule->type == L2FILTER_RULE_REQUIRE)
+        {
+            printf("  %u: at least %u hits in channels %08X%08X", i, pRule->count,
+                   (unsigned int)(pRule->setA >> 32), (unsigned int)pRule->setA);
+        }
+        else
+        {
+            printf("  %u: channels %08X%08X and %08X%08X within %u", i,
+                   (unsigned int)(pRule->setA >> 32), (unsigned int)pRule->setA,
+                   (unsigned int)(pRule->setB >> 32), (unsigned int)pRule->setB, pRule->window);
+        }
+        printf(", %u events rejected\n\r", count);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Parses an IP address in dotted decimal notation.
+/// \param pString  String to parse.
+/// \param pAddress  Parsed address.
+/// \return 1 if the string is a valid address, 0 otherwise.
+//------------------------------------------------------------------------------
+static unsigned char ParseAddress(const char *pString, unsigned int *pAddress)
+{
+    unsigned int address = 0;
+    unsigned int value;
+    unsigned int i;
+
+    for(i = 0; i < 4; i++)
+    {
+        if((*pString < '0') || (*pString > '9')) return 0;
+        value = 0;
+        while((*pString >= '0') && (*pString <= '9'))
+        {
+            value = value * 10 + (*pString++ - '0');
+            if(value > 255) return 0;
+        }
+        if(*pString++ != ((i == 3) ? 0 : '.')) return 0;
+        address = (address << 8) | value;
+    }
+    *pAddress = address;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Prints an IP address in dotted decimal notation, after a label.
+//------------------------------------------------------------------------------
+static void PrintAddress(const char *pName, unsigned int address)
+{
+    printf("%s %u.%u.%u.%u", pName, address >> 24, (address >> 16) & 0xFF,
+           (address >> 8) & 0xFF, address & 0xFF);
+}
+
+//------------------------------------------------------------------------------
+/// Sets the IP addresses or the destination of the UDP data link, and prints
+/// the Ethernet link state and the IP stack statistics.
+//------------------------------------------------------------------------------
+static void NetCommand(int argc, char **argv)
+{
+    unsigned int address;
+    unsigned int mask;
+    unsigned int gateway;
+    unsigned int value;
+    unsigned short port;
+    const NetStats *pStats;
+    const UdpLinkStats *pLinkStats;
+    const EmacStats *pEmacStats;
+
+    if((argc == 5) && (strcmp(argv[1], "ip") == 0) && ParseAddress(argv[2], &address)
+       && ParseAddress(argv[3], &mask) && ParseAddress(argv[4], &gateway))
+    {
+        NET_SetAddress(address, mask, gateway);
+    }
+    else if((argc == 4) && (strcmp(argv[1], "dest") == 0) && ParseAddress(argv[2], &address)
+            && SHELL_ParseUnsigned(argv[3], &value) && (value != 0) && (value <= 0xFFFF))
+    {
+        RestartUdpLink(address, value);
+    }
+    else if(argc != 1)
+    {
+        printf("Usage: net [ip <address> <mask> <gateway>|dest <address> <port>]\n\r");
+        return;
+    }
+
+    NET_GetAddress(&address, &mask, &gateway);
+    printf("MAC %02X:%02X:%02X:%02X:%02X:%02X, link %s\n\r", pMacAddress[0], pMacAddress[1],
+           pMacAddress[2], pMacAddress[3], pMacAddress[4], pMacAddress[5], pEmacLinkNames[linkState]);
+    PrintAddress("IP", address);
+    PrintAddress(", mask", mask);
+    PrintAddress(", gateway", gateway);
+    UDPLINK_GetDestination(&address, &port);
+    PrintAddress(", data link to", address);
+    printf(":%u\n\r", port);
+
+    pStats = NET_GetStats();
+    printf("Received %u frames, %u bad, %u ignored, %u dropped by the EMAC\n\r",
+           pStats->rxFrames, pStats->rxErrors, pStats->rxIgnored, EMAC_GetRxDropped());
+    printf("Sent %u ARP requests, %u ARP replies, %u echo replies; UDP %u received, %u sent\n\r",
+           pStats->arpRequests, pStats->arpReplies, pStats->echoReplies,
+           pStats->udpReceived, pStats->udpSent);
+    printf("%u datagrams waited for ARP, %u frames for a transmit buffer\n\r",
+           pStats->unresolved, pStats->noBuffer);
+    pEmacStats = EMAC_GetStats();
+    printf("EMAC %s: %u interrupts, %u switches to polling, %u back, %u ms polled, %u frames/ms (max %u)\n\r",
+           EMAC_IsPolling() ? "polled" : "on interrupts", pEmacStats->interrupts,
+           pEmacStats->toPolling, pEmacStats->toInterrupts, pEmacStats->polls,
+           pEmacStats->polls ? pEmacStats->polledFrames / pEmacStats->polls : 0,
+           pEmacStats->maxPolledFrames);
+    pLinkStats = UDPLINK_GetStats();
+    printf("Data link %s: %u datagrams, %u control messages, %u NACKs, %u sent again, %u missed\n\r",
+           UDPLINK_IsReliable() ? "acknowledged" : "not acknowledged", pLinkStats->datagrams,
+           pLinkStats->controls, pLinkStats->nacks, pLinkStats->retransmits, pLinkStats->misses);
+    printf("Window full %u times, receiver lost %u times, %u blocks held, %u released unacknowledged\n\r",
+           pLinkStats->windowFull, pLinkStats->timeouts, EVBUF_GetPending(EVBUF_STAGE_ACK),
+           unackedCounter.value);
+}
+
+//------------------------------------------------------------------------------
+/// Sets the readout parameters.
+//------------------------------------------------------------------------------
+static void SetCommand(int argc, char **argv)
+{
+    unsigned int value;
+    unsigned int address;
+    unsigned short port;
+
+    if((argc == 3) && SHELL_ParseUnsigned(argv[2], &value))
+    {
+        if((strcmp(argv[1], "readout") == 0) && (value != 0))
+        {
+            readoutPeriod = value;
+        }
+        else if((strcmp(argv[1], "drain") == 0) && (value != 0))
+        {
+            drainBatch = value;
+        }
+        else if((strcmp(argv[1], "link") == 0) && (value <= DATA_LINK_UDP))
+        {
+            if(dataLink == DATA_LINK_SD) SDLOG_Close();
+            if((dataLink == DATA_LINK_UDP) && (value != DATA_LINK_UDP))
+            {
+                UDPLINK_GetDestination(&address, &port);
+                RestartUdpLink(address, port);
+            }
+            dataLink = value;
+            SCHED_Post(&transmitTask);
+        }
+        else if(strcmp(argv[1], "board") == 0)
+        {
+            boardId = value;
+        }
+        else if(strcmp(argv[1], "run") == 0)
+        {
+            runNumber = value;
+            eventNumber = 0;
+        }
+        else if((strcmp(argv[1], "sort") == 0) && (value <= 1))
+        {
+            sortHits = value;
+        }
+        else if((strcmp(argv[1], "codec") == 0) && (value < CODEC_NUM))
+        {
+            payloadCodec = value;
+        }
+        else
+        {
+            argc = 0;
+        }
+    }
+    else if(argc != 1)
+    {
+        argc = 0;
+    }
+
+    if(argc == 0)
+    {
+        printf("Usage: set [readout <ms>|drain <blocks>|link <0 DBGU|1 USART|2 USB|3 SD|4 UDP>|board <id>|run <n>|sort <0|1>|codec <0 none|1 lz|2 rice>]\n\r");
+        return;
+    }
+    printf("Readout period %u ms, drain batch %u blocks, data link %s\n\r",
+           readoutPeriod, drainBatch, pLinkNames[dataLink]);
+    printf("USART link %u baud, USB %s, SD log %s\n\r", SERLINK_GetBaudrate(),
+           USBSTREAM_IsConfigured() ? "configured" : "not configured",
+           pSdLogStates[SDLOG_GetState()]);
+    printf("Board %u, run %u, next event %u, hit sort %s, codec %s from the next run\n\r",
+           boardId, runNumber, eventNumber, sortHits ? "on" : "off", CODEC_GetName(payloadCodec));
+}
+
+//------------------------------------------------------------------------------
+/// Prints the result of a benchmark, as a throughput and in CPU cycles per
+/// byte.
+/// \param pName  Name of the benchmark.
+/// \param nWords  Number of words handled.
+/// \param us  Duration in microseconds.
+//------------------------------------------------------------------------------
+static void PrintBench(const char *pName, unsigned int nWords, unsigned int us)
+{
+    unsigned int cycles;
+
+    if(us == 0) us = 1;
+    cycles = (us * (CLOCK_GetCpuClock() / 100000)) / (nWords * 4);
+    printf("%s: %u words in %u us, %u.%u MB/s, %u.%u cycles/byte\n\r", pName, nWords, us,
+           (nWords * 4) / us, ((nWords * 40) / us) % 10, cycles / 10, cycles % 10);
+}
+
+//------------------------------------------------------------------------------
+/// Measures the hit sort on random hits spread over all the channels and
+/// times (no pass can be skipped), at typical multiplicities and at the
+/// largest one, or at the given one.
+//------------------------------------------------------------------------------
+static void BenchSort(int argc, char **argv)
+{
+    static const unsigned int pSizes[] = {64, 1024, DPRAM_NWORDS};
+    unsigned int random = TIMER_GetTicks();
+    unsigned int *pHits;
+    unsigned int size;
+    unsigned int start;
+    unsigned int us;
+    unsigned int n;
+    unsigned int i;
+
+    if((argc > 3) || ((argc == 3) && (!SHELL_ParseUnsigned(argv[2], &size)
+                                      || (size == 0) || (size > DPRAM_NWORDS))))
+    {
+        printf("Usage: bench sort [hits], 1 to %u\n\r", DPRAM_NWORDS);
+        return;
+    }
+
+    // Reserved but never committed, so the buffered events are left intact
+    pHits = EVBUF_Reserve(DPRAM_NWORDS);
+    if(pHits == 0)
+    {
+        printf("Event buffer full\n\r");
+        return;
+    }
+
+    for(n = 0; n < ((argc == 3) ? 1 : sizeof(pSizes) / sizeof(pSizes[0])); n++)
+    {
+        if(argc != 3) size = pSizes[n];
+        for(i = 0; i < size; i++)
+        {
+            random = random * 1664525 + 1013904223;
+            pHits[i] = random;
+        }
+        start = TIMER_GetTicks();
+        HITSORT_Sort(pHits, size, pScratch);
+        us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+        printf("Hit sort: %u hits in %u us, %u cycles/hit\n\r", size, us,
+               (us * (CLOCK_GetCpuClock() / 1000000)) / size);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Measures the compression ratio and speed of the codecs on random hits in a
+/// 2000-count trigger window, sorted as by the processing task.
+//------------------------------------------------------------------------------
+static void BenchCodec(int argc, char **argv)
+{
+    unsigned int random = TIMER_GetTicks();
+    unsigned int size = 1024;
+    unsigned int *pHits;
+    unsigned int *pDecoded;
+    unsigned int words;
+    unsigned int start;
+    unsigned int us;
+    unsigned int codec;
+    unsigned int i;
+
+    if((argc > 3) || ((argc == 3) && (!SHELL_ParseUnsigned(argv[2], &size)
+                                      || (size == 0) || (size > DPRAM_NWORDS))))
+    {
+        printf("Usage: bench codec [hits], 1 to %u\n\r", DPRAM_NWORDS);
+        return;
+    }
+
+    // Reserved but never committed, so the buffered events are left intact
+    pHits = EVBUF_Reserve(2 * DPRAM_NWORDS);
+    if(pHits == 0)
+    {
+        printf("Event buffer full\n\r");
+        return;
+    }
+    pDecoded = pHits + DPRAM_NWORDS;
+    for(i = 0; i < size; i++)
+    {
+        random = random * 1664525 + 1013904223;
+        pHits[i] = ((random >> 26) << TDC_CHANNEL_SHIFT) | (1000 + (random & 0xFFFF) % 2000);
+    }
+    HITSORT_Sort(pHits, size, pScratch);
+
+    for(codec = CODEC_NONE + 1; codec < CODEC_NUM; codec++)
+    {
+        start = TIMER_GetTicks();
+        words = CODEC_Encode(codec, pHits, size, pScratch, size);
+        us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+        if(words == 0)
+        {
+            printf("%s: %u hits not compressible\n\r", CODEC_GetName(codec), size);
+            continue;
+        }
+        printf("%s: %u hits in %u words, %u%%\n\r", CODEC_GetName(codec), size, words,
+               (words * 100) / size);
+        PrintBench(" encode", size, us);
+        start = TIMER_GetTicks();
+        if(!CODEC_Decode(codec, pScratch, words, pDecoded, DPRAM_NWORDS, &i)
+           || (i != size) || (memcmp(pHits, pDecoded, size * 4) != 0))
+        {
+            printf(" decode failed\n\r");
+            continue;
+        }
+        us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+        PrintBench(" decode", size, us);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Measures the DPRAM to SDRAM copy throughput of the readout, and the cost of
+/// the record CRC alone and fused with the copy, using the free space of the
+/// event buffer.
+//------------------------------------------------------------------------------
+static void BenchCommand(int argc, char **argv)
+{
+    unsigned int nWords = DPRAM_NWORDS;
+    unsigned int start;
+    unsigned int us;
+    lPTR tAddr;
+    unsigned int crc;
+
+    if((argc >= 2) && (strcmp(argv[1], "sort") == 0))
+    {
+        BenchSort(argc, argv);
+        return;
+    }
+    if((argc >= 2) && (strcmp(argv[1], "codec") == 0))
+    {
+        BenchCodec(argc, argv);
+        return;
+    }
+    if((argc > 2) || ((argc == 2) && (!SHELL_ParseUnsigned(argv[1], &nWords)
+                                      || (nWords == 0) || (nWords > DPRAM_NWORDS))))
+    {
+        printf("Usage: bench [words|sort [hits]|codec [hits]], 1 to %u\n\r", DPRAM_NWORDS);
+        return;
+    }
+
+    // Reserved but never committed, so the buffered events are left intact
+    tAddr = (lPTR)EVBUF_Reserve(nWords);
+    if(tAddr == 0)
+    {
+        printf("Event buffer full\n\r");
+        return;
+    }
+
+    start = TIMER_GetTicks();
+    CopyDPRam(tAddr, nWords);
+    us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+    PrintBench("DPRAM copy", nWords, us);
+
+    // CRC of the copy in SDRAM, then CRC fused with the copy as in the readout
+    start = TIMER_GetTicks();
+    crc = CRC32_Update(0, (void *)tAddr, nWords * 4);
+    us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+    PrintBench("SDRAM CRC", nWords, us);
+
+    start = TIMER_GetTicks();
+    if(CRC32_Copy(0, (unsigned int *)tAddr, (unsigned int *)DPRAM_BASE, nWords) != crc)
+    {
+        printf("DPRAM content changed during the test\n\r");
+    }
+    us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+    PrintBench("DPRAM copy with CRC", nWords, us);
+}
+
+//------------------------------------------------------------------------------
+/// Runs the memory tests on the DPRAM or on the whole event buffer, while the
+/// run is stopped and the event buffer is empty. The DPRAM content is saved in
+/// the scratch buffer and restored after the tests; the event buffer one is
+/// lost.
+//------------------------------------------------------------------------------
+static void MemTestCommand(int argc, char **argv)
+{
+    volatile unsigned int *pDpram = (volatile unsigned int *) DPRAM_BASE;
+    unsigned int tests = MEMTEST_ALL;
+    unsigned int seed = TIMER_GetTicks();
+    unsigned int i;
+
+    if((argc < 2) || (argc > 4)
+        || ((strcmp(argv[1], "dpram") != 0) && (strcmp(argv[1], "sdram") != 0))
+        || ((argc >= 3) && (!SHELL_ParseUnsigned(argv[2], &tests) || (tests == 0)
+                            || (tests > MEMTEST_ALL)))
+        || ((argc == 4) && !SHELL_ParseUnsigned(argv[3], &seed)))
+    {
+        printf("Usage: memtest <dpram|sdram> [tests] [seed]\n\r");
+        printf("  tests: 1 data bus, 2 address, 4 March C-, 8 random (default all)\n\r");
+        return;
+    }
+    if(pLedStates[0] || (EVBUF_GetUsed() != 0))
+    {
+        printf("Stop the run and wait for the event buffer to drain first\n\r");
+        return;
+    }
+
+    if(strcmp(argv[1], "dpram") == 0)
+    {
+        for(i = 0; i < DPRAM_NWORDS; i++) pScratch[i] = pDpram[i];
+        MEMTEST_RunSuite("DPRAM", pDpram, DPRAM_NWORDS, tests, seed);
+        for(i = 0; i < DPRAM_NWORDS; i++) pDpram[i] = pScratch[i];
+    }
+    else
+    {
+        MEMTEST_RunSuite("SDRAM", (unsigned int *) SDRAM_BUFFER, SDRAM_BUFFER_NWORDS, tests, seed);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads or writes an SMC or SDRAMC register.
+//------------------------------------------------------------------------------
+static void RegCommand(int argc, char **argv)
+{
+    volatile unsigned int *pBase = 0;
+    unsigned int size = 0;
+    unsigned int offset;
+    unsigned int value;
+
+    if(argc >= 2)
+    {
+        if(strcmp(argv[1], "smc") == 0)
+        {
+            pBase = (volatile unsigned int *)AT91C_BASE_SMC;
+            size = sizeof(AT91S_SMC);
+        }
+        else if(strcmp(argv[1], "sdramc") == 0)
+        {
+            pBase = (volatile unsigned int *)AT91C_BASE_SDRAMC;
+            size = sizeof(AT91S_SDRAMC);
+        }
+    }
+    if((pBase == 0) || (argc < 3) || (argc > 4)
+        || !SHELL_ParseUnsigned(argv[2], &offset) || (offset >= size) || (offset & 3)
+        || ((argc == 4) && !SHELL_ParseUnsigned(argv[3], &value)))
+    {
+        printf("Usage: reg <smc|sdramc> <offset> [value]\n\r");
+        return;
+    }
+
+    if(argc == 4) pBase[offset / 4] = value;
+    printf("%s[0x%02X] = 0x%08X\n\r", argv[1], offset, pBase[offset / 4]);
+}
+
+//------------------------------------------------------------------------------
+/// Lists the clock profiles or switches to another one.
+//------------------------------------------------------------------------------
+static void ClockCommand(int argc, char **argv)
+{
+    unsigned int profile;
+
+    if(argc == 1)
+    {
+        CLOCK_PrintProfiles();
+    }
+    else if((argc == 2) && SHELL_ParseUnsigned(argv[1], &profile)
+            && (profile < CLOCK_NUM_PROFILES))
+    {
+        if(!CLOCK_SetProfile(profile))
+        {
+            printf("Profile %u not supported\n\r", profile);
+        }
+        printf("Clock profile %s: CPU %u Hz, MCK %u Hz\n\r",
+               CLOCK_GetProfileName(CLOCK_GetProfile()), CLOCK_GetCpuClock(), CLOCK_GetMck());
+    }
+    else
+    {
+        printf("Usage: clock [profile]\n\r");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Lists the trace channel levels or changes one of them.
+//------------------------------------------------------------------------------
+static void TraceCommand(int argc, char **argv)
+{
+    unsigned int channel;
+    unsigned int level;
+
+    if((argc == 3) && SHELL_ParseUnsigned(argv[1], &channel) && (channel < TRACE_NUM_CHANNELS)
+        && SHELL_ParseUnsigned(argv[2], &level) && (level <= TRACE_LEVEL_DEBUG))
+    {
+        TRACE_SetChannelLevel(channel, level);
+    }
+    else if(argc != 1)
+    {
+        printf("Usage: trace [<channel> <level>], level 0 (none) to %u (debug)\n\r",
+               TRACE_LEVEL_DEBUG);
+        return;
+    }
+    for(channel = 0; channel < TRACE_NUM_CHANNELS; channel++)
+    {
+        printf("  channel %u: level %u\n\r", channel, TRACE_GetChannelLevel(channel));
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Prints the state and sessions of the SD card event log, mounts it again
+/// (e.g. after a card change), starts a new log or ends the current session.
+//------------------------------------------------------------------------------
+static void SdLogCommand(int argc, char **argv)
+{
+    const SdLogSuper *pSuper = SDLOG_GetSuper();
+    const SdLogSession *pSession;
+    unsigned int i;
+
+    if(argc > 2)
+    {
+        argc = 0;
+    }
+    else if(argc == 2)
+    {
+        if(SDLOG_IsBusy() || SDCARD_IsBusy())
+        {
+            printf("SD card busy\n\r");
+            return;
+        }
+        if(strcmp(argv[1], "mount") == 0)
+        {
+            MountSdLog();
+        }
+        else if(strcmp(argv[1], "format") == 0)
+        {
+            if(SDLOG_GetState() == SDLOG_STATE_UNMOUNTED) MountSdLog();
+            if(!SDLOG_Format(&sdDevice, TIMER_GetTicks())) printf("Format failed\n\r");
+        }
+        else if(strcmp(argv[1], "close") == 0)
+        {
+            SDLOG_Close();
+        }
+        else
+        {
+            argc = 0;
+        }
+    }
+    if(argc == 0)
+    {
+        printf("Usage: sdlog [mount|format|close]\n\r");
+        return;
+    }
+
+    printf("Event log %s, %u write errors\n\r", pSdLogStates[SDLOG_GetState()], SDCARD_GetErrors());
+    if(SDLOG_GetState() == SDLOG_STATE_UNMOUNTED) return;
+    printf("Volume %08X, %u blocks, %u sessions\n\r", pSuper->volume, pSuper->numBlocks,
+           pSuper->numSessions);
+    for(i = 0; i < pSuper->numSessions; i++)
+    {
+        pSession = &pSuper->pSessions[i];
+        printf("  session %u: blocks %u to %u, records %u to %u\n\r", i,
+               pSession->firstBlock, pSession->endBlock,
+               pSession->firstRecord, pSession->firstRecord + pSession->numRecords);
+    }
+}
+
+/// Application shell command list.
+static const ShellCommand pCommands[] = {
+
+    {"run", "[start|stop] - start or stop the run", RunCommand},
+    {"stats", "[bin] - print or export the counters", StatsCommand},
+    {"hist", "[live] [<group>|bin] - monitoring histograms", HistCommand},
+    {"calib", "[<channel> <t0> <scale>|commit <id>] - TDC calibration", CalibCommand},
+    {"l2", "[off|mark|drop|clear|<rule>] - level-2 filter", L2Command},
+    {"evb", "[<count>|<segment> <offset> <words>] - event builder segments", EvbCommand},
+    {"set", "[readout|drain|link|board|run|sort|codec <value>] - readout parameters", SetCommand},
+    {"net", "[ip <address> <mask> <gateway>|dest <address> <port>] - Ethernet and UDP data link", NetCommand},
+    {"bench", "[words|sort|codec [hits]] - time the DPRAM copy and CRC, the hit sort or the codecs", BenchCommand},
+    {"memtest", "<dpram|sdram> [tests] [seed] - memory tests (clear the SDRAM buffer)", MemTestCommand},
+    {"reg", "<smc|sdramc> <offset> [value] - read or write a register", RegCommand},
+    {"clock", "[profile] - list or switch the clock profiles", ClockCommand},
+    {"trace", "[<channel> <level>] - trace channel levels", TraceCommand},
+    {"sdlog", "[mount|format|close] - SD card event log", SdLogCommand}
+};
+
+//------------------------------------------------------------------------------
+/// Application entry point. 
+//------------------------------------------------------------------------------
+int main(void)
+{
+    unsigned int mck;
+
+    // DBGU output configuration, at the clock left by the bootloader
+    ConfigureDbgu(CLOCK_GetMck());
+    printf("-- SeaQuest VME TDC Embedded Project %s --\n\r", SOFTPACK_VERSION);
+    printf("-- %s\n\r", BOARD_NAME);
+    printf("-- Compiled: %s %s --\n\r", __DATE__, __TIME__);
+
+    // SDRAM first since it programs the refresh for BOARD_MCK, then switch to
+    // the boot clock profile
+    BOARD_ConfigureSdram(32);
+    CLOCK_RegisterListener(&dbguListener, DBGU_Flush, ConfigureDbgu);
+    CLOCK_SetProfile(BOOT_CLOCK_PROFILE);
+    mck = CLOCK_GetMck();
+    printf("-- Clock profile %s: CPU %u Hz, MCK %u Hz --\n\r",
+           CLOCK_GetProfileName(CLOCK_GetProfile()), CLOCK_GetCpuClock(), mck);
+
+    // Scheduler and its time base, before any interrupt may post a task
+    TIMER_Configure(mck);
+    TRACELOG_Initialize((void *) TRACELOG_BUFFER, TRACELOG_SIZE, TIMER_GetTicks, TIMER_GetFrequency());
+    CRC32_Initialize();
+    HIST_Initialize();
+    CALIB_Initialize();
+    SCHED_Initialize();
+    SCHED_InitializeTask(&readoutTask, "readout", SCHED_PRIO_READOUT, ReadoutTask, 0);
+    SCHED_InitializeTask(&processingTask, "processing", SCHED_PRIO_PROCESSING, ProcessingTask, 0);
+    SCHED_InitializeTask(&endOfSpillTask, "eos", SCHED_PRIO_PROCESSING, EndOfSpillTask, 0);
+    SCHED_InitializeTask(&transmitTask, "transmit", SCHED_PRIO_TRANSMIT, TransmitTask, 0);
+    SCHED_InitializeTask(&housekeepingTask, "housekeeping", SCHED_PRIO_HOUSEKEEPING, HousekeepingTask, 0);
+    SCHED_InitializeTask(&netTask, "net", SCHED_PRIO_TRANSMIT, NetTask, 0);
+    COUNTERS_Register(&pitIrqCounter, "pit irq", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&readoutWordsCounter, "readout words", COUNTER_TYPE_COUNT64);
+    COUNTERS_Register(&readoutBlocksCounter, "readout blocks", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&overflowCounter, "overflows", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&crcErrorCounter, "crc errors", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&transmitBytesCounter, "transmit bytes", COUNTER_TYPE_COUNT64);
+    COUNTERS_Register(&codecInCounter, "codec in bytes", COUNTER_TYPE_COUNT64);
+    COUNTERS_Register(&codecOutCounter, "codec out bytes", COUNTER_TYPE_COUNT64);
+    COUNTERS_Register(&unackedCounter, "udp unacked drops", COUNTER_TYPE_COUNT);
+    COUNTERS_Register(&sdDroppedCounter, "sd dropped blocks", COUNTER_TYPE_COUNT);
+
+    // Configuration
+    ConfigurePit(mck);
+    ConfigureTc(mck);
+    ConfigureButtons();
+    SPILL_Configure(SPILL_GATE, &endOfSpillTask);
+    ConfigureLeds();
+    ConfigureDPRam(mck);
+
+    // Memory tests, before the DPRAM and the event buffer are used
+    MEMTEST_RunSuite("DPRAM", (unsigned int *) DPRAM_BASE, DPRAM_NWORDS, BOOT_MEMTEST, 1);
+    MEMTEST_RunSuite("SDRAM", (unsigned int *) SDRAM_BUFFER, BOOT_MEMTEST_NWORDS, BOOT_MEMTEST, 1);
+    EVBUF_Initialize((unsigned int *) SDRAM_BUFFER, SDRAM_BUFFER_NWORDS);
+    EVBUILD_Initialize((unsigned int *) DPRAM_BASE, DPRAM_NWORDS);
+    L2FILTER_Initialize();
+    SERLINK_Initialize(OnLinkDone);
+    SERLINK_Configure(mck);
+    USBSTREAM_Initialize(OnLinkDone);
+    SDCARD_Initialize(OnLinkDone);
+    SDCARD_Configure(mck);
+    MountSdLog();
+    ConfigureEmac();
+    UDPLINK_Initialize(FetchHeld);
+    printf("-- Data link %s, USART at %u baud --\n\r", pLinkNames[dataLink], SERLINK_GetBaudrate());
+
+    // From now on diagnostics must never stall the data path
+    DBGU_SetTxPolicy(DBGU_TX_DROP);
+
+    // Follow later clock profile changes
+    CLOCK_RegisterListener(&timerListener, 0, TIMER_Configure);
+    CLOCK_RegisterListener(&pitListener, 0, ConfigurePit);
+    CLOCK_RegisterListener(&tcListener, 0, ConfigureTc);
+    CLOCK_RegisterListener(&dpramListener, 0, ConfigureDPRam);
+    CLOCK_RegisterListener(&serlinkListener, SERLINK_Flush, SERLINK_Configure);
+    CLOCK_RegisterListener(&sdcardListener, SDCARD_Flush, SDCARD_Configure);
+    
+    // Base addresses of DPRAM and SDRAM
+    lPTR dpAddr = (lPTR)DPRAM_BASE;
+    
+    // Initialize DP to a bunch or dummy values, and check them with the CRC
+    // of what was written against the CRC of a read back
+    printf("Initialize DP to a bunch or dummy values\n\r");
+    unsigned int i;
+    unsigned int nWords = DPRAM_NWORDS;
+    unsigned int crcWritten = 0;
+    unsigned int crcRead;
+    lPTR i_dpaddr = dpAddr;
+    for(i = nWords; i != 0; i--) 
+    {
+    	// write with some dummy data
+    	unsigned int data = 0xDEAD0000 + nWords - i;
+        *i_dpaddr = data;
+        crcWritten = CRC32_Update(crcWritten, &data, 4);
+
+        //increment addr pointers by 4 bytes
+        ++i_dpaddr;
+    }
+    crcRead = CRC32_Update(0, (void *)dpAddr, nWords * 4);
+    printf(" -- DPRam check: %u words, CRC %08X written, %08X read back, %s \n\r",
+           nWords, crcWritten, crcRead, (crcRead == crcWritten) ? "OK" : "FAILED");
+    
+    // Command shell, once the DBGU interrupt is routed by ConfigurePit(),
+    // sharing its input with the slow-control frames
+    SHELL_RegisterCommands(&shellCommands, pCommands, sizeof(pCommands) / sizeof(pCommands[0]));
+    SLOWCTL_Initialize(pSlowCtlRegions, sizeof(pSlowCtlRegions) / sizeof(pSlowCtlRegions[0]),
+                       TIMER_GetTicks, TIMER_GetFrequency);
+    SLOWCTL_InitializePort(&slowCtlPort, SlowCtlWrite);
+    SHELL_SetInputFilter(SlowCtlFilter);
+    SHELL_Initialize();
+
+    // Main loop: everything else runs from the scheduler
+    SCHED_Run();
 }
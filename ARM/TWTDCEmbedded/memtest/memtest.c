@@ -0,0 +1,305 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "memtest.h"
+#include <timer/timer.h>
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Names of the tests, by bit index.
+static const char * const pNames[MEMTEST_NUM_TESTS] = {
+
+    "data bus", "address", "March C-", "random"
+};
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Records a word read back wrong.
+/// \param pResult  Result of the test.
+/// \param pAddress  Address of the word.
+/// \param expected  Value written.
+/// \param actual  Value read.
+//------------------------------------------------------------------------------
+static void RecordError(
+    MemTestResult *pResult,
+    volatile unsigned int *pAddress,
+    unsigned int expected,
+    unsigned int actual)
+{
+    unsigned int bits = expected ^ actual;
+    unsigned int i;
+
+    if (pResult->errors < MEMTEST_MAX_ADDRESSES) {
+
+        pResult->pAddresses[pResult->errors] = (unsigned int) pAddress;
+        pResult->pExpected[pResult->errors] = expected;
+        pResult->pActual[pResult->errors] = actual;
+    }
+    pResult->errors++;
+    for (i = 0; i < 32; i++) {
+
+        if ((bits >> i) & 1) {
+
+            pResult->pBitErrors[i]++;
+        }
+    }
+}
+
+/// Reads a word and checks it against the expected value.
+#define CHECK(pResult, pAddress, expected) \
+    { unsigned int actual = *(pAddress); \
+      if (actual != (expected)) RecordError(pResult, pAddress, expected, actual); }
+
+//------------------------------------------------------------------------------
+/// Returns the next value of a 32-bit xorshift generator.
+/// \param pState  Generator state, never 0.
+//------------------------------------------------------------------------------
+static unsigned int Random(unsigned int *pState)
+{
+    unsigned int x = *pState;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *pState = x;
+    return x;
+}
+
+//------------------------------------------------------------------------------
+/// Walking ones then walking zeros on the first word.
+//------------------------------------------------------------------------------
+static void TestDataBus(volatile unsigned int *pBase, MemTestResult *pResult)
+{
+    unsigned int i;
+
+    for (i = 0; i < 32; i++) {
+
+        *pBase = 1 << i;
+        CHECK(pResult, pBase, 1 << i);
+        *pBase = ~(1 << i);
+        CHECK(pResult, pBase, ~(1 << i));
+    }
+    pResult->bytes = 32 * 4 * 4;
+}
+
+//------------------------------------------------------------------------------
+/// Address-in-address, then its complement.
+//------------------------------------------------------------------------------
+static void TestAddress(volatile unsigned int *pBase, unsigned int size, MemTestResult *pResult)
+{
+    volatile unsigned int *pWord;
+    unsigned int pass;
+    unsigned int mask;
+
+    for (pass = 0; pass < 2; pass++) {
+
+        mask = pass ? 0xFFFFFFFF : 0;
+        for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+            *pWord = (unsigned int) pWord ^ mask;
+        }
+        for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+            CHECK(pResult, pWord, (unsigned int) pWord ^ mask);
+        }
+    }
+    pResult->bytes = size * 4 * 4;
+}
+
+//------------------------------------------------------------------------------
+/// March C-: up(w0); up(r0, w1); up(r1, w0); down(r0, w1); down(r1, w0);
+/// up(r0).
+//------------------------------------------------------------------------------
+static void TestMarchC(volatile unsigned int *pBase, unsigned int size, MemTestResult *pResult)
+{
+    volatile unsigned int *pWord;
+    unsigned int element;
+    unsigned int value;
+
+    for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+        *pWord = 0;
+    }
+
+    // Up, then down, each time 0 to 1 then 1 to 0
+    for (element = 0; element < 4; element++) {
+
+        value = (element & 1) ? 0xFFFFFFFF : 0;
+        if (element < 2) {
+
+            for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+                CHECK(pResult, pWord, value);
+                *pWord = ~value;
+            }
+        }
+        else {
+
+            for (pWord = pBase + size; pWord != pBase;) {
+
+                pWord--;
+                CHECK(pResult, pWord, value);
+                *pWord = ~value;
+            }
+        }
+    }
+
+    for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+        CHECK(pResult, pWord, 0);
+    }
+    pResult->bytes = size * 4 * 10;
+}
+
+//------------------------------------------------------------------------------
+/// Pseudo-random words, written then checked.
+//------------------------------------------------------------------------------
+static void TestRandom(
+    volatile unsigned int *pBase,
+    unsigned int size,
+    unsigned int seed,
+    MemTestResult *pResult)
+{
+    volatile unsigned int *pWord;
+    unsigned int state;
+
+    state = (seed != 0) ? seed : 1;
+    for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+        *pWord = Random(&state);
+    }
+    state = (seed != 0) ? seed : 1;
+    for (pWord = pBase; pWord != pBase + size; pWord++) {
+
+        CHECK(pResult, pWord, Random(&state));
+    }
+    pResult->bytes = size * 4 * 2;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the name of a test.
+/// \param test  Test (one MEMTEST_xxx bit).
+//------------------------------------------------------------------------------
+const char * MEMTEST_GetName(unsigned int test)
+{
+    unsigned int i;
+
+    for (i = 0; i < MEMTEST_NUM_TESTS; i++) {
+
+        if (test == (1 << i)) {
+
+            return pNames[i];
+        }
+    }
+    return "?";
+}
+
+//------------------------------------------------------------------------------
+/// Runs one test on a memory range.
+/// \param test  Test (one MEMTEST_xxx bit), nothing is done for others.
+/// \param pBase  Start of the range, word aligned.
+/// \param size  Size of the range in words.
+/// \param seed  Seed of the random test.
+/// \param pResult  Result of the test.
+/// \return Number of words read back wrong.
+//------------------------------------------------------------------------------
+unsigned int MEMTEST_Run(
+    unsigned int test,
+    volatile unsigned int *pBase,
+    unsigned int size,
+    unsigned int seed,
+    MemTestResult *pResult)
+{
+    unsigned int start;
+
+    memset(pResult, 0, sizeof(MemTestResult));
+    start = TIMER_GetTicks();
+    switch (test) {
+
+        case MEMTEST_DATA_BUS: TestDataBus(pBase, pResult); break;
+        case MEMTEST_ADDRESS: TestAddress(pBase, size, pResult); break;
+        case MEMTEST_MARCH_C: TestMarchC(pBase, size, pResult); break;
+        case MEMTEST_RANDOM: TestRandom(pBase, size, seed, pResult); break;
+    }
+    pResult->us = TIMER_TicksToUs(TIMER_GetTicks() - start);
+
+    return pResult->errors;
+}
+
+//------------------------------------------------------------------------------
+/// Runs a set of tests on a memory range and prints a line per test, with the
+/// first failing addresses and the errors by data bit if any, then the total
+/// number of failing words.
+/// \param pName  Name of the memory.
+/// \param pBase  Start of the range, word aligned.
+/// \param size  Size of the range in words.
+/// \param tests  Tests to run (MEMTEST_xxx bits).
+/// \param seed  Seed of the random test.
+/// \return Total number of words read back wrong.
+//------------------------------------------------------------------------------
+unsigned int MEMTEST_RunSuite(
+    const char *pName,
+    volatile unsigned int *pBase,
+    unsigned int size,
+    unsigned int tests,
+    unsigned int seed)
+{
+    MemTestResult result;
+    unsigned int errors = 0;
+    unsigned int test;
+    unsigned int us;
+    unsigned int i;
+
+    printf("-- Memory test of %s, %08X to %08X, seed %u --\n\r",
+           pName, (unsigned int) pBase, (unsigned int) (pBase + size), seed);
+    for (test = 1; test <= MEMTEST_ALL; test <<= 1) {
+
+        if ((tests & test) == 0) {
+
+            continue;
+        }
+
+        errors += MEMTEST_Run(test, pBase, size, seed, &result);
+        us = (result.us != 0) ? result.us : 1;
+        printf("  %-10s %8u errors %8u us %4u.%u MB/s\n\r", MEMTEST_GetName(test),
+               result.errors, result.us, result.bytes / us, ((result.bytes * 10) / us) % 10);
+
+        if (result.errors != 0) {
+
+            for (i = 0; (i < result.errors) && (i < MEMTEST_MAX_ADDRESSES); i++) {
+
+                printf("    at %08X: wrote %08X, read %08X\n\r",
+                       result.pAddresses[i], result.pExpected[i], result.pActual[i]);
+            }
+            if (result.errors > MEMTEST_MAX_ADDRESSES) {
+
+                printf("    and %u more\n\r", result.errors - MEMTEST_MAX_ADDRESSES);
+            }
+            printf("    errors by bit:");
+            for (i = 0; i < 32; i++) {
+
+                if (result.pBitErrors[i] != 0) {
+
+                    printf(" %u:%u", i, result.pBitErrors[i]);
+                }
+            }
+            printf("\n\r");
+        }
+    }
+    printf("-- %s: %u failing words --\n\r", pName, errors);
+
+    return errors;
+}
+
@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Destructive memory tests for the external memories (CS4 DPRAM, SDRAM),
+/// to tell a flaky memory or bus timing from slow firmware. Each test
+/// reports its number of failing words, the first MEMTEST_MAX_ADDRESSES of
+/// them and the errors by data bit, and its throughput (bytes read and
+/// written per second), which can be compared with the readout.
+///
+/// Tests (MEMTEST_xxx bits):
+/// - DATA_BUS: walking ones then walking zeros at the first word;
+/// - ADDRESS: address-in-address, each word written with its own address
+///   then with its complement, which catches shorted or stuck address lines;
+/// - MARCH_C: March C- with all-zero and all-one words, for stuck-at,
+///   transition and coupling faults between words;
+/// - RANDOM: pseudo-random words from a seeded generator, written in one
+///   pass and checked in a second one, so a failure can be reproduced with
+///   the same seed.
+///
+/// !Usage
+///
+/// -# Make sure nothing else uses the memory range during the test: its
+///    content is destroyed.
+/// -# Call MEMTEST_RunSuite() with a mask of tests to print a report, or
+///    MEMTEST_Run() to run one test and get its MemTestResult.
+//------------------------------------------------------------------------------
+
+#ifndef MEMTEST_H
+#define MEMTEST_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Tests, as bits of a mask.
+#define MEMTEST_DATA_BUS        (1 << 0)
+#define MEMTEST_ADDRESS         (1 << 1)
+#define MEMTEST_MARCH_C         (1 << 2)
+#define MEMTEST_RANDOM          (1 << 3)
+
+/// Number of tests.
+#define MEMTEST_NUM_TESTS       4
+
+/// All the tests.
+#define MEMTEST_ALL             ((1 << MEMTEST_NUM_TESTS) - 1)
+
+/// Number of failing words whose address and values are kept.
+#define MEMTEST_MAX_ADDRESSES   8
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Result of one test.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Number of words read back wrong.
+    unsigned int errors;
+    /// Number of errors on each data bit.
+    unsigned int pBitErrors[32];
+    /// First failing addresses, expected and actual values.
+    unsigned int pAddresses[MEMTEST_MAX_ADDRESSES];
+    unsigned int pExpected[MEMTEST_MAX_ADDRESSES];
+    unsigned int pActual[MEMTEST_MAX_ADDRESSES];
+    /// Number of bytes read and written.
+    unsigned int bytes;
+    /// Duration in microseconds.
+    unsigned int us;
+
+} MemTestResult;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern const char * MEMTEST_GetName(unsigned int test);
+
+extern unsigned int MEMTEST_Run(
+    unsigned int test,
+    volatile unsigned int *pBase,
+    unsigned int size,
+    unsigned int seed,
+    MemTestResult *pResult);
+
+extern unsigned int MEMTEST_RunSuite(
+    const char *pName,
+    volatile unsigned int *pBase,
+    unsigned int size,
+    unsigned int tests,
+    unsigned int seed);
+
+#endif //#ifndef MEMTEST_H
+
@@ -0,0 +1,683 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "net.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Big-endian accesses, at any alignment.
+#define GET16(p)        (((p)[0] << 8) | (p)[1])
+#define GET32(p)        (((unsigned int) (p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+#define PUT16(p, v)     do { (p)[0] = (unsigned char) ((v) >> 8); (p)[1] = (unsigned char) (v); } while (0)
+#define PUT32(p, v)     do { PUT16(p, (v) >> 16); PUT16((p) + 2, v); } while (0)
+
+/// Header sizes.
+#define ETH_HEADER      14
+#define ARP_SIZE        28
+#define IP_HEADER       20
+#define UDP_HEADER      8
+#define ICMP_HEADER     8
+
+/// Ethernet types.
+#define ETH_ARP         0x0806
+#define ETH_IP          0x0800
+
+/// ARP operations.
+#define ARP_REQUEST     1
+#define ARP_REPLY       2
+
+/// IP protocols.
+#define IP_ICMP         1
+#define IP_UDP          17
+
+/// IP flags: don't fragment, more fragments and fragment offset.
+#define IP_DONT_FRAGMENT    0x4000
+#define IP_FRAGMENT         0x3FFF
+
+/// ICMP types.
+#define ICMP_ECHO_REPLY     0
+#define ICMP_ECHO_REQUEST   8
+
+/// Time to live of the sent packets.
+#define IP_TTL          64
+
+/// Broadcast address.
+#define BROADCAST       0xFFFFFFFF
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// ARP cache entry; a zero address marks an empty one.
+typedef struct {
+
+    unsigned int address;
+    unsigned char pMac[6];
+    unsigned short age;
+
+} ArpEntry;
+
+/// Bound UDP port; a zero port marks a free one.
+typedef struct {
+
+    unsigned short port;
+    NetHandler handler;
+
+} Binding;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Driver and addresses.
+static const NetDriver *pNetDriver;
+static unsigned char pLocalMac[6];
+static unsigned int localAddress;
+static unsigned int localMask;
+static unsigned int localGateway;
+
+static const unsigned char pBroadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static ArpEntry pArpCache[NET_ARP_ENTRIES];
+
+/// Address of the last ARP request sent, and set when another may be sent.
+static unsigned int requestAddress;
+static unsigned char requestAllowed;
+
+static Binding pBindings[NET_MAX_PORTS];
+
+/// Receive frame, 2 bytes past a word boundary like the transmit ones.
+static unsigned int pRxBuffer[(NET_FRAME_SIZE + 2 + 3) / 4];
+
+/// Frame of the datagram being built by NET_BeginUdp(), 0 if none.
+static unsigned char *pUdpFrame;
+
+/// Identification of the sent IP packets.
+static unsigned short ipIdentification;
+
+static NetStats stats;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Adds bytes to a one's complement sum.
+/// \param pData  Bytes, taken as big-endian 16-bit words.
+/// \param size  Number of bytes.
+/// \param sum  Sum so far.
+/// \return Sum, not folded.
+//------------------------------------------------------------------------------
+static unsigned int Sum(const unsigned char *pData, unsigned int size, unsigned int sum)
+{
+    while (size > 1) {
+
+        sum += GET16(pData);
+        pData += 2;
+        size -= 2;
+    }
+    if (size > 0) {
+
+        sum += pData[0] << 8;
+    }
+    return sum;
+}
+
+//------------------------------------------------------------------------------
+/// Folds a one's complement sum into the 16-bit checksum.
+//------------------------------------------------------------------------------
+static unsigned short Checksum(unsigned int sum)
+{
+    while (sum >> 16) {
+
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (unsigned short) ~sum;
+}
+
+//------------------------------------------------------------------------------
+/// Claims a transmit frame and writes its Ethernet header.
+/// \param pDestination  Destination MAC address.
+/// \param type  Ethernet type.
+/// \return Frame, 0 if the driver has no free buffer.
+//------------------------------------------------------------------------------
+static unsigned char * BeginFrame(const unsigned char *pDestination, unsigned short type)
+{
+    unsigned char *pFrame = pNetDriver->Allocate();
+
+    if (pFrame == 0) {
+
+        stats.noBuffer++;
+        return 0;
+    }
+    memcpy(pFrame, pDestination, 6);
+    memcpy(pFrame + 6, pLocalMac, 6);
+    PUT16(pFrame + 12, type);
+    return pFrame;
+}
+
+//------------------------------------------------------------------------------
+/// Writes an IP header.
+/// \param pHeader  Header.
+/// \param protocol  Protocol.
+/// \param destination  Destination address.
+/// \param size  Payload size in bytes.
+//------------------------------------------------------------------------------
+static void PutIpHeader(
+    unsigned char *pHeader,
+    unsigned char protocol,
+    unsigned int destination,
+    unsigned int size)
+{
+    pHeader[0] = 0x45;
+    pHeader[1] = 0;
+    PUT16(pHeader + 2, IP_HEADER + size);
+    PUT16(pHeader + 4, ipIdentification);
+    PUT16(pHeader + 6, IP_DONT_FRAGMENT);
+    pHeader[8] = IP_TTL;
+    pHeader[9] = protocol;
+    PUT16(pHeader + 10, 0);
+    PUT32(pHeader + 12, localAddress);
+    PUT32(pHeader + 16, destination);
+    PUT16(pHeader + 10, Checksum(Sum(pHeader, IP_HEADER, 0)));
+    ipIdentification++;
+}
+
+//------------------------------------------------------------------------------
+/// Sends an ARP packet.
+/// \param operation  ARP_REQUEST or ARP_REPLY.
+/// \param pMac  Destination MAC address, also the target one of a reply.
+/// \param address  Target IP address.
+//------------------------------------------------------------------------------
+static void SendArp(unsigned short operation, const unsigned char *pMac, unsigned int address)
+{
+    unsigned char *pFrame = BeginFrame(pMac, ETH_ARP);
+    unsigned char *pArp;
+
+    if (pFrame == 0) {
+
+        return;
+    }
+
+    pArp = pFrame + ETH_HEADER;
+    PUT16(pArp, 1);
+    PUT16(pArp + 2, ETH_IP);
+    pArp[4] = 6;
+    pArp[5] = 4;
+    PUT16(pArp + 6, operation);
+    memcpy(pArp + 8, pLocalMac, 6);
+    PUT32(pArp + 14, localAddress);
+    if (operation == ARP_REPLY) {
+
+        memcpy(pArp + 18, pMac, 6);
+    }
+    else {
+
+        memset(pArp + 18, 0, 6);
+    }
+    PUT32(pArp + 24, address);
+    pNetDriver->Transmit(pFrame, ETH_HEADER + ARP_SIZE);
+
+    if (operation == ARP_REPLY) {
+
+        stats.arpReplies++;
+    }
+    else {
+
+        stats.arpRequests++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Stores an address in the ARP cache, replacing its entry or the oldest one.
+//------------------------------------------------------------------------------
+static void StoreArp(unsigned int address, const unsigned char *pMac)
+{
+    unsigned int entry = 0;
+    unsigned int i;
+
+    for (i = 0; i < NET_ARP_ENTRIES; i++) {
+
+        if (pArpCache[i].address == address) {
+
+            entry = i;
+            break;
+        }
+        if (pArpCache[entry].address == 0) {
+
+            continue;
+        }
+        if ((pArpCache[i].address == 0) || (pArpCache[i].age > pArpCache[entry].age)) {
+
+            entry = i;
+        }
+    }
+    pArpCache[entry].address = address;
+    memcpy(pArpCache[entry].pMac, pMac, 6);
+    pArpCache[entry].age = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Finds the MAC address of the next hop towards an address, and asks for it
+/// when it is not known.
+/// \return MAC address, 0 if not known yet.
+//------------------------------------------------------------------------------
+static const unsigned char * Resolve(unsigned int address)
+{
+    unsigned int i;
+
+    if ((address == BROADCAST) || (address == (localAddress | ~localMask))) {
+
+        return pBroadcastMac;
+    }
+    if ((address ^ localAddress) & localMask) {
+
+        address = localGateway;
+    }
+
+    for (i = 0; i < NET_ARP_ENTRIES; i++) {
+
+        if ((pArpCache[i].address == address) && (address != 0)) {
+
+            return pArpCache[i].pMac;
+        }
+    }
+
+    // One request per tick, but at once for a new address
+    if (requestAllowed || (requestAddress != address)) {
+
+        requestAddress = address;
+        requestAllowed = 0;
+        SendArp(ARP_REQUEST, pBroadcastMac, address);
+    }
+    stats.unresolved++;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Processes a received ARP packet.
+//------------------------------------------------------------------------------
+static void ProcessArp(const unsigned char *pFrame, unsigned int size)
+{
+    const unsigned char *pArp = pFrame + ETH_HEADER;
+    unsigned int sender;
+    unsigned int i;
+
+    if ((size < ETH_HEADER + ARP_SIZE) || (GET16(pArp) != 1) || (GET16(pArp + 2) != ETH_IP)
+        || (pArp[4] != 6) || (pArp[5] != 4)) {
+
+        stats.rxErrors++;
+        return;
+    }
+
+    sender = GET32(pArp + 14);
+    if ((localAddress == 0) || (GET32(pArp + 24) != localAddress)) {
+
+        // Refresh a known entry anyway
+        for (i = 0; i < NET_ARP_ENTRIES; i++) {
+
+            if ((pArpCache[i].address == sender) && (sender != 0)) {
+
+                StoreArp(sender, pArp + 8);
+            }
+        }
+        stats.rxIgnored++;
+        return;
+    }
+
+    StoreArp(sender, pArp + 8);
+    if (GET16(pArp + 6) == ARP_REQUEST) {
+
+        SendArp(ARP_REPLY, pArp + 8, sender);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Answers an ICMP echo request.
+/// \param pFrame  Received frame.
+/// \param pIcmp  ICMP message.
+/// \param size  ICMP message size in bytes.
+//------------------------------------------------------------------------------
+static void ProcessIcmp(const unsigned char *pFrame, const unsigned char *pIcmp, unsigned int size)
+{
+    unsigned char *pReply;
+    unsigned char *pMessage;
+
+    if ((size < ICMP_HEADER) || (Checksum(Sum(pIcmp, size, 0)) != 0)) {
+
+        stats.rxErrors++;
+        return;
+    }
+    if ((pIcmp[0] != ICMP_ECHO_REQUEST) || (pIcmp[1] != 0)) {
+
+        stats.rxIgnored++;
+        return;
+    }
+
+    // Straight back to the sender MAC, which is the gateway for remote hosts
+    pReply = BeginFrame(pFrame + 6, ETH_IP);
+    if (pReply == 0) {
+
+        return;
+    }
+    pMessage = pReply + ETH_HEADER + IP_HEADER;
+    memcpy(pMessage, pIcmp, size);
+    pMessage[0] = ICMP_ECHO_REPLY;
+    PUT16(pMessage + 2, 0);
+    PUT16(pMessage + 2, Checksum(Sum(pMessage, size, 0)));
+    PutIpHeader(pReply + ETH_HEADER, IP_ICMP, GET32(pFrame + ETH_HEADER + 12), size);
+    pNetDriver->Transmit(pReply, ETH_HEADER + IP_HEADER + size);
+    stats.echoReplies++;
+}
+
+//------------------------------------------------------------------------------
+/// Delivers a received UDP datagram to its port.
+/// \param pIp  IP header.
+/// \param pUdp  UDP header.
+/// \param size  Size of the IP payload in bytes.
+//------------------------------------------------------------------------------
+static void ProcessUdp(const unsigned char *pIp, const unsigned char *pUdp, unsigned int size)
+{
+    unsigned int length;
+    unsigned int sum;
+    unsigned short port;
+    unsigned int i;
+
+    if ((size < UDP_HEADER) || ((length = GET16(pUdp + 4)) < UDP_HEADER) || (length > size)) {
+
+        stats.rxErrors++;
+        return;
+    }
+    if (GET16(pUdp + 6) != 0) {
+
+        // Pseudo header: addresses, protocol and length
+        sum = Sum(pIp + 12, 8, IP_UDP + length);
+        if (Checksum(Sum(pUdp, length, sum)) != 0) {
+
+            stats.rxErrors++;
+            return;
+        }
+    }
+
+    port = GET16(pUdp + 2);
+    for (i = 0; i < NET_MAX_PORTS; i++) {
+
+        if ((pBindings[i].port == port) && (port != 0)) {
+
+            stats.udpReceived++;
+            pBindings[i].handler(GET32(pIp + 12), GET16(pUdp), pUdp + UDP_HEADER, length - UDP_HEADER);
+            return;
+        }
+    }
+    stats.rxIgnored++;
+}
+
+//------------------------------------------------------------------------------
+/// Processes a received IP packet.
+//------------------------------------------------------------------------------
+static void ProcessIp(const unsigned char *pFrame, unsigned int size)
+{
+    const unsigned char *pIp = pFrame + ETH_HEADER;
+    unsigned int headerSize;
+    unsigned int length;
+    unsigned int destination;
+
+    if ((size < ETH_HEADER + IP_HEADER) || ((pIp[0] >> 4) != 4)) {
+
+        stats.rxErrors++;
+        return;
+    }
+    headerSize = (pIp[0] & 0xF) * 4;
+    length = GET16(pIp + 2);
+    if ((headerSize < IP_HEADER) || (length < headerSize) || (length > size - ETH_HEADER)
+        || (Checksum(Sum(pIp, headerSize, 0)) != 0)) {
+
+        stats.rxErrors++;
+        return;
+    }
+
+    destination = GET32(pIp + 16);
+    if ((localAddress == 0) || (GET16(pIp + 6) & IP_FRAGMENT)
+        || ((destination != localAddress) && (destination != BROADCAST)
+            && (destination != (localAddress | ~localMask)))) {
+
+        stats.rxIgnored++;
+        return;
+    }
+
+    if ((pIp[9] == IP_ICMP) && (destination == localAddress)) {
+
+        ProcessIcmp(pFrame, pIp + headerSize, length - headerSize);
+    }
+    else if (pIp[9] == IP_UDP) {
+
+        ProcessUdp(pIp, pIp + headerSize, length - headerSize);
+    }
+    else {
+
+        stats.rxIgnored++;
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes the stack.
+/// \param pDriver  Ethernet driver.
+/// \param pMac  MAC address, 6 bytes.
+/// \param address  IP address, 0 to stay silent until NET_SetAddress().
+/// \param mask  Subnet mask.
+/// \param gateway  Gateway address, 0 if none.
+//------------------------------------------------------------------------------
+void NET_Initialize(
+    const NetDriver *pDriver,
+    const unsigned char *pMac,
+    unsigned int address,
+    unsigned int mask,
+    unsigned int gateway)
+{
+    pNetDriver = pDriver;
+    memcpy(pLocalMac, pMac, 6);
+    memset(pBindings, 0, sizeof(pBindings));
+    memset(&stats, 0, sizeof(stats));
+    pUdpFrame = 0;
+    NET_SetAddress(address, mask, gateway);
+}
+
+//------------------------------------------------------------------------------
+/// Changes the IP address, and empties the ARP cache.
+/// \param address  IP address.
+/// \param mask  Subnet mask.
+/// \param gateway  Gateway address, 0 if none.
+//------------------------------------------------------------------------------
+void NET_SetAddress(unsigned int address, unsigned int mask, unsigned int gateway)
+{
+    localAddress = address;
+    localMask = mask;
+    localGateway = gateway;
+    memset(pArpCache, 0, sizeof(pArpCache));
+    requestAddress = 0;
+    requestAllowed = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the IP address, subnet mask and gateway.
+//------------------------------------------------------------------------------
+void NET_GetAddress(unsigned int *pAddress, unsigned int *pMask, unsigned int *pGateway)
+{
+    *pAddress = localAddress;
+    *pMask = localMask;
+    *pGateway = localGateway;
+}
+
+//------------------------------------------------------------------------------
+/// Delivers the datagrams received on a port to a handler, called from
+/// NET_Poll().
+/// \param port  Local port, not 0.
+/// \param handler  Handler, 0 to unbind the port.
+/// \return 1 if done, 0 if all the ports are in use.
+//------------------------------------------------------------------------------
+unsigned char NET_Bind(unsigned short port, NetHandler handler)
+{
+    unsigned int i;
+
+    for (i = 0; i < NET_MAX_PORTS; i++) {
+
+        if (pBindings[i].port == port) {
+
+            pBindings[i].port = handler ? port : 0;
+            pBindings[i].handler = handler;
+            return 1;
+        }
+    }
+    if (handler == 0) {
+
+        return 1;
+    }
+    for (i = 0; i < NET_MAX_PORTS; i++) {
+
+        if (pBindings[i].port == 0) {
+
+            pBindings[i].port = port;
+            pBindings[i].handler = handler;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Processes the received frames.
+/// \param maxFrames  Largest number of frames to process.
+/// \return Number of frames processed.
+//------------------------------------------------------------------------------
+unsigned int NET_Poll(unsigned int maxFrames)
+{
+    unsigned char *pFrame = (unsigned char *) pRxBuffer + 2;
+    unsigned int numFrames = 0;
+    unsigned int size;
+
+    while (numFrames < maxFrames) {
+
+        size = pNetDriver->Receive(pFrame, NET_FRAME_SIZE);
+        if (size == 0) {
+
+            break;
+        }
+        numFrames++;
+        stats.rxFrames++;
+
+        if (size < ETH_HEADER) {
+
+            stats.rxErrors++;
+        }
+        else if (GET16(pFrame + 12) == ETH_ARP) {
+
+            ProcessArp(pFrame, size);
+        }
+        else if (GET16(pFrame + 12) == ETH_IP) {
+
+            ProcessIp(pFrame, size);
+        }
+        else {
+
+            stats.rxIgnored++;
+        }
+    }
+
+    return numFrames;
+}
+
+//------------------------------------------------------------------------------
+/// Ages the ARP cache, and allows the next ARP request. To be called every
+/// second.
+//------------------------------------------------------------------------------
+void NET_Tick(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < NET_ARP_ENTRIES; i++) {
+
+        if ((pArpCache[i].address != 0) && (++pArpCache[i].age >= NET_ARP_LIFETIME)) {
+
+            pArpCache[i].address = 0;
+        }
+    }
+    requestAllowed = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Starts a UDP datagram, in a transmit buffer of the driver.
+/// \param address  Destination address.
+/// \param port  Destination port.
+/// \param sourcePort  Source port.
+/// \return Where to write the payload, up to NET_UDP_PAYLOAD bytes, or 0 if
+///         the datagram cannot be sent yet.
+//------------------------------------------------------------------------------
+unsigned char * NET_BeginUdp(unsigned int address, unsigned short port, unsigned short sourcePort)
+{
+    const unsigned char *pMac;
+    unsigned char *pUdp;
+
+    if ((pUdpFrame != 0) || (localAddress == 0) || (address == 0)) {
+
+        return 0;
+    }
+    pMac = Resolve(address);
+    if (pMac == 0) {
+
+        return 0;
+    }
+    pUdpFrame = BeginFrame(pMac, ETH_IP);
+    if (pUdpFrame == 0) {
+
+        return 0;
+    }
+
+    // The IP header is written by NET_EndUdp(), with the size
+    PUT32(pUdpFrame + ETH_HEADER + 16, address);
+    pUdp = pUdpFrame + ETH_HEADER + IP_HEADER;
+    PUT16(pUdp, sourcePort);
+    PUT16(pUdp + 2, port);
+    PUT16(pUdp + 6, 0);
+    return pUdp + UDP_HEADER;
+}
+
+//------------------------------------------------------------------------------
+/// Sends the datagram started by NET_BeginUdp().
+/// \param size  Payload size in bytes.
+//------------------------------------------------------------------------------
+void NET_EndUdp(unsigned int size)
+{
+    unsigned char *pIp;
+
+    if (pUdpFrame == 0) {
+
+        return;
+    }
+    pIp = pUdpFrame + ETH_HEADER;
+    if (size > NET_UDP_PAYLOAD) {
+
+        size = NET_UDP_PAYLOAD;
+    }
+    PUT16(pIp + IP_HEADER + 4, UDP_HEADER + size);
+    PutIpHeader(pIp, IP_UDP, GET32(pIp + 16), UDP_HEADER + size);
+    pNetDriver->Transmit(pUdpFrame, ETH_HEADER + IP_HEADER + UDP_HEADER + size);
+    pUdpFrame = 0;
+    stats.udpSent++;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the statistics of the stack.
+//------------------------------------------------------------------------------
+const NetStats * NET_GetStats(void)
+{
+    return &stats;
+}
+
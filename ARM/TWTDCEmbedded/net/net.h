@@ -0,0 +1,147 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Minimal IPv4 stack for the event stream: ARP, ICMP echo and UDP, on an
+/// Ethernet driver given as a NetDriver. Just what is needed to send UDP
+/// datagrams to the DAQ PC and answer ping:
+/// - ARP answers the requests for the board address, and resolves the next
+///   hop (the destination on the subnet, the gateway otherwise) in a cache of
+///   NET_ARP_ENTRIES entries, which expire after NET_ARP_LIFETIME ticks;
+/// - ICMP answers echo requests;
+/// - UDP delivers the datagrams to up to NET_MAX_PORTS bound ports. The
+///   checksum of the received datagrams is checked when present; the sent
+///   ones carry none, the event records having their own CRC.
+///
+/// Fragments, IP options on the sent packets and everything else are left
+/// out. Outgoing datagrams are built in place in the driver transmit buffer:
+/// NET_BeginUdp() returns where to write the payload, NET_EndUdp() sends it.
+/// All the fields are big-endian and accessed byte by byte, so the stack
+/// runs on any host.
+///
+/// !Usage
+///
+/// -# Call NET_Initialize() with the driver, the MAC and IP addresses.
+/// -# Bind the UDP ports to receive with NET_Bind().
+/// -# Call NET_Poll() when frames are received, and NET_Tick() every second.
+/// -# Send datagrams with NET_BeginUdp() and NET_EndUdp(). NET_BeginUdp()
+///    returns 0 while the next hop is being resolved or when the driver has
+///    no free buffer: try again later.
+///
+/// \note This module is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef NET_H
+#define NET_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Largest Ethernet frame without the FCS.
+#define NET_FRAME_SIZE          1514
+
+/// Largest UDP payload in one frame.
+#define NET_UDP_PAYLOAD         (NET_FRAME_SIZE - 14 - 20 - 8)
+
+/// Number of UDP ports which can be bound.
+#define NET_MAX_PORTS           4
+
+/// Number of entries of the ARP cache, and their lifetime in ticks.
+#define NET_ARP_ENTRIES         4
+#define NET_ARP_LIFETIME        300
+
+/// Builds an IP address from its 4 bytes.
+#define NET_ADDRESS(a, b, c, d) (((unsigned int) (a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Ethernet driver.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Claims a transmit buffer of NET_FRAME_SIZE bytes, 0 if none is free.
+    unsigned char * (*Allocate)(void);
+    /// Sends a claimed buffer.
+    void (*Transmit)(unsigned char *pFrame, unsigned int size);
+    /// Copies out a received frame, returns its size or 0 if none.
+    unsigned int (*Receive)(unsigned char *pFrame, unsigned int size);
+
+} NetDriver;
+
+//------------------------------------------------------------------------------
+/// Handler of the datagrams received on a bound port.
+/// \param address  Source IP address.
+/// \param port  Source port.
+/// \param pData  Payload.
+/// \param size  Payload size in bytes.
+//------------------------------------------------------------------------------
+typedef void (*NetHandler)(
+    unsigned int address,
+    unsigned short port,
+    const unsigned char *pData,
+    unsigned int size);
+
+//------------------------------------------------------------------------------
+/// Statistics of the stack.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Frames received.
+    unsigned int rxFrames;
+    /// Frames malformed or with a bad checksum.
+    unsigned int rxErrors;
+    /// Frames for another host, or of an unsupported protocol or port.
+    unsigned int rxIgnored;
+    /// ARP requests and replies sent.
+    unsigned int arpRequests;
+    unsigned int arpReplies;
+    /// ICMP echo replies sent.
+    unsigned int echoReplies;
+    /// UDP datagrams received and sent.
+    unsigned int udpReceived;
+    unsigned int udpSent;
+    /// Datagrams not started for want of the next hop address.
+    unsigned int unresolved;
+    /// Frames not sent for want of a transmit buffer.
+    unsigned int noBuffer;
+
+} NetStats;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void NET_Initialize(
+    const NetDriver *pDriver,
+    const unsigned char *pMac,
+    unsigned int address,
+    unsigned int mask,
+    unsigned int gateway);
+
+extern void NET_SetAddress(unsigned int address, unsigned int mask, unsigned int gateway);
+
+extern void NET_GetAddress(unsigned int *pAddress, unsigned int *pMask, unsigned int *pGateway);
+
+extern unsigned char NET_Bind(unsigned short port, NetHandler handler);
+
+extern unsigned int NET_Poll(unsigned int maxFrames);
+
+extern void NET_Tick(void);
+
+extern unsigned char * NET_BeginUdp(
+    unsigned int address,
+    unsigned short port,
+    unsigned short sourcePort);
+
+extern void NET_EndUdp(unsigned int size);
+
+extern const NetStats * NET_GetStats(void);
+
+#endif //#ifndef NET_H
+
@@ -0,0 +1,264 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   SCHED
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "sched.h"
+#include <timer/timer.h>
+#include <board.h>
+#include <pmc/pmc.h>
+#include <utility/assert.h>
+#include <utility/critical.h>
+#include <utility/trace.h>
+#include <stdio.h>
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// FIFO of ready tasks for one priority level.
+typedef struct {
+
+    SchedTask *pHead;
+    SchedTask *pTail;
+
+} ReadyQueue;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Ready queues, indexed by priority.
+static ReadyQueue queues[SCHED_NUM_PRIORITIES];
+
+/// Bitmask of the non-empty ready queues.
+static volatile unsigned int readyMask;
+
+/// List of all the initialized tasks.
+static SchedTask *pTasks;
+
+/// Start of the current load window, in ticks.
+static unsigned int windowStart;
+
+/// Idle time accumulated in the current load window, in ticks.
+static unsigned int windowIdle;
+
+/// CPU load over the last complete window, in per mille.
+static volatile unsigned int load;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Removes and returns the first task of the highest priority non-empty queue,
+/// or 0 if no task is ready. Must be called with interrupts masked.
+//------------------------------------------------------------------------------
+static SchedTask * PopReadyTask(void)
+{
+    unsigned int priority = 0;
+    ReadyQueue *pQueue;
+    SchedTask *pTask;
+
+    if (readyMask == 0) {
+
+        return 0;
+    }
+
+    while ((readyMask & (1 << priority)) == 0) {
+
+        priority++;
+    }
+
+    pQueue = &queues[priority];
+    pTask = pQueue->pHead;
+    pQueue->pHead = pTask->pNextReady;
+    if (pQueue->pHead == 0) {
+
+        pQueue->pTail = 0;
+        readyMask &= ~(1 << priority);
+    }
+    pTask->pNextReady = 0;
+    pTask->pending = 0;
+
+    return pTask;
+}
+
+//------------------------------------------------------------------------------
+/// Closes the load window once SCHED_LOAD_WINDOW ms have elapsed.
+/// \param now  Current tick count.
+//------------------------------------------------------------------------------
+static void UpdateLoad(unsigned int now)
+{
+    unsigned int elapsed = now - windowStart;
+    unsigned int window = (TIMER_GetFrequency() / 1000) * SCHED_LOAD_WINDOW;
+
+    if (elapsed >= window) {
+
+        load = 1000 - windowIdle / (elapsed / 1000);
+        windowStart = now;
+        windowIdle = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Resets the ready queues and the load measurement.
+//------------------------------------------------------------------------------
+void SCHED_Initialize(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < SCHED_NUM_PRIORITIES; i++) {
+
+        queues[i].pHead = 0;
+        queues[i].pTail = 0;
+    }
+    readyMask = 0;
+    pTasks = 0;
+    windowStart = TIMER_GetTicks();
+    windowIdle = 0;
+    load = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Initializes a task and adds it to the statistics list.
+/// \param pTask  Task to initialize.
+/// \param name  Name displayed in statistics.
+/// \param priority  Priority level (SCHED_PRIO_xxx).
+/// \param handler  Function executed when the task runs.
+/// \param pArg  Argument passed to the handler.
+//------------------------------------------------------------------------------
+void SCHED_InitializeTask(
+    SchedTask *pTask,
+    const char *name,
+    unsigned char priority,
+    void (*handler)(void *),
+    void *pArg)
+{
+    SANITY_CHECK(priority < SCHED_NUM_PRIORITIES);
+    SANITY_CHECK(handler);
+
+    pTask->handler = handler;
+    pTask->pArg = pArg;
+    pTask->name = name;
+    pTask->pNextReady = 0;
+    pTask->priority = priority;
+    pTask->pending = 0;
+    pTask->runs = 0;
+    pTask->ticks = 0;
+    pTask->maxTicks = 0;
+
+    pTask->pNextTask = pTasks;
+    pTasks = pTask;
+}
+
+//------------------------------------------------------------------------------
+/// Appends a task to the ready queue of its priority level, unless it is
+/// already pending. Can be called from interrupt handlers.
+/// \param pTask  Task to post.
+//------------------------------------------------------------------------------
+void SCHED_Post(SchedTask *pTask)
+{
+    CriticalState state;
+    ReadyQueue *pQueue;
+
+    state = CRITICAL_Enter();
+    if (!pTask->pending) {
+
+        pTask->pending = 1;
+        pQueue = &queues[pTask->priority];
+        if (pQueue->pTail) {
+
+            pQueue->pTail->pNextReady = pTask;
+        }
+        else {
+
+            pQueue->pHead = pTask;
+        }
+        pQueue->pTail = pTask;
+        readyMask |= 1 << pTask->priority;
+    }
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Scheduler main loop. Runs the ready tasks by order of priority, and puts
+/// the CPU in idle mode when none is left. Never returns.
+/// The ready queues are checked with interrupts masked right before going
+/// idle, so a task posted by an interrupt cannot be missed: the pending
+/// interrupt still wakes the core up and is serviced as soon as the mask is
+/// restored.
+//------------------------------------------------------------------------------
+void SCHED_Run(void)
+{
+    CriticalState state;
+    SchedTask *pTask;
+    unsigned int start;
+    unsigned int end;
+
+    while (1) {
+
+        state = CRITICAL_Enter();
+        pTask = PopReadyTask();
+        if (pTask == 0) {
+
+            start = TIMER_GetTicks();
+            PMC_CPUInIdleMode();
+            end = TIMER_GetTicks();
+            windowIdle += end - start;
+            CRITICAL_Exit(state);
+        }
+        else {
+
+            CRITICAL_Exit(state);
+            start = TIMER_GetTicks();
+            pTask->handler(pTask->pArg);
+            end = TIMER_GetTicks();
+
+            pTask->runs++;
+            pTask->ticks += end - start;
+            if ((end - start) > pTask->maxTicks) {
+
+                pTask->maxTicks = end - start;
+            }
+        }
+
+        UpdateLoad(end);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the CPU load over the last complete window, in per mille. Time
+/// spent in interrupt handlers counts as busy.
+//------------------------------------------------------------------------------
+unsigned int SCHED_GetLoad(void)
+{
+    return load;
+}
+
+//------------------------------------------------------------------------------
+/// Prints the CPU load and the statistics of every task on the DBGU.
+//------------------------------------------------------------------------------
+void SCHED_PrintStats(void)
+{
+    SchedTask *pTask = pTasks;
+
+    printf("-- CPU load %u.%u %%\n\r", load / 10, load % 10);
+    while (pTask) {
+
+        printf(" -- %-12s prio %u runs %10u avg %8u us max %8u us\n\r",
+               pTask->name,
+               pTask->priority,
+               pTask->runs,
+               pTask->runs ? TIMER_TicksToUs((unsigned int) (pTask->ticks / pTask->runs)) : 0,
+               TIMER_TicksToUs(pTask->maxTicks));
+        pTask = pTask->pNextTask;
+    }
+}
+
@@ -0,0 +1,100 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Run-to-completion task scheduler with one FIFO queue per priority level.
+/// When no task is pending the CPU is put in idle mode until the next
+/// interrupt, and the time spent idle is used to compute the CPU load.
+///
+/// !Usage
+///
+/// -# Initialize the scheduler with SCHED_Initialize(), after TIMER_Configure().
+/// -# Declare one SchedTask per job and set it up with SCHED_InitializeTask().
+/// -# Post tasks with SCHED_Post(), from the main program or from interrupt
+///    handlers. Posting a task which is already pending has no effect.
+/// -# Call SCHED_Run() at the end of main(); it never returns.
+/// -# Read the CPU load with SCHED_GetLoad() or print the per-task statistics
+///    with SCHED_PrintStats().
+///
+/// \note Tasks are never preempted by other tasks, only by interrupts. A task
+/// which has more work than it should do in one go must re-post itself.
+//------------------------------------------------------------------------------
+
+#ifndef SCHED_H
+#define SCHED_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Priority of the tasks draining the front-end (highest).
+#define SCHED_PRIO_READOUT          0
+/// Priority of the tasks processing data already in SDRAM.
+#define SCHED_PRIO_PROCESSING       1
+/// Priority of the tasks sending data off the board.
+#define SCHED_PRIO_TRANSMIT         2
+/// Priority of monitoring, user interface and other slow tasks (lowest).
+#define SCHED_PRIO_HOUSEKEEPING     3
+/// Number of priority levels.
+#define SCHED_NUM_PRIORITIES        4
+
+/// Length of the window over which the CPU load is computed, in ms.
+#define SCHED_LOAD_WINDOW           1000
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// A schedulable job. Instances are owned by the caller and must stay valid
+/// for the whole program lifetime.
+//------------------------------------------------------------------------------
+typedef struct _SchedTask {
+
+    /// Function executed each time the task runs.
+    void (*handler)(void *pArg);
+    /// Argument given to the handler.
+    void *pArg;
+    /// Name displayed in statistics.
+    const char *name;
+    /// Next task in the ready queue.
+    struct _SchedTask *pNextReady;
+    /// Next task in the list of all tasks.
+    struct _SchedTask *pNextTask;
+    /// Priority level (SCHED_PRIO_xxx).
+    unsigned char priority;
+    /// Indicates if the task is in a ready queue.
+    volatile unsigned char pending;
+    /// Number of times the handler has been executed.
+    unsigned int runs;
+    /// Total time spent in the handler, in timer ticks.
+    unsigned long long ticks;
+    /// Longest single execution of the handler, in timer ticks.
+    unsigned int maxTicks;
+
+} SchedTask;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SCHED_Initialize(void);
+
+extern void SCHED_InitializeTask(
+    SchedTask *pTask,
+    const char *name,
+    unsigned char priority,
+    void (*handler)(void *),
+    void *pArg);
+
+extern void SCHED_Post(SchedTask *pTask);
+
+extern void SCHED_Run(void);
+
+extern unsigned int SCHED_GetLoad(void);
+
+extern void SCHED_PrintStats(void);
+
+#endif //#ifndef SCHED_H
+
@@ -0,0 +1,595 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   SDCARD
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "sdcard.h"
+#include <board.h>
+#include <pio/pio.h>
+#include <aic/aic.h>
+#include <mci/mci.h>
+#include <timer/timer.h>
+#include <utility/assert.h>
+#include <utility/critical.h>
+#include <utility/trace.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// MCI connected to the card.
+#define SDCARD_MCI          BOARD_SD_MCI_BASE
+#define SDCARD_ID           BOARD_SD_MCI_ID
+
+/// Command register values of the SD commands used: index, response type and
+/// data transfer.
+#define CMD_R1              (AT91C_MCI_RSPTYP_48 | AT91C_MCI_MAXLAT)
+#define CMD_INIT                    (AT91C_MCI_RSPTYP_NO | AT91C_MCI_SPCMD_INIT)
+#define CMD0_GO_IDLE_STATE          (0 | AT91C_MCI_RSPTYP_NO)
+#define CMD2_ALL_SEND_CID           (2 | AT91C_MCI_RSPTYP_136 | AT91C_MCI_MAXLAT)
+#define CMD3_SEND_RELATIVE_ADDR     (3 | CMD_R1)
+#define CMD7_SELECT_CARD            (7 | CMD_R1)
+#define CMD8_SEND_IF_COND           (8 | CMD_R1)
+#define CMD9_SEND_CSD               (9 | AT91C_MCI_RSPTYP_136 | AT91C_MCI_MAXLAT)
+#define CMD12_STOP_TRANSMISSION     (12 | CMD_R1 | AT91C_MCI_TRCMD_STOP)
+#define CMD16_SET_BLOCKLEN          (16 | CMD_R1)
+#define CMD17_READ_SINGLE_BLOCK     (17 | CMD_R1 | AT91C_MCI_TRCMD_START \
+                                     | AT91C_MCI_TRTYP_BLOCK | AT91C_MCI_TRDIR)
+#define CMD18_READ_MULTIPLE_BLOCK   (18 | CMD_R1 | AT91C_MCI_TRCMD_START \
+                                     | AT91C_MCI_TRTYP_MULTIPLE | AT91C_MCI_TRDIR)
+#define CMD24_WRITE_BLOCK           (24 | CMD_R1 | AT91C_MCI_TRCMD_START \
+                                     | AT91C_MCI_TRTYP_BLOCK)
+#define CMD25_WRITE_MULTIPLE_BLOCK  (25 | CMD_R1 | AT91C_MCI_TRCMD_START \
+                                     | AT91C_MCI_TRTYP_MULTIPLE)
+#define CMD55_APP_CMD               (55 | CMD_R1)
+#define ACMD6_SET_BUS_WIDTH         (6 | CMD_R1)
+#define ACMD41_SD_SEND_OP_COND      (41 | AT91C_MCI_RSPTYP_48)
+
+/// SEND_IF_COND argument: 2.7-3.6V and check pattern, echoed by the card.
+#define SDCARD_IF_COND      0x1AA
+
+/// OCR bits: 3.2-3.4V window, high capacity (HCS/CCS), power up done.
+#define SDCARD_OCR_VOLTAGE  0x00300000
+#define SDCARD_OCR_CCS      (1 << 30)
+#define SDCARD_OCR_READY    (1 << 31)
+
+/// Card status bits (R1) reporting an error.
+#define SDCARD_R1_ERRORS    0xFDF98008
+
+/// Status flags reporting a failed data transfer.
+#define SDCARD_DATA_ERRORS  (AT91C_MCI_DCRCE | AT91C_MCI_DTOE | AT91C_MCI_UNRE)
+
+/// Timeouts of the synchronous operations, in milliseconds.
+#define SDCARD_INIT_TIMEOUT 1000
+#define SDCARD_BUSY_TIMEOUT 500
+
+/// Maximum number of words of one PDC buffer, a whole number of blocks.
+#define SDCARD_CHUNK_SIZE   (128 * SDCARD_BLOCK_SIZE / 4)
+
+/// Write states.
+#define SDCARD_STATE_IDLE       0
+/// Data in the PDC.
+#define SDCARD_STATE_DATA       1
+/// PDC empty, waiting for the end of the last block.
+#define SDCARD_STATE_LAST       2
+/// Waiting for the response to STOP_TRANSMISSION.
+#define SDCARD_STATE_STOP       3
+/// Waiting for the card to program the data (busy).
+#define SDCARD_STATE_PROGRAM    4
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// MCI pins.
+static const Pin pinsMci[] = {BOARD_SD_PINS};
+
+/// Master clock frequency.
+static unsigned int masterClock;
+
+/// Indicates if a card is identified and ready for data transfers.
+static unsigned char identified = 0;
+
+/// Indicates if the card uses block addresses (SDHC) instead of bytes.
+static unsigned char blockAddressing;
+
+/// Relative card address.
+static unsigned int rca;
+
+/// Card capacity in blocks.
+static unsigned int numBlocks = 0;
+
+/// Write state (SDCARD_STATE_xxx).
+static volatile unsigned char writeState = SDCARD_STATE_IDLE;
+
+/// Indicates if the write in progress is a multiple block one.
+static unsigned char multiple;
+
+/// Part of the write not handed to the PDC yet.
+static const unsigned int *pRemaining;
+static volatile unsigned int remaining;
+
+/// Number of failed writes.
+static volatile unsigned int errors = 0;
+
+/// Function called at the end of each write.
+static void (*pDoneCallback)(void) = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Polls the MCI status until one of the given flags or an error is set.
+/// \param flags  Status flags to wait for.
+/// \param timeout  Timeout in milliseconds.
+/// \return The last status read.
+//------------------------------------------------------------------------------
+static unsigned int WaitStatus(unsigned int flags, unsigned int timeout)
+{
+    unsigned int start = TIMER_GetTicks();
+    unsigned int ticks = (TIMER_GetFrequency() / 1000) * timeout;
+    unsigned int status;
+
+    do {
+
+        status = SDCARD_MCI->MCI_SR;
+        if (status & (flags | SDCARD_DATA_ERRORS)) {
+
+            break;
+        }
+    }
+    while ((TIMER_GetTicks() - start) < ticks);
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+/// Sends a command with an R1 response and checks the card status.
+/// \param command  Command register value (CMDxx_xxx).
+/// \param argument  Command argument.
+/// \return 0 if the command succeeded, else the MCI error flags or the card
+/// status error bits.
+//------------------------------------------------------------------------------
+static unsigned int SendCardCommand(unsigned int command, unsigned int argument)
+{
+    unsigned int status;
+    unsigned int response;
+
+    status = MCI_SendCommand(SDCARD_MCI, command, argument);
+    if (status != 0) {
+
+        return status;
+    }
+    MCI_GetResponse(SDCARD_MCI, &response, 1);
+
+    return response & SDCARD_R1_ERRORS;
+}
+
+//------------------------------------------------------------------------------
+/// Sends an application specific command (ACMDxx).
+/// \param command  Command register value (ACMDxx_xxx).
+/// \param argument  Command argument.
+/// \return The MCI error flags of the command, 0 if it succeeded.
+//------------------------------------------------------------------------------
+static unsigned int SendAppCommand(unsigned int command, unsigned int argument)
+{
+    unsigned int status;
+
+    status = SendCardCommand(CMD55_APP_CMD, rca << 16);
+    if (status != 0) {
+
+        return status;
+    }
+
+    return MCI_SendCommand(SDCARD_MCI, command, argument);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the card address of a block.
+/// \param block  Block number.
+//------------------------------------------------------------------------------
+static unsigned int Address(unsigned int block)
+{
+    return blockAddressing ? block : block * SDCARD_BLOCK_SIZE;
+}
+
+//------------------------------------------------------------------------------
+/// Computes the card capacity from its CSD register.
+/// \param pCsd  CSD, most significant word first.
+/// \return Number of blocks.
+//------------------------------------------------------------------------------
+static unsigned int GetCapacity(const unsigned int *pCsd)
+{
+    unsigned int size;
+    unsigned int mult;
+    unsigned int blockLength;
+
+    // CSD version 2.0 (high capacity): C_SIZE in 512kB units
+    if ((pCsd[0] >> 30) == 1) {
+
+        size = ((pCsd[1] & 0x3F) << 16) | (pCsd[2] >> 16);
+        return (size + 1) * 1024;
+    }
+
+    // CSD version 1.0: (C_SIZE + 1) x 2^(C_SIZE_MULT + 2) x 2^READ_BL_LEN bytes
+    size = ((pCsd[1] & 0x3FF) << 2) | (pCsd[2] >> 30);
+    mult = (pCsd[2] >> 15) & 0x7;
+    blockLength = (pCsd[1] >> 16) & 0xF;
+
+    return ((size + 1) << (mult + 2 + blockLength)) / SDCARD_BLOCK_SIZE;
+}
+
+//------------------------------------------------------------------------------
+/// Hands as much of the write as possible to the PDC.
+//------------------------------------------------------------------------------
+static void QueueChunks(void)
+{
+    unsigned int size;
+
+    while (remaining > 0) {
+
+        size = (remaining > SDCARD_CHUNK_SIZE) ? SDCARD_CHUNK_SIZE : remaining;
+        if (!MCI_WriteBuffer(SDCARD_MCI, pRemaining, size)) {
+
+            break;
+        }
+        pRemaining += size;
+        remaining -= size;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Ends the data phase of the write: stops a multiple block write, then waits
+/// for the card to program the data.
+//------------------------------------------------------------------------------
+static void EndData(void)
+{
+    SDCARD_MCI->MCI_PTCR = AT91C_PDC_TXTDIS;
+    if (multiple) {
+
+        writeState = SDCARD_STATE_STOP;
+        SDCARD_MCI->MCI_ARGR = 0;
+        SDCARD_MCI->MCI_CMDR = CMD12_STOP_TRANSMISSION;
+        SDCARD_MCI->MCI_IER = AT91C_MCI_CMDRDY;
+    }
+    else {
+
+        writeState = SDCARD_STATE_PROGRAM;
+        SDCARD_MCI->MCI_IER = AT91C_MCI_NOTBUSY;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// MCI interrupt handler: chains the chunks of the write in progress, then
+/// goes through the end of the write (last block sent, STOP_TRANSMISSION,
+/// card programming).
+//------------------------------------------------------------------------------
+static void ISR_Mci(void)
+{
+    unsigned int status = SDCARD_MCI->MCI_SR & SDCARD_MCI->MCI_IMR;
+
+    if (status & SDCARD_DATA_ERRORS) {
+
+        SDCARD_MCI->MCI_IDR = 0xFFFFFFFF;
+        MCI_StopPdc(SDCARD_MCI);
+        errors++;
+        TRACE_LOG_WARNING("SDCARD: write error, status 0x%08X\n\r", status);
+        EndData();
+        return;
+    }
+    if (status & AT91C_MCI_ENDTX) {
+
+        QueueChunks();
+        if (remaining == 0) {
+
+            SDCARD_MCI->MCI_IDR = AT91C_MCI_ENDTX;
+            SDCARD_MCI->MCI_IER = AT91C_MCI_TXBUFE;
+        }
+    }
+    if (status & AT91C_MCI_TXBUFE) {
+
+        // The last block is being sent; reading the status above cleared the
+        // end flag of the previous ones
+        SDCARD_MCI->MCI_IDR = AT91C_MCI_TXBUFE;
+        SDCARD_MCI->MCI_IER = AT91C_MCI_BLKE;
+        writeState = SDCARD_STATE_LAST;
+    }
+    if (status & AT91C_MCI_BLKE) {
+
+        SDCARD_MCI->MCI_IDR = AT91C_MCI_BLKE | SDCARD_DATA_ERRORS;
+        EndData();
+    }
+    if (status & AT91C_MCI_CMDRDY) {
+
+        SDCARD_MCI->MCI_IDR = AT91C_MCI_CMDRDY;
+        writeState = SDCARD_STATE_PROGRAM;
+        SDCARD_MCI->MCI_IER = AT91C_MCI_NOTBUSY;
+    }
+    if (status & AT91C_MCI_NOTBUSY) {
+
+        SDCARD_MCI->MCI_IDR = AT91C_MCI_NOTBUSY;
+        writeState = SDCARD_STATE_IDLE;
+        if (pDoneCallback) {
+
+            pDoneCallback();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sets up the MCI pins and peripheral, and the function called at the end of
+/// each write.
+/// \param callback  Function called in interrupt context (can be 0).
+//------------------------------------------------------------------------------
+void SDCARD_Initialize(void (*callback)(void))
+{
+    pDoneCallback = callback;
+    PIO_Configure(pinsMci, PIO_LISTSIZE(pinsMci));
+    AT91C_BASE_PMC->PMC_PCER = 1 << SDCARD_ID;
+    MCI_Configure(SDCARD_MCI, BOARD_SD_SLOT);
+
+    AIC_ConfigureIT(SDCARD_ID, AT91C_AIC_PRIOR_LOWEST, ISR_Mci);
+    AIC_EnableIT(SDCARD_ID);
+}
+
+//------------------------------------------------------------------------------
+/// Sets the card clock for a new master clock frequency.
+/// \param mck  Master clock frequency.
+//------------------------------------------------------------------------------
+void SDCARD_Configure(unsigned int mck)
+{
+    masterClock = mck;
+    MCI_SetSpeed(SDCARD_MCI, identified ? SDCARD_SPEED : SDCARD_INIT_SPEED, mck);
+}
+
+//------------------------------------------------------------------------------
+/// Identifies and selects the card, then switches to the 4-bit bus and the
+/// full card clock. Blocks for up to a second while the card powers up.
+/// \return 1 if a card is ready for data transfers.
+//------------------------------------------------------------------------------
+unsigned char SDCARD_Identify(void)
+{
+    unsigned int response[4];
+    unsigned int status;
+    unsigned int start;
+    unsigned int timeout;
+    unsigned char version2;
+
+    SANITY_CHECK(writeState == SDCARD_STATE_IDLE);
+
+    identified = 0;
+    rca = 0;
+    MCI_SetBusWidth(SDCARD_MCI, 0);
+    MCI_SetSpeed(SDCARD_MCI, SDCARD_INIT_SPEED, masterClock);
+
+    // 74 clock cycles before the first command, then reset the card
+    MCI_SendCommand(SDCARD_MCI, CMD_INIT, 0);
+    MCI_SendCommand(SDCARD_MCI, CMD0_GO_IDLE_STATE, 0);
+
+    // Version 2.00 cards echo the check pattern, older ones do not answer
+    status = MCI_SendCommand(SDCARD_MCI, CMD8_SEND_IF_COND, SDCARD_IF_COND);
+    MCI_GetResponse(SDCARD_MCI, response, 1);
+    version2 = (status == 0) && ((response[0] & 0xFFF) == SDCARD_IF_COND);
+
+    // Wait for the end of the power up, asking for high capacity if possible
+    // (the OCR response has no CRC)
+    start = TIMER_GetTicks();
+    timeout = (TIMER_GetFrequency() / 1000) * SDCARD_INIT_TIMEOUT;
+    do {
+
+        status = SendAppCommand(ACMD41_SD_SEND_OP_COND,
+                                SDCARD_OCR_VOLTAGE | (version2 ? SDCARD_OCR_CCS : 0));
+        if ((status & ~(AT91C_MCI_RCRCE | AT91C_MCI_RINDE)) != 0) {
+
+            TRACE_INFO("SDCARD: no card (0x%08X)\n\r", status);
+            return 0;
+        }
+        MCI_GetResponse(SDCARD_MCI, response, 1);
+        if ((TIMER_GetTicks() - start) > timeout) {
+
+            TRACE_WARNING("SDCARD: power up timeout\n\r");
+            return 0;
+        }
+    }
+    while ((response[0] & SDCARD_OCR_READY) == 0);
+    blockAddressing = (response[0] & SDCARD_OCR_CCS) != 0;
+
+    // Identification, then capacity
+    status = MCI_SendCommand(SDCARD_MCI, CMD2_ALL_SEND_CID, 0);
+    if (status == 0) {
+
+        status = MCI_SendCommand(SDCARD_MCI, CMD3_SEND_RELATIVE_ADDR, 0);
+        MCI_GetResponse(SDCARD_MCI, response, 1);
+        rca = response[0] >> 16;
+    }
+    if (status == 0) {
+
+        status = MCI_SendCommand(SDCARD_MCI, CMD9_SEND_CSD, rca << 16);
+        MCI_GetResponse(SDCARD_MCI, response, 4);
+        numBlocks = GetCapacity(response);
+    }
+
+    // Transfer state, 4-bit bus and 512-byte blocks
+    if (status == 0) {
+
+        status = SendCardCommand(CMD7_SELECT_CARD, rca << 16);
+        if ((WaitStatus(AT91C_MCI_NOTBUSY, SDCARD_BUSY_TIMEOUT) & AT91C_MCI_NOTBUSY) == 0) {
+
+            status = AT91C_MCI_DTOE;
+        }
+    }
+    if (status == 0) {
+
+        status = SendAppCommand(ACMD6_SET_BUS_WIDTH, 2);
+        MCI_SetBusWidth(SDCARD_MCI, 1);
+    }
+    if ((status == 0) && !blockAddressing) {
+
+        status = SendCardCommand(CMD16_SET_BLOCKLEN, SDCARD_BLOCK_SIZE);
+    }
+    if (status != 0) {
+
+        TRACE_WARNING("SDCARD: identification failed (0x%08X)\n\r", status);
+        return 0;
+    }
+
+    MCI_SetBlockLength(SDCARD_MCI, SDCARD_BLOCK_SIZE);
+    identified = 1;
+    TRACE_INFO("SDCARD: %s card, %u blocks, %u Hz\n\r", blockAddressing ? "SDHC" : "SD",
+               numBlocks, MCI_SetSpeed(SDCARD_MCI, SDCARD_SPEED, masterClock));
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the capacity of the identified card in blocks, 0 if none.
+//------------------------------------------------------------------------------
+unsigned int SDCARD_GetNumBlocks(void)
+{
+    return identified ? numBlocks : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing consecutive blocks. The first block is taken from pFirst,
+/// the following ones from pNext, both read in place by the PDC.
+/// \param block  First block number.
+/// \param pFirst  Data of the first block, word aligned.
+/// \param pNext  Data of the other blocks, word aligned (unused for a single
+///               block).
+/// \param count  Number of blocks, up to 65535.
+/// \return 1 if the write is started, 0 if the card is busy, not identified,
+/// or rejected the write (which then counts as an error).
+//------------------------------------------------------------------------------
+unsigned char SDCARD_Write(
+    unsigned int block,
+    const void *pFirst,
+    const void *pNext,
+    unsigned int count)
+{
+    CriticalState state;
+    unsigned int status;
+
+    SANITY_CHECK((count > 0) && (count <= 0xFFFF));
+    SANITY_CHECK((count == 1) || pNext);
+
+    if (!identified || (writeState != SDCARD_STATE_IDLE)) {
+
+        return 0;
+    }
+
+    // The card may still be programming the previous write; the end of the
+    // busy period calls back
+    if ((SDCARD_MCI->MCI_SR & AT91C_MCI_NOTBUSY) == 0) {
+
+        writeState = SDCARD_STATE_PROGRAM;
+        SDCARD_MCI->MCI_IER = AT91C_MCI_NOTBUSY;
+        return 0;
+    }
+
+    multiple = (count > 1);
+    pRemaining = (const unsigned int *) pNext;
+    remaining = (count - 1) * (SDCARD_BLOCK_SIZE / 4);
+    SDCARD_MCI->MCI_BLKR = count;
+    MCI_WriteBuffer(SDCARD_MCI, pFirst, SDCARD_BLOCK_SIZE / 4);
+    QueueChunks();
+
+    status = SendCardCommand(multiple ? CMD25_WRITE_MULTIPLE_BLOCK : CMD24_WRITE_BLOCK,
+                             Address(block));
+    if (status != 0) {
+
+        MCI_StopPdc(SDCARD_MCI);
+        errors++;
+        TRACE_WARNING("SDCARD: write of block %u rejected (0x%08X)\n\r", block, status);
+        return 0;
+    }
+
+    // The PDC is enabled after the command, see the datasheet
+    state = CRITICAL_Enter();
+    writeState = SDCARD_STATE_DATA;
+    SDCARD_MCI->MCI_PTCR = AT91C_PDC_TXTEN;
+    SDCARD_MCI->MCI_IER = ((remaining > 0) ? AT91C_MCI_ENDTX : AT91C_MCI_TXBUFE)
+                          | SDCARD_DATA_ERRORS;
+    CRITICAL_Exit(state);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Reads consecutive blocks, waiting for the end of the transfer.
+/// \param block  First block number.
+/// \param pData  Destination buffer, word aligned.
+/// \param count  Number of blocks, up to SDCARD_MAX_READ.
+/// \return 1 if the blocks were read, 0 if the card is busy writing, not
+/// identified, or the read failed.
+//------------------------------------------------------------------------------
+unsigned char SDCARD_Read(unsigned int block, void *pData, unsigned int count)
+{
+    unsigned int status;
+
+    SANITY_CHECK((count > 0) && (count <= SDCARD_MAX_READ));
+
+    if (!identified || (writeState != SDCARD_STATE_IDLE)) {
+
+        return 0;
+    }
+    if ((WaitStatus(AT91C_MCI_NOTBUSY, SDCARD_BUSY_TIMEOUT) & AT91C_MCI_NOTBUSY) == 0) {
+
+        TRACE_WARNING("SDCARD: card busy\n\r");
+        return 0;
+    }
+
+    SDCARD_MCI->MCI_BLKR = count;
+    MCI_ReadBuffer(SDCARD_MCI, pData, count * (SDCARD_BLOCK_SIZE / 4));
+    SDCARD_MCI->MCI_PTCR = AT91C_PDC_RXTEN;
+    status = SendCardCommand((count > 1) ? CMD18_READ_MULTIPLE_BLOCK : CMD17_READ_SINGLE_BLOCK,
+                             Address(block));
+    if (status == 0) {
+
+        status = WaitStatus(AT91C_MCI_RXBUFF, SDCARD_BUSY_TIMEOUT);
+        status = (status & AT91C_MCI_RXBUFF) ? (status & SDCARD_DATA_ERRORS) : AT91C_MCI_DTOE;
+    }
+    MCI_StopPdc(SDCARD_MCI);
+    if (count > 1) {
+
+        MCI_SendCommand(SDCARD_MCI, CMD12_STOP_TRANSMISSION, 0);
+    }
+
+    if (status != 0) {
+
+        TRACE_WARNING("SDCARD: read of block %u failed (0x%08X)\n\r", block, status);
+        return 0;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a write is in progress.
+//------------------------------------------------------------------------------
+unsigned char SDCARD_IsBusy(void)
+{
+    return writeState != SDCARD_STATE_IDLE;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of failed writes since startup.
+//------------------------------------------------------------------------------
+unsigned int SDCARD_GetErrors(void)
+{
+    return errors;
+}
+
+//------------------------------------------------------------------------------
+/// Waits for the end of the write in progress. Use before a clock change.
+//------------------------------------------------------------------------------
+void SDCARD_Flush(void)
+{
+    while (writeState != SDCARD_STATE_IDLE);
+}
@@ -0,0 +1,72 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// SD card driver on the MCI, in 4-bit mode, for the local event log. The
+/// writes are asynchronous: a multiple block write is fed by the PDC from up
+/// to two memory areas (a first block, usually a header staged in RAM, then
+/// the payload in place), chained in chunks by the interrupt handler, and
+/// ended with STOP_TRANSMISSION once the last block is sent. The reads are
+/// synchronous, they are only used to mount and scan the log.
+///
+/// Standard and high capacity (SDHC) cards are supported; the blocks are
+/// always 512 bytes.
+///
+/// !Usage
+///
+/// -# Call SDCARD_Initialize() with the function to call at the end of each
+///    write (in interrupt context), then SDCARD_Configure() with the master
+///    clock frequency (and again after every MCK change).
+/// -# Call SDCARD_Identify() once a card is inserted.
+/// -# Start writes with SDCARD_Write() when SDCARD_IsBusy() returns 0; the
+///    data must stay untouched until the end of the write. Failed writes are
+///    counted by SDCARD_GetErrors().
+/// -# Read blocks with SDCARD_Read().
+//------------------------------------------------------------------------------
+
+#ifndef SDCARD_H
+#define SDCARD_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Block size in bytes.
+#define SDCARD_BLOCK_SIZE       512
+
+/// Card clock during the identification, and afterwards (default speed).
+#define SDCARD_INIT_SPEED       400000
+#define SDCARD_SPEED            25000000
+
+/// Maximum number of blocks of one SDCARD_Read().
+#define SDCARD_MAX_READ         256
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SDCARD_Initialize(void (*callback)(void));
+
+extern void SDCARD_Configure(unsigned int mck);
+
+extern unsigned char SDCARD_Identify(void);
+
+extern unsigned int SDCARD_GetNumBlocks(void);
+
+extern unsigned char SDCARD_Write(
+    unsigned int block,
+    const void *pFirst,
+    const void *pNext,
+    unsigned int count);
+
+extern unsigned char SDCARD_Read(unsigned int block, void *pData, unsigned int count);
+
+extern unsigned char SDCARD_IsBusy(void);
+
+extern unsigned int SDCARD_GetErrors(void);
+
+extern void SDCARD_Flush(void);
+
+#endif //#ifndef SDCARD_H
+
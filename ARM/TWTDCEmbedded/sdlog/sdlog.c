@@ -0,0 +1,496 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "sdlog.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Number of words of a block.
+#define BLOCK_WORDS         (SDLOG_BLOCK_SIZE / 4)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Device holding the log.
+static const SdLogDevice *pDevice = 0;
+
+/// Log state (SDLOG_STATE_xxx).
+static unsigned char state = SDLOG_STATE_UNMOUNTED;
+
+/// Current index.
+static SdLogSuper super;
+
+/// Indicates if the index changed since it was last written.
+static unsigned char dirty;
+
+/// Indicates if a write of the log is in progress.
+static unsigned char writing = 0;
+
+/// Device error count at the start of the write in progress.
+static unsigned int writeErrors;
+
+/// Superblock being written.
+static unsigned int pSuperBlock[BLOCK_WORDS];
+
+/// First block (header and start of payload) of the record being written.
+static unsigned int pFirstBlock[BLOCK_WORDS];
+
+/// Buffer for the blocks read.
+static unsigned int pReadBlock[BLOCK_WORDS];
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the checksum of a superblock.
+/// \param pSuper  Superblock.
+//------------------------------------------------------------------------------
+static unsigned int Checksum(const SdLogSuper *pSuper)
+{
+    const unsigned int *pWords = (const unsigned int *) pSuper;
+    unsigned int sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < (sizeof(SdLogSuper) / 4) - 1; i++) {
+
+        sum += pWords[i];
+    }
+
+    return ~sum;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the block following the last record.
+//------------------------------------------------------------------------------
+static unsigned int GetEndBlock(void)
+{
+    if (super.numSessions == 0) {
+
+        return SDLOG_DATA_BLOCK;
+    }
+
+    return super.pSessions[super.numSessions - 1].endBlock;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of the next record.
+//------------------------------------------------------------------------------
+static unsigned int GetNextRecord(void)
+{
+    const SdLogSession *pSession;
+
+    if (super.numSessions == 0) {
+
+        return 0;
+    }
+    pSession = &super.pSessions[super.numSessions - 1];
+
+    return pSession->firstRecord + pSession->numRecords;
+}
+
+//------------------------------------------------------------------------------
+/// Checks for the end of the write in progress.
+/// \return 1 if the write is still in progress.
+//------------------------------------------------------------------------------
+static unsigned char Poll(void)
+{
+    if (writing && !pDevice->IsBusy()) {
+
+        writing = 0;
+        if (pDevice->GetErrors() != writeErrors) {
+
+            state = SDLOG_STATE_FAILED;
+        }
+    }
+
+    return writing;
+}
+
+//------------------------------------------------------------------------------
+/// Starts a write on the device.
+/// \return 1 if the write is started.
+//------------------------------------------------------------------------------
+static unsigned char StartWrite(
+    unsigned int block,
+    const void *pFirst,
+    const void *pNext,
+    unsigned int count)
+{
+    writeErrors = pDevice->GetErrors();
+    if (pDevice->Write(block, pFirst, pNext, count)) {
+
+        writing = 1;
+        return 1;
+    }
+    if (pDevice->GetErrors() != writeErrors) {
+
+        state = SDLOG_STATE_FAILED;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing the index in the next superblock copy.
+/// \return 1 if the write is started.
+//------------------------------------------------------------------------------
+static unsigned char WriteSuper(void)
+{
+    super.generation++;
+    super.checksum = Checksum(&super);
+    memset(pSuperBlock, 0, sizeof(pSuperBlock));
+    memcpy(pSuperBlock, &super, sizeof(super));
+    if (!StartWrite(super.generation % 2, pSuperBlock, 0, 1)) {
+
+        super.generation--;
+        return 0;
+    }
+    dirty = 0;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Waits for the end of the write in progress.
+//------------------------------------------------------------------------------
+static void Wait(void)
+{
+    while (Poll());
+}
+
+//------------------------------------------------------------------------------
+/// Adds the records written after the last index update to the last session,
+/// or to a first session if the index has none yet.
+//------------------------------------------------------------------------------
+static void Recover(void)
+{
+    SdLogSession *pSession;
+    SdLogRecord record;
+    unsigned int block;
+
+    if (super.numSessions == 0) {
+
+        block = SDLOG_DATA_BLOCK;
+        if (!SDLOG_ReadRecord(&block, &record, 0, 0) || (record.sequence != 0)) {
+
+            return;
+        }
+        pSession = &super.pSessions[0];
+        pSession->firstBlock = SDLOG_DATA_BLOCK;
+        pSession->endBlock = SDLOG_DATA_BLOCK;
+        pSession->firstRecord = 0;
+        pSession->numRecords = 0;
+        super.numSessions = 1;
+    }
+    pSession = &super.pSessions[super.numSessions - 1];
+    block = pSession->endBlock;
+    while (SDLOG_ReadRecord(&block, &record, 0, 0)
+           && (record.sequence == pSession->firstRecord + pSession->numRecords)) {
+
+        pSession->endBlock = block;
+        pSession->numRecords++;
+        dirty = 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Mounts the log of a device: loads the most recent valid index, then finds
+/// the records written after it.
+/// \param pDev  Device, which must stay valid.
+/// \return 1 if a log was found, 0 if the device must be formatted.
+//------------------------------------------------------------------------------
+unsigned char SDLOG_Mount(const SdLogDevice *pDev)
+{
+    const SdLogSuper *pCopy = (const SdLogSuper *) pReadBlock;
+    unsigned char found = 0;
+    unsigned int i;
+
+    pDevice = pDev;
+    state = SDLOG_STATE_UNMOUNTED;
+    writing = 0;
+    dirty = 0;
+
+    for (i = 0; i < 2; i++) {
+
+        if (pDevice->Read(i, pReadBlock, 1)
+            && (pCopy->magic == SDLOG_MAGIC)
+            && (pCopy->version == SDLOG_VERSION)
+            && (pCopy->checksum == Checksum(pCopy))
+            && (pCopy->numSessions <= SDLOG_MAX_SESSIONS)
+            && (pCopy->numBlocks <= pDevice->numBlocks)
+            && (!found || ((int) (pCopy->generation - super.generation) > 0))) {
+
+            memcpy(&super, pCopy, sizeof(super));
+            found = 1;
+        }
+    }
+    if (!found) {
+
+        return 0;
+    }
+
+    state = SDLOG_STATE_CLOSED;
+    Recover();
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Starts a new empty log on a device, and mounts it. Both superblock copies
+/// are written before returning.
+/// \param pDev  Device, which must stay valid.
+/// \param volume  Volume ID, which should differ from the previous one (e.g.
+///                a timer value).
+/// \return 1 if the log was written.
+//------------------------------------------------------------------------------
+unsigned char SDLOG_Format(const SdLogDevice *pDev, unsigned int volume)
+{
+    unsigned int i;
+
+    if (writing) {
+
+        Wait();
+    }
+    pDevice = pDev;
+    state = SDLOG_STATE_UNMOUNTED;
+    if (pDevice->numBlocks <= SDLOG_DATA_BLOCK) {
+
+        return 0;
+    }
+
+    memset(&super, 0, sizeof(super));
+    super.magic = SDLOG_MAGIC;
+    super.version = SDLOG_VERSION;
+    super.volume = volume;
+    super.numBlocks = pDevice->numBlocks;
+
+    state = SDLOG_STATE_CLOSED;
+    for (i = 0; i < 2; i++) {
+
+        do {
+
+            while (pDevice->IsBusy());
+        }
+        while (!WriteSuper() && (state == SDLOG_STATE_CLOSED));
+        Wait();
+        if (state != SDLOG_STATE_CLOSED) {
+
+            state = SDLOG_STATE_UNMOUNTED;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing a record, opening a new session if none is open.
+/// \param pData  Record payload, left untouched until the end of the write.
+/// \param size  Payload size in words.
+/// \return 1 if the write is started, 0 if the device is busy or the log is
+/// not mounted, full or failed (see SDLOG_GetState()).
+//------------------------------------------------------------------------------
+unsigned char SDLOG_Append(const unsigned int *pData, unsigned int size)
+{
+    SdLogRecord *pRecord = (SdLogRecord *) pFirstBlock;
+    SdLogSession *pSession;
+    unsigned int bytes = size * 4;
+    unsigned int count;
+    unsigned int block;
+
+    if (((state != SDLOG_STATE_CLOSED) && (state != SDLOG_STATE_OPEN))
+        || Poll() || pDevice->IsBusy()) {
+
+        return 0;
+    }
+
+    block = GetEndBlock();
+    count = (sizeof(SdLogRecord) + bytes + SDLOG_BLOCK_SIZE - 1) / SDLOG_BLOCK_SIZE;
+    if (count > super.numBlocks - block) {
+
+        state = SDLOG_STATE_FULL;
+        return 0;
+    }
+
+    // New session, or extension of the last one once the index is full
+    if (state == SDLOG_STATE_CLOSED) {
+
+        if (super.numSessions < SDLOG_MAX_SESSIONS) {
+
+            pSession = &super.pSessions[super.numSessions];
+            pSession->firstBlock = block;
+            pSession->endBlock = block;
+            pSession->firstRecord = GetNextRecord();
+            pSession->numRecords = 0;
+            super.numSessions++;
+            dirty = 1;
+        }
+        state = SDLOG_STATE_OPEN;
+    }
+    pSession = &super.pSessions[super.numSessions - 1];
+
+    // The header and the start of the payload are staged in the first block,
+    // the rest of the payload is written in place
+    pRecord->magic = SDLOG_RECORD_MAGIC;
+    pRecord->volume = super.volume;
+    pRecord->sequence = pSession->firstRecord + pSession->numRecords;
+    pRecord->size = bytes;
+    if (bytes >= SDLOG_FIRST_PAYLOAD) {
+
+        memcpy(pRecord + 1, pData, SDLOG_FIRST_PAYLOAD);
+    }
+    else {
+
+        memcpy(pRecord + 1, pData, bytes);
+        memset((unsigned char *) (pRecord + 1) + bytes, 0, SDLOG_FIRST_PAYLOAD - bytes);
+    }
+    if (!StartWrite(block, pFirstBlock, pData + SDLOG_FIRST_PAYLOAD / 4, count)) {
+
+        return 0;
+    }
+
+    pSession->endBlock = block + count;
+    pSession->numRecords++;
+    dirty = 1;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a write of the log is in progress.
+//------------------------------------------------------------------------------
+unsigned char SDLOG_IsBusy(void)
+{
+    return (pDevice != 0) && Poll();
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing the index if it changed and the device is idle. The index
+/// write completes like the record ones (see SDLOG_IsBusy()).
+/// \return 1 if the index on the device is up to date.
+//------------------------------------------------------------------------------
+unsigned char SDLOG_Sync(void)
+{
+    if ((state == SDLOG_STATE_UNMOUNTED) || (state == SDLOG_STATE_FAILED)) {
+
+        return 0;
+    }
+    if (Poll()) {
+
+        return 0;
+    }
+    if (!dirty) {
+
+        return 1;
+    }
+    if (!pDevice->IsBusy()) {
+
+        WriteSuper();
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Ends the current session; the next record opens a new one. The index is
+/// updated by the next SDLOG_Sync().
+//------------------------------------------------------------------------------
+void SDLOG_Close(void)
+{
+    if ((state == SDLOG_STATE_OPEN) || (state == SDLOG_STATE_FULL)) {
+
+        state = SDLOG_STATE_CLOSED;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the log state (SDLOG_STATE_xxx).
+//------------------------------------------------------------------------------
+unsigned char SDLOG_GetState(void)
+{
+    return state;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the current index, valid once the log is mounted.
+//------------------------------------------------------------------------------
+const SdLogSuper * SDLOG_GetSuper(void)
+{
+    return &super;
+}
+
+//------------------------------------------------------------------------------
+/// Reads a record of the log.
+/// \param pBlock  Block of the record, advanced to the next record.
+/// \param pRecord  Record header.
+/// \param pData  Buffer for the payload, 0 to read the header only.
+/// \param size  Size of the buffer in bytes; it must hold the payload padded
+///              to the end of the last block of the record.
+/// \return 1 if a record was read, 0 if there is no valid record at the given
+/// block (end of the log), the buffer is too small or the read failed.
+//------------------------------------------------------------------------------
+unsigned char SDLOG_ReadRecord(
+    unsigned int *pBlock,
+    SdLogRecord *pRecord,
+    unsigned int *pData,
+    unsigned int size)
+{
+    const SdLogRecord *pHeader = (const SdLogRecord *) pReadBlock;
+    unsigned int block = *pBlock;
+    unsigned int count;
+    unsigned int next;
+    unsigned int n;
+
+    if ((state == SDLOG_STATE_UNMOUNTED)
+        || (block < SDLOG_DATA_BLOCK) || (block >= super.numBlocks)
+        || !pDevice->Read(block, pReadBlock, 1)
+        || (pHeader->magic != SDLOG_RECORD_MAGIC) || (pHeader->volume != super.volume)
+        || ((pHeader->size / SDLOG_BLOCK_SIZE) >= (super.numBlocks - block))) {
+
+        return 0;
+    }
+    count = pHeader->size / SDLOG_BLOCK_SIZE
+            + ((pHeader->size % SDLOG_BLOCK_SIZE) + sizeof(SdLogRecord) + SDLOG_BLOCK_SIZE - 1)
+              / SDLOG_BLOCK_SIZE;
+    if (count > super.numBlocks - block) {
+
+        return 0;
+    }
+    *pRecord = *pHeader;
+    next = block + count;
+
+    if (pData) {
+
+        if (size < count * SDLOG_BLOCK_SIZE - sizeof(SdLogRecord)) {
+
+            return 0;
+        }
+        memcpy(pData, pHeader + 1, SDLOG_FIRST_PAYLOAD);
+        pData += SDLOG_FIRST_PAYLOAD / 4;
+        block++;
+        for (count--; count > 0; count -= n) {
+
+            n = (count > SDLOG_MAX_READ) ? SDLOG_MAX_READ : count;
+            if (!pDevice->Read(block, pData, n)) {
+
+                return 0;
+            }
+            pData += n * BLOCK_WORDS;
+            block += n;
+        }
+    }
+
+    *pBlock = next;
+
+    return 1;
+}
@@ -0,0 +1,194 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Raw append-only event log on a block device (the SD card), so that the
+/// board can keep taking data while the data link is down and the data can be
+/// replayed later. There is no file system: the device holds an index in two
+/// superblocks, then the records back to back, each starting on a block.
+///
+/// Layout (512-byte blocks):
+/// - blocks 0 and 1: two copies of the SdLogSuper index, written alternately
+///   (the valid copy with the highest generation is the current one), so that
+///   a power loss during an index update leaves the previous index intact;
+/// - from block SDLOG_DATA_BLOCK: the records. A record is made of a
+///   SdLogRecord header followed by the payload, padded to a whole block; the
+///   padding content is unspecified.
+///
+/// Each run of logging since the card was mounted is a session of the index,
+/// giving its first block and record and its extent at the last index
+/// update. Records written after that update are found again when the log is
+/// mounted, by following the record headers from the end of the last
+/// session, or from SDLOG_DATA_BLOCK for a first session which is not in the
+/// index yet: each header carries the volume ID chosen at format time and the
+/// record number since format, so stale data from a previous format is never
+/// taken for a record.
+///
+/// !Usage
+///
+/// -# Describe the device with a SdLogDevice, then call SDLOG_Mount(), or
+///    SDLOG_Format() to start a new log.
+/// -# Append blocks with SDLOG_Append() when SDLOG_IsBusy() returns 0; a new
+///    session is opened by the first one. The block must stay untouched
+///    until the end of the write.
+/// -# Call SDLOG_Sync() periodically (e.g. every second) to update the index,
+///    and SDLOG_Close() to end the session.
+/// -# Read the records back with SDLOG_ReadRecord().
+///
+/// \note All the functions must be called from task context.
+/// \note This module is also used by the host tools (with a file as block
+/// device); it must not depend on the board.
+//------------------------------------------------------------------------------
+
+#ifndef SDLOG_H
+#define SDLOG_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Block size in bytes.
+#define SDLOG_BLOCK_SIZE        512
+
+/// Identifies a superblock ("SDLG") and a record header ("SDRC").
+#define SDLOG_MAGIC             0x474C4453
+#define SDLOG_RECORD_MAGIC      0x43524453
+
+/// Version of the layout.
+#define SDLOG_VERSION           1
+
+/// First block of the records: the first 4MB are left to the superblocks, so
+/// that the records are written in whole allocation units of the card.
+#define SDLOG_DATA_BLOCK        8192
+
+/// Maximum number of sessions; once reached, the last session is extended.
+#define SDLOG_MAX_SESSIONS      30
+
+/// Number of payload bytes in the first block of a record.
+#define SDLOG_FIRST_PAYLOAD     (SDLOG_BLOCK_SIZE - sizeof(SdLogRecord))
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Index entry of a session, little-endian.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// First block of the session.
+    unsigned int firstBlock;
+    /// Block following the last record of the session.
+    unsigned int endBlock;
+    /// Number of the first record.
+    unsigned int firstRecord;
+    /// Number of records.
+    unsigned int numRecords;
+
+} SdLogSession;
+
+//------------------------------------------------------------------------------
+/// Superblock, little-endian, at the start of blocks 0 and 1.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// SDLOG_MAGIC.
+    unsigned int magic;
+    /// SDLOG_VERSION.
+    unsigned int version;
+    /// Incremented at each update; the copy is written to block
+    /// (generation % 2).
+    unsigned int generation;
+    /// Volume ID, chosen at format time.
+    unsigned int volume;
+    /// Size of the device in blocks.
+    unsigned int numBlocks;
+    /// Number of sessions.
+    unsigned int numSessions;
+    /// Sessions, oldest first.
+    SdLogSession pSessions[SDLOG_MAX_SESSIONS];
+    /// Complement of the sum of the previous words.
+    unsigned int checksum;
+
+} SdLogSuper;
+
+//------------------------------------------------------------------------------
+/// Record header, little-endian, at the start of the first block of each
+/// record and followed by the payload.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// SDLOG_RECORD_MAGIC.
+    unsigned int magic;
+    /// Volume ID of the superblock.
+    unsigned int volume;
+    /// Record number since format, starting at 0.
+    unsigned int sequence;
+    /// Payload size in bytes.
+    unsigned int size;
+
+} SdLogRecord;
+
+//------------------------------------------------------------------------------
+/// Block device holding the log (see sdcard.h for the semantics).
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Size of the device in blocks.
+    unsigned int numBlocks;
+    /// Starts writing count blocks at block: the first one from pFirst, the
+    /// others from pNext. Returns 1 if the write is started.
+    unsigned char (*Write)(unsigned int block, const void *pFirst,
+                           const void *pNext, unsigned int count);
+    /// Reads count blocks (up to SDLOG_MAX_READ), returns 1 on success.
+    unsigned char (*Read)(unsigned int block, void *pData, unsigned int count);
+    /// Returns 1 while a write is in progress.
+    unsigned char (*IsBusy)(void);
+    /// Returns the number of failed writes since startup.
+    unsigned int (*GetErrors)(void);
+
+} SdLogDevice;
+
+/// Maximum number of blocks asked to SdLogDevice.Read() at once.
+#define SDLOG_MAX_READ          256
+
+/// Log states.
+#define SDLOG_STATE_UNMOUNTED   0
+/// Mounted, no session open.
+#define SDLOG_STATE_CLOSED      1
+/// Session open.
+#define SDLOG_STATE_OPEN        2
+/// No room left for the last record appended.
+#define SDLOG_STATE_FULL        3
+/// A write failed; the log must be mounted again.
+#define SDLOG_STATE_FAILED      4
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern unsigned char SDLOG_Mount(const SdLogDevice *pDevice);
+
+extern unsigned char SDLOG_Format(const SdLogDevice *pDevice, unsigned int volume);
+
+extern unsigned char SDLOG_Append(const unsigned int *pData, unsigned int size);
+
+extern unsigned char SDLOG_IsBusy(void);
+
+extern unsigned char SDLOG_Sync(void);
+
+extern void SDLOG_Close(void);
+
+extern unsigned char SDLOG_GetState(void);
+
+extern const SdLogSuper * SDLOG_GetSuper(void);
+
+extern unsigned char SDLOG_ReadRecord(
+    unsigned int *pBlock,
+    SdLogRecord *pRecord,
+    unsigned int *pData,
+    unsigned int size);
+
+#endif //#ifndef SDLOG_H
+
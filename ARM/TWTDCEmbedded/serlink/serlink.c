@@ -0,0 +1,186 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "serlink.h"
+#include <board.h>
+#include <pio/pio.h>
+#include <aic/aic.h>
+#include <usart/usart.h>
+#include <utility/critical.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// USART used by the link.
+#define SERLINK_USART       AT91C_BASE_US0
+#define SERLINK_ID          AT91C_ID_US0
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// USART0 pins, with RTS/CTS.
+static const Pin pinsLink[] = {PIN_USART0_TXD, PIN_USART0_RXD, PIN_USART0_RTS, PIN_USART0_CTS};
+
+/// Header of the frame being sent.
+static SerLinkHeader header;
+
+/// Part of the payload not handed to the PDC yet.
+static const unsigned char *pRemaining;
+static volatile unsigned int remaining;
+
+/// Indicates if a frame is being sent.
+static volatile unsigned char busy = 0;
+
+/// Number of the next frame.
+static unsigned int sequence = 0;
+
+/// Master clock frequency the USART is configured for.
+static unsigned int masterClock;
+
+/// Function called at the end of each frame.
+static void (*pDoneCallback)(void) = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Hands as much of the payload as possible to the PDC.
+//------------------------------------------------------------------------------
+static void QueueChunks(void)
+{
+    unsigned int size;
+
+    while (remaining > 0) {
+
+        size = (remaining > SERLINK_CHUNK_SIZE) ? SERLINK_CHUNK_SIZE : remaining;
+        if (!USART_WriteBuffer(SERLINK_USART, pRemaining, size)) {
+
+            break;
+        }
+        pRemaining += size;
+        remaining -= size;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// USART interrupt handler: chains the next chunk each time the PDC finishes
+/// one, then waits for the end of the last one to complete the frame.
+//------------------------------------------------------------------------------
+static void ISR_Usart(void)
+{
+    unsigned int status = SERLINK_USART->US_CSR & SERLINK_USART->US_IMR;
+
+    if (status & AT91C_US_ENDTX) {
+
+        QueueChunks();
+        if (remaining == 0) {
+
+            SERLINK_USART->US_IDR = AT91C_US_ENDTX;
+            SERLINK_USART->US_IER = AT91C_US_TXBUFE;
+        }
+    }
+    if (status & AT91C_US_TXBUFE) {
+
+        SERLINK_USART->US_IDR = AT91C_US_TXBUFE;
+        busy = 0;
+        if (pDoneCallback) {
+
+            pDoneCallback();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sets up the link pins and the function called at the end of each frame.
+/// \param callback  Function called in interrupt context (can be 0).
+//------------------------------------------------------------------------------
+void SERLINK_Initialize(void (*callback)(void))
+{
+    pDoneCallback = callback;
+    PIO_Configure(pinsLink, PIO_LISTSIZE(pinsLink));
+    AT91C_BASE_PMC->PMC_PCER = 1 << SERLINK_ID;
+}
+
+//------------------------------------------------------------------------------
+/// Configures the USART for SERLINK_BAUDRATE with RTS/CTS, and its interrupt.
+/// A frame in progress is aborted.
+/// \param mck  Master clock frequency.
+//------------------------------------------------------------------------------
+void SERLINK_Configure(unsigned int mck)
+{
+    AIC_DisableIT(SERLINK_ID);
+    USART_Configure(SERLINK_USART, USART_MODE_HWHSH, SERLINK_BAUDRATE, mck);
+    masterClock = mck;
+    remaining = 0;
+    busy = 0;
+
+    AIC_ConfigureIT(SERLINK_ID, AT91C_AIC_PRIOR_LOWEST, ISR_Usart);
+    AIC_EnableIT(SERLINK_ID);
+    USART_SetTransmitterEnabled(SERLINK_USART, 1);
+}
+
+//------------------------------------------------------------------------------
+/// Starts sending a block.
+/// \param pData  Block payload, left untouched until the end of the frame.
+/// \param size  Payload size in words.
+/// \return 1 if the frame is started, 0 if the link is busy.
+//------------------------------------------------------------------------------
+unsigned char SERLINK_Send(const unsigned int *pData, unsigned int size)
+{
+    CriticalState state;
+
+    if (busy) {
+
+        return 0;
+    }
+
+    header.magic = SERLINK_MAGIC;
+    header.sequence = sequence++;
+    header.size = size * 4;
+    pRemaining = (const unsigned char *) pData;
+    remaining = size * 4;
+    busy = 1;
+
+    // The PDC is idle: the header goes in the current buffer, the first
+    // chunk of payload in the next one
+    state = CRITICAL_Enter();
+    USART_WriteBuffer(SERLINK_USART, &header, sizeof(header));
+    QueueChunks();
+    SERLINK_USART->US_IER = AT91C_US_ENDTX;
+    CRITICAL_Exit(state);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a frame is being sent.
+//------------------------------------------------------------------------------
+unsigned char SERLINK_IsBusy(void)
+{
+    return busy;
+}
+
+//------------------------------------------------------------------------------
+/// Waits for the end of the frame in progress, unless the host holds CTS
+/// deasserted. Use before a clock change.
+//------------------------------------------------------------------------------
+void SERLINK_Flush(void)
+{
+    while (busy && ((SERLINK_USART->US_CSR & AT91C_US_CTS) == 0));
+}
+
+//------------------------------------------------------------------------------
+/// Returns the actual link baudrate.
+//------------------------------------------------------------------------------
+unsigned int SERLINK_GetBaudrate(void)
+{
+    return USART_GetBaudrate(SERLINK_USART, masterClock);
+}
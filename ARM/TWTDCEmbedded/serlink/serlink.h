@@ -0,0 +1,79 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Serial data link on USART0, a fallback for test stands without Ethernet.
+/// Each event buffer block is sent as a frame made of a SerLinkHeader and the
+/// block payload. The transfer is done by the PDC straight from the event
+/// buffer, in chunks chained through the next buffer registers so that the
+/// line never idles within a frame; RTS/CTS hardware handshaking lets the
+/// host throttle the link at multi-megabaud rates.
+///
+/// !Usage
+///
+/// -# Call SERLINK_Initialize() with the function to call at the end of each
+///    frame (in interrupt context), then SERLINK_Configure() with the master
+///    clock frequency (and again after every MCK change).
+/// -# Send a block with SERLINK_Send() when SERLINK_IsBusy() returns 0. The
+///    block must stay untouched until the end of the frame.
+/// -# On the host, receive the frames with Host/serlink.
+///
+/// \note A frame interrupted by SERLINK_Configure() is lost; the host detects
+/// it with the sequence numbers.
+/// \note The frame format definitions are also used by the host tools; they
+/// must not depend on the board.
+//------------------------------------------------------------------------------
+
+#ifndef SERLINK_H
+#define SERLINK_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Default link baudrate; the actual one is the nearest MCK/8/n.
+#define SERLINK_BAUDRATE    3000000
+
+/// Identifies a frame header ("SLNK").
+#define SERLINK_MAGIC       0x4B4E4C53
+
+/// Maximum number of bytes of one PDC transfer.
+#define SERLINK_CHUNK_SIZE  32768
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Header sent before each block, little-endian.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// SERLINK_MAGIC.
+    unsigned int magic;
+    /// Frame number since boot, starting at 0.
+    unsigned int sequence;
+    /// Payload size in bytes.
+    unsigned int size;
+
+} SerLinkHeader;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SERLINK_Initialize(void (*callback)(void));
+
+extern void SERLINK_Configure(unsigned int mck);
+
+extern unsigned char SERLINK_Send(const unsigned int *pData, unsigned int size);
+
+extern unsigned char SERLINK_IsBusy(void);
+
+extern void SERLINK_Flush(void);
+
+extern unsigned int SERLINK_GetBaudrate(void);
+
+#endif //#ifndef SERLINK_H
+
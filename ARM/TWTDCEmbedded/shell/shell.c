@@ -0,0 +1,287 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   SHELL
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "shell.h"
+#include <sched/sched.h>
+#include <dbgu/dbgu.h>
+#include <utility/trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Prompt displayed before each command line.
+#define SHELL_PROMPT        "> "
+
+/// Maximum number of characters handled by one run of the shell task.
+#define SHELL_BATCH         16
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Handles the received characters and executes the commands.
+static SchedTask shellTask;
+
+/// Registered command tables.
+static ShellCommandTable *pTables = 0;
+
+/// Command line being edited.
+static char line[SHELL_LINE_SIZE + 1];
+
+/// Number of characters in the command line.
+static unsigned int lineLength = 0;
+
+/// Built-in commands.
+static ShellCommandTable builtinTable;
+
+/// Takes the received characters which are not for the shell, can be 0.
+static unsigned char (*InputFilter)(unsigned char c) = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Lists the registered commands.
+//------------------------------------------------------------------------------
+static void HelpCommand(int argc, char **argv)
+{
+    ShellCommandTable *pTable;
+    unsigned int i;
+
+    for (pTable = pTables; pTable != 0; pTable = pTable->pNext) {
+
+        for (i = 0; i < pTable->count; i++) {
+
+            printf("  %-8s %s\n\r", pTable->pCommands[i].name, pTable->pCommands[i].help);
+        }
+    }
+}
+
+/// Built-in command list.
+static const ShellCommand builtinCommands[] = {
+
+    {"help", "- list the commands", HelpCommand}
+};
+
+//------------------------------------------------------------------------------
+/// Splits the command line into words and executes the matching command.
+//------------------------------------------------------------------------------
+static void Execute(void)
+{
+    char *argv[SHELL_MAX_ARGS];
+    int argc = 0;
+    char *p = line;
+    ShellCommandTable *pTable;
+    unsigned int i;
+
+    line[lineLength] = 0;
+    while (*p) {
+
+        while (*p == ' ') {
+
+            *p++ = 0;
+        }
+        if (*p == 0) {
+
+            break;
+        }
+        if (argc == SHELL_MAX_ARGS) {
+
+            printf("Too many arguments\n\r");
+            return;
+        }
+        argv[argc++] = p;
+        while (*p && (*p != ' ')) {
+
+            p++;
+        }
+    }
+    if (argc == 0) {
+
+        return;
+    }
+
+    for (pTable = pTables; pTable != 0; pTable = pTable->pNext) {
+
+        for (i = 0; i < pTable->count; i++) {
+
+            if (strcmp(argv[0], pTable->pCommands[i].name) == 0) {
+
+                TRACE_DEBUG("SHELL: %s, %d arguments\n\r", argv[0], argc - 1);
+                pTable->pCommands[i].handler(argc, argv);
+                return;
+            }
+        }
+    }
+    printf("Unknown command '%s', type help\n\r", argv[0]);
+}
+
+//------------------------------------------------------------------------------
+/// Shell task: edits the command line with the received characters, and
+/// executes it on a carriage return. Handles at most SHELL_BATCH characters
+/// then re-posts itself.
+//------------------------------------------------------------------------------
+static void ShellTask(void *pArg)
+{
+    unsigned char c;
+    unsigned int n;
+
+    for (n = SHELL_BATCH; n != 0; n--) {
+
+        if (DBGU_Read(&c, 1) == 0) {
+
+            return;
+        }
+        if ((InputFilter != 0) && InputFilter(c)) {
+
+            continue;
+        }
+
+        if ((c == '\r') || (c == '\n')) {
+
+            // Ignore the LF of a CR-LF pair
+            if ((c == '\n') && (lineLength == 0)) {
+
+                continue;
+            }
+            printf("\n\r");
+            Execute();
+            lineLength = 0;
+            printf(SHELL_PROMPT);
+        }
+        else if ((c == '\b') || (c == 0x7F)) {
+
+            if (lineLength > 0) {
+
+                lineLength--;
+                printf("\b \b");
+            }
+        }
+        else if ((c >= ' ') && (c < 0x7F) && (lineLength < SHELL_LINE_SIZE)) {
+
+            line[lineLength++] = c;
+            putchar(c);
+        }
+    }
+
+    SCHED_Post(&shellTask);
+}
+
+//------------------------------------------------------------------------------
+/// DBGU receive callback, called in interrupt context.
+//------------------------------------------------------------------------------
+static void OnReceive(void)
+{
+    SCHED_Post(&shellTask);
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Adds a table of commands to the shell.
+/// \param pTable  Table instance to use.
+/// \param pCommands  Commands.
+/// \param count  Number of commands.
+//------------------------------------------------------------------------------
+void SHELL_RegisterCommands(
+    ShellCommandTable *pTable,
+    const ShellCommand *pCommands,
+    unsigned int count)
+{
+    ShellCommandTable **ppLast = &pTables;
+
+    pTable->pCommands = pCommands;
+    pTable->count = count;
+    pTable->pNext = 0;
+
+    // Keep the registration order for "help"
+    while (*ppLast != 0) {
+
+        ppLast = &(*ppLast)->pNext;
+    }
+    *ppLast = pTable;
+}
+
+//------------------------------------------------------------------------------
+/// Starts the shell: registers the built-in commands, enables the DBGU
+/// receive interrupt and displays the prompt.
+//------------------------------------------------------------------------------
+void SHELL_Initialize(void)
+{
+    SHELL_RegisterCommands(&builtinTable, builtinCommands,
+                           sizeof(builtinCommands) / sizeof(builtinCommands[0]));
+    SCHED_InitializeTask(&shellTask, "shell", SCHED_PRIO_HOUSEKEEPING, ShellTask, 0);
+    lineLength = 0;
+    DBGU_EnableRxInterrupt(OnReceive);
+    printf(SHELL_PROMPT);
+}
+
+//------------------------------------------------------------------------------
+/// Sets a function which sees each received character before the shell, and
+/// keeps it from the command line by returning 1.
+/// \param filter  Filter function, or 0 for none.
+//------------------------------------------------------------------------------
+void SHELL_SetInputFilter(unsigned char (*filter)(unsigned char c))
+{
+    InputFilter = filter;
+}
+
+//------------------------------------------------------------------------------
+/// Converts a command argument to an unsigned integer, in decimal or in
+/// hexadecimal with a 0x prefix.
+/// \param pString  Argument.
+/// \param pValue  Converted value.
+/// \return 1 if the whole argument is a valid number, 0 otherwise.
+//------------------------------------------------------------------------------
+unsigned char SHELL_ParseUnsigned(const char *pString, unsigned int *pValue)
+{
+    char *pEnd;
+
+    if ((*pString < '0') || (*pString > '9')) {
+
+        return 0;
+    }
+    *pValue = strtoul(pString, &pEnd, 0);
+
+    return (*pEnd == 0);
+}
+
+//------------------------------------------------------------------------------
+/// Converts a command argument to a signed integer: SHELL_ParseUnsigned()
+/// with an optional minus sign.
+/// \param pString  Argument.
+/// \param pValue  Converted value.
+/// \return 1 if the whole argument is a valid number, 0 otherwise.
+//------------------------------------------------------------------------------
+unsigned char SHELL_ParseSigned(const char *pString, int *pValue)
+{
+    unsigned int value;
+
+    if (*pString == '-') {
+
+        if (!SHELL_ParseUnsigned(pString + 1, &value) || (value > 0x80000000)) {
+
+            return 0;
+        }
+        *pValue = -(int) value;
+        return 1;
+    }
+    if (!SHELL_ParseUnsigned(pString, &value) || (value > 0x7FFFFFFF)) {
+
+        return 0;
+    }
+    *pValue = value;
+
+    return 1;
+}
@@ -0,0 +1,90 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Line-oriented command shell on the DBGU. Received characters are stored
+/// by the DBGU interrupt handler; the line editing, parsing and command
+/// execution run in a low priority task, so that typing or slow commands
+/// never delay the readout path.
+///
+/// !Usage
+///
+/// -# Declare the commands of a module in a constant ShellCommand array, and
+///    register it with SHELL_RegisterCommands().
+/// -# Call SHELL_Initialize() after SCHED_Initialize() and once the DBGU
+///    interrupt is routed to DBGU_InterruptHandler().
+/// -# Type "help" on the console for the list of commands.
+/// -# To share the DBGU with a binary protocol, give SHELL_SetInputFilter()
+///    a function which takes the bytes of the protocol out of the input.
+///
+/// \note Command handlers run in task context: they can print and take their
+/// time, but they delay the other tasks of the same or lower priority.
+//------------------------------------------------------------------------------
+
+#ifndef SHELL_H
+#define SHELL_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Maximum length of a command line, in characters.
+#define SHELL_LINE_SIZE     80
+
+/// Maximum number of words of a command line, including the command name.
+#define SHELL_MAX_ARGS      8
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// A shell command.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Name typed on the console.
+    const char *name;
+    /// Arguments and short description, displayed by "help"
+    /// (e.g. "<start|stop> - start or stop the run").
+    const char *help;
+    /// Executes the command. argv[0] is the command name.
+    void (*handler)(int argc, char **argv);
+
+} ShellCommand;
+
+//------------------------------------------------------------------------------
+/// A table of commands registered by a module. Instances are owned by the
+/// caller and must stay valid for the whole program lifetime.
+//------------------------------------------------------------------------------
+typedef struct _ShellCommandTable {
+
+    /// Commands of the table.
+    const ShellCommand *pCommands;
+    /// Number of commands in the table.
+    unsigned int count;
+    /// Next registered table.
+    struct _ShellCommandTable *pNext;
+
+} ShellCommandTable;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SHELL_RegisterCommands(
+    ShellCommandTable *pTable,
+    const ShellCommand *pCommands,
+    unsigned int count);
+
+extern void SHELL_Initialize(void);
+
+extern void SHELL_SetInputFilter(unsigned char (*filter)(unsigned char c));
+
+extern unsigned char SHELL_ParseUnsigned(const char *pString, unsigned int *pValue);
+
+extern unsigned char SHELL_ParseSigned(const char *pString, int *pValue);
+
+#endif //#ifndef SHELL_H
+
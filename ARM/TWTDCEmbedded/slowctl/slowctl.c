@@ -0,0 +1,475 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "slowctl.h"
+#include <utility/crc32.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Port states: between frames, in a frame, after an escape byte in a frame,
+/// and dropping a frame too long.
+#define STATE_IDLE      0
+#define STATE_FRAME     1
+#define STATE_ESCAPE    2
+#define STATE_DROP      3
+
+/// Size of the headers, in words.
+#define REQUEST_WORDS   (sizeof(SlowCtlRequest) / 4)
+#define OPERATION_WORDS (sizeof(SlowCtlOperation) / 4)
+#define RESPONSE_WORDS  (sizeof(SlowCtlResponse) / 4)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Memory areas open to the protocol.
+static const SlowCtlRegion *pRegionTable;
+static unsigned int regionCount;
+
+/// Time source, can be 0.
+static unsigned int (*GetTicks)(void);
+static unsigned int (*GetFrequency)(void);
+
+/// Response being sent by a port, and its frame.
+static unsigned int pResponse[SLOWCTL_MAX_PACKET / 4];
+static unsigned char pFrame[SLOWCTL_MAX_FRAME];
+
+static SlowCtlStats stats;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Finds where words of the protocol address space are.
+/// \param address  Address of the first word.
+/// \param size  Number of bytes.
+/// \param write  Set if the words are to be written.
+/// \return The first word, or 0 if outside the regions, unaligned or
+/// read-only.
+//------------------------------------------------------------------------------
+static volatile unsigned int * Map(unsigned int address, unsigned int size, unsigned char write)
+{
+    const SlowCtlRegion *pRegion;
+    unsigned int i;
+
+    if ((address & 3) != 0) {
+
+        return 0;
+    }
+    for (i = 0; i < regionCount; i++) {
+
+        pRegion = &pRegionTable[i];
+        if ((address - pRegion->address < pRegion->size)
+            && (size <= pRegion->size - (address - pRegion->address))) {
+
+            if (write && !pRegion->writable) {
+
+                return 0;
+            }
+            return pRegion->pMemory + (address - pRegion->address) / 4;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Fills the header of a response.
+/// \param pOutput  Response.
+/// \param pRequest  Request, or 0 if not known.
+/// \param status  SLOWCTL_OK or the error.
+/// \param index  Index of the faulty operation, or SLOWCTL_NO_INDEX.
+/// \param count  Number of operations applied.
+/// \param start  Tick count when the request was applied.
+/// \param duration  Number of ticks taken.
+/// \return Size of the header in bytes.
+//------------------------------------------------------------------------------
+static unsigned int Respond(
+    unsigned int *pOutput,
+    const SlowCtlRequest *pRequest,
+    unsigned short status,
+    unsigned short index,
+    unsigned short count,
+    unsigned int start,
+    unsigned int duration)
+{
+    SlowCtlResponse *pHeader = (SlowCtlResponse *) pOutput;
+
+    pHeader->magic = SLOWCTL_RESPONSE_MAGIC;
+    pHeader->tag = (pRequest != 0) ? pRequest->tag : 0;
+    pHeader->status = status;
+    pHeader->index = index;
+    pHeader->count = count;
+    pHeader->time = start;
+    pHeader->duration = duration;
+    pHeader->frequency = (GetFrequency != 0) ? GetFrequency() : 0;
+
+    return sizeof(SlowCtlResponse);
+}
+
+//------------------------------------------------------------------------------
+/// Checks a whole request.
+/// \param pRequest  Request.
+/// \param size  Size of the request in bytes.
+/// \param pIndex  Index of the faulty operation, if any.
+/// \return SLOWCTL_OK or the error.
+//------------------------------------------------------------------------------
+static unsigned short Check(
+    const unsigned int *pRequest,
+    unsigned int size,
+    unsigned short *pIndex)
+{
+    const SlowCtlRequest *pHeader = (const SlowCtlRequest *) pRequest;
+    const SlowCtlOperation *pOperation;
+    unsigned int numWords = size / 4;
+    unsigned int position = REQUEST_WORDS;
+    unsigned int responseWords = RESPONSE_WORDS;
+    unsigned int dataWords;
+    unsigned int bytes;
+    unsigned short i;
+
+    *pIndex = SLOWCTL_NO_INDEX;
+    if (((size & 3) != 0) || (numWords < REQUEST_WORDS)
+        || (pHeader->magic != SLOWCTL_REQUEST_MAGIC)) {
+
+        return SLOWCTL_BAD_REQUEST;
+    }
+
+    for (i = 0; i < pHeader->count; i++) {
+
+        *pIndex = i;
+        if (numWords - position < OPERATION_WORDS) {
+
+            return SLOWCTL_BAD_REQUEST;
+        }
+        pOperation = (const SlowCtlOperation *) (pRequest + position);
+        position += OPERATION_WORDS;
+        bytes = (pOperation->op & SLOWCTL_OP_FIFO) ? 4 : pOperation->count * 4;
+
+        switch (pOperation->op & ~SLOWCTL_OP_FIFO) {
+
+            case SLOWCTL_OP_READ:
+                dataWords = 0;
+                responseWords += pOperation->count;
+                break;
+
+            case SLOWCTL_OP_WRITE:
+                dataWords = pOperation->count;
+                break;
+
+            case SLOWCTL_OP_RMW:
+                dataWords = 2;
+                responseWords += pOperation->count;
+                break;
+
+            default:
+                return SLOWCTL_BAD_REQUEST;
+        }
+        if (numWords - position < dataWords) {
+
+            return SLOWCTL_BAD_REQUEST;
+        }
+        position += dataWords;
+        if ((pOperation->count != 0)
+            && (Map(pOperation->address, bytes,
+                    (pOperation->op & ~SLOWCTL_OP_FIFO) != SLOWCTL_OP_READ) == 0)) {
+
+            return SLOWCTL_BAD_ADDRESS;
+        }
+        if (responseWords > SLOWCTL_MAX_PACKET / 4) {
+
+            return SLOWCTL_TOO_LARGE;
+        }
+    }
+
+    *pIndex = SLOWCTL_NO_INDEX;
+    return (position == numWords) ? SLOWCTL_OK : SLOWCTL_BAD_REQUEST;
+}
+
+//------------------------------------------------------------------------------
+/// Sends a response on a port, counting it if the port cuts it short.
+/// \param pPort  Port.
+/// \param size  Size of the response in bytes.
+//------------------------------------------------------------------------------
+static void Send(SlowCtlPort *pPort, unsigned int size)
+{
+    unsigned int length = SLOWCTL_Encode(pResponse, size, pFrame);
+
+    if (pPort->Write(pFrame, length) != length) {
+
+        stats.truncated++;
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sets the memory areas open to the protocol and the time source.
+/// \param pRegions  Regions, which must stay valid.
+/// \param numRegions  Number of regions.
+/// \param getTicks  Function returning the current tick count (can be 0).
+/// \param getFrequency  Function returning the tick frequency in Hz (can be
+/// 0).
+//------------------------------------------------------------------------------
+void SLOWCTL_Initialize(
+    const SlowCtlRegion *pRegions,
+    unsigned int numRegions,
+    unsigned int (*getTicks)(void),
+    unsigned int (*getFrequency)(void))
+{
+    pRegionTable = pRegions;
+    regionCount = numRegions;
+    GetTicks = getTicks;
+    GetFrequency = getFrequency;
+    stats.requests = 0;
+    stats.operations = 0;
+    stats.words = 0;
+    stats.rejected = 0;
+    stats.badFrames = 0;
+    stats.truncated = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Checks and applies a request, all or nothing.
+/// \param pRequest  Request, word aligned.
+/// \param size  Size of the request in bytes.
+/// \param pOutput  Response, at least SLOWCTL_MAX_PACKET bytes.
+/// \return Size of the response in bytes.
+//------------------------------------------------------------------------------
+unsigned int SLOWCTL_Execute(
+    const unsigned int *pRequest,
+    unsigned int size,
+    unsigned int *pOutput)
+{
+    const SlowCtlRequest *pHeader = (const SlowCtlRequest *) pRequest;
+    const SlowCtlOperation *pOperation;
+    const unsigned int *pData;
+    volatile unsigned int *pMemory;
+    unsigned int *pValue;
+    unsigned int position;
+    unsigned int start;
+    unsigned int numWords = 0;
+    unsigned int step;
+    unsigned int old;
+    unsigned short status;
+    unsigned short index;
+    unsigned short i;
+    unsigned short j;
+
+    start = (GetTicks != 0) ? GetTicks() : 0;
+    status = Check(pRequest, size, &index);
+    if (status != SLOWCTL_OK) {
+
+        stats.rejected++;
+        return Respond(pOutput, (size >= sizeof(SlowCtlRequest)) ? pHeader : 0,
+                       status, index, 0, start, 0);
+    }
+
+    // Nothing can fail from here
+    pValue = pOutput + RESPONSE_WORDS;
+    position = REQUEST_WORDS;
+    for (i = 0; i < pHeader->count; i++) {
+
+        pOperation = (const SlowCtlOperation *) (pRequest + position);
+        pData = pRequest + position + OPERATION_WORDS;
+        position += OPERATION_WORDS;
+        if (pOperation->count == 0) {
+
+            position += ((pOperation->op & ~SLOWCTL_OP_FIFO) == SLOWCTL_OP_RMW) ? 2 : 0;
+            continue;
+        }
+        step = (pOperation->op & SLOWCTL_OP_FIFO) ? 0 : 1;
+        pMemory = Map(pOperation->address, step ? pOperation->count * 4 : 4, 0);
+        numWords += pOperation->count;
+
+        switch (pOperation->op & ~SLOWCTL_OP_FIFO) {
+
+            case SLOWCTL_OP_READ:
+                for (j = 0; j < pOperation->count; j++) {
+
+                    *pValue++ = *pMemory;
+                    pMemory += step;
+                }
+                break;
+
+            case SLOWCTL_OP_WRITE:
+                for (j = 0; j < pOperation->count; j++) {
+
+                    *pMemory = *pData++;
+                    pMemory += step;
+                }
+                position += pOperation->count;
+                break;
+
+            case SLOWCTL_OP_RMW:
+                for (j = 0; j < pOperation->count; j++) {
+
+                    old = *pMemory;
+                    *pMemory = (old & ~pData[0]) | (pData[1] & pData[0]);
+                    *pValue++ = old;
+                    pMemory += step;
+                }
+                position += 2;
+                break;
+        }
+    }
+
+    stats.requests++;
+    stats.operations += pHeader->count;
+    stats.words += numWords;
+    Respond(pOutput, pHeader, SLOWCTL_OK, SLOWCTL_NO_INDEX, pHeader->count, start,
+            (GetTicks != 0) ? GetTicks() - start : 0);
+
+    return (unsigned int) (pValue - pOutput) * 4;
+}
+
+//------------------------------------------------------------------------------
+/// Frames a packet: SLIP framing of the packet followed by its CRC-32.
+/// \param pPacket  Packet.
+/// \param size  Size of the packet in bytes, at most SLOWCTL_MAX_PACKET.
+/// \param pOutput  Frame, at least SLOWCTL_MAX_FRAME bytes.
+/// \return Size of the frame in bytes.
+//------------------------------------------------------------------------------
+unsigned int SLOWCTL_Encode(const void *pPacket, unsigned int size, unsigned char *pOutput)
+{
+    const unsigned char *pBytes = (const unsigned char *) pPacket;
+    unsigned int crc = CRC32_Update(0, pPacket, size);
+    unsigned int length = 0;
+    unsigned int i;
+    unsigned char c;
+
+    pOutput[length++] = SLOWCTL_SLIP_END;
+    for (i = 0; i < size + 4; i++) {
+
+        c = (i < size) ? pBytes[i] : (unsigned char) (crc >> ((i - size) * 8));
+        if (c == SLOWCTL_SLIP_END) {
+
+            pOutput[length++] = SLOWCTL_SLIP_ESC;
+            pOutput[length++] = SLOWCTL_SLIP_ESC_END;
+        }
+        else if (c == SLOWCTL_SLIP_ESC) {
+
+            pOutput[length++] = SLOWCTL_SLIP_ESC;
+            pOutput[length++] = SLOWCTL_SLIP_ESC_ESC;
+        }
+        else {
+
+            pOutput[length++] = c;
+        }
+    }
+    pOutput[length++] = SLOWCTL_SLIP_END;
+
+    return length;
+}
+
+//------------------------------------------------------------------------------
+/// Sets up a port.
+/// \param pPort  Port.
+/// \param write  Function sending bytes on the link.
+//------------------------------------------------------------------------------
+void SLOWCTL_InitializePort(
+    SlowCtlPort *pPort,
+    unsigned int (*write)(const unsigned char *pData, unsigned int size))
+{
+    pPort->Write = write;
+    pPort->length = 0;
+    pPort->state = STATE_IDLE;
+}
+
+//------------------------------------------------------------------------------
+/// Takes a byte received on a port. A frame starts with SLOWCTL_SLIP_END;
+/// when it ends, the request is checked, applied and answered.
+/// \param pPort  Port.
+/// \param c  Byte received.
+/// \return 1 if the byte was part of a frame, 0 if it is left to the caller.
+//------------------------------------------------------------------------------
+unsigned char SLOWCTL_Input(SlowCtlPort *pPort, unsigned char c)
+{
+    unsigned char *pBytes = (unsigned char *) pPort->pFrame;
+    unsigned int size;
+    unsigned int crc;
+
+    if (pPort->state == STATE_IDLE) {
+
+        if (c != SLOWCTL_SLIP_END) {
+
+            return 0;
+        }
+        pPort->state = STATE_FRAME;
+        pPort->length = 0;
+        return 1;
+    }
+
+    if (c == SLOWCTL_SLIP_END) {
+
+        // Back-to-back ends: the first closed nothing, start again
+        if ((pPort->state == STATE_FRAME) && (pPort->length == 0)) {
+
+            return 1;
+        }
+        if (pPort->state == STATE_DROP) {
+
+            stats.badFrames++;
+        }
+        else if (pPort->length < sizeof(SlowCtlRequest) + 4) {
+
+            stats.badFrames++;
+            Send(pPort, Respond(pResponse, 0, SLOWCTL_BAD_FRAME, SLOWCTL_NO_INDEX, 0, 0, 0));
+        }
+        else {
+
+            size = pPort->length - 4;
+            crc = pBytes[size] | (pBytes[size + 1] << 8) | (pBytes[size + 2] << 16)
+                  | ((unsigned int) pBytes[size + 3] << 24);
+            if (crc != CRC32_Update(0, pBytes, size)) {
+
+                stats.badFrames++;
+                Send(pPort, Respond(pResponse, 0, SLOWCTL_BAD_FRAME, SLOWCTL_NO_INDEX, 0, 0, 0));
+            }
+            else {
+
+                Send(pPort, SLOWCTL_Execute(pPort->pFrame, size, pResponse));
+            }
+        }
+        pPort->state = STATE_IDLE;
+        return 1;
+    }
+
+    if (pPort->state == STATE_DROP) {
+
+        return 1;
+    }
+    if (pPort->state == STATE_ESCAPE) {
+
+        pPort->state = STATE_FRAME;
+        c = (c == SLOWCTL_SLIP_ESC_END) ? SLOWCTL_SLIP_END
+            : (c == SLOWCTL_SLIP_ESC_ESC) ? SLOWCTL_SLIP_ESC : c;
+    }
+    else if (c == SLOWCTL_SLIP_ESC) {
+
+        pPort->state = STATE_ESCAPE;
+        return 1;
+    }
+    if (pPort->length == sizeof(pPort->pFrame)) {
+
+        pPort->state = STATE_DROP;
+        return 1;
+    }
+    pBytes[pPort->length++] = c;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// \return The statistics of the protocol.
+//------------------------------------------------------------------------------
+const SlowCtlStats * SLOWCTL_GetStats(void)
+{
+    return &stats;
+}
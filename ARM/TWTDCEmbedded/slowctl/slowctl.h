@@ -0,0 +1,223 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Binary slow-control protocol: batches of register operations (read,
+/// write, read-modify-write, block transfers) sent by the DAQ PC in one
+/// request packet and answered by one response packet. The core only sees
+/// packets and does not depend on the link; SlowCtlPort frames them on any
+/// byte stream (SLIP framing with a CRC-32), and the board reads the DBGU
+/// through the shell input filter.
+///
+/// A request is a SlowCtlRequest header followed by count operations, each
+/// a SlowCtlOperation followed by its data words:
+/// - SLOWCTL_OP_READ: none, count words come back in the response;
+/// - SLOWCTL_OP_WRITE: the count words to write;
+/// - SLOWCTL_OP_RMW: a mask and a value, written to the bits set in the mask
+///   of each of the count words, whose old values come back.
+/// With SLOWCTL_OP_FIFO, every word of the operation goes to the same
+/// address (e.g. a mailbox FIFO); otherwise the address goes up by 4.
+///
+/// The whole request is checked before anything is done: operations on
+/// addresses outside the declared regions (SlowCtlRegion), writes to
+/// read-only regions, malformed packets or responses too large for
+/// SLOWCTL_MAX_PACKET reject it whole. A valid request is then applied in
+/// one go, from a single task run, so that no readout happens in the
+/// middle of it. The response gives the status, the index of the faulty
+/// operation, and the tick counter of the board when it was applied and how
+/// long it took (the same time base as the trace log).
+///
+/// !Usage
+///
+/// -# Call SLOWCTL_Initialize() with the regions open to the protocol and
+///    the time source.
+/// -# Per link, set up a SlowCtlPort with SLOWCTL_InitializePort() and feed
+///    it the received bytes with SLOWCTL_Input(): the bytes which are not
+///    part of a frame are left to the caller (e.g. the command shell). The
+///    requests are executed and answered from SLOWCTL_Input().
+/// -# On the host, use Host/slowctl.
+///
+/// \note All the fields are little-endian and 32-bit aligned.
+/// \note This module is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef SLOWCTL_H
+#define SLOWCTL_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Identify a request and a response ("SCRQ", "SCRS").
+#define SLOWCTL_REQUEST_MAGIC   0x51524353
+#define SLOWCTL_RESPONSE_MAGIC  0x53524353
+
+/// Largest request or response, in bytes, without the framing.
+#define SLOWCTL_MAX_PACKET      1024
+
+/// Largest frame: both ends, and every byte of the packet and CRC escaped.
+#define SLOWCTL_MAX_FRAME       (2 + 2 * (SLOWCTL_MAX_PACKET + 4))
+
+/// Operation codes, and flag of the operations on a single address.
+#define SLOWCTL_OP_READ         1
+#define SLOWCTL_OP_WRITE        2
+#define SLOWCTL_OP_RMW          3
+#define SLOWCTL_OP_FIFO         0x80
+
+/// Response status.
+#define SLOWCTL_OK              0
+/// Bad frame CRC; the tag of the response is 0.
+#define SLOWCTL_BAD_FRAME       1
+/// Truncated packet, bad magic, or unknown operation.
+#define SLOWCTL_BAD_REQUEST     2
+/// Address outside the regions, unaligned, or region not writable.
+#define SLOWCTL_BAD_ADDRESS     3
+/// Response larger than SLOWCTL_MAX_PACKET.
+#define SLOWCTL_TOO_LARGE       4
+
+/// Value of SlowCtlResponse.index when no operation is at fault.
+#define SLOWCTL_NO_INDEX        0xFFFF
+
+/// SLIP framing bytes.
+#define SLOWCTL_SLIP_END        0xC0
+#define SLOWCTL_SLIP_ESC        0xDB
+#define SLOWCTL_SLIP_ESC_END    0xDC
+#define SLOWCTL_SLIP_ESC_ESC    0xDD
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Header of a request.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// SLOWCTL_REQUEST_MAGIC.
+    unsigned int magic;
+    /// Chosen by the host, returned in the response.
+    unsigned short tag;
+    /// Number of operations.
+    unsigned short count;
+
+} SlowCtlRequest;
+
+//------------------------------------------------------------------------------
+/// Header of an operation.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// SLOWCTL_OP_xxx, with SLOWCTL_OP_FIFO.
+    unsigned char op;
+    unsigned char reserved;
+    /// Number of words.
+    unsigned short count;
+    /// Address of the first word.
+    unsigned int address;
+
+} SlowCtlOperation;
+
+//------------------------------------------------------------------------------
+/// Header of a response, followed by the words read, in the order of the
+/// operations.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// SLOWCTL_RESPONSE_MAGIC.
+    unsigned int magic;
+    /// Tag of the request.
+    unsigned short tag;
+    /// SLOWCTL_OK or the error.
+    unsigned short status;
+    /// Index of the faulty operation, or SLOWCTL_NO_INDEX.
+    unsigned short index;
+    /// Number of operations applied.
+    unsigned short count;
+    /// Tick count of the board when the request was applied.
+    unsigned int time;
+    /// Number of ticks taken to apply it.
+    unsigned int duration;
+    /// Frequency of the ticks, in Hz.
+    unsigned int frequency;
+
+} SlowCtlResponse;
+
+//------------------------------------------------------------------------------
+/// Memory area open to the protocol.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Address in the protocol, and size in bytes.
+    unsigned int address;
+    unsigned int size;
+    /// Where the area is accessed: the same address on the board.
+    volatile unsigned int *pMemory;
+    /// Set if the area can be written.
+    unsigned char writable;
+
+} SlowCtlRegion;
+
+//------------------------------------------------------------------------------
+/// Framing of the packets on a byte stream.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Sends bytes on the link (e.g. DBGU_Write()) and returns how many were
+    /// taken; a response cut short is counted in SlowCtlStats.
+    unsigned int (*Write)(const unsigned char *pData, unsigned int size);
+    /// Frame being received: packet and its CRC.
+    unsigned int pFrame[(SLOWCTL_MAX_PACKET + 4) / 4];
+    unsigned int length;
+    /// Receiving a frame, after an escape byte, or dropping an overlong one.
+    unsigned char state;
+
+} SlowCtlPort;
+
+//------------------------------------------------------------------------------
+/// Statistics of the protocol.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Requests applied, and their operations and words.
+    unsigned int requests;
+    unsigned int operations;
+    unsigned int words;
+    /// Requests rejected, and frames with a bad CRC or too long.
+    unsigned int rejected;
+    unsigned int badFrames;
+    /// Responses the port did not take whole.
+    unsigned int truncated;
+
+} SlowCtlStats;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SLOWCTL_Initialize(
+    const SlowCtlRegion *pRegions,
+    unsigned int numRegions,
+    unsigned int (*getTicks)(void),
+    unsigned int (*getFrequency)(void));
+
+extern unsigned int SLOWCTL_Execute(
+    const unsigned int *pRequest,
+    unsigned int size,
+    unsigned int *pResponse);
+
+extern void SLOWCTL_InitializePort(
+    SlowCtlPort *pPort,
+    unsigned int (*write)(const unsigned char *pData, unsigned int size));
+
+extern unsigned char SLOWCTL_Input(SlowCtlPort *pPort, unsigned char c);
+
+extern unsigned int SLOWCTL_Encode(
+    const void *pPacket,
+    unsigned int size,
+    unsigned char *pFrame);
+
+extern const SlowCtlStats * SLOWCTL_GetStats(void);
+
+#endif //#ifndef SLOWCTL_H
@@ -0,0 +1,202 @@
+/// Trace channel of this module (see trace_channels.h).
+#define TRACE_CHANNEL   SPILL
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "spill.h"
+#include <timer/timer.h>
+#include <counters/counters.h>
+#include <pio/pio_it.h>
+#include <utility/critical.h>
+#include <utility/trace.h>
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Begin-of-spill pin instance.
+static const Pin pinBos = PIN_SPILL_BOS;
+
+/// End-of-spill pin instance.
+static const Pin pinEos = PIN_SPILL_EOS;
+
+/// Indicates if the data taking follows the spill gate.
+static unsigned char gateEnabled;
+
+/// Indicates if a spill is in progress.
+static volatile unsigned char spillActive;
+
+/// Task posted at the end of each spill.
+static SchedTask *pSpillEndTask;
+
+/// Statistics of the spill in progress, or of the last one between spills.
+static SpillStats current;
+
+/// Statistics of the last completed spill, saved at BOS.
+static SpillStats last;
+
+/// Number of BOS and EOS interrupts, including glitches.
+static Counter irqCounter;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Handler for the BOS input. Starts a new spill on the rising edge.
+//------------------------------------------------------------------------------
+static void ISR_Bos(const Pin *pPin)
+{
+    COUNTER_Increment(&irqCounter);
+
+    if (!PIO_Get(pPin) || spillActive) {
+
+        return;
+    }
+
+    last = current;
+    current.number++;
+    current.events = 0;
+    current.words = 0;
+    current.overflows = 0;
+    current.startTicks = TIMER_GetTicks();
+    current.durationTicks = 0;
+    spillActive = 1;
+    TRACE_LOG_INFO("BOS: spill %u\n\r", current.number);
+}
+
+//------------------------------------------------------------------------------
+/// Handler for the EOS input. Closes the current spill on the rising edge and
+/// posts the end-of-spill task.
+//------------------------------------------------------------------------------
+static void ISR_Eos(const Pin *pPin)
+{
+    COUNTER_Increment(&irqCounter);
+
+    if (!PIO_Get(pPin) || !spillActive) {
+
+        return;
+    }
+
+    spillActive = 0;
+    current.durationTicks = TIMER_GetTicks() - current.startTicks;
+    TRACE_LOG_INFO("EOS: spill %u, %u events\n\r", current.number, current.events);
+
+    if (pSpillEndTask) {
+
+        SCHED_Post(pSpillEndTask);
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Configures the BOS and EOS inputs and their interrupts. Must be called
+/// after PIO_InitializeInterrupts().
+/// \param gated  1 to follow the spill gate, 0 for continuous data taking.
+/// \param pEndTask  Task posted at each EOS (can be 0).
+//------------------------------------------------------------------------------
+void SPILL_Configure(unsigned char gated, SchedTask *pEndTask)
+{
+    gateEnabled = gated;
+    spillActive = 0;
+    pSpillEndTask = pEndTask;
+    current.number = 0;
+    last.number = 0;
+
+    if (!gated) {
+
+        TRACE_INFO("Spill gate disabled, continuous mode\n\r");
+        return;
+    }
+
+    COUNTERS_Register(&irqCounter, "spill irq", COUNTER_TYPE_COUNT);
+    PIO_Configure(&pinBos, 1);
+    PIO_Configure(&pinEos, 1);
+    PIO_ConfigureIt(&pinBos, ISR_Bos);
+    PIO_ConfigureIt(&pinEos, ISR_Eos);
+    PIO_EnableIt(&pinBos);
+    PIO_EnableIt(&pinEos);
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if the data taking follows the spill gate.
+//------------------------------------------------------------------------------
+unsigned char SPILL_IsGated(void)
+{
+    return gateEnabled;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a spill is in progress. Always 0 in continuous mode.
+//------------------------------------------------------------------------------
+unsigned char SPILL_IsActive(void)
+{
+    return spillActive;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of the current (or last) spill, 0 before the first one.
+//------------------------------------------------------------------------------
+unsigned int SPILL_GetNumber(void)
+{
+    return current.number;
+}
+
+//------------------------------------------------------------------------------
+/// Accounts for an event read out in the current spill.
+/// \param words  Event size in words.
+//------------------------------------------------------------------------------
+void SPILL_CountEvent(unsigned int words)
+{
+    CriticalState state;
+
+    state = CRITICAL_Enter();
+    current.events++;
+    current.words += words;
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Accounts for an event dropped in the current spill.
+//------------------------------------------------------------------------------
+void SPILL_CountOverflow(void)
+{
+    CriticalState state;
+
+    state = CRITICAL_Enter();
+    current.overflows++;
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Returns a consistent copy of the statistics of the current spill.
+/// \param pStats  Filled with the statistics.
+//------------------------------------------------------------------------------
+void SPILL_GetCurrent(SpillStats *pStats)
+{
+    CriticalState state;
+
+    state = CRITICAL_Enter();
+    *pStats = current;
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Returns a consistent copy of the statistics of the last completed spill.
+/// Between spills this includes the data read out after the EOS edge.
+/// \param pStats  Filled with the statistics (number is 0 if none).
+//------------------------------------------------------------------------------
+void SPILL_GetLast(SpillStats *pStats)
+{
+    CriticalState state;
+
+    state = CRITICAL_Enter();
+    *pStats = spillActive ? last : current;
+    CRITICAL_Exit(state);
+}
+
@@ -0,0 +1,88 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Beam spill gate synchronization. The accelerator signals the begin (BOS)
+/// and end (EOS) of each spill on two PIO inputs; this module keeps track of
+/// the spill state and of per-spill statistics, so that the data path can do
+/// the bare minimum during the spill and the heavy work in between.
+///
+/// !Usage
+///
+/// -# Call SPILL_Configure() after PIO_InitializeInterrupts(), with the task
+///    to post at the end of each spill. Without gating the module stays in
+///    continuous mode: no spill is ever active and the readout runs freely.
+/// -# Query the gate state with SPILL_IsActive() and SPILL_GetNumber().
+/// -# Account for the data taken with SPILL_CountEvent() and
+///    SPILL_CountOverflow().
+/// -# Read the statistics of the running spill with SPILL_GetCurrent() and
+///    of the last completed one with SPILL_GetLast().
+//------------------------------------------------------------------------------
+
+#ifndef SPILL_H
+#define SPILL_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <pio/pio.h>
+#include <sched/sched.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Begin-of-spill input, active on the rising edge.
+#define PIN_SPILL_BOS   {1 << 6, AT91C_BASE_PIOC, AT91C_ID_PIOC, PIO_INPUT, PIO_DEGLITCH}
+/// End-of-spill input, active on the rising edge.
+#define PIN_SPILL_EOS   {1 << 7, AT91C_BASE_PIOC, AT91C_ID_PIOC, PIO_INPUT, PIO_DEGLITCH}
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Statistics of one spill.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Spill number, starting at 1.
+    unsigned int number;
+    /// Number of events read out.
+    unsigned int events;
+    /// Number of words read out.
+    unsigned int words;
+    /// Number of events dropped because the buffer was full.
+    unsigned int overflows;
+    /// Time of the BOS edge, in timer ticks.
+    unsigned int startTicks;
+    /// Time between the BOS and EOS edges, in timer ticks.
+    unsigned int durationTicks;
+
+} SpillStats;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SPILL_Configure(unsigned char gated, SchedTask *pEndTask);
+
+extern unsigned char SPILL_IsGated(void);
+
+extern unsigned char SPILL_IsActive(void);
+
+extern unsigned int SPILL_GetNumber(void);
+
+extern void SPILL_CountEvent(unsigned int words);
+
+extern void SPILL_CountOverflow(void);
+
+extern void SPILL_GetCurrent(SpillStats *pStats);
+
+extern void SPILL_GetLast(SpillStats *pStats);
+
+#endif //#ifndef SPILL_H
+
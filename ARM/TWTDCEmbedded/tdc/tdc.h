@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Layout of the TDC hit words read from the DPRAM, shared by the modules
+/// that look into the event payload. This is the only place to change when
+/// the FPGA word format changes.
+///
+/// Hit word:
+/// - bits 31..26: channel number (0 to TDC_NUM_CHANNELS - 1);
+/// - bits 25..16: reserved;
+/// - bits 15..0: leading edge time, in TDC counts from the trigger.
+///
+/// When the DPRAM is split in segments (one per TDC chip, see evbuild.h),
+/// each segment starts with a fragment header, followed by the hit words:
+/// - bits 31..28: TDC_FRAGMENT_MARKER;
+/// - bits 27..16: trigger number, modulo 2^12;
+/// - bits 15..0: number of hit words following.
+//------------------------------------------------------------------------------
+
+#ifndef TDC_H
+#define TDC_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Number of channels of a board.
+#define TDC_NUM_CHANNELS        64
+
+/// Position and mask of the channel number.
+#define TDC_CHANNEL_SHIFT       26
+#define TDC_CHANNEL_MASK        0x3F
+
+/// Number of bits and mask of the time.
+#define TDC_TIME_BITS           16
+#define TDC_TIME_MASK           0xFFFF
+
+/// Returns the channel number of a hit word.
+#define TDC_GET_CHANNEL(word)   (((word) >> TDC_CHANNEL_SHIFT) & TDC_CHANNEL_MASK)
+
+/// Returns the time of a hit word.
+#define TDC_GET_TIME(word)      ((word) & TDC_TIME_MASK)
+
+/// Marker of a fragment header.
+#define TDC_FRAGMENT_MARKER     0xA
+
+/// Mask of the trigger numbers.
+#define TDC_TRIGGER_MASK        0xFFF
+
+/// Returns 1 if a word has the fragment header marker.
+#define TDC_IS_FRAGMENT(word)   (((word) >> 28) == TDC_FRAGMENT_MARKER)
+
+/// Returns the trigger number of a fragment header.
+#define TDC_GET_TRIGGER(word)   (((word) >> 16) & TDC_TRIGGER_MASK)
+
+/// Returns the number of hit words of a fragment header.
+#define TDC_GET_FRAGMENT_SIZE(word) ((word) & 0xFFFF)
+
+#endif //#ifndef TDC_H
+
@@ -0,0 +1,166 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "timer.h"
+#include <board.h>
+#include <tc/tc.h>
+#include <utility/critical.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// TC1 value at which TIOA1 rises and TC2 is incremented. Placing the carry in
+/// the middle of the low half keeps it away from the TC1 wrap-around.
+#define TIMER_CARRY         0x8000
+
+/// Number of TC1 ticks after TIMER_CARRY during which TC2 may not have been
+/// resynchronized yet.
+#define TIMER_GUARD         8
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Tick frequency in Hz, 0 until configured.
+static unsigned int frequency = 0;
+
+/// Microseconds since startup at the last update of the microsecond count,
+/// tick count at that time, and ticks not converted yet (in units of
+/// 1/1000000 tick).
+static unsigned long long microseconds = 0;
+static unsigned int lastTicks = 0;
+static unsigned int fraction = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Adds the ticks elapsed since the last update to the microsecond count.
+/// Must be called with interrupts masked.
+//------------------------------------------------------------------------------
+static void UpdateMicroseconds(void)
+{
+    unsigned int ticks = TIMER_GetTicks();
+    unsigned long long elapsed;
+
+    elapsed = (unsigned long long) (ticks - lastTicks) * 1000000 + fraction;
+    microseconds += elapsed / frequency;
+    fraction = (unsigned int) (elapsed % frequency);
+    lastTicks = ticks;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Configures and starts the TC1/TC2 chain. TC1 runs at MCK/2 and raises
+/// TIOA1 once per period, which clocks TC2 via XC2.
+/// \param mck  Master clock frequency in Hz.
+//------------------------------------------------------------------------------
+void TIMER_Configure(unsigned int mck)
+{
+    CriticalState state;
+
+    // Account for the time elapsed at the previous frequency
+    state = CRITICAL_Enter();
+    if (frequency != 0) {
+
+        UpdateMicroseconds();
+    }
+
+    AT91C_BASE_PMC->PMC_PCER = (1 << AT91C_ID_TC1) | (1 << AT91C_ID_TC2);
+
+    // TC1: free running at MCK/2, TIOA1 set at RA and cleared at RC
+    TC_Configure(AT91C_BASE_TC1, AT91C_TC_CLKS_TIMER_DIV1_CLOCK
+                                 | AT91C_TC_WAVE
+                                 | AT91C_TC_WAVESEL_UP
+                                 | AT91C_TC_ACPA_SET
+                                 | AT91C_TC_ACPC_CLEAR);
+    AT91C_BASE_TC1->TC_RA = TIMER_CARRY;
+    AT91C_BASE_TC1->TC_RC = 0xFFFF;
+
+    // TC2: counts TIOA1 rising edges
+    AT91C_BASE_TCB0->TCB_BMR = (AT91C_BASE_TCB0->TCB_BMR & ~AT91C_TCB_TC2XC2S)
+                               | AT91C_TCB_TC2XC2S_TIOA1;
+    TC_Configure(AT91C_BASE_TC2, AT91C_TC_CLKS_XC2
+                                 | AT91C_TC_WAVE
+                                 | AT91C_TC_WAVESEL_UP);
+
+    // Start both channels at the same time
+    AT91C_BASE_TC1->TC_CCR = AT91C_TC_CLKEN;
+    AT91C_BASE_TC2->TC_CCR = AT91C_TC_CLKEN;
+    AT91C_BASE_TCB0->TCB_BCR = AT91C_TCB_SYNC;
+
+    frequency = mck / 2;
+    lastTicks = 0;
+    fraction = 0;
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the current 32-bit tick count.
+/// TC2 is incremented when TC1 reaches TIMER_CARRY, so the upper half read
+/// while TC1 is past that point is one period ahead and gets corrected. The
+/// read is retried if TC2 changed in between, or if TC1 sits in the few ticks
+/// where the carry may not be visible yet.
+//------------------------------------------------------------------------------
+unsigned int TIMER_GetTicks(void)
+{
+    unsigned int high;
+    unsigned int low;
+
+    do {
+        high = AT91C_BASE_TC2->TC_CV;
+        low = AT91C_BASE_TC1->TC_CV;
+    }
+    while ((high != AT91C_BASE_TC2->TC_CV)
+           || ((low - TIMER_CARRY) < TIMER_GUARD));
+
+    if (low >= TIMER_CARRY) {
+
+        high--;
+    }
+
+    return (high << 16) | low;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time since startup in microseconds, on 64 bits. The count is
+/// carried over clock changes, but it must be read at least once every 2^32
+/// ticks to follow the wrap-arounds of the tick counter.
+//------------------------------------------------------------------------------
+unsigned long long TIMER_GetMicroseconds(void)
+{
+    unsigned long long result;
+    CriticalState state;
+
+    state = CRITICAL_Enter();
+    UpdateMicroseconds();
+    result = microseconds;
+    CRITICAL_Exit(state);
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the tick frequency in Hz.
+//------------------------------------------------------------------------------
+unsigned int TIMER_GetFrequency(void)
+{
+    return frequency;
+}
+
+//------------------------------------------------------------------------------
+/// Converts a number of ticks into microseconds.
+/// \param ticks  Duration in ticks.
+/// \return Duration in microseconds.
+//------------------------------------------------------------------------------
+unsigned int TIMER_TicksToUs(unsigned int ticks)
+{
+    return (unsigned int) (((unsigned long long) ticks * 1000000) / frequency);
+}
+
@@ -0,0 +1,43 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Free-running 32-bit tick counter used to time tasks, idle periods and
+/// benchmarks with sub-microsecond resolution.
+///
+/// The counter is built from two chained 16-bit channels of the first TC
+/// block: TC1 counts MCK/2 and clocks TC2 through TIOA1. TC0 is left to the
+/// application.
+///
+/// !Usage
+///
+/// -# Call TIMER_Configure() once the master clock is set up (and again after
+///    every MCK change).
+/// -# Read the current tick count with TIMER_GetTicks(); differences between
+///    two readings are valid as long as they are shorter than 2^32 ticks
+///    (about 86 s at the default MCK).
+/// -# Convert durations with TIMER_TicksToUs().
+/// -# For absolute timestamps, use TIMER_GetMicroseconds() and read it at
+///    least once a minute (e.g. from a periodic task).
+//------------------------------------------------------------------------------
+
+#ifndef TIMER_H
+#define TIMER_H
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void TIMER_Configure(unsigned int mck);
+
+extern unsigned int TIMER_GetTicks(void);
+
+extern unsigned long long TIMER_GetMicroseconds(void);
+
+extern unsigned int TIMER_GetFrequency(void);
+
+extern unsigned int TIMER_TicksToUs(unsigned int ticks);
+
+#endif //#ifndef TIMER_H
+
@@ -0,0 +1,60 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Trace channels of the application modules, used by trace.h when a module
+/// defines TRACE_CHANNEL.
+///
+/// Each channel XXX has an ID TRACE_CH_XXX (0 to 31), which is its bit in
+/// the runtime masks, and a compile-time level TRACE_CH_XXX_LEVEL: traces
+/// above that level are not compiled in the module. Raise the compile-time
+/// level of a channel to be able to enable its debug traces in the field
+/// with TRACE_SetChannelLevel(); at startup every channel runs at TRACE_LEVEL.
+///
+/// !Usage
+///
+/// -# Add a channel below.
+/// -# In the module, add "#define TRACE_CHANNEL XXX" before any #include.
+//------------------------------------------------------------------------------
+
+#ifndef TRACE_CHANNELS_H
+#define TRACE_CHANNELS_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Main program and tasks.
+#define TRACE_CH_MAIN               0
+#define TRACE_CH_MAIN_LEVEL         TRACE_LEVEL
+
+/// Task scheduler.
+#define TRACE_CH_SCHED              1
+#define TRACE_CH_SCHED_LEVEL        TRACE_LEVEL
+
+/// Clock profiles.
+#define TRACE_CH_CLOCK              2
+#define TRACE_CH_CLOCK_LEVEL        TRACE_LEVEL_DEBUG
+
+/// Spill gate.
+#define TRACE_CH_SPILL              3
+#define TRACE_CH_SPILL_LEVEL        TRACE_LEVEL_DEBUG
+
+/// Event buffer.
+#define TRACE_CH_EVBUF              4
+#define TRACE_CH_EVBUF_LEVEL        TRACE_LEVEL
+
+/// Command shell.
+#define TRACE_CH_SHELL              5
+#define TRACE_CH_SHELL_LEVEL        TRACE_LEVEL
+
+/// SD card.
+#define TRACE_CH_SDCARD             6
+#define TRACE_CH_SDCARD_LEVEL       TRACE_LEVEL
+
+/// Number of channels in use.
+#define TRACE_NUM_CHANNELS          7
+
+#endif //#ifndef TRACE_CHANNELS_H
+
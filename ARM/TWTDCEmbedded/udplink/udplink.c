@@ -0,0 +1,460 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "udplink.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Little-endian accesses, at any alignment.
+#define GET32(p)        ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((unsigned int) (p)[3] << 24))
+#define PUT16(p, v)     do { (p)[0] = (unsigned char) (v); (p)[1] = (unsigned char) ((v) >> 8); } while (0)
+#define PUT32(p, v)     do { PUT16(p, v); PUT16((p) + 2, (v) >> 16); } while (0)
+
+/// Comparison of stream offsets modulo 2^32: a is before b.
+#define BEFORE(a, b)    ((int) ((a) - (b)) < 0)
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// What is needed to send a datagram again.
+typedef struct {
+
+    unsigned int offset;
+    unsigned short first;
+    unsigned short size;
+
+} Sent;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Source of the bytes of the retransmissions.
+static UdpLinkFetch fetchBytes;
+
+/// Destination.
+static unsigned int destination;
+static unsigned short destinationPort = UDPLINK_PORT;
+
+/// Number of the next datagram, and stream offset of the next byte.
+static unsigned int sequence;
+static unsigned int streamOffset;
+
+/// Receiver state: set while control messages come, offset of the first
+/// byte it does not have, window, and ticks since its last message.
+static unsigned char reliable;
+static unsigned int ackedOffset;
+static unsigned int window;
+static unsigned int silentTicks;
+
+/// Acknowledged offset at the previous tick, to notice a lost tail.
+static unsigned int tickAcked;
+
+/// Datagrams which can be sent again, by sequence number.
+static Sent pHistory[UDPLINK_HISTORY];
+
+/// Datagrams to send again, from pNacks[nackHead] to pNacks[numNacks - 1].
+static unsigned int pNacks[UDPLINK_MAX_NACKS];
+static unsigned int nackHead;
+static unsigned int numNacks;
+
+/// Datagram being filled: payload, number of stream bytes and offset of the
+/// first block; pDatagram is 0 when none is open.
+static unsigned char *pDatagram;
+static unsigned int datagramSize;
+static unsigned int datagramFirst;
+
+/// Bytes of the current block already in datagrams.
+static unsigned int blockOffset;
+
+/// Event buffer occupancy sent in the headers.
+static unsigned short occupancy;
+
+static UdpLinkStats stats;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Writes a datagram header.
+//------------------------------------------------------------------------------
+static void PutHeader(
+    unsigned char *pHeader,
+    unsigned int number,
+    const Sent *pSent,
+    unsigned short flags)
+{
+    PUT32(pHeader, UDPLINK_MAGIC);
+    PUT32(pHeader + 4, number);
+    PUT32(pHeader + 8, pSent->offset);
+    PUT16(pHeader + 12, pSent->first);
+    PUT16(pHeader + 14, pSent->size);
+    PUT16(pHeader + 16, flags);
+    PUT16(pHeader + 18, occupancy);
+}
+
+//------------------------------------------------------------------------------
+/// Sends the open datagram, and keeps what is needed to send it again.
+//------------------------------------------------------------------------------
+static void Close(void)
+{
+    Sent *pSent = &pHistory[sequence % UDPLINK_HISTORY];
+
+    pSent->offset = streamOffset - datagramSize;
+    pSent->first = datagramFirst;
+    pSent->size = datagramSize;
+    PutHeader(pDatagram, sequence, pSent, 0);
+    NET_EndUdp(UDPLINK_HEADER_SIZE + datagramSize);
+    pDatagram = 0;
+    sequence++;
+    stats.datagrams++;
+    if (!reliable) {
+
+        ackedOffset = streamOffset;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sends a datagram again.
+/// \param number  Sequence number.
+/// \return 1 if done or not needed, 0 if no transmit buffer was free.
+//------------------------------------------------------------------------------
+static unsigned char Retransmit(unsigned int number)
+{
+    const Sent *pSent = &pHistory[number % UDPLINK_HISTORY];
+    Sent resent = *pSent;
+    unsigned short flags = UDPLINK_FLAG_RETRANSMIT;
+    unsigned char *pPayload;
+    unsigned char known = ((sequence - number) <= UDPLINK_HISTORY);
+
+    // Not sent yet, or received since
+    if (((sequence - number) == 0)
+        || (known && !BEFORE(ackedOffset, resent.offset + resent.size))) {
+
+        return 1;
+    }
+
+    pPayload = NET_BeginUdp(destination, destinationPort, UDPLINK_PORT);
+    if (pPayload == 0) {
+
+        return 0;
+    }
+    // Too old to be known, or its bytes are gone
+    if (!known) {
+
+        resent.offset = 0;
+        resent.first = UDPLINK_NO_BLOCK;
+        resent.size = 0;
+        flags |= UDPLINK_FLAG_GONE;
+        stats.misses++;
+    }
+    else if ((fetchBytes == 0) || !fetchBytes(resent.offset, pPayload + UDPLINK_HEADER_SIZE, resent.size)) {
+
+        resent.size = 0;
+        flags |= UDPLINK_FLAG_GONE;
+        stats.misses++;
+    }
+    PutHeader(pPayload, number, &resent, flags);
+    NET_EndUdp(UDPLINK_HEADER_SIZE + resent.size);
+    stats.retransmits++;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Queues a datagram to send again, unless it already is.
+//------------------------------------------------------------------------------
+static void Queue(unsigned int number)
+{
+    unsigned int i;
+
+    for (i = nackHead; i < numNacks; i++) {
+
+        if (pNacks[i] == number) {
+
+            return;
+        }
+    }
+    if (nackHead > 0) {
+
+        memmove(pNacks, pNacks + nackHead, (numNacks - nackHead) * sizeof(pNacks[0]));
+        numNacks -= nackHead;
+        nackHead = 0;
+    }
+    if (numNacks < UDPLINK_MAX_NACKS) {
+
+        pNacks[numNacks++] = number;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Handles a control message from the receiver (see NetHandler).
+//------------------------------------------------------------------------------
+static void OnControl(
+    unsigned int address,
+    unsigned short port,
+    const unsigned char *pData,
+    unsigned int size)
+{
+    unsigned int acked;
+    unsigned int count;
+    unsigned int i;
+
+    if ((address != destination) || (size < UDPLINK_CONTROL_SIZE)
+        || (GET32(pData) != UDPLINK_CONTROL_MAGIC)) {
+
+        return;
+    }
+    count = GET32(pData + 12);
+    if ((count > UDPLINK_MAX_NACKS) || (size < UDPLINK_CONTROL_SIZE + count * 4)) {
+
+        return;
+    }
+    stats.controls++;
+    stats.nacks += count;
+    acked = GET32(pData + 4);
+
+    // Resume from the acknowledgement of the receiver if it is recent, what
+    // was sent before it spoke counts as acknowledged otherwise
+    if (!reliable) {
+
+        reliable = 1;
+        ackedOffset = streamOffset;
+        if (!BEFORE(streamOffset, acked)
+            && ((streamOffset - acked) <= UDPLINK_HISTORY * UDPLINK_PAYLOAD)) {
+
+            ackedOffset = acked;
+        }
+        tickAcked = ackedOffset;
+    }
+    silentTicks = 0;
+
+    if (BEFORE(ackedOffset, acked) && !BEFORE(streamOffset, acked)) {
+
+        ackedOffset = acked;
+    }
+    window = GET32(pData + 8);
+    for (i = 0; i < count; i++) {
+
+        Queue(GET32(pData + UDPLINK_CONTROL_SIZE + i * 4));
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Binds the control messages of the receiver to the link.
+/// \param fetch  Function copying the sent bytes for the retransmissions.
+//------------------------------------------------------------------------------
+void UDPLINK_Initialize(UdpLinkFetch fetch)
+{
+    fetchBytes = fetch;
+    NET_Bind(UDPLINK_PORT, OnControl);
+}
+
+//------------------------------------------------------------------------------
+/// Sets the destination of the stream, and starts a new stream: the sequence
+/// numbers and offsets restart at 0, the block being sent is dropped, and the
+/// link is not reliable until the receiver speaks.
+/// \param address  Destination IP address.
+/// \param port  Destination port.
+//------------------------------------------------------------------------------
+void UDPLINK_Configure(unsigned int address, unsigned short port)
+{
+    UDPLINK_Flush();
+    destination = address;
+    destinationPort = port;
+    sequence = 0;
+    streamOffset = 0;
+    blockOffset = 0;
+    reliable = 0;
+    ackedOffset = 0;
+    nackHead = 0;
+    numNacks = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the destination of the stream.
+//------------------------------------------------------------------------------
+void UDPLINK_GetDestination(unsigned int *pAddress, unsigned short *pPort)
+{
+    *pAddress = destination;
+    *pPort = destinationPort;
+}
+
+//------------------------------------------------------------------------------
+/// Sets the event buffer occupancy sent in the next headers.
+/// \param value  Occupancy in 1/65536 of the buffer size.
+//------------------------------------------------------------------------------
+void UDPLINK_SetOccupancy(unsigned short value)
+{
+    occupancy = value;
+}
+
+//------------------------------------------------------------------------------
+/// Sends the datagrams asked again by the receiver, after the open one.
+/// \return 1 if none is left, 0 if no transmit buffer was free.
+//------------------------------------------------------------------------------
+unsigned char UDPLINK_Service(void)
+{
+    if (nackHead == numNacks) {
+
+        return 1;
+    }
+    UDPLINK_Flush();
+    while (nackHead < numNacks) {
+
+        if (!Retransmit(pNacks[nackHead])) {
+
+            return 0;
+        }
+        nackHead++;
+    }
+    nackHead = 0;
+    numNacks = 0;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Adds a block to the stream.
+/// \param pData  Block.
+/// \param size  Block size in bytes.
+/// \return 1 if the whole block is in datagrams, 0 if it must be given again
+///         (no transmit buffer free, next hop not resolved yet or window of
+///         the receiver full).
+//------------------------------------------------------------------------------
+unsigned char UDPLINK_Send(const void *pData, unsigned int size)
+{
+    unsigned int chunk;
+
+    while (blockOffset < size) {
+
+        if (pDatagram == 0) {
+
+            // Only whole datagrams within the window of the receiver
+            if (reliable && ((int) (ackedOffset + window - streamOffset) < UDPLINK_PAYLOAD)) {
+
+                stats.windowFull++;
+                return 0;
+            }
+            pDatagram = NET_BeginUdp(destination, destinationPort, UDPLINK_PORT);
+            if (pDatagram == 0) {
+
+                return 0;
+            }
+            datagramSize = 0;
+            datagramFirst = UDPLINK_NO_BLOCK;
+        }
+        if ((blockOffset == 0) && (datagramFirst == UDPLINK_NO_BLOCK)) {
+
+            datagramFirst = datagramSize;
+        }
+
+        chunk = size - blockOffset;
+        if (chunk > UDPLINK_PAYLOAD - datagramSize) {
+
+            chunk = UDPLINK_PAYLOAD - datagramSize;
+        }
+        memcpy(pDatagram + UDPLINK_HEADER_SIZE + datagramSize,
+               (const unsigned char *) pData + blockOffset, chunk);
+        datagramSize += chunk;
+        blockOffset += chunk;
+        streamOffset += chunk;
+        if (datagramSize == UDPLINK_PAYLOAD) {
+
+            Close();
+        }
+    }
+
+    blockOffset = 0;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Sends the partly filled datagram, if any.
+//------------------------------------------------------------------------------
+void UDPLINK_Flush(void)
+{
+    if (pDatagram != 0) {
+
+        Close();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Follows the receiver, to be called every second: the link is no longer
+/// reliable after UDPLINK_TIMEOUT ticks without control message, and the
+/// datagram holding the first unacknowledged byte is sent again when the
+/// acknowledgement did not move for a whole tick.
+//------------------------------------------------------------------------------
+void UDPLINK_Tick(void)
+{
+    unsigned int number;
+    const Sent *pSent;
+
+    if (!reliable) {
+
+        return;
+    }
+    if (++silentTicks >= UDPLINK_TIMEOUT) {
+
+        reliable = 0;
+        ackedOffset = streamOffset;
+        nackHead = 0;
+        numNacks = 0;
+        stats.timeouts++;
+        return;
+    }
+
+    if ((ackedOffset == tickAcked) && (pDatagram == 0)) {
+
+        for (number = sequence - 1; (sequence - number) <= UDPLINK_HISTORY; number--) {
+
+            pSent = &pHistory[number % UDPLINK_HISTORY];
+            if ((ackedOffset - pSent->offset) < pSent->size) {
+
+                Queue(number);
+                break;
+            }
+            if (BEFORE(pSent->offset, ackedOffset)) {
+
+                break;
+            }
+        }
+    }
+    tickAcked = ackedOffset;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 while the receiver sends control messages.
+//------------------------------------------------------------------------------
+unsigned char UDPLINK_IsReliable(void)
+{
+    return reliable;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the stream offset up to which the bytes can be released: the
+/// first one not received yet while the link is reliable, the next one to
+/// send otherwise.
+//------------------------------------------------------------------------------
+unsigned int UDPLINK_GetAcked(void)
+{
+    return ackedOffset;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the statistics of the link.
+//------------------------------------------------------------------------------
+const UdpLinkStats * UDPLINK_GetStats(void)
+{
+    return &stats;
+}
+
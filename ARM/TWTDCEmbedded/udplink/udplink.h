@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// UDP data link over the Ethernet port (see net.h). The event buffer blocks
+/// are streamed as a byte stream cut into datagrams of up to
+/// UDPLINK_PAYLOAD bytes, each made of a UdpLinkHeader and the bytes. Small
+/// blocks share a datagram, large ones span several, so the datagrams are
+/// full as long as blocks are waiting. The header gives the offset of the
+/// first block starting in the datagram, for the receiver to resynchronize
+/// after a lost datagram, which it detects with the sequence numbers.
+///
+/// Reliable delivery is driven by the receiver, which sends UdpLinkControl
+/// messages back to the source port: the stream offset up to which it has
+/// everything (cumulative acknowledgement), how many bytes more it can take
+/// (window), and the sequence numbers of the missing datagrams (NACKs). The
+/// link keeps the offset, size and first block of the last
+/// UDPLINK_HISTORY datagrams; a NACKed datagram is rebuilt with the same
+/// header from the stream bytes, which the caller fetches from wherever they
+/// still are (the event buffer, see UdpLinkFetch), and sent before any new
+/// data. A datagram too old to be known or whose bytes are gone is sent
+/// empty with UDPLINK_FLAG_GONE, so the receiver stops asking. When the
+/// acknowledgement stays behind while the link is idle, the datagram holding
+/// the first unacknowledged byte is sent again, which recovers a lost tail.
+///
+/// A new datagram is only started when it fits in the window of the
+/// receiver. The header carries the occupancy of the event buffer, for the
+/// receiver to see the pressure on the board. The link is reliable only while
+/// control messages come: until the first one, and UDPLINK_TIMEOUT ticks
+/// after the last one, everything sent counts as acknowledged, so the board
+/// never waits for a receiver that is not there. The first message takes the
+/// acknowledgement back to the one of the receiver if it is within the
+/// history, so that what the receiver missed meanwhile can still be asked.
+///
+/// !Usage
+///
+/// -# Call UDPLINK_Initialize() with the fetch function after NET_Initialize(),
+///    then UDPLINK_Configure() with the destination address and port.
+/// -# Call UDPLINK_Service() first, then UDPLINK_Send() with each block:
+///    when either returns 0, no transmit buffer was free or the window is
+///    full; call again later, the part already sent is remembered.
+/// -# Call UDPLINK_Flush() when no block is waiting, to send the partly
+///    filled datagram, and UDPLINK_Tick() every second.
+/// -# Keep the blocks until UDPLINK_GetAcked() has passed their end.
+/// -# On the host, receive the datagrams with Host/netsim.
+///
+/// \note Stream offsets are modulo 2^32.
+/// \note This module is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef UDPLINK_H
+#define UDPLINK_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <net/net.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Default destination and source port.
+#define UDPLINK_PORT            9060
+
+/// Identifies a datagram header ("UDLK").
+#define UDPLINK_MAGIC           0x4B4C4455
+
+/// Identifies a control message from the receiver ("UDAK").
+#define UDPLINK_CONTROL_MAGIC   0x4B414455
+
+/// Header size in bytes.
+#define UDPLINK_HEADER_SIZE     20
+
+/// Size of a control message without the NACKs, in bytes.
+#define UDPLINK_CONTROL_SIZE    16
+
+/// Largest number of stream bytes in one datagram.
+#define UDPLINK_PAYLOAD         (NET_UDP_PAYLOAD - UDPLINK_HEADER_SIZE)
+
+/// Value of UdpLinkHeader.first when no block starts in the datagram.
+#define UDPLINK_NO_BLOCK        0xFFFF
+
+/// Datagram flags: sent again, or its bytes are no longer available.
+#define UDPLINK_FLAG_RETRANSMIT (1 << 0)
+#define UDPLINK_FLAG_GONE       (1 << 1)
+
+/// Number of datagrams which can be sent again.
+#define UDPLINK_HISTORY         512
+
+/// Largest number of NACKs in a control message, and waiting to be served.
+#define UDPLINK_MAX_NACKS       64
+
+/// Number of ticks without control message after which the link is no
+/// longer reliable.
+#define UDPLINK_TIMEOUT         5
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Header at the start of each datagram, little-endian.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// UDPLINK_MAGIC.
+    unsigned int magic;
+    /// Datagram number since the configuration, starting at 0.
+    unsigned int sequence;
+    /// Stream offset of the first byte after the header.
+    unsigned int offset;
+    /// Offset of the first block starting in the datagram, or
+    /// UDPLINK_NO_BLOCK.
+    unsigned short first;
+    /// Number of stream bytes after the header.
+    unsigned short size;
+    /// UDPLINK_FLAG_xxx.
+    unsigned short flags;
+    /// Event buffer occupancy, in 1/65536 of its size.
+    unsigned short occupancy;
+
+} UdpLinkHeader;
+
+//------------------------------------------------------------------------------
+/// Control message from the receiver, little-endian, followed by count
+/// sequence numbers of missing datagrams.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// UDPLINK_CONTROL_MAGIC.
+    unsigned int magic;
+    /// Stream offset of the first byte not received yet.
+    unsigned int acked;
+    /// Number of bytes the receiver can take after acked.
+    unsigned int window;
+    /// Number of NACKs, at most UDPLINK_MAX_NACKS.
+    unsigned int count;
+
+} UdpLinkControl;
+
+//------------------------------------------------------------------------------
+/// Copies stream bytes which have been sent, for a retransmission.
+/// \param offset  Stream offset of the first byte.
+/// \param pData  Destination.
+/// \param size  Number of bytes.
+/// \return 1 if done, 0 if the bytes are no longer available.
+//------------------------------------------------------------------------------
+typedef unsigned char (*UdpLinkFetch)(unsigned int offset, unsigned char *pData, unsigned int size);
+
+//------------------------------------------------------------------------------
+/// Statistics of the link.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Datagrams sent for the first time.
+    unsigned int datagrams;
+    /// Control messages received, and NACKs in them.
+    unsigned int controls;
+    unsigned int nacks;
+    /// Datagrams sent again, on a NACK or when the link was idle.
+    unsigned int retransmits;
+    /// NACKs of datagrams too old, or whose bytes were gone.
+    unsigned int misses;
+    /// Times new data waited for the window of the receiver.
+    unsigned int windowFull;
+    /// Times the receiver went silent for UDPLINK_TIMEOUT ticks.
+    unsigned int timeouts;
+
+} UdpLinkStats;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void UDPLINK_Initialize(UdpLinkFetch fetch);
+
+extern void UDPLINK_Configure(unsigned int address, unsigned short port);
+
+extern void UDPLINK_GetDestination(unsigned int *pAddress, unsigned short *pPort);
+
+extern void UDPLINK_SetOccupancy(unsigned short occupancy);
+
+extern unsigned char UDPLINK_Service(void);
+
+extern unsigned char UDPLINK_Send(const void *pData, unsigned int size);
+
+extern void UDPLINK_Flush(void);
+
+extern void UDPLINK_Tick(void);
+
+extern unsigned char UDPLINK_IsReliable(void);
+
+extern unsigned int UDPLINK_GetAcked(void);
+
+extern const UdpLinkStats * UDPLINK_GetStats(void);
+
+#endif //#ifndef UDPLINK_H
+
@@ -0,0 +1,656 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "usbstream.h"
+#include <board.h>
+#include <pio/pio.h>
+#include <pio/pio_it.h>
+#include <aic/aic.h>
+#include <udp/udp.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Standard requests.
+#define GET_STATUS              0
+#define CLEAR_FEATURE           1
+#define SET_FEATURE             3
+#define SET_ADDRESS             5
+#define GET_DESCRIPTOR          6
+#define GET_CONFIGURATION       8
+#define SET_CONFIGURATION       9
+#define GET_INTERFACE           10
+#define SET_INTERFACE           11
+
+/// Descriptor types.
+#define DESCRIPTOR_DEVICE       1
+#define DESCRIPTOR_CONFIGURATION 2
+#define DESCRIPTOR_STRING       3
+
+/// Request recipients (bmRequestType bits 0-4).
+#define RECIPIENT_DEVICE        0
+#define RECIPIENT_INTERFACE     1
+#define RECIPIENT_ENDPOINT      2
+
+/// Control endpoint packet size.
+#define EP0_SIZE                BOARD_USB_ENDPOINTS_MAXPACKETSIZE(0)
+
+/// Control transfer states.
+#define CTRL_IDLE               0
+#define CTRL_DATA_IN            1
+#define CTRL_STATUS_IN          2
+#define CTRL_STATUS_OUT         3
+
+/// Writes a 16-bit value in a descriptor.
+#define WORD(value)             ((value) & 0xFF), (((value) >> 8) & 0xFF)
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// SETUP packet.
+typedef struct {
+
+    unsigned char bmRequestType;
+    unsigned char bRequest;
+    unsigned short wValue;
+    unsigned short wIndex;
+    unsigned short wLength;
+
+} SetupRequest;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// VBus detection pin instance.
+static const Pin pinVbus = PIN_USB_VBUS;
+
+/// Device descriptor.
+static const unsigned char deviceDescriptor[] = {
+
+    18, DESCRIPTOR_DEVICE, WORD(0x0200),
+    0x00, 0x00, 0x00, EP0_SIZE,
+    WORD(USBSTREAM_VID), WORD(USBSTREAM_PID), WORD(0x0100),
+    1, 2, 0,
+    1
+};
+
+/// Configuration descriptor, with one vendor-class interface and one
+/// bulk-IN endpoint.
+static const unsigned char configurationDescriptor[] = {
+
+    9, DESCRIPTOR_CONFIGURATION, WORD(9 + 9 + 7), 1, 1, 0, 0xC0, 0,
+    9, 4, 0, 0, 1, 0xFF, 0x00, 0x00, 0,
+    7, 5, 0x80 | USBSTREAM_EP, 0x02, WORD(USBSTREAM_PACKET_SIZE), 0
+};
+
+/// String descriptors: languages, manufacturer and product.
+static const unsigned char languageString[] = {4, DESCRIPTOR_STRING, WORD(0x0409)};
+static const unsigned char manufacturerString[] = {
+
+    10, DESCRIPTOR_STRING, 'E', 0, '9', 0, '0', 0, '6', 0
+};
+static const unsigned char productString[] = {
+
+    26, DESCRIPTOR_STRING, 'T', 0, 'W', 0, 'T', 0, 'D', 0, 'C', 0, ' ', 0,
+    's', 0, 't', 0, 'r', 0, 'e', 0, 'a', 0, 'm', 0
+};
+static const unsigned char * const pStrings[] = {
+
+    languageString, manufacturerString, productString
+};
+
+/// Control transfer in progress.
+static unsigned char ctrlState = CTRL_IDLE;
+static const unsigned char *pCtrlData;
+static unsigned int ctrlRemaining;
+static unsigned char ctrlZlp;
+
+/// Small replies (status, configuration...).
+static unsigned char ctrlBuffer[2];
+
+/// Address to apply at the end of the SET_ADDRESS status stage, 0 if none.
+static unsigned char pendingAddress = 0;
+
+/// Current configuration (0 or 1).
+static volatile unsigned char configuration = 0;
+
+/// Header and first payload bytes of the transfer, sent as the first packet.
+static unsigned int firstPacket[USBSTREAM_PACKET_SIZE / 4];
+static unsigned int firstSize;
+
+/// Rest of the payload not written to the FIFO yet.
+static const unsigned char *pStream;
+static unsigned int streamRemaining;
+
+/// Indicates if a zero-length packet must end the transfer.
+static unsigned char streamZlp;
+
+/// Indicates if a bank is filled but not released to the UDP yet, and if a
+/// packet is being sent.
+static unsigned char streamLoaded;
+static unsigned char streamInFlight;
+
+/// Indicates if a transfer is in progress.
+static volatile unsigned char streamBusy = 0;
+
+/// Number of the next transfer.
+static unsigned int sequence = 0;
+
+/// Function called at the end of each transfer and at configuration.
+static void (*pCallback)(void) = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Ends the transfer in progress, completed or aborted.
+//------------------------------------------------------------------------------
+static void EndTransfer(void)
+{
+    streamBusy = 0;
+    streamLoaded = 0;
+    streamInFlight = 0;
+    if (pCallback) {
+
+        pCallback();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Writes the next packet of the transfer in the free bank of the stream
+/// endpoint.
+/// \return 1 if a packet (possibly empty) has been written, 0 if the
+/// transfer has been entirely written.
+//------------------------------------------------------------------------------
+static unsigned char LoadPacket(void)
+{
+    unsigned int size;
+
+    if (firstSize > 0) {
+
+        UDP_WriteFifo(USBSTREAM_EP, firstPacket, firstSize);
+        firstSize = 0;
+        return 1;
+    }
+    if (streamRemaining > 0) {
+
+        size = (streamRemaining > USBSTREAM_PACKET_SIZE) ? USBSTREAM_PACKET_SIZE : streamRemaining;
+        UDP_WriteFifo(USBSTREAM_EP, pStream, size);
+        pStream += size;
+        streamRemaining -= size;
+        return 1;
+    }
+    if (streamZlp) {
+
+        streamZlp = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Handles the end of a packet on the stream endpoint: releases the bank
+/// filled meanwhile, and fills the one just sent.
+//------------------------------------------------------------------------------
+static void StreamHandler(void)
+{
+    unsigned int csr = AT91C_BASE_UDP->UDP_CSR[USBSTREAM_EP];
+
+    if (csr & AT91C_UDP_STALLSENT) {
+
+        UDP_ClearCsr(USBSTREAM_EP, AT91C_UDP_STALLSENT);
+    }
+    if ((csr & AT91C_UDP_TXCOMP) == 0) {
+
+        return;
+    }
+
+    streamInFlight = 0;
+    if (streamLoaded) {
+
+        UDP_SetCsr(USBSTREAM_EP, AT91C_UDP_TXPKTRDY);
+        streamInFlight = 1;
+        streamLoaded = LoadPacket();
+    }
+    UDP_ClearCsr(USBSTREAM_EP, AT91C_UDP_TXCOMP);
+
+    if (streamBusy && !streamInFlight) {
+
+        EndTransfer();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sends the next packet of the control IN data stage.
+//------------------------------------------------------------------------------
+static void SendControlData(void)
+{
+    unsigned int size = (ctrlRemaining > EP0_SIZE) ? EP0_SIZE : ctrlRemaining;
+
+    // An empty packet is the one ending a stage of full packets
+    if (size == 0) {
+
+        ctrlZlp = 0;
+    }
+    UDP_WriteFifo(0, pCtrlData, size);
+    pCtrlData += size;
+    ctrlRemaining -= size;
+    UDP_SetCsr(0, AT91C_UDP_TXPKTRDY);
+}
+
+//------------------------------------------------------------------------------
+/// Starts the IN data stage of a control transfer.
+/// \param pData  Data to send.
+/// \param size  Data size.
+/// \param wLength  Number of bytes requested by the host.
+//------------------------------------------------------------------------------
+static void ReplyData(const void *pData, unsigned int size, unsigned int wLength)
+{
+    if (size > wLength) {
+
+        size = wLength;
+    }
+    pCtrlData = (const unsigned char *) pData;
+    ctrlRemaining = size;
+    ctrlZlp = (size < wLength) && ((size % EP0_SIZE) == 0);
+    ctrlState = CTRL_DATA_IN;
+    SendControlData();
+}
+
+//------------------------------------------------------------------------------
+/// Acknowledges a request without data stage with a zero-length packet.
+//------------------------------------------------------------------------------
+static void ReplyStatus(void)
+{
+    ctrlState = CTRL_STATUS_IN;
+    UDP_SetCsr(0, AT91C_UDP_TXPKTRDY);
+}
+
+//------------------------------------------------------------------------------
+/// Rejects a request.
+//------------------------------------------------------------------------------
+static void ReplyStall(void)
+{
+    ctrlState = CTRL_IDLE;
+    UDP_SetCsr(0, AT91C_UDP_FORCESTALL);
+}
+
+//------------------------------------------------------------------------------
+/// Enables or disables the stream endpoint according to the configuration.
+/// \param value  Configuration value, 0 or 1.
+//------------------------------------------------------------------------------
+static void SetConfiguration(unsigned char value)
+{
+    configuration = value;
+    if (value) {
+
+        UDP_ConfigureEndpoint(USBSTREAM_EP, AT91C_UDP_EPTYPE_BULK_IN);
+        AT91C_BASE_UDP->UDP_GLBSTATE = AT91C_UDP_FADDEN | AT91C_UDP_CONFG;
+    }
+    else {
+
+        AT91C_BASE_UDP->UDP_IDR = 1 << USBSTREAM_EP;
+        AT91C_BASE_UDP->UDP_CSR[USBSTREAM_EP] = 0;
+        AT91C_BASE_UDP->UDP_GLBSTATE = AT91C_UDP_FADDEN;
+    }
+
+    // Abort the transfer in progress, or let the application start one
+    EndTransfer();
+}
+
+//------------------------------------------------------------------------------
+/// Handles a standard request.
+/// \param pRequest  SETUP packet.
+//------------------------------------------------------------------------------
+static void HandleRequest(const SetupRequest *pRequest)
+{
+    unsigned char recipient = pRequest->bmRequestType & 0x1F;
+    unsigned char endpoint = pRequest->wIndex & 0x0F;
+    unsigned char index = pRequest->wValue & 0xFF;
+
+    if ((pRequest->bmRequestType & 0x60) != 0) {
+
+        // No class or vendor request
+        ReplyStall();
+        return;
+    }
+
+    switch (pRequest->bRequest) {
+
+        case GET_STATUS:
+            ctrlBuffer[0] = 0;
+            ctrlBuffer[1] = 0;
+            if (recipient == RECIPIENT_DEVICE) {
+
+                ctrlBuffer[0] = 1; // Self-powered
+            }
+            else if ((recipient == RECIPIENT_ENDPOINT) && (endpoint == USBSTREAM_EP)) {
+
+                ctrlBuffer[0] = (AT91C_BASE_UDP->UDP_CSR[endpoint] & AT91C_UDP_FORCESTALL) ? 1 : 0;
+            }
+            ReplyData(ctrlBuffer, 2, pRequest->wLength);
+            break;
+
+        case CLEAR_FEATURE:
+        case SET_FEATURE:
+            if ((recipient == RECIPIENT_ENDPOINT) && (endpoint == USBSTREAM_EP)
+                && (pRequest->wValue == 0) && configuration) {
+
+                // Endpoint halt; clearing it also resets the data toggle
+                if (pRequest->bRequest == SET_FEATURE) {
+
+                    UDP_SetCsr(endpoint, AT91C_UDP_FORCESTALL);
+                }
+                else {
+
+                    UDP_ResetEndpoint(endpoint);
+                    UDP_ClearCsr(endpoint, AT91C_UDP_FORCESTALL);
+                }
+                if (streamBusy) {
+
+                    EndTransfer();
+                }
+                ReplyStatus();
+            }
+            else if (recipient == RECIPIENT_DEVICE) {
+
+                // Remote wakeup is not supported, accepted anyway
+                ReplyStatus();
+            }
+            else {
+
+                ReplyStall();
+            }
+            break;
+
+        case SET_ADDRESS:
+            pendingAddress = index & 0x7F;
+            ReplyStatus();
+            break;
+
+        case GET_DESCRIPTOR:
+            switch (pRequest->wValue >> 8) {
+
+                case DESCRIPTOR_DEVICE:
+                    ReplyData(deviceDescriptor, sizeof(deviceDescriptor), pRequest->wLength);
+                    break;
+                case DESCRIPTOR_CONFIGURATION:
+                    ReplyData(configurationDescriptor, sizeof(configurationDescriptor),
+                              pRequest->wLength);
+                    break;
+                case DESCRIPTOR_STRING:
+                    if (index < sizeof(pStrings) / sizeof(pStrings[0])) {
+
+                        ReplyData(pStrings[index], pStrings[index][0], pRequest->wLength);
+                    }
+                    else {
+
+                        ReplyStall();
+                    }
+                    break;
+                default:
+                    ReplyStall();
+            }
+            break;
+
+        case GET_CONFIGURATION:
+            ctrlBuffer[0] = configuration;
+            ReplyData(ctrlBuffer, 1, pRequest->wLength);
+            break;
+
+        case SET_CONFIGURATION:
+            if (index <= 1) {
+
+                SetConfiguration(index);
+                ReplyStatus();
+            }
+            else {
+
+                ReplyStall();
+            }
+            break;
+
+        case GET_INTERFACE:
+            ctrlBuffer[0] = 0;
+            ReplyData(ctrlBuffer, 1, pRequest->wLength);
+            break;
+
+        case SET_INTERFACE:
+            if (pRequest->wValue == 0) {
+
+                ReplyStatus();
+            }
+            else {
+
+                ReplyStall();
+            }
+            break;
+
+        default:
+            ReplyStall();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Handles the control endpoint events.
+//------------------------------------------------------------------------------
+static void ControlHandler(void)
+{
+    unsigned int csr = AT91C_BASE_UDP->UDP_CSR[0];
+    SetupRequest request;
+
+    if (csr & AT91C_UDP_STALLSENT) {
+
+        UDP_ClearCsr(0, AT91C_UDP_STALLSENT | AT91C_UDP_FORCESTALL);
+    }
+
+    if (csr & AT91C_UDP_RXSETUP) {
+
+        UDP_ReadFifo(0, &request, sizeof(request));
+        if (request.bmRequestType & 0x80) {
+
+            UDP_SetCsr(0, AT91C_UDP_DIR);
+        }
+        UDP_ClearCsr(0, AT91C_UDP_RXSETUP);
+        HandleRequest(&request);
+        return;
+    }
+
+    if (csr & AT91C_UDP_TXCOMP) {
+
+        UDP_ClearCsr(0, AT91C_UDP_TXCOMP);
+        if (ctrlState == CTRL_DATA_IN) {
+
+            if ((ctrlRemaining > 0) || ctrlZlp) {
+
+                SendControlData();
+            }
+            else {
+
+                // The host acknowledges with an OUT zero-length packet
+                UDP_ClearCsr(0, AT91C_UDP_DIR);
+                ctrlState = CTRL_STATUS_OUT;
+            }
+        }
+        else if (ctrlState == CTRL_STATUS_IN) {
+
+            if (pendingAddress != 0) {
+
+                AT91C_BASE_UDP->UDP_FADDR = AT91C_UDP_FEN | pendingAddress;
+                AT91C_BASE_UDP->UDP_GLBSTATE = AT91C_UDP_FADDEN;
+                pendingAddress = 0;
+            }
+            ctrlState = CTRL_IDLE;
+        }
+    }
+
+    if (csr & AT91C_UDP_RX_DATA_BK0) {
+
+        // Status stage of an IN transfer, or an aborted data stage
+        UDP_ClearCsr(0, AT91C_UDP_RX_DATA_BK0 | AT91C_UDP_DIR);
+        ctrlState = CTRL_IDLE;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Brings the device back to the default state after a USB bus reset.
+//------------------------------------------------------------------------------
+static void ResetDevice(void)
+{
+    unsigned char i;
+
+    for (i = 1; i < BOARD_USB_NUMENDPOINTS; i++) {
+
+        AT91C_BASE_UDP->UDP_CSR[i] = 0;
+    }
+    AT91C_BASE_UDP->UDP_IDR = 0xFFFFFFFF;
+    AT91C_BASE_UDP->UDP_FADDR = AT91C_UDP_FEN;
+    AT91C_BASE_UDP->UDP_GLBSTATE = 0;
+    UDP_ConfigureEndpoint(0, AT91C_UDP_EPTYPE_CTRL);
+    AT91C_BASE_UDP->UDP_IER = AT91C_UDP_ENDBUSRES;
+
+    ctrlState = CTRL_IDLE;
+    pendingAddress = 0;
+    configuration = 0;
+    if (streamBusy) {
+
+        EndTransfer();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// UDP interrupt handler.
+//------------------------------------------------------------------------------
+static void ISR_Udp(void)
+{
+    unsigned int status = AT91C_BASE_UDP->UDP_ISR & AT91C_BASE_UDP->UDP_IMR;
+
+    if (status & AT91C_UDP_ENDBUSRES) {
+
+        AT91C_BASE_UDP->UDP_ICR = AT91C_UDP_ENDBUSRES;
+        ResetDevice();
+        return;
+    }
+    if (status & AT91C_UDP_EPINT0) {
+
+        ControlHandler();
+    }
+    if (status & (1 << USBSTREAM_EP)) {
+
+        StreamHandler();
+    }
+
+    // Suspend and resume are not used
+    AT91C_BASE_UDP->UDP_ICR = AT91C_UDP_RXSUSP | AT91C_UDP_RXRSM | AT91C_UDP_WAKEUP;
+}
+
+//------------------------------------------------------------------------------
+/// Handler for the VBus input: connects the device when VBus is present, as
+/// required for self-powered devices.
+//------------------------------------------------------------------------------
+static void ISR_Vbus(const Pin *pPin)
+{
+    if (PIO_Get(&pinVbus)) {
+
+        UDP_Connect();
+    }
+    else {
+
+        UDP_Disconnect();
+        ResetDevice();
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Configures the UDP and the VBus detection, and connects the device if
+/// VBus is present. Must be called after PIO_InitializeInterrupts().
+/// \param callback  Function called in interrupt context at the end of each
+/// transfer and when the configuration changes (can be 0).
+//------------------------------------------------------------------------------
+void USBSTREAM_Initialize(void (*callback)(void))
+{
+    pCallback = callback;
+
+    UDP_Configure();
+    ResetDevice();
+    AIC_ConfigureIT(AT91C_ID_UDP, AT91C_AIC_PRIOR_LOWEST, ISR_Udp);
+    AIC_EnableIT(AT91C_ID_UDP);
+
+    PIO_Configure(&pinVbus, 1);
+    PIO_ConfigureIt(&pinVbus, ISR_Vbus);
+    PIO_EnableIt(&pinVbus);
+    ISR_Vbus(&pinVbus);
+}
+
+//------------------------------------------------------------------------------
+/// Starts sending a block to the host.
+/// \param pData  Block payload, left untouched until the end of the transfer.
+/// \param size  Payload size in words.
+/// \return 1 if the transfer is started, 0 if the stream is busy or the
+/// device is not configured by the host.
+//------------------------------------------------------------------------------
+unsigned char USBSTREAM_Send(const unsigned int *pData, unsigned int size)
+{
+    UsbStreamHeader header;
+    unsigned int bytes = size * 4;
+    unsigned int first;
+
+    if (streamBusy || !configuration) {
+
+        return 0;
+    }
+
+    // The header and the start of the payload make up the first packet
+    header.magic = USBSTREAM_MAGIC;
+    header.sequence = sequence++;
+    header.size = bytes;
+    first = USBSTREAM_PACKET_SIZE - sizeof(header);
+    if (first > bytes) {
+
+        first = bytes;
+    }
+    memcpy(firstPacket, &header, sizeof(header));
+    memcpy((unsigned char *) firstPacket + sizeof(header), pData, first);
+    firstSize = sizeof(header) + first;
+    pStream = (const unsigned char *) pData + first;
+    streamRemaining = bytes - first;
+    streamZlp = (((sizeof(header) + bytes) % USBSTREAM_PACKET_SIZE) == 0);
+
+    // Fill both banks, the first one being released right away
+    AIC_DisableIT(AT91C_ID_UDP);
+    streamBusy = 1;
+    LoadPacket();
+    UDP_SetCsr(USBSTREAM_EP, AT91C_UDP_TXPKTRDY);
+    streamInFlight = 1;
+    streamLoaded = LoadPacket();
+    AIC_EnableIT(AT91C_ID_UDP);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a transfer is in progress.
+//------------------------------------------------------------------------------
+unsigned char USBSTREAM_IsBusy(void)
+{
+    return streamBusy;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if the host has configured the device.
+//------------------------------------------------------------------------------
+unsigned char USBSTREAM_IsConfigured(void)
+{
+    return configuration;
+}
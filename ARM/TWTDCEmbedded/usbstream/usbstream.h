@@ -0,0 +1,84 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Vendor-class USB device streaming the event buffer blocks to the host on
+/// a bulk-IN endpoint, a readout path for test benches without the network.
+/// Each block is sent as one USB transfer made of a UsbStreamHeader and the
+/// block payload, ended by a short (or zero-length) packet.
+///
+/// The stream uses a dual-bank endpoint in ping-pong mode: while the UDP
+/// sends one bank, the interrupt handler fills the other one from SDRAM, so
+/// that a packet is ready at each IN token. The UDP is full-speed only, so
+/// bulk packets are 64 bytes whatever the FIFO size of the endpoint.
+///
+/// !Usage
+///
+/// -# Call USBSTREAM_Initialize() after PIO_InitializeInterrupts(), with the
+///    function to call (in interrupt context) at the end of each transfer and
+///    when the host configures the device. The device connects as soon as
+///    VBus is present.
+/// -# Send a block with USBSTREAM_Send() when USBSTREAM_IsBusy() returns 0.
+///    The block must stay untouched until the end of the transfer.
+/// -# On the host, receive the blocks with Host/usbrecv.
+///
+/// \note A transfer interrupted by a USB reset or an endpoint halt is lost;
+/// the host detects it with the sequence numbers.
+/// \note The header and descriptor definitions are also used by the host
+/// tools; they must not depend on the board.
+//------------------------------------------------------------------------------
+
+#ifndef USBSTREAM_H
+#define USBSTREAM_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Vendor and product IDs of the device: Atmel VID with a product ID for
+/// bench use only, change both before any distribution.
+#define USBSTREAM_VID           0x03EB
+#define USBSTREAM_PID           0x6190
+
+/// Bulk-IN endpoint number (dual bank).
+#define USBSTREAM_EP            4
+
+/// Bulk packet size at full speed.
+#define USBSTREAM_PACKET_SIZE   64
+
+/// Identifies a transfer header ("USBS").
+#define USBSTREAM_MAGIC         0x53425355
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Header sent at the start of each transfer, little-endian.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// USBSTREAM_MAGIC.
+    unsigned int magic;
+    /// Block number since boot, starting at 0.
+    unsigned int sequence;
+    /// Payload size in bytes.
+    unsigned int size;
+
+} UsbStreamHeader;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void USBSTREAM_Initialize(void (*callback)(void));
+
+extern unsigned char USBSTREAM_Send(const unsigned int *pData, unsigned int size);
+
+extern unsigned char USBSTREAM_IsBusy(void);
+
+extern unsigned char USBSTREAM_IsConfigured(void);
+
+#endif //#ifndef USBSTREAM_H
+
@@ -34,6 +34,85 @@
 #include "dbgu.h"
 #include <stdarg.h>
 #include <board.h>
+#include <utility/critical.h>
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Transmit ring buffer, drained by the PDC.
+static unsigned char txBuffer[DBGU_TX_BUFFER_SIZE];
+
+/// Index where the next character is written.
+static volatile unsigned int txHead = 0;
+
+/// Index of the first character not sent yet.
+static volatile unsigned int txTail = 0;
+
+/// Number of characters programmed in the PDC, starting at txTail.
+static volatile unsigned int txInFlight = 0;
+
+/// Behaviour when the ring buffer is full (DBGU_TX_BLOCK or DBGU_TX_DROP).
+static unsigned char txPolicy = DBGU_TX_BLOCK;
+
+/// Number of characters dropped because the ring buffer was full.
+static volatile unsigned int txDropped = 0;
+
+/// Receive ring buffer, filled by the RXRDY interrupt.
+static unsigned char rxBuffer[DBGU_RX_BUFFER_SIZE];
+
+/// Index where the next received character is stored.
+static volatile unsigned int rxHead = 0;
+
+/// Index of the next character to read.
+static volatile unsigned int rxTail = 0;
+
+/// Function called after each character received, 0 if the receive
+/// interrupt is not used.
+static void (*pRxCallback)(void) = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+/// Releases the characters sent by the PDC and starts the transfer of the
+/// pending ones, the wrapped part being chained in the next buffer registers.
+/// Must be called with interrupts masked.
+//------------------------------------------------------------------------------
+static void TxService(void)
+{
+    if (txInFlight) {
+
+        if ((AT91C_BASE_DBGU->DBGU_CSR & AT91C_US_TXBUFE) == 0) {
+
+            return;
+        }
+        txTail = (txTail + txInFlight) % DBGU_TX_BUFFER_SIZE;
+        txInFlight = 0;
+    }
+
+    if (txHead == txTail) {
+
+        AT91C_BASE_DBGU->DBGU_IDR = AT91C_US_TXBUFE;
+        return;
+    }
+
+    // Current buffer first: the PDC would start from the next one otherwise
+    AT91C_BASE_DBGU->DBGU_TPR = (unsigned int) &txBuffer[txTail];
+    if (txHead > txTail) {
+
+        txInFlight = txHead - txTail;
+        AT91C_BASE_DBGU->DBGU_TCR = txInFlight;
+    }
+    else {
+
+        AT91C_BASE_DBGU->DBGU_TCR = DBGU_TX_BUFFER_SIZE - txTail;
+        AT91C_BASE_DBGU->DBGU_TNPR = (unsigned int) txBuffer;
+        AT91C_BASE_DBGU->DBGU_TNCR = txHead;
+        txInFlight = DBGU_TX_BUFFER_SIZE - txTail + txHead;
+    }
+    AT91C_BASE_DBGU->DBGU_IER = AT91C_US_TXBUFE;
+}
 
 //------------------------------------------------------------------------------
 //         Global functions
@@ -53,6 +132,8 @@ void DBGU_Configure(
     unsigned int baudrate,
     unsigned int mck)
 {   
+    CriticalState state;
+
     // Reset & disable receiver and transmitter, disable interrupts
     AT91C_BASE_DBGU->DBGU_CR = AT91C_US_RSTRX | AT91C_US_RSTTX;
     AT91C_BASE_DBGU->DBGU_IDR = 0xFFFFFFFF;
@@ -63,20 +144,38 @@ void DBGU_Configure(
     // Configure mode register
     AT91C_BASE_DBGU->DBGU_MR = mode;
     
-    // Disable DMA channel
+    // Disable DMA channel; the characters it was sending are lost
+    state = CRITICAL_Enter();
     AT91C_BASE_DBGU->DBGU_PTCR = AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS;
+    AT91C_BASE_DBGU->DBGU_TCR = 0;
+    AT91C_BASE_DBGU->DBGU_TNCR = 0;
+    txTail = (txTail + txInFlight) % DBGU_TX_BUFFER_SIZE;
+    txInFlight = 0;
 
     // Enable receiver and transmitter
     AT91C_BASE_DBGU->DBGU_CR = AT91C_US_RXEN | AT91C_US_TXEN;
+
+    // Enable the transmit DMA channel and resume the ring buffer
+    AT91C_BASE_DBGU->DBGU_PTCR = AT91C_PDC_TXTEN;
+    TxService();
+
+    // Restore the receive interrupt
+    if (pRxCallback) {
+
+        AT91C_BASE_DBGU->DBGU_IER = AT91C_US_RXRDY;
+    }
+    CRITICAL_Exit(state);
 }
 
 //------------------------------------------------------------------------------
-/// Outputs a character on the DBGU line.
+/// Outputs a character on the DBGU line, after the content of the ring buffer.
 /// \note This function is synchronous (i.e. uses polling).
 /// \param c  Character to send.
 //------------------------------------------------------------------------------
 void DBGU_PutChar(unsigned char c)
 {
+    DBGU_Flush();
+
     // Wait for the transmitter to be ready
     while ((AT91C_BASE_DBGU->DBGU_CSR & AT91C_US_TXEMPTY) == 0);
     
@@ -106,8 +205,153 @@ unsigned char DBGU_GetChar(void)
     return AT91C_BASE_DBGU->DBGU_RHR;
 }
 
+//------------------------------------------------------------------------------
+/// Copies data into the transmit ring buffer and starts its transfer if the
+/// PDC is idle. Can be called from interrupt handlers.
+/// \param pData  Data to send.
+/// \param size  Number of bytes to send.
+/// \return Number of bytes queued; less than size if the ring buffer is full
+/// and the policy is DBGU_TX_DROP.
+//------------------------------------------------------------------------------
+unsigned int DBGU_Write(const unsigned char *pData, unsigned int size)
+{
+    CriticalState state;
+    unsigned int written = 0;
+    unsigned int next;
+
+    state = CRITICAL_Enter();
+    while (written < size) {
+
+        next = (txHead + 1) % DBGU_TX_BUFFER_SIZE;
+        if (next == txTail) {
+
+            if (txPolicy == DBGU_TX_DROP) {
+
+                txDropped += size - written;
+                break;
+            }
+
+            // Poll the PDC, in case interrupts were masked by the caller,
+            // and give pending interrupts a chance
+            TxService();
+            CRITICAL_Exit(state);
+            state = CRITICAL_Enter();
+            continue;
+        }
+
+        txBuffer[txHead] = pData[written];
+        txHead = next;
+        written++;
+    }
+    TxService();
+    CRITICAL_Exit(state);
+
+    return written;
+}
+
+//------------------------------------------------------------------------------
+/// Waits until the content of the ring buffer has been sent on the line.
+//------------------------------------------------------------------------------
+void DBGU_Flush(void)
+{
+    CriticalState state;
+    unsigned char empty;
+
+    do {
+        state = CRITICAL_Enter();
+        TxService();
+        empty = (txInFlight == 0);
+        CRITICAL_Exit(state);
+    } while (!empty);
+
+    while ((AT91C_BASE_DBGU->DBGU_CSR & AT91C_US_TXEMPTY) == 0);
+}
+
+//------------------------------------------------------------------------------
+/// Selects what happens when the transmit ring buffer is full.
+/// \param policy  DBGU_TX_BLOCK or DBGU_TX_DROP.
+//------------------------------------------------------------------------------
+void DBGU_SetTxPolicy(unsigned char policy)
+{
+    txPolicy = policy;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of characters dropped because the ring buffer was full.
+//------------------------------------------------------------------------------
+unsigned int DBGU_GetTxDropped(void)
+{
+    return txDropped;
+}
+
+//------------------------------------------------------------------------------
+/// Enables the receive interrupt: received characters are stored in a ring
+/// buffer, to be read with DBGU_Read().
+/// \param callback  Function called from the interrupt after each character
+/// (e.g. to post a task).
+//------------------------------------------------------------------------------
+void DBGU_EnableRxInterrupt(void (*callback)(void))
+{
+    pRxCallback = callback;
+    AT91C_BASE_DBGU->DBGU_IER = AT91C_US_RXRDY;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the characters received under interrupt. Does not wait.
+/// \param pData  Buffer to fill.
+/// \param size  Size of the buffer.
+/// \return Number of characters read.
+//------------------------------------------------------------------------------
+unsigned int DBGU_Read(unsigned char *pData, unsigned int size)
+{
+    unsigned int count = 0;
+
+    while ((count < size) && (rxTail != rxHead)) {
+
+        pData[count++] = rxBuffer[rxTail];
+        rxTail = (rxTail + 1) % DBGU_RX_BUFFER_SIZE;
+    }
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+/// Services the DBGU interrupts. Must be called by the AT91C_ID_SYS handler.
+//------------------------------------------------------------------------------
+void DBGU_InterruptHandler(void)
+{
+    CriticalState state;
+    unsigned int status;
+    unsigned int next;
+    unsigned char c;
+
+    status = AT91C_BASE_DBGU->DBGU_CSR & AT91C_BASE_DBGU->DBGU_IMR;
+
+    if (status & AT91C_US_RXRDY) {
+
+        // Store the character, or drop it if the ring buffer is full
+        c = AT91C_BASE_DBGU->DBGU_RHR;
+        next = (rxHead + 1) % DBGU_RX_BUFFER_SIZE;
+        if (next != rxTail) {
+
+            rxBuffer[rxHead] = c;
+            rxHead = next;
+        }
+        AT91C_BASE_DBGU->DBGU_CR = AT91C_US_RSTSTA;
+        pRxCallback();
+    }
+
+    if (status & AT91C_US_TXBUFE) {
+
+        state = CRITICAL_Enter();
+        TxService();
+        CRITICAL_Exit(state);
+    }
+}
+
 #ifndef NOFPUT
 #include <stdio.h>
+#include <string.h>
 
 //------------------------------------------------------------------------------
 /// \exclude
@@ -120,9 +364,11 @@ unsigned char DBGU_GetChar(void)
 //------------------------------------------------------------------------------
 signed int fputc(signed int c, FILE *pStream)
 {
+    unsigned char ch = c;
+
     if ((pStream == stdout) || (pStream == stderr)) {
     
-        DBGU_PutChar(c);
+        DBGU_Write(&ch, 1);
         return c;
     }
     else {
@@ -134,7 +380,7 @@ signed int fputc(signed int c, FILE *pStream)
 //------------------------------------------------------------------------------
 /// \exclude
 /// Implementation of fputs using the DBGU as the standard output. Required
-/// for printf(). Does NOT currently use the PDC.
+/// for printf(). The string is queued in the PDC ring buffer in one go.
 /// \param pStr  String to write.
 /// \param pStream  Output stream.
 /// \return Number of characters written if successful, or -1 if the output
@@ -142,19 +388,14 @@ signed int fputc(signed int c, FILE *pStream)
 //------------------------------------------------------------------------------
 signed int fputs(const char *pStr, FILE *pStream)
 {
-    signed int num = 0;
-
-    while (*pStr != 0) {
-
-        if (fputc(*pStr, pStream) == -1) {
+    if ((pStream == stdout) || (pStream == stderr)) {
 
-            return -1;
-        }
-        num++;
-        pStr++;
+        return DBGU_Write((const unsigned char *) pStr, strlen(pStr));
     }
+    else {
 
-    return num;
+        return -1;
+    }
 }
 
 #undef putchar
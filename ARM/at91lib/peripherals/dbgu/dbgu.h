@@ -46,8 +46,20 @@
 /// -# Send characters using DBGU_PutChar() or the printf() method.
 /// -# Receive characters using DBGU_GetChar().
 ///
+/// The printf() output and DBGU_Write() go through a transmit ring buffer
+/// which the PDC drains in the background. To keep the ring moving, call
+/// DBGU_InterruptHandler() from the system interrupt handler (the DBGU shares
+/// AT91C_ID_SYS with the PIT, RTT...); without it the ring is only drained
+/// when new data is written or DBGU_Flush() is called.
+/// When the ring is full, the writer either waits (DBGU_TX_BLOCK, default) or
+/// the data is dropped and counted (DBGU_TX_DROP), see DBGU_SetTxPolicy().
+/// Likewise, DBGU_EnableRxInterrupt() makes the received characters go to a
+/// ring buffer read with DBGU_Read(), instead of polling with DBGU_GetChar().
+///
 /// \note Unless specified, all the functions defined here operate synchronously;
 /// i.e. they all wait the data is sent/received before returning.
+/// \note The ring buffer is read by the PDC, it must not be in a write-back
+/// cached memory area.
 //------------------------------------------------------------------------------
 
 #ifndef DBGU_H
@@ -60,6 +72,21 @@
 /// Standard operating mode (asynchronous, 8bit, no parity, 1 stop bit)
 #define DBGU_STANDARD           AT91C_US_PAR_NONE
 
+/// Size of the transmit ring buffer, in bytes.
+#ifndef DBGU_TX_BUFFER_SIZE
+#define DBGU_TX_BUFFER_SIZE     4096
+#endif
+
+/// Size of the receive ring buffer, in bytes.
+#ifndef DBGU_RX_BUFFER_SIZE
+#define DBGU_RX_BUFFER_SIZE     64
+#endif
+
+/// Wait for room in the transmit ring buffer when it is full.
+#define DBGU_TX_BLOCK           0
+/// Drop the data which does not fit in the transmit ring buffer.
+#define DBGU_TX_DROP            1
+
 //------------------------------------------------------------------------------
 //         Global functions
 //------------------------------------------------------------------------------
@@ -75,5 +102,19 @@ extern void DBGU_PutChar(unsigned char c);
 
 extern unsigned int DBGU_IsRxReady(void);
 
+extern unsigned int DBGU_Write(const unsigned char *pData, unsigned int size);
+
+extern void DBGU_Flush(void);
+
+extern void DBGU_SetTxPolicy(unsigned char policy);
+
+extern unsigned int DBGU_GetTxDropped(void);
+
+extern void DBGU_EnableRxInterrupt(void (*callback)(void));
+
+extern unsigned int DBGU_Read(unsigned char *pData, unsigned int size);
+
+extern void DBGU_InterruptHandler(void);
+
 #endif //#ifndef DBGU_H
 
@@ -0,0 +1,493 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "emac.h"
+#include <utility/assert.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Receive descriptor bits: in the address word, then in the status word.
+#define RX_OWNERSHIP        (1 << 0)
+#define RX_WRAP             (1 << 1)
+#define RX_LENGTH_MASK      0xFFF
+#define RX_START_OF_FRAME   (1 << 14)
+#define RX_END_OF_FRAME     (1 << 15)
+
+/// Transmit descriptor status bits.
+#define TX_LAST             (1 << 15)
+#define TX_WRAP             (1 << 30)
+#define TX_USED             (1UL << 31)
+
+/// Transmit buffer states.
+#define TX_FREE             0
+#define TX_CLAIMED          1
+#define TX_SENDING          2
+
+/// Transmit errors which stop the transmitter.
+#define TX_ERRORS           (AT91C_EMAC_RLES | AT91C_EMAC_BEX | AT91C_EMAC_UND)
+
+/// Size of a transmit buffer in words.
+#define TX_BUFFER_WORDS     ((EMAC_FRAME_OFFSET + EMAC_FRAME_SIZE + 3) / 4)
+
+/// PHY registers and bits (IEEE 802.3 clause 22).
+#define PHY_BMSR            1
+#define PHY_ID1             2
+#define PHY_ANAR            4
+#define PHY_ANLPAR          5
+#define BMSR_LINK           (1 << 2)
+#define ANLPAR_100FD        (1 << 8)
+#define ANLPAR_100HD        (1 << 7)
+#define ANLPAR_10FD         (1 << 6)
+
+/// PHY maintenance frame: start, read, turnaround.
+#define MAN_READ            ((1UL << 30) | (2 << 28) | (2 << 16))
+
+/// Number of polls of the PHY maintenance interface before giving up.
+#define MAN_TIMEOUT         100000
+
+/// No PHY found.
+#define NO_PHY              0xFF
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// DMA descriptor.
+typedef struct {
+
+    unsigned int address;
+    unsigned int status;
+
+} Descriptor;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Descriptor rings and buffers.
+static Descriptor pRxDescriptors[EMAC_RX_BUFFERS];
+static Descriptor pTxDescriptors[EMAC_TX_BUFFERS];
+static unsigned int pRxBuffers[EMAC_RX_BUFFERS][EMAC_RX_BUFFER_SIZE / 4];
+static unsigned int pTxBuffers[EMAC_TX_BUFFERS][TX_BUFFER_WORDS];
+
+/// State of each transmit buffer (TX_xxx).
+static unsigned char pTxStates[EMAC_TX_BUFFERS];
+
+/// Next receive descriptor to look at.
+static unsigned int rxTail;
+
+/// Next transmit buffer to claim, and oldest one not yet free.
+static unsigned int txHead;
+static unsigned int txTail;
+
+/// Address of the PHY.
+static unsigned char phyAddress = NO_PHY;
+
+/// Frames dropped for lack of receive buffers or too long.
+static unsigned int rxDropped;
+
+/// Set while polling, and milliseconds below EMAC_POLL_EXIT since when.
+static unsigned char polling;
+static unsigned int quietTicks;
+
+static EmacStats stats;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Puts the transmit ring back in its initial state, all buffers free.
+//------------------------------------------------------------------------------
+static void ResetTx(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < EMAC_TX_BUFFERS; i++) {
+
+        pTxDescriptors[i].address = (unsigned int) pTxBuffers[i] + EMAC_FRAME_OFFSET;
+        pTxDescriptors[i].status = TX_USED;
+        pTxStates[i] = TX_FREE;
+    }
+    pTxDescriptors[EMAC_TX_BUFFERS - 1].status |= TX_WRAP;
+    txHead = 0;
+    txTail = 0;
+    AT91C_BASE_EMAC->EMAC_TBQP = (unsigned int) pTxDescriptors;
+}
+
+//------------------------------------------------------------------------------
+/// Hands receive buffers back to the EMAC.
+/// \param first  First descriptor.
+/// \param count  Number of descriptors.
+//------------------------------------------------------------------------------
+static void ReleaseRx(unsigned int first, unsigned int count)
+{
+    while (count > 0) {
+
+        pRxDescriptors[first].address &= ~RX_OWNERSHIP;
+        first = (first + 1) % EMAC_RX_BUFFERS;
+        count--;
+    }
+    rxTail = first;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Resets the EMAC and its rings, and enables the receiver and transmitter
+/// at 100 Mbit/s full duplex until EMAC_UpdateLink() says otherwise.
+/// \param pAddress  MAC address, 6 bytes.
+/// \param rmii  1 for a RMII PHY, 0 for a MII one.
+//------------------------------------------------------------------------------
+void EMAC_Initialize(const unsigned char *pAddress, unsigned char rmii)
+{
+    AT91PS_EMAC emac = AT91C_BASE_EMAC;
+    unsigned int i;
+
+    emac->EMAC_NCR = 0;
+    emac->EMAC_IDR = 0xFFFFFFFF;
+    emac->EMAC_NCR = AT91C_EMAC_CLRSTAT;
+    emac->EMAC_RSR = AT91C_EMAC_BNA | AT91C_EMAC_REC | AT91C_EMAC_OVR;
+    emac->EMAC_TSR = AT91C_EMAC_UBR | AT91C_EMAC_COL | AT91C_EMAC_RLES | AT91C_EMAC_BEX
+                     | AT91C_EMAC_COMP | AT91C_EMAC_UND;
+    i = emac->EMAC_ISR;
+
+    emac->EMAC_SA1L = pAddress[0] | (pAddress[1] << 8) | (pAddress[2] << 16)
+                      | ((unsigned int) pAddress[3] << 24);
+    emac->EMAC_SA1H = pAddress[4] | (pAddress[5] << 8);
+
+    for (i = 0; i < EMAC_RX_BUFFERS; i++) {
+
+        pRxDescriptors[i].address = (unsigned int) pRxBuffers[i];
+        pRxDescriptors[i].status = 0;
+    }
+    pRxDescriptors[EMAC_RX_BUFFERS - 1].address |= RX_WRAP;
+    rxTail = 0;
+    rxDropped = 0;
+    polling = 0;
+    memset(&stats, 0, sizeof(stats));
+    emac->EMAC_RBQP = (unsigned int) pRxDescriptors;
+    ResetTx();
+
+    // MDC at most 2.5 MHz, FCS removed from the received frames
+    emac->EMAC_NCFGR = AT91C_EMAC_CLK_HCLK_64 | AT91C_EMAC_DRFCS | AT91C_EMAC_SPD | AT91C_EMAC_FD;
+    emac->EMAC_USRIO = AT91C_EMAC_CLKEN | (rmii ? AT91C_EMAC_RMII : 0);
+    emac->EMAC_NCR = AT91C_EMAC_RE | AT91C_EMAC_TE | AT91C_EMAC_MPE;
+}
+
+//------------------------------------------------------------------------------
+/// Reads a PHY register.
+/// \param reg  Register number.
+/// \param pValue  Register value.
+/// \return 1 if the register was read, 0 if there is no PHY or it does not
+///         answer.
+//------------------------------------------------------------------------------
+unsigned char EMAC_ReadPhy(unsigned int reg, unsigned int *pValue)
+{
+    unsigned int timeout = MAN_TIMEOUT;
+
+    if (phyAddress == NO_PHY) {
+
+        return 0;
+    }
+
+    AT91C_BASE_EMAC->EMAC_MAN = MAN_READ | (phyAddress << 23) | ((reg & 0x1F) << 18);
+    while ((AT91C_BASE_EMAC->EMAC_NSR & AT91C_EMAC_IDLE) == 0) {
+
+        if (--timeout == 0) {
+
+            return 0;
+        }
+    }
+    *pValue = AT91C_BASE_EMAC->EMAC_MAN & AT91C_EMAC_DATA;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Looks for the PHY on the management interface.
+/// \return 1 if a PHY answers.
+//------------------------------------------------------------------------------
+unsigned char EMAC_FindPhy(void)
+{
+    unsigned int value;
+    unsigned int address;
+
+    for (address = 0; address < 32; address++) {
+
+        phyAddress = address;
+        if (EMAC_ReadPhy(PHY_ID1, &value) && (value != 0) && (value != 0xFFFF)) {
+
+            return 1;
+        }
+    }
+    phyAddress = NO_PHY;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the link state from the PHY and sets the EMAC speed and duplex mode
+/// to the negotiated ones.
+/// \return The link state (EMAC_LINK_xxx).
+//------------------------------------------------------------------------------
+unsigned char EMAC_UpdateLink(void)
+{
+    unsigned int status;
+    unsigned int advertised;
+    unsigned int partner;
+    unsigned int mode;
+
+    // The link bit latches failures: read it twice for the current state
+    if (!EMAC_ReadPhy(PHY_BMSR, &status) || !EMAC_ReadPhy(PHY_BMSR, &status)
+        || ((status & BMSR_LINK) == 0)
+        || !EMAC_ReadPhy(PHY_ANAR, &advertised) || !EMAC_ReadPhy(PHY_ANLPAR, &partner)) {
+
+        return EMAC_LINK_DOWN;
+    }
+
+    partner &= advertised;
+    mode = AT91C_BASE_EMAC->EMAC_NCFGR & ~(AT91C_EMAC_SPD | AT91C_EMAC_FD);
+    if (partner & ANLPAR_100FD) {
+
+        AT91C_BASE_EMAC->EMAC_NCFGR = mode | AT91C_EMAC_SPD | AT91C_EMAC_FD;
+        return EMAC_LINK_100FD;
+    }
+    if (partner & ANLPAR_100HD) {
+
+        AT91C_BASE_EMAC->EMAC_NCFGR = mode | AT91C_EMAC_SPD;
+        return EMAC_LINK_100HD;
+    }
+    if (partner & ANLPAR_10FD) {
+
+        AT91C_BASE_EMAC->EMAC_NCFGR = mode | AT91C_EMAC_FD;
+        return EMAC_LINK_10FD;
+    }
+    AT91C_BASE_EMAC->EMAC_NCFGR = mode;
+    return EMAC_LINK_10HD;
+}
+
+//------------------------------------------------------------------------------
+/// Reads and clears the interrupt status, and the receive status.
+/// \return The interrupt status (AT91C_EMAC_xxx).
+//------------------------------------------------------------------------------
+unsigned int EMAC_GetStatus(void)
+{
+    unsigned int status = AT91C_BASE_EMAC->EMAC_ISR;
+
+    stats.interrupts++;
+    if (status & (AT91C_EMAC_RXUBR | AT91C_EMAC_ROVR)) {
+
+        AT91C_BASE_EMAC->EMAC_RSR = AT91C_EMAC_BNA | AT91C_EMAC_OVR;
+    }
+    return status;
+}
+
+//------------------------------------------------------------------------------
+/// Claims the next transmit buffer.
+/// \return Start of the frame, EMAC_FRAME_SIZE bytes long, or 0 if all the
+///         buffers are in use.
+//------------------------------------------------------------------------------
+unsigned char * EMAC_AllocateTx(void)
+{
+    unsigned char *pFrame;
+
+    // After a transmit error, the EMAC restarts from the first descriptor
+    if (AT91C_BASE_EMAC->EMAC_TSR & TX_ERRORS) {
+
+        AT91C_BASE_EMAC->EMAC_NCR &= ~AT91C_EMAC_TE;
+        AT91C_BASE_EMAC->EMAC_TSR = TX_ERRORS;
+        ResetTx();
+        AT91C_BASE_EMAC->EMAC_NCR |= AT91C_EMAC_TE;
+    }
+
+    // Free the buffers sent since the last call
+    while ((pTxStates[txTail] == TX_SENDING) && (pTxDescriptors[txTail].status & TX_USED)) {
+
+        pTxStates[txTail] = TX_FREE;
+        txTail = (txTail + 1) % EMAC_TX_BUFFERS;
+    }
+
+    if (pTxStates[txHead] != TX_FREE) {
+
+        return 0;
+    }
+    pTxStates[txHead] = TX_CLAIMED;
+    pFrame = (unsigned char *) pTxBuffers[txHead] + EMAC_FRAME_OFFSET;
+    txHead = (txHead + 1) % EMAC_TX_BUFFERS;
+    return pFrame;
+}
+
+//------------------------------------------------------------------------------
+/// Hands a claimed transmit buffer to the EMAC.
+/// \param pFrame  Frame returned by EMAC_AllocateTx().
+/// \param size  Frame size in bytes, without the FCS; shorter frames are
+///              padded by the EMAC.
+//------------------------------------------------------------------------------
+void EMAC_Transmit(unsigned char *pFrame, unsigned int size)
+{
+    unsigned int index = ((unsigned int *) (pFrame - EMAC_FRAME_OFFSET) - pTxBuffers[0]) / TX_BUFFER_WORDS;
+
+    SANITY_CHECK((index < EMAC_TX_BUFFERS) && (pTxStates[index] == TX_CLAIMED));
+    SANITY_CHECK(size <= EMAC_FRAME_SIZE);
+
+    pTxStates[index] = TX_SENDING;
+    pTxDescriptors[index].status = size | TX_LAST | ((index == EMAC_TX_BUFFERS - 1) ? TX_WRAP : 0);
+    AT91C_BASE_EMAC->EMAC_NCR |= AT91C_EMAC_TSTART;
+}
+
+//------------------------------------------------------------------------------
+/// Copies out the oldest received frame, and frees its buffers.
+/// \param pFrame  Destination.
+/// \param size  Size of the destination in bytes; longer frames are dropped.
+/// \return Frame size in bytes, 0 if no complete frame is waiting.
+//------------------------------------------------------------------------------
+unsigned int EMAC_Receive(unsigned char *pFrame, unsigned int size)
+{
+    unsigned int first;
+    unsigned int last;
+    unsigned int count;
+    unsigned int length;
+    unsigned int chunk;
+    unsigned int offset;
+
+    while (pRxDescriptors[rxTail].address & RX_OWNERSHIP) {
+
+        // Buffers of a frame whose start was lost
+        first = rxTail;
+        if ((pRxDescriptors[first].status & RX_START_OF_FRAME) == 0) {
+
+            ReleaseRx(first, 1);
+            continue;
+        }
+
+        // Find the end of the frame, if it is complete
+        last = first;
+        count = 1;
+        while ((pRxDescriptors[last].status & RX_END_OF_FRAME) == 0) {
+
+            last = (last + 1) % EMAC_RX_BUFFERS;
+            if ((pRxDescriptors[last].address & RX_OWNERSHIP) == 0) {
+
+                return 0;
+            }
+            if (pRxDescriptors[last].status & RX_START_OF_FRAME) {
+
+                // Frame cut short by the next one, which starts at last
+                break;
+            }
+            if (++count == EMAC_RX_BUFFERS) {
+
+                break;
+            }
+        }
+        if ((last != first) && (pRxDescriptors[last].status & RX_START_OF_FRAME)) {
+
+            ReleaseRx(first, count);
+            rxDropped++;
+            continue;
+        }
+        if ((pRxDescriptors[last].status & RX_END_OF_FRAME) == 0) {
+
+            ReleaseRx(first, count);
+            rxDropped++;
+            continue;
+        }
+
+        length = pRxDescriptors[last].status & RX_LENGTH_MASK;
+        if (length > size) {
+
+            ReleaseRx(first, count);
+            rxDropped++;
+            continue;
+        }
+        for (offset = 0; offset < length; offset += chunk) {
+
+            chunk = length - offset;
+            if (chunk > EMAC_RX_BUFFER_SIZE) {
+
+                chunk = EMAC_RX_BUFFER_SIZE;
+            }
+            memcpy(pFrame + offset, pRxBuffers[first], chunk);
+            first = (first + 1) % EMAC_RX_BUFFERS;
+        }
+        ReleaseRx(rxTail, count);
+        return length;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of received frames dropped since the initialization,
+/// for lack of buffers or because they were too long.
+//------------------------------------------------------------------------------
+unsigned int EMAC_GetRxDropped(void)
+{
+    rxDropped += AT91C_BASE_EMAC->EMAC_RRE + AT91C_BASE_EMAC->EMAC_ROV;
+    return rxDropped;
+}
+
+//------------------------------------------------------------------------------
+/// Moderates the interrupts with the number of frames sent and received since
+/// the last call: switches between interrupts and polling (see
+/// EMAC_POLL_ENTER). Call every millisecond, from an interrupt handler or with
+/// the EMAC interrupt disabled.
+/// \return 1 if the caller should poll the EMAC now.
+//------------------------------------------------------------------------------
+unsigned char EMAC_Moderate(void)
+{
+    unsigned int frames = AT91C_BASE_EMAC->EMAC_FRO + AT91C_BASE_EMAC->EMAC_FTO;
+
+    if (!polling) {
+
+        if (frames < EMAC_POLL_ENTER) {
+
+            return 0;
+        }
+        AT91C_BASE_EMAC->EMAC_IDR = EMAC_MODERATED_INTERRUPTS;
+        polling = 1;
+        quietTicks = 0;
+        stats.toPolling++;
+        return 1;
+    }
+
+    stats.polls++;
+    stats.polledFrames += frames;
+    if (frames > stats.maxPolledFrames) {
+
+        stats.maxPolledFrames = frames;
+    }
+    quietTicks = (frames < EMAC_POLL_EXIT) ? quietTicks + 1 : 0;
+    if (quietTicks >= EMAC_POLL_HOLD) {
+
+        // The status bits set meanwhile raise an interrupt at once, and
+        // the last poll below takes what came before
+        AT91C_BASE_EMAC->EMAC_IER = EMAC_MODERATED_INTERRUPTS;
+        polling = 0;
+        stats.toInterrupts++;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 while the interrupts are replaced by polling.
+//------------------------------------------------------------------------------
+unsigned char EMAC_IsPolling(void)
+{
+    return polling;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the statistics of the interrupt moderation.
+//------------------------------------------------------------------------------
+const EmacStats * EMAC_GetStats(void)
+{
+    return &stats;
+}
+
@@ -0,0 +1,145 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Driver of the EMAC (Ethernet MAC 10/100) with its DMA descriptor rings.
+///
+/// Received frames are stored by the EMAC in a ring of EMAC_RX_BUFFERS
+/// buffers of EMAC_RX_BUFFER_SIZE bytes, and copied out one frame at a time
+/// by EMAC_Receive(). Frames are sent from a ring of EMAC_TX_BUFFERS buffers
+/// of one frame each, which the caller fills in place: a buffer is claimed
+/// with EMAC_AllocateTx() and handed to the EMAC with EMAC_Transmit(), so a
+/// frame is copied only once. Frames go out in the order of the claims: a
+/// claimed buffer holds back the ones claimed after it until it is handed
+/// over, so it should be filled and sent without delay. Frames start
+/// EMAC_FRAME_OFFSET bytes past a word boundary, which puts the IP header on
+/// one.
+///
+/// !Usage
+///
+/// -# Enable the EMAC pins (see pio & board.h) and the peripheral clock.
+/// -# Call EMAC_Initialize() with the MAC address, then EMAC_FindPhy() and
+///    EMAC_UpdateLink() periodically to follow the speed and duplex mode
+///    negotiated by the PHY.
+/// -# Enable the EMAC interrupt in the AIC if needed; EMAC_GetStatus() reads
+///    and clears the interrupt status.
+/// -# Send frames with EMAC_AllocateTx() and EMAC_Transmit(), receive them
+///    with EMAC_Receive().
+/// -# To moderate the interrupts, call EMAC_Moderate() every millisecond
+///    (e.g. from the PIT interrupt) and poll whenever it returns 1.
+///
+/// Interrupt moderation: the frames sent and received in each millisecond
+/// are counted by the EMAC. At or above EMAC_POLL_ENTER frames in a
+/// millisecond, the per-frame interrupts (EMAC_MODERATED_INTERRUPTS) are
+/// masked and the caller polls once a millisecond instead, handling the
+/// frames in batches. Polling goes on until the rate stays below
+/// EMAC_POLL_EXIT frames per millisecond for EMAC_POLL_HOLD milliseconds;
+/// the gap between both thresholds and the hold time keep the mode from
+/// flapping at a rate near the switch point. The statistics (EmacStats) give
+/// the switches and the frame rate while polling, in frames per millisecond.
+///
+/// \note The buffers are accessed by the EMAC DMA, they must not be in a
+/// write-back cached memory area.
+//------------------------------------------------------------------------------
+
+#ifndef EMAC_H
+#define EMAC_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Number and size of the receive buffers (the size is fixed by the EMAC).
+#define EMAC_RX_BUFFERS         64
+#define EMAC_RX_BUFFER_SIZE     128
+
+/// Number of transmit buffers, one frame each.
+#define EMAC_TX_BUFFERS         16
+
+/// Largest frame without the FCS, which the EMAC adds and removes.
+#define EMAC_FRAME_SIZE         1514
+
+/// Offset of the frames from a word boundary.
+#define EMAC_FRAME_OFFSET       2
+
+/// Interrupts used by the driver: frame received, frame sent, errors.
+#define EMAC_INTERRUPTS         (AT91C_EMAC_RCOMP | AT91C_EMAC_TCOMP | AT91C_EMAC_RXUBR \
+                                 | AT91C_EMAC_ROVR | AT91C_EMAC_TUNDR | AT91C_EMAC_RLEX \
+                                 | AT91C_EMAC_TXERR | AT91C_EMAC_HRESP)
+
+/// Interrupts masked while polling: one per frame received or sent, and the
+/// receive buffer exhaustion which repeats while the ring is full.
+#define EMAC_MODERATED_INTERRUPTS (AT91C_EMAC_RCOMP | AT91C_EMAC_TCOMP | AT91C_EMAC_RXUBR)
+
+/// Frames per millisecond from which to poll, below which to stop polling,
+/// and number of milliseconds below before going back to the interrupts.
+#define EMAC_POLL_ENTER         4
+#define EMAC_POLL_EXIT          2
+#define EMAC_POLL_HOLD          20
+
+/// Link states returned by EMAC_UpdateLink().
+#define EMAC_LINK_DOWN          0
+#define EMAC_LINK_10HD          1
+#define EMAC_LINK_10FD          2
+#define EMAC_LINK_100HD         3
+#define EMAC_LINK_100FD         4
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Statistics of the interrupt moderation.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Calls of EMAC_GetStatus(), i.e. interrupts taken.
+    unsigned int interrupts;
+    /// Switches to polling, and back to the interrupts.
+    unsigned int toPolling;
+    unsigned int toInterrupts;
+    /// Milliseconds polled (calls of EMAC_Moderate() while polling), frames
+    /// sent and received meanwhile, and most in one millisecond.
+    unsigned int polls;
+    unsigned int polledFrames;
+    unsigned int maxPolledFrames;
+
+} EmacStats;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void EMAC_Initialize(const unsigned char *pAddress, unsigned char rmii);
+
+extern unsigned char EMAC_FindPhy(void);
+
+extern unsigned char EMAC_ReadPhy(unsigned int reg, unsigned int *pValue);
+
+extern unsigned char EMAC_UpdateLink(void);
+
+extern unsigned int EMAC_GetStatus(void);
+
+extern unsigned char * EMAC_AllocateTx(void);
+
+extern void EMAC_Transmit(unsigned char *pFrame, unsigned int size);
+
+extern unsigned int EMAC_Receive(unsigned char *pFrame, unsigned int size);
+
+extern unsigned int EMAC_GetRxDropped(void);
+
+extern unsigned char EMAC_Moderate(void);
+
+extern unsigned char EMAC_IsPolling(void);
+
+extern const EmacStats * EMAC_GetStats(void);
+
+#endif //#ifndef EMAC_H
+
@@ -0,0 +1,226 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "mci.h"
+#include <utility/assert.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Longest data timeout: 15 x 1048576 card clock cycles.
+#define MCI_DTOR_MAX        (AT91C_MCI_DTOMUL_1048576 | AT91C_MCI_DTOCYC)
+
+/// Power saving divider, used only in power save mode.
+#define MCI_PWSDIV          (0x7 << 8)
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Resets the MCI and enables it on the given slot, with a 1-bit bus, the
+/// slowest clock, the longest data timeout and every interrupt disabled.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param slot  Card slot (MCI_SD_SLOTx).
+//------------------------------------------------------------------------------
+void MCI_Configure(AT91S_MCI *mci, unsigned char slot)
+{
+    SANITY_CHECK(mci);
+    SANITY_CHECK(slot <= MCI_SD_SLOTB);
+
+    mci->MCI_CR = AT91C_MCI_MCIDIS | AT91C_MCI_PWSDIS;
+    mci->MCI_CR = AT91C_MCI_SWRST;
+    mci->MCI_IDR = 0xFFFFFFFF;
+    MCI_StopPdc(mci);
+
+    mci->MCI_DTOR = MCI_DTOR_MAX;
+    mci->MCI_SDCR = slot;
+    mci->MCI_MR = MCI_PWSDIV | AT91C_MCI_CLKDIV;
+    mci->MCI_CR = AT91C_MCI_MCIEN;
+}
+
+//------------------------------------------------------------------------------
+/// Sets the card clock to the fastest MCK/(2 x (CLKDIV + 1)) not above the
+/// given frequency.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param speed  Maximum card clock frequency (in Hz).
+/// \param masterClock  Frequency of the system master clock (in Hz).
+/// \return The actual card clock frequency.
+//------------------------------------------------------------------------------
+unsigned int MCI_SetSpeed(
+    AT91S_MCI *mci,
+    unsigned int speed,
+    unsigned int masterClock)
+{
+    unsigned int divisor;
+
+    SANITY_CHECK(speed > 0);
+
+    divisor = (masterClock + 2 * speed - 1) / (2 * speed);
+    if (divisor > 0) {
+
+        divisor--;
+    }
+    if (divisor > 0xFF) {
+
+        divisor = 0xFF;
+    }
+    mci->MCI_MR = (mci->MCI_MR & ~AT91C_MCI_CLKDIV) | divisor;
+
+    return masterClock / (2 * (divisor + 1));
+}
+
+//------------------------------------------------------------------------------
+/// Selects the 1-bit or 4-bit data bus.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param wide  1 for the 4-bit bus.
+//------------------------------------------------------------------------------
+void MCI_SetBusWidth(AT91S_MCI *mci, unsigned char wide)
+{
+    if (wide) {
+
+        mci->MCI_SDCR |= AT91C_MCI_SCDBUS;
+    }
+    else {
+
+        mci->MCI_SDCR &= ~AT91C_MCI_SCDBUS;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sets the data block length, and the PDC mode with word transfers.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param length  Block length in bytes, a multiple of 4.
+//------------------------------------------------------------------------------
+void MCI_SetBlockLength(AT91S_MCI *mci, unsigned int length)
+{
+    SANITY_CHECK((length & 3) == 0);
+
+    mci->MCI_MR = (mci->MCI_MR & ~(AT91C_MCI_BLKLEN | AT91C_MCI_PDCFBYTE))
+                  | AT91C_MCI_PDCMODE | (length << 16);
+}
+
+//------------------------------------------------------------------------------
+/// Sends a command and waits until the MCI is done with it (response
+/// received, or command sent when there is no response). The data transfer
+/// which the command may start goes on in the background.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param command  Value of the command register (index, response type,
+///                 transfer...).
+/// \param argument  Command argument.
+/// \return The error flags of the status register (MCI_STATUS_ERRORS), 0 if
+/// the command succeeded.
+//------------------------------------------------------------------------------
+unsigned int MCI_SendCommand(
+    AT91S_MCI *mci,
+    unsigned int command,
+    unsigned int argument)
+{
+    unsigned int status;
+
+    mci->MCI_ARGR = argument;
+    mci->MCI_CMDR = command;
+    do {
+
+        status = mci->MCI_SR;
+    }
+    while ((status & AT91C_MCI_CMDRDY) == 0);
+
+    return status & MCI_STATUS_ERRORS;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the response of the last command.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param pResponse  Buffer for the response words, most significant first.
+/// \param size  Number of words: 1 for 48-bit responses, 4 for 136-bit ones.
+//------------------------------------------------------------------------------
+void MCI_GetResponse(AT91S_MCI *mci, unsigned int *pResponse, unsigned int size)
+{
+    unsigned int i;
+
+    SANITY_CHECK(size <= 4);
+
+    for (i = 0; i < size; i++) {
+
+        pResponse[i] = mci->MCI_RSPR[i];
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Gives a buffer to send to the PDC, as the current buffer if it is free,
+/// or else as the next one.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param buffer  Data to send, word aligned.
+/// \param size  Number of words, up to 65535.
+/// \return 1 if the buffer was taken, 0 if both PDC buffers are in use.
+//------------------------------------------------------------------------------
+unsigned char MCI_WriteBuffer(
+    AT91S_MCI *mci,
+    const void *buffer,
+    unsigned int size)
+{
+    SANITY_CHECK((size > 0) && (size <= 0xFFFF));
+
+    if (mci->MCI_TCR == 0) {
+
+        mci->MCI_TPR = (unsigned int) buffer;
+        mci->MCI_TCR = size;
+        return 1;
+    }
+    else if (mci->MCI_TNCR == 0) {
+
+        mci->MCI_TNPR = (unsigned int) buffer;
+        mci->MCI_TNCR = size;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Gives a buffer to fill to the PDC, as the current buffer if it is free,
+/// or else as the next one.
+/// \param mci  Pointer to the MCI peripheral.
+/// \param buffer  Destination buffer, word aligned.
+/// \param size  Number of words, up to 65535.
+/// \return 1 if the buffer was taken, 0 if both PDC buffers are in use.
+//------------------------------------------------------------------------------
+unsigned char MCI_ReadBuffer(
+    AT91S_MCI *mci,
+    void *buffer,
+    unsigned int size)
+{
+    SANITY_CHECK((size > 0) && (size <= 0xFFFF));
+
+    if (mci->MCI_RCR == 0) {
+
+        mci->MCI_RPR = (unsigned int) buffer;
+        mci->MCI_RCR = size;
+        return 1;
+    }
+    else if (mci->MCI_RNCR == 0) {
+
+        mci->MCI_RNPR = (unsigned int) buffer;
+        mci->MCI_RNCR = size;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Disables both PDC channels and drops their buffers, e.g. after a failed
+/// transfer.
+/// \param mci  Pointer to the MCI peripheral.
+//------------------------------------------------------------------------------
+void MCI_StopPdc(AT91S_MCI *mci)
+{
+    mci->MCI_PTCR = AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS;
+    mci->MCI_TCR = 0;
+    mci->MCI_TNCR = 0;
+    mci->MCI_RCR = 0;
+    mci->MCI_RNCR = 0;
+}
@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Low-level functions for the Multimedia Card Interface (MCI): slot, clock
+/// and bus width setup, command sending, and data transfers by the PDC. The
+/// card protocol itself (identification, read and write sequences) is left to
+/// the application.
+///
+/// !Usage
+///
+/// -# Enable the MCI pins (see pio & board.h) and the peripheral clock, then
+///    call MCI_Configure() with the slot of the card.
+/// -# Set the card clock with MCI_SetSpeed() (400kHz at most during the card
+///    identification), and the bus width with MCI_SetBusWidth().
+/// -# Send commands with MCI_SendCommand() and get their response with
+///    MCI_GetResponse().
+/// -# For data transfers, set the block length with MCI_SetBlockLength() and
+///    the PDC buffers with MCI_WriteBuffer() or MCI_ReadBuffer(), send the
+///    command, then enable the PDC channel (after the command for writes, see
+///    the datasheet). As for the USART, the PDC holds a current and a next
+///    buffer, chained without any gap.
+///
+/// \note The buffers are accessed by the PDC, they must not be in a
+/// write-back cached memory area and must stay valid during the transfer.
+//------------------------------------------------------------------------------
+
+#ifndef MCI_H
+#define MCI_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// SD card slots (see BOARD_SD_SLOT).
+#define MCI_SD_SLOTA            0
+#define MCI_SD_SLOTB            1
+
+/// Status flags reporting a failed command or data transfer.
+#define MCI_STATUS_ERRORS       (AT91C_MCI_RINDE | AT91C_MCI_RDIRE | AT91C_MCI_RCRCE \
+                                 | AT91C_MCI_RENDE | AT91C_MCI_RTOE | AT91C_MCI_DCRCE \
+                                 | AT91C_MCI_DTOE | AT91C_MCI_OVRE | AT91C_MCI_UNRE)
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void MCI_Configure(AT91S_MCI *mci, unsigned char slot);
+
+extern unsigned int MCI_SetSpeed(
+    AT91S_MCI *mci,
+    unsigned int speed,
+    unsigned int masterClock);
+
+extern void MCI_SetBusWidth(AT91S_MCI *mci, unsigned char wide);
+
+extern void MCI_SetBlockLength(AT91S_MCI *mci, unsigned int length);
+
+extern unsigned int MCI_SendCommand(
+    AT91S_MCI *mci,
+    unsigned int command,
+    unsigned int argument);
+
+extern void MCI_GetResponse(AT91S_MCI *mci, unsigned int *pResponse, unsigned int size);
+
+extern unsigned char MCI_WriteBuffer(
+    AT91S_MCI *mci,
+    const void *buffer,
+    unsigned int size);
+
+extern unsigned char MCI_ReadBuffer(
+    AT91S_MCI *mci,
+    void *buffer,
+    unsigned int size);
+
+extern void MCI_StopPdc(AT91S_MCI *mci);
+
+#endif //#ifndef MCI_H
+
@@ -56,7 +56,7 @@ void PIT_Init(unsigned int period, unsigned int pit_frequency)
 //------------------------------------------------------------------------------
 void PIT_SetPIV(unsigned int piv)
 {
-    AT91C_BASE_PITC->PITC_PIMR = (AT91C_BASE_PITC->PITC_PIMR & AT91C_PITC_PIV)
+    AT91C_BASE_PITC->PITC_PIMR = (AT91C_BASE_PITC->PITC_PIMR & ~AT91C_PITC_PIV)
                                  | piv;
 }
 
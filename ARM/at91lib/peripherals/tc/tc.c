@@ -96,14 +96,14 @@ unsigned char TC_FindMckDivisor(
     unsigned int *div,
     unsigned int *tcclks)
 {
-    const unsigned int divisors[5] = {2, 8, 32, 128,
+    unsigned int divisors[5] = {2, 8, 32, 128, 1024};
+    unsigned int index = 0;
+
 #if defined(at91sam9260) || defined(at91sam9261) || defined(at91sam9263) \
     || defined(at91sam9xe) || defined(at91sam9rl64) || defined(at91cap9)
-        BOARD_MCK / 32768};
-#else
-        1024};
+    // TIMER_CLOCK5 is the slow clock on these chips
+    divisors[4] = mck / 32768;
 #endif
-    unsigned int index = 0;
 
     // Satisfy lower bound
     while (freq < ((mck / divisors[index]) / 65536)) {
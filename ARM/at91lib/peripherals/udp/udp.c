@@ -0,0 +1,204 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "udp.h"
+#include <utility/assert.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// CSR bits which are cleared by writing 0 and left untouched by writing 1.
+#define UDP_CSR_NO_EFFECT_1     (AT91C_UDP_TXCOMP | AT91C_UDP_RX_DATA_BK0 \
+                                 | AT91C_UDP_RXSETUP | AT91C_UDP_STALLSENT \
+                                 | AT91C_UDP_RX_DATA_BK1)
+
+/// Number of peripheral register reads to wait after a CSR write, for the
+/// write to reach the USB clock domain.
+#define UDP_CSR_SYNC            15
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Waits for a CSR write to be taken into account.
+/// \param endpoint  Endpoint number.
+//------------------------------------------------------------------------------
+static void WaitCsr(unsigned char endpoint)
+{
+    volatile unsigned int dummy;
+    unsigned int i;
+
+    for (i = 0; i < UDP_CSR_SYNC; i++) {
+
+        dummy = AT91C_BASE_UDP->UDP_CSR[endpoint];
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Enables the UDP clocks and transceiver, disconnected, with every endpoint
+/// disabled and every interrupt masked. PLLB must already output the 96MHz
+/// divided down to the 48MHz USB clock (see board_lowlevel.c).
+//------------------------------------------------------------------------------
+void UDP_Configure(void)
+{
+    unsigned char i;
+
+    AT91C_BASE_PMC->PMC_PCER = 1 << AT91C_ID_UDP;
+    AT91C_BASE_PMC->PMC_SCER = AT91C_PMC_UDP;
+
+    AT91C_BASE_UDP->UDP_TXVC = 0;
+    AT91C_BASE_UDP->UDP_IDR = 0xFFFFFFFF;
+    AT91C_BASE_UDP->UDP_ICR = 0xFFFFFFFF;
+    AT91C_BASE_UDP->UDP_FADDR = 0;
+    AT91C_BASE_UDP->UDP_GLBSTATE = 0;
+    for (i = 0; i < BOARD_USB_NUMENDPOINTS; i++) {
+
+        AT91C_BASE_UDP->UDP_CSR[i] = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Enables the D+ pull-up, so that the host detects the device.
+//------------------------------------------------------------------------------
+void UDP_Connect(void)
+{
+#if defined(BOARD_USB_PULLUP_INTERNAL)
+    AT91C_BASE_UDP->UDP_TXVC |= AT91C_UDP_PUON;
+#else
+    #error Only the internal D+ pull-up is supported.
+#endif
+}
+
+//------------------------------------------------------------------------------
+/// Disables the D+ pull-up; the host sees a disconnection.
+//------------------------------------------------------------------------------
+void UDP_Disconnect(void)
+{
+    AT91C_BASE_UDP->UDP_TXVC &= ~AT91C_UDP_PUON;
+}
+
+//------------------------------------------------------------------------------
+/// Sets bits of an endpoint CSR without acknowledging any event.
+/// \param endpoint  Endpoint number.
+/// \param flags  Bits to set.
+//------------------------------------------------------------------------------
+void UDP_SetCsr(unsigned char endpoint, unsigned int flags)
+{
+    unsigned int csr;
+
+    SANITY_CHECK(endpoint < BOARD_USB_NUMENDPOINTS);
+
+    csr = AT91C_BASE_UDP->UDP_CSR[endpoint];
+    AT91C_BASE_UDP->UDP_CSR[endpoint] = csr | UDP_CSR_NO_EFFECT_1 | flags;
+    WaitCsr(endpoint);
+}
+
+//------------------------------------------------------------------------------
+/// Clears bits of an endpoint CSR (i.e. acknowledges events or cancels
+/// requests), leaving the other events pending.
+/// \param endpoint  Endpoint number.
+/// \param flags  Bits to clear.
+//------------------------------------------------------------------------------
+void UDP_ClearCsr(unsigned char endpoint, unsigned int flags)
+{
+    unsigned int csr;
+
+    SANITY_CHECK(endpoint < BOARD_USB_NUMENDPOINTS);
+
+    csr = AT91C_BASE_UDP->UDP_CSR[endpoint];
+    AT91C_BASE_UDP->UDP_CSR[endpoint] = (csr | UDP_CSR_NO_EFFECT_1) & ~flags;
+    WaitCsr(endpoint);
+}
+
+//------------------------------------------------------------------------------
+/// Resets and enables an endpoint, and its interrupt.
+/// \param endpoint  Endpoint number.
+/// \param type  Endpoint type (AT91C_UDP_EPTYPE_xxx).
+//------------------------------------------------------------------------------
+void UDP_ConfigureEndpoint(unsigned char endpoint, unsigned int type)
+{
+    UDP_ResetEndpoint(endpoint);
+    AT91C_BASE_UDP->UDP_CSR[endpoint] = AT91C_UDP_EPEDS | type;
+    WaitCsr(endpoint);
+    AT91C_BASE_UDP->UDP_IER = 1 << endpoint;
+}
+
+//------------------------------------------------------------------------------
+/// Resets the FIFOs and the data toggle of an endpoint.
+/// \param endpoint  Endpoint number.
+//------------------------------------------------------------------------------
+void UDP_ResetEndpoint(unsigned char endpoint)
+{
+    AT91C_BASE_UDP->UDP_RSTEP |= 1 << endpoint;
+    AT91C_BASE_UDP->UDP_RSTEP &= ~(1 << endpoint);
+}
+
+//------------------------------------------------------------------------------
+/// Writes data in the free bank of an endpoint FIFO. The packet is sent once
+/// TXPKTRDY is set.
+/// \param endpoint  Endpoint number.
+/// \param pData  Data to write.
+/// \param size  Number of bytes, up to the endpoint packet size.
+//------------------------------------------------------------------------------
+void UDP_WriteFifo(unsigned char endpoint, const void *pData, unsigned int size)
+{
+    volatile AT91_REG *pFifo = &AT91C_BASE_UDP->UDP_FDR[endpoint];
+    const unsigned char *pBytes = (const unsigned char *) pData;
+
+    SANITY_CHECK(size <= BOARD_USB_ENDPOINTS_MAXPACKETSIZE(endpoint));
+
+    // The FIFO is written one byte at a time, unrolled by 8 for the full
+    // bulk packets
+    while (size >= 8) {
+
+        *pFifo = pBytes[0];
+        *pFifo = pBytes[1];
+        *pFifo = pBytes[2];
+        *pFifo = pBytes[3];
+        *pFifo = pBytes[4];
+        *pFifo = pBytes[5];
+        *pFifo = pBytes[6];
+        *pFifo = pBytes[7];
+        pBytes += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+
+        *pFifo = *pBytes++;
+        size--;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads the received data of an endpoint FIFO; the bank must then be
+/// released by clearing its RX_DATA_BKx (or RXSETUP) bit.
+/// \param endpoint  Endpoint number.
+/// \param pData  Destination buffer.
+/// \param size  Size of the buffer.
+/// \return Number of bytes read.
+//------------------------------------------------------------------------------
+unsigned int UDP_ReadFifo(unsigned char endpoint, void *pData, unsigned int size)
+{
+    unsigned char *pBytes = (unsigned char *) pData;
+    unsigned int count;
+    unsigned int i;
+
+    count = (AT91C_BASE_UDP->UDP_CSR[endpoint] & AT91C_UDP_RXBYTECNT) >> 16;
+    if (count > size) {
+
+        count = size;
+    }
+    for (i = 0; i < count; i++) {
+
+        pBytes[i] = AT91C_BASE_UDP->UDP_FDR[endpoint];
+    }
+
+    return count;
+}
@@ -0,0 +1,53 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Low-level functions for the USB Device Port (UDP) full-speed controller:
+/// clocks and transceiver, endpoint setup and FIFO accesses. The USB
+/// protocol itself (enumeration, requests) is left to the application.
+///
+/// !Usage
+///
+/// -# Call UDP_Configure() once PLLB provides the 48MHz USB clock, then
+///    UDP_Connect() to signal the device to the host.
+/// -# Handle the interrupts (AT91C_ID_UDP) with the UDP_ISR and UDP_CSR
+///    registers; modify the endpoint status registers only through
+///    UDP_SetCsr() and UDP_ClearCsr().
+/// -# Configure the endpoints with UDP_ConfigureEndpoint(), and access their
+///    FIFOs with UDP_WriteFifo() and UDP_ReadFifo().
+//------------------------------------------------------------------------------
+
+#ifndef UDP_H
+#define UDP_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void UDP_Configure(void);
+
+extern void UDP_Connect(void);
+
+extern void UDP_Disconnect(void);
+
+extern void UDP_SetCsr(unsigned char endpoint, unsigned int flags);
+
+extern void UDP_ClearCsr(unsigned char endpoint, unsigned int flags);
+
+extern void UDP_ConfigureEndpoint(unsigned char endpoint, unsigned int type);
+
+extern void UDP_ResetEndpoint(unsigned char endpoint);
+
+extern void UDP_WriteFifo(unsigned char endpoint, const void *pData, unsigned int size);
+
+extern unsigned int UDP_ReadFifo(unsigned char endpoint, void *pData, unsigned int size);
+
+#endif //#ifndef UDP_H
+
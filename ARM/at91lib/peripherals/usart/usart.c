@@ -0,0 +1,147 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "usart.h"
+#include <utility/assert.h>
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Configures a USART with the given mode and baudrate, the transmitter and
+/// receiver being left disabled. The baudrate is rounded to the nearest one
+/// which the master clock allows.
+/// \param usart  Pointer to the USART peripheral.
+/// \param mode  Desired value of the mode register (see USART_MODE_xxx).
+/// \param baudrate  Baudrate at which the USART should operate (in Hz).
+/// \param masterClock  Frequency of the system master clock (in Hz).
+//------------------------------------------------------------------------------
+void USART_Configure(
+    AT91S_USART *usart,
+    unsigned int mode,
+    unsigned int baudrate,
+    unsigned int masterClock)
+{
+    unsigned int divisor;
+    unsigned int cd;
+
+    SANITY_CHECK(usart);
+    SANITY_CHECK(baudrate > 0);
+
+    // Reset and disable receiver & transmitter, stop the PDC
+    usart->US_CR = AT91C_US_RSTRX | AT91C_US_RSTTX
+                   | AT91C_US_RXDIS | AT91C_US_TXDIS | AT91C_US_RSTSTA;
+    usart->US_IDR = 0xFFFFFFFF;
+    usart->US_PTCR = AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS;
+    usart->US_TCR = 0;
+    usart->US_TNCR = 0;
+
+    // Configure mode and baudrate (8x or 16x oversampling)
+    usart->US_MR = mode;
+    divisor = (mode & AT91C_US_OVER) ? 8 : 16;
+    cd = (masterClock + (divisor * baudrate) / 2) / (divisor * baudrate);
+    if (cd == 0) {
+
+        cd = 1;
+    }
+    usart->US_BRGR = cd;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the actual baudrate of a configured USART.
+/// \param usart  Pointer to the USART peripheral.
+/// \param masterClock  Frequency of the system master clock (in Hz).
+//------------------------------------------------------------------------------
+unsigned int USART_GetBaudrate(AT91S_USART *usart, unsigned int masterClock)
+{
+    unsigned int divisor = (usart->US_MR & AT91C_US_OVER) ? 8 : 16;
+    unsigned int cd = usart->US_BRGR & 0xFFFF;
+
+    if (cd == 0) {
+
+        return 0;
+    }
+
+    return masterClock / (divisor * cd);
+}
+
+//------------------------------------------------------------------------------
+/// Enables or disables the transmitter of a USART, and its PDC channel.
+/// \param usart  Pointer to the USART peripheral.
+/// \param enabled  1 to enable the transmitter, 0 to disable it.
+//------------------------------------------------------------------------------
+void USART_SetTransmitterEnabled(AT91S_USART *usart, unsigned char enabled)
+{
+    if (enabled) {
+
+        usart->US_CR = AT91C_US_TXEN;
+        usart->US_PTCR = AT91C_PDC_TXTEN;
+    }
+    else {
+
+        usart->US_PTCR = AT91C_PDC_TXTDIS;
+        usart->US_CR = AT91C_US_TXDIS;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Enables or disables the receiver of a USART.
+/// \param usart  Pointer to the USART peripheral.
+/// \param enabled  1 to enable the receiver, 0 to disable it.
+//------------------------------------------------------------------------------
+void USART_SetReceiverEnabled(AT91S_USART *usart, unsigned char enabled)
+{
+    if (enabled) {
+
+        usart->US_CR = AT91C_US_RXEN;
+    }
+    else {
+
+        usart->US_CR = AT91C_US_RXDIS;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Queues a buffer for transmission by the PDC. The buffer goes in the current
+/// transfer registers if they are free, otherwise in the next ones; the
+/// function returns immediately in both cases.
+/// \param usart  Pointer to the USART peripheral.
+/// \param buffer  Data to send.
+/// \param size  Number of bytes to send (1 to 65535).
+/// \return 1 if the buffer has been queued, 0 if both PDC buffers are in use.
+//------------------------------------------------------------------------------
+unsigned char USART_WriteBuffer(
+    AT91S_USART *usart,
+    const void *buffer,
+    unsigned int size)
+{
+    SANITY_CHECK((size > 0) && (size <= 0xFFFF));
+
+    if (usart->US_TCR == 0) {
+
+        usart->US_TPR = (unsigned int) buffer;
+        usart->US_TCR = size;
+        return 1;
+    }
+    else if (usart->US_TNCR == 0) {
+
+        usart->US_TNPR = (unsigned int) buffer;
+        usart->US_TNCR = size;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if both PDC transmit buffers are empty and the last character
+/// has left the shift register.
+/// \param usart  Pointer to the USART peripheral.
+//------------------------------------------------------------------------------
+unsigned char USART_IsTxEmpty(AT91S_USART *usart)
+{
+    return ((usart->US_CSR & (AT91C_US_TXBUFE | AT91C_US_TXEMPTY))
+            == (AT91C_US_TXBUFE | AT91C_US_TXEMPTY));
+}
@@ -0,0 +1,83 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// This module provides functions for using the USART peripherals in
+/// asynchronous mode, with the transmissions done by the PDC.
+///
+/// !Usage
+///
+/// -# Enable the USART pins (see pio & board.h) and the peripheral clock.
+/// -# Configure the USART with USART_Configure(), e.g. with USART_MODE_HWHSH
+///    for a high speed link with RTS/CTS flow control.
+/// -# Enable the transmitter and/or the receiver with
+///    USART_SetTransmitterEnabled() and USART_SetReceiverEnabled().
+/// -# Send buffers with USART_WriteBuffer(). The PDC holds two buffers, the
+///    current one (TPR/TCR) and the next one (TNPR/TNCR) which starts right
+///    after the current one without any gap; USART_WriteBuffer() returns 0
+///    when both are in use.
+/// -# Check the end of the transfers with the AT91C_US_ENDTX (current buffer
+///    sent) and AT91C_US_TXBUFE (both buffers sent) status flags or
+///    interrupts.
+///
+/// \note The buffers are read by the PDC, they must not be in a write-back
+/// cached memory area and must stay valid until they are sent.
+//------------------------------------------------------------------------------
+
+#ifndef USART_H
+#define USART_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Asynchronous mode, 8 bits, no parity, 1 stop bit, 16x oversampling.
+#define USART_MODE_ASYNCHRONOUS     (AT91C_US_USMODE_NORMAL \
+                                     | AT91C_US_CLKS_CLOCK \
+                                     | AT91C_US_CHRL_8_BITS \
+                                     | AT91C_US_PAR_NONE \
+                                     | AT91C_US_NBSTOP_1_BIT \
+                                     | AT91C_US_CHMODE_NORMAL)
+
+/// Same as USART_MODE_ASYNCHRONOUS with RTS/CTS hardware handshaking and 8x
+/// oversampling, for baudrates up to MCK/8.
+#define USART_MODE_HWHSH            (AT91C_US_USMODE_HWHSH \
+                                     | AT91C_US_CLKS_CLOCK \
+                                     | AT91C_US_CHRL_8_BITS \
+                                     | AT91C_US_PAR_NONE \
+                                     | AT91C_US_NBSTOP_1_BIT \
+                                     | AT91C_US_CHMODE_NORMAL \
+                                     | AT91C_US_OVER)
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void USART_Configure(
+    AT91S_USART *usart,
+    unsigned int mode,
+    unsigned int baudrate,
+    unsigned int masterClock);
+
+extern unsigned int USART_GetBaudrate(AT91S_USART *usart, unsigned int masterClock);
+
+extern void USART_SetTransmitterEnabled(AT91S_USART *usart, unsigned char enabled);
+
+extern void USART_SetReceiverEnabled(AT91S_USART *usart, unsigned char enabled);
+
+extern unsigned char USART_WriteBuffer(
+    AT91S_USART *usart,
+    const void *buffer,
+    unsigned int size);
+
+extern unsigned char USART_IsTxEmpty(AT91S_USART *usart);
+
+#endif //#ifndef USART_H
+
@@ -0,0 +1,139 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "crc32.h"
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Reflected polynomial.
+#define POLYNOMIAL      0xEDB88320
+
+/// Places the tables in the internal SRAM1 on the board, filled at runtime.
+#if defined(__ICCARM__)
+    #define CRC32_SRAM  _Pragma("location=\".sram1\"") __no_init
+#else
+    #define CRC32_SRAM
+#endif
+
+/// Updates a CRC with one byte.
+#define UPDATE_BYTE(crc, byte) \
+    (crc = pTables[0][((crc) ^ (byte)) & 0xFF] ^ ((crc) >> 8))
+
+/// Updates a CRC with one little-endian word.
+#define UPDATE_WORD(crc, word) \
+    (crc ^= (word), \
+     crc = pTables[3][(crc) & 0xFF] ^ pTables[2][((crc) >> 8) & 0xFF] \
+           ^ pTables[1][((crc) >> 16) & 0xFF] ^ pTables[0][(crc) >> 24])
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// pTables[0][b] is the CRC of byte b; pTables[n][b] is the CRC of byte b
+/// followed by n zero bytes.
+CRC32_SRAM static unsigned int pTables[4][256];
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Builds the lookup tables.
+//------------------------------------------------------------------------------
+void CRC32_Initialize(void)
+{
+    unsigned int crc;
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 0; i < 256; i++) {
+
+        crc = i;
+        for (j = 0; j < 8; j++) {
+
+            crc = (crc & 1) ? ((crc >> 1) ^ POLYNOMIAL) : (crc >> 1);
+        }
+        pTables[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+
+        for (j = 1; j < 4; j++) {
+
+            crc = pTables[j - 1][i];
+            pTables[j][i] = pTables[0][crc & 0xFF] ^ (crc >> 8);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Updates a CRC-32 with more data.
+/// \param crc  CRC of the previous data, 0 at the start.
+/// \param pData  Data.
+/// \param size  Number of bytes.
+/// \return The CRC of the previous data followed by the new one.
+//------------------------------------------------------------------------------
+unsigned int CRC32_Update(unsigned int crc, const void *pData, unsigned int size)
+{
+    const unsigned char *pBytes = (const unsigned char *) pData;
+    const unsigned int *pWords;
+
+    crc = ~crc;
+
+    // Bytes up to the first word boundary
+    while ((size > 0) && (((unsigned long) pBytes & 3) != 0)) {
+
+        UPDATE_BYTE(crc, *pBytes++);
+        size--;
+    }
+
+    // Whole words
+    pWords = (const unsigned int *) pBytes;
+    while (size >= 4) {
+
+        UPDATE_WORD(crc, *pWords++);
+        size -= 4;
+    }
+
+    // Remaining bytes
+    pBytes = (const unsigned char *) pWords;
+    while (size > 0) {
+
+        UPDATE_BYTE(crc, *pBytes++);
+        size--;
+    }
+
+    return ~crc;
+}
+
+//------------------------------------------------------------------------------
+/// Copies words and updates a CRC-32 with them, reading each source word only
+/// once.
+/// \param crc  CRC of the previous data, 0 at the start.
+/// \param pDestination  Destination, word-aligned.
+/// \param pSource  Source, word-aligned.
+/// \param size  Number of words.
+/// \return The CRC of the previous data followed by the copied words.
+//------------------------------------------------------------------------------
+unsigned int CRC32_Copy(
+    unsigned int crc,
+    unsigned int *pDestination,
+    const volatile unsigned int *pSource,
+    unsigned int size)
+{
+    unsigned int word;
+
+    crc = ~crc;
+    while (size > 0) {
+
+        word = *pSource++;
+        *pDestination++ = word;
+        UPDATE_WORD(crc, word);
+        size--;
+    }
+
+    return ~crc;
+}
+
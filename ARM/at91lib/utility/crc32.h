@@ -0,0 +1,49 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// CRC-32 of the IEEE 802.3 standard (polynomial 0x04C11DB7, reflected, as
+/// computed by zlib's crc32()), used to protect the event records.
+///
+/// The data is processed a word at a time with four 1kB tables ("slice-by-4"),
+/// which cuts the table lookups and loop overhead of the byte-wise algorithm
+/// by four; the word loads assume a little-endian CPU. On the board the
+/// tables fill the internal SRAM1 (section .sram1 of the linker file), which
+/// answers in one cycle where the SDRAM needs several per random access.
+/// CRC32_Copy() fuses the CRC with a copy, so that data read from a slow
+/// memory (the DPRAM) is read only once.
+///
+/// The "bench" shell command measures the cost on the board, in cycles per
+/// byte, of the CRC alone and fused with the DPRAM copy.
+///
+/// !Usage
+///
+/// -# Call CRC32_Initialize() once at startup to build the tables.
+/// -# Start with a CRC of 0, then feed the data in one or more pieces with
+///    CRC32_Update() or CRC32_Copy(), each call returning the CRC of
+///    everything so far.
+///
+/// \note This module is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef CRC32_H
+#define CRC32_H
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void CRC32_Initialize(void);
+
+extern unsigned int CRC32_Update(unsigned int crc, const void *pData, unsigned int size);
+
+extern unsigned int CRC32_Copy(
+    unsigned int crc,
+    unsigned int *pDestination,
+    const volatile unsigned int *pSource,
+    unsigned int size);
+
+#endif //#ifndef CRC32_H
+
@@ -0,0 +1,80 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Short critical sections for code shared between interrupt handlers and the
+/// main program (queues, counters, ring buffer indexes...).
+///
+/// !Usage
+///
+/// -# Save the interrupt state and mask interrupts with CRITICAL_Enter().
+/// -# Restore the saved state with CRITICAL_Exit(). Sections can be nested
+///    since the previous state is restored, not blindly re-enabled.
+///
+/// \note Critical sections must stay a handful of instructions long; they
+/// delay every interrupt of the system, including the readout ones.
+//------------------------------------------------------------------------------
+
+#ifndef CRITICAL_H
+#define CRITICAL_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#if defined(__ICCARM__)
+#include <intrinsics.h>
+#endif
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+#if defined(__ICCARM__)
+/// Saved interrupt state (CPSR I & F bits).
+typedef __istate_t CriticalState;
+#else
+/// Saved interrupt state (CPSR I & F bits).
+typedef unsigned int CriticalState;
+#endif
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Masks IRQ and FIQ interrupts and returns the previous interrupt state.
+//------------------------------------------------------------------------------
+static inline CriticalState CRITICAL_Enter(void)
+{
+#if defined(__ICCARM__)
+    CriticalState state = __get_interrupt_state();
+    __disable_interrupt();
+    return state;
+#else
+    CriticalState state;
+    unsigned int cpsr;
+    __asm__ __volatile__ ("mrs %0, cpsr\n\t"
+                          "orr %1, %0, #0xC0\n\t"
+                          "msr cpsr_c, %1"
+                          : "=r" (state), "=r" (cpsr) : : "memory");
+    return state;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/// Restores an interrupt state previously returned by CRITICAL_Enter().
+/// \param state  Saved interrupt state.
+//------------------------------------------------------------------------------
+static inline void CRITICAL_Exit(CriticalState state)
+{
+#if defined(__ICCARM__)
+    __set_interrupt_state(state);
+#else
+    __asm__ __volatile__ ("msr cpsr_c, %0" : : "r" (state) : "memory");
+#endif
+}
+
+#endif //#ifndef CRITICAL_H
+
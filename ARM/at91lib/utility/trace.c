@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "trace.h"
+#include <utility/critical.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Initial channel mask of a level: every channel is enabled up to TRACE_LEVEL.
+#define INITIAL_MASK(level)     (((level) <= TRACE_LEVEL) ? 0xFFFFFFFF : 0)
+
+//------------------------------------------------------------------------------
+//         Exported variables
+//------------------------------------------------------------------------------
+
+/// Channels enabled for each trace level, one bit per channel.
+volatile unsigned int traceChannelMasks[TRACE_LEVEL_DEBUG + 1] = {
+
+    0,
+    INITIAL_MASK(TRACE_LEVEL_FATAL),
+    INITIAL_MASK(TRACE_LEVEL_ERROR),
+    INITIAL_MASK(TRACE_LEVEL_WARNING),
+    INITIAL_MASK(TRACE_LEVEL_INFO),
+    INITIAL_MASK(TRACE_LEVEL_DEBUG)
+};
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Sets the runtime level of a trace channel. Traces above the compile-time
+/// level of the channel stay disabled whatever the runtime level.
+/// \param channel  Channel ID (TRACE_CH_xxx).
+/// \param level  Highest trace level to output (TRACE_LEVEL_xxx).
+//------------------------------------------------------------------------------
+void TRACE_SetChannelLevel(unsigned int channel, unsigned int level)
+{
+    CriticalState state;
+    unsigned int i;
+
+    state = CRITICAL_Enter();
+    for (i = TRACE_LEVEL_FATAL; i <= TRACE_LEVEL_DEBUG; i++) {
+
+        if (i <= level) {
+
+            traceChannelMasks[i] |= 1 << channel;
+        }
+        else {
+
+            traceChannelMasks[i] &= ~(1 << channel);
+        }
+    }
+    CRITICAL_Exit(state);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the runtime level of a trace channel.
+/// \param channel  Channel ID (TRACE_CH_xxx).
+//------------------------------------------------------------------------------
+unsigned int TRACE_GetChannelLevel(unsigned int channel)
+{
+    unsigned int level = TRACE_LEVEL_NO_TRACE;
+
+    while ((level < TRACE_LEVEL_DEBUG)
+           && (traceChannelMasks[level + 1] & (1 << channel))) {
+
+        level++;
+    }
+
+    return level;
+}
+
@@ -47,6 +47,17 @@
 /// -# Trace disabling can be static or dynamic. If dynamic disabling is selected
 ///    the trace level can be modified in runtime. If static disabling is selected
 ///    the disabled traces are not compiled.
+/// -# A module can use its own trace channel by defining TRACE_CHANNEL (before
+///    including any header) to a channel name declared in the application
+///    trace_channels.h. The channel compile-time level then replaces
+///    TRACE_LEVEL for that module, and traces are further filtered at runtime
+///    with TRACE_SetChannelLevel(). Channels are ignored with DYN_TRACES.
+/// -# With TRACE_BINARY set to 1, the enabled traces (except fatal ones) are
+///    not formatted but recorded in the binary trace log (see tracelog.h);
+///    they take at most four integer arguments.
+/// -# In interrupt handlers and on the readout path, use the TRACE_LOG_xxx()
+///    macros to record a message in the binary trace log whatever
+///    TRACE_BINARY; they are filtered like the other traces.
 ///
 /// !Trace level description
 /// -# TRACE_DEBUG (5): Traces whose only purpose is for debugging the program, 
@@ -73,6 +84,7 @@
 #include <dbgu/dbgu.h>
 #include <pio/pio.h>
 #include <stdio.h>
+#include <utility/tracelog.h>
 
 //------------------------------------------------------------------------------
 //         Global Definitions
@@ -98,6 +110,11 @@
 #define DYN_TRACES 0
 #endif
 
+// By default, traces are formatted immediately (not recorded in binary)
+#if !defined(TRACE_BINARY)
+#define TRACE_BINARY 0
+#endif
+
 #if defined(NOTRACE)
 #error "Error: NOTRACE has to be not defined !"
 #endif
@@ -107,6 +124,22 @@
 #define NOTRACE
 #endif
 
+// Per-module channel: its ID and compile-time ceiling come from the
+// application trace_channels.h, e.g. TRACE_CH_SPILL and TRACE_CH_SPILL_LEVEL
+// for TRACE_CHANNEL defined as SPILL
+#if defined(TRACE_CHANNEL)
+#include <trace_channels.h>
+#define TRACE_PASTE(a, b, c)        a ## b ## c
+#define TRACE_CHANNEL_NAME(a, b, c) TRACE_PASTE(a, b, c)
+#define TRACE_CHANNEL_ID            TRACE_CHANNEL_NAME(TRACE_CH_, TRACE_CHANNEL, )
+#define TRACE_COMPILED_LEVEL        TRACE_CHANNEL_NAME(TRACE_CH_, TRACE_CHANNEL, _LEVEL)
+#if (TRACE_CHANNEL_ID > 31)
+#error "Error: trace channel IDs must be lower than 32 !"
+#endif
+#else
+#define TRACE_COMPILED_LEVEL        TRACE_LEVEL
+#endif
+
 
 
 //------------------------------------------------------------------------------
@@ -146,7 +179,6 @@
 /// enough. Can be disabled by defining TRACE_LEVEL=0 during compilation.
 /// \param format  Formatted string to output.
 /// \param ...  Additional parameters depending on formatted string.
-//------------------------------------------------------------------------------
 #if defined(NOTRACE)
 
 // Empty macro
@@ -179,40 +211,58 @@
 
 #else
 
-// Trace compilation depends on TRACE_LEVEL value
-#if (TRACE_LEVEL >= TRACE_LEVEL_DEBUG)
-#define TRACE_DEBUG(...)      { printf("-D- " __VA_ARGS__); }
-#define TRACE_DEBUG_WP(...)   { printf(__VA_ARGS__); }
+// Output of an enabled trace: formatted right away, or recorded in the
+// binary trace log
+#if (TRACE_BINARY == 1)
+#define TRACE_OUTPUT(level, prefix, ...)  TRACELOG(level, __VA_ARGS__)
+#define TRACE_OUTPUT_WP(level, ...)       TRACELOG_WP(level, __VA_ARGS__)
+#else
+#define TRACE_OUTPUT(level, prefix, ...)  printf(prefix __VA_ARGS__)
+#define TRACE_OUTPUT_WP(level, ...)       printf(__VA_ARGS__)
+#endif
+
+// Runtime filter: one load and test of the channel mask for the level
+#if defined(TRACE_CHANNEL)
+#define TRACE_ENABLED(level)  (traceChannelMasks[level] & (1 << TRACE_CHANNEL_ID))
+#else
+#define TRACE_ENABLED(level)  1
+#endif
+
+// Trace compilation depends on TRACE_COMPILED_LEVEL value
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_DEBUG)
+#define TRACE_DEBUG(...)      { if (TRACE_ENABLED(TRACE_LEVEL_DEBUG)) { TRACE_OUTPUT(TRACE_LEVEL_DEBUG, "-D- ", __VA_ARGS__); } }
+#define TRACE_DEBUG_WP(...)   { if (TRACE_ENABLED(TRACE_LEVEL_DEBUG)) { TRACE_OUTPUT_WP(TRACE_LEVEL_DEBUG, __VA_ARGS__); } }
 #else
 #define TRACE_DEBUG(...)      { }
 #define TRACE_DEBUG_WP(...)   { }
 #endif
 
-#if (TRACE_LEVEL >= TRACE_LEVEL_INFO)
-#define TRACE_INFO(...)       { printf("-I- " __VA_ARGS__); }
-#define TRACE_INFO_WP(...)    { printf(__VA_ARGS__); }
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_INFO)
+#define TRACE_INFO(...)       { if (TRACE_ENABLED(TRACE_LEVEL_INFO)) { TRACE_OUTPUT(TRACE_LEVEL_INFO, "-I- ", __VA_ARGS__); } }
+#define TRACE_INFO_WP(...)    { if (TRACE_ENABLED(TRACE_LEVEL_INFO)) { TRACE_OUTPUT_WP(TRACE_LEVEL_INFO, __VA_ARGS__); } }
 #else
 #define TRACE_INFO(...)       { }
 #define TRACE_INFO_WP(...)    { }
 #endif
 
-#if (TRACE_LEVEL >= TRACE_LEVEL_WARNING)
-#define TRACE_WARNING(...)    { printf("-W- " __VA_ARGS__); }
-#define TRACE_WARNING_WP(...) { printf(__VA_ARGS__); }
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_WARNING)
+#define TRACE_WARNING(...)    { if (TRACE_ENABLED(TRACE_LEVEL_WARNING)) { TRACE_OUTPUT(TRACE_LEVEL_WARNING, "-W- ", __VA_ARGS__); } }
+#define TRACE_WARNING_WP(...) { if (TRACE_ENABLED(TRACE_LEVEL_WARNING)) { TRACE_OUTPUT_WP(TRACE_LEVEL_WARNING, __VA_ARGS__); } }
 #else
 #define TRACE_WARNING(...)    { }
 #define TRACE_WARNING_WP(...) { }
 #endif
 
-#if (TRACE_LEVEL >= TRACE_LEVEL_ERROR)
-#define TRACE_ERROR(...)      { printf("-E- " __VA_ARGS__); }
-#define TRACE_ERROR_WP(...)   { printf(__VA_ARGS__); }
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_ERROR)
+#define TRACE_ERROR(...)      { if (TRACE_ENABLED(TRACE_LEVEL_ERROR)) { TRACE_OUTPUT(TRACE_LEVEL_ERROR, "-E- ", __VA_ARGS__); } }
+#define TRACE_ERROR_WP(...)   { if (TRACE_ENABLED(TRACE_LEVEL_ERROR)) { TRACE_OUTPUT_WP(TRACE_LEVEL_ERROR, __VA_ARGS__); } }
 #else
 #define TRACE_ERROR(...)      { }
 #define TRACE_ERROR_WP(...)   { }
 #endif
 
-#if (TRACE_LEVEL >= TRACE_LEVEL_FATAL)
+// Fatal traces are always printed right away, the program stops there
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_FATAL)
 #define TRACE_FATAL(...)      { printf("-F- " __VA_ARGS__); while(1); }
 #define TRACE_FATAL_WP(...)   { printf(__VA_ARGS__); while(1); }
 #else
@@ -222,6 +272,58 @@
 
 #endif
 
+//------------------------------------------------------------------------------
+/// Records a message in the binary trace log (see tracelog.h) if the log level
+/// is high enough, whatever TRACE_BINARY. Can be disabled by defining
+/// TRACE_LEVEL=0 during compilation.
+/// \param format  Format string literal.
+/// \param ...  Up to four integer arguments.
+//------------------------------------------------------------------------------
+#if defined(NOTRACE)
+
+// Empty macro
+#define TRACE_LOG_DEBUG(...)    { }
+#define TRACE_LOG_INFO(...)     { }
+#define TRACE_LOG_WARNING(...)  { }
+#define TRACE_LOG_ERROR(...)    { }
+
+#elif (DYN_TRACES == 1)
+
+// Trace recording depends on traceLevel value
+#define TRACE_LOG_DEBUG(...)    { if (traceLevel >= TRACE_LEVEL_DEBUG)   { TRACELOG(TRACE_LEVEL_DEBUG, __VA_ARGS__); } }
+#define TRACE_LOG_INFO(...)     { if (traceLevel >= TRACE_LEVEL_INFO)    { TRACELOG(TRACE_LEVEL_INFO, __VA_ARGS__); } }
+#define TRACE_LOG_WARNING(...)  { if (traceLevel >= TRACE_LEVEL_WARNING) { TRACELOG(TRACE_LEVEL_WARNING, __VA_ARGS__); } }
+#define TRACE_LOG_ERROR(...)    { if (traceLevel >= TRACE_LEVEL_ERROR)   { TRACELOG(TRACE_LEVEL_ERROR, __VA_ARGS__); } }
+
+#else
+
+// Trace compilation depends on TRACE_COMPILED_LEVEL value
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_DEBUG)
+#define TRACE_LOG_DEBUG(...)    { if (TRACE_ENABLED(TRACE_LEVEL_DEBUG)) { TRACELOG(TRACE_LEVEL_DEBUG, __VA_ARGS__); } }
+#else
+#define TRACE_LOG_DEBUG(...)    { }
+#endif
+
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_INFO)
+#define TRACE_LOG_INFO(...)     { if (TRACE_ENABLED(TRACE_LEVEL_INFO)) { TRACELOG(TRACE_LEVEL_INFO, __VA_ARGS__); } }
+#else
+#define TRACE_LOG_INFO(...)     { }
+#endif
+
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_WARNING)
+#define TRACE_LOG_WARNING(...)  { if (TRACE_ENABLED(TRACE_LEVEL_WARNING)) { TRACELOG(TRACE_LEVEL_WARNING, __VA_ARGS__); } }
+#else
+#define TRACE_LOG_WARNING(...)  { }
+#endif
+
+#if (TRACE_COMPILED_LEVEL >= TRACE_LEVEL_ERROR)
+#define TRACE_LOG_ERROR(...)    { if (TRACE_ENABLED(TRACE_LEVEL_ERROR)) { TRACELOG(TRACE_LEVEL_ERROR, __VA_ARGS__); } }
+#else
+#define TRACE_LOG_ERROR(...)    { }
+#endif
+
+#endif
+
 
 //------------------------------------------------------------------------------
 //         Exported variables
@@ -232,5 +334,16 @@
     extern unsigned int traceLevel;
 #endif
 
+// Channels enabled for each trace level, one bit per channel
+extern volatile unsigned int traceChannelMasks[TRACE_LEVEL_DEBUG + 1];
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+extern void TRACE_SetChannelLevel(unsigned int channel, unsigned int level);
+
+extern unsigned int TRACE_GetChannelLevel(unsigned int channel);
+
 #endif //#ifndef TRACE_H
 
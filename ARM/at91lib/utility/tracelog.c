@@ -0,0 +1,212 @@
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "tracelog.h"
+#include <utility/assert.h>
+#include <utility/critical.h>
+#include <stdio.h>
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Header of the trace log area, 0 until initialized.
+static TraceLogHeader *pHeader = 0;
+
+/// Record ring, right after the header.
+static TraceLogRecord *pRecords;
+
+/// Number of records minus one (the ring size is a power of two).
+static unsigned int recordMask;
+
+/// Returns the current timestamp.
+static unsigned int (*pGetTimestamp)(void);
+
+/// Index of the next record to format on the target.
+static unsigned int readIndex;
+
+/// Number of records overwritten before TRACELOG_Drain() could format them.
+static unsigned int lost;
+
+/// Prefixes of the formatted records, indexed by trace level.
+static const char * const pPrefixes[] = {"", "-F- ", "-E- ", "-W- ", "-I- ", "-D- "};
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes the trace log in the given memory area. The number of records
+/// is the largest power of two which fits after the header.
+/// \param pMemory  Start of the area (word aligned).
+/// \param size  Size of the area in bytes.
+/// \param getTimestamp  Function returning the current timestamp (can be 0).
+/// \param frequency  Frequency of the timestamps in Hz, stored for decoders.
+//------------------------------------------------------------------------------
+void TRACELOG_Initialize(
+    void *pMemory,
+    unsigned int size,
+    unsigned int (*getTimestamp)(void),
+    unsigned int frequency)
+{
+    TraceLogHeader *pLog = (TraceLogHeader *) pMemory;
+    unsigned int numRecords = 1;
+    unsigned int i;
+
+    SANITY_CHECK(pMemory);
+    SANITY_CHECK(size >= sizeof(TraceLogHeader) + sizeof(TraceLogRecord));
+
+    while ((numRecords * 2 * sizeof(TraceLogRecord)) <= (size - sizeof(TraceLogHeader))) {
+
+        numRecords *= 2;
+    }
+
+    pRecords = (TraceLogRecord *) (pLog + 1);
+    for (i = 0; i < numRecords; i++) {
+
+        pRecords[i].sequence = TRACELOG_EMPTY;
+    }
+
+    pLog->magic = TRACELOG_MAGIC;
+    pLog->version = TRACELOG_VERSION;
+    pLog->recordSize = sizeof(TraceLogRecord);
+    pLog->numRecords = numRecords;
+    pLog->writeIndex = 0;
+    pLog->frequency = frequency;
+    pLog->reserved[0] = 0;
+    pLog->reserved[1] = 0;
+
+    recordMask = numRecords - 1;
+    pGetTimestamp = getTimestamp;
+    readIndex = 0;
+    lost = 0;
+    pHeader = pLog;
+}
+
+//------------------------------------------------------------------------------
+/// Stores a record in the ring; use the TRACELOG() macro instead. Can be
+/// called from interrupt handlers. Does nothing until the log is initialized.
+/// \param info  Number of arguments, level and flags (see TraceLogRecord).
+/// \param format  Format string.
+/// \param a  First argument.
+/// \param b  Second argument.
+/// \param c  Third argument.
+/// \param d  Fourth argument.
+//------------------------------------------------------------------------------
+void TRACELOG_Record(
+    unsigned int info,
+    const char *format,
+    unsigned int a,
+    unsigned int b,
+    unsigned int c,
+    unsigned int d)
+{
+    CriticalState state;
+    TraceLogRecord *pRecord;
+    unsigned int index;
+    unsigned int timestamp;
+
+    if (pHeader == 0) {
+
+        return;
+    }
+
+    // Claim the slot and timestamp it atomically, so that records are in
+    // timestamp order
+    state = CRITICAL_Enter();
+    index = pHeader->writeIndex++;
+    timestamp = pGetTimestamp ? pGetTimestamp() : 0;
+    CRITICAL_Exit(state);
+
+    pRecord = &pRecords[index & recordMask];
+    pRecord->sequence = TRACELOG_EMPTY;
+    pRecord->timestamp = timestamp;
+    pRecord->format = (unsigned int) format;
+    pRecord->info = info;
+    pRecord->args[0] = a;
+    pRecord->args[1] = b;
+    pRecord->args[2] = c;
+    pRecord->args[3] = d;
+    pRecord->sequence = index;
+}
+
+//------------------------------------------------------------------------------
+/// Formats and prints the oldest pending records on the standard output.
+/// Must be called from a single, low priority task context.
+/// \param maxRecords  Maximum number of records to print.
+/// \return Number of records printed.
+//------------------------------------------------------------------------------
+unsigned int TRACELOG_Drain(unsigned int maxRecords)
+{
+    TraceLogRecord *pRecord;
+    TraceLogRecord record;
+    unsigned int writeIndex;
+    unsigned int level;
+    unsigned int count = 0;
+
+    if (pHeader == 0) {
+
+        return 0;
+    }
+
+    while (count < maxRecords) {
+
+        writeIndex = pHeader->writeIndex;
+        if (readIndex == writeIndex) {
+
+            break;
+        }
+
+        // Skip what has been overwritten
+        if ((writeIndex - readIndex) > pHeader->numRecords) {
+
+            lost += writeIndex - readIndex - pHeader->numRecords;
+            readIndex = writeIndex - pHeader->numRecords;
+        }
+
+        pRecord = &pRecords[readIndex & recordMask];
+        if (pRecord->sequence != readIndex) {
+
+            // Being overwritten by a newer record, or not complete yet
+            if ((writeIndex - readIndex) >= pHeader->numRecords) {
+
+                lost++;
+                readIndex++;
+                continue;
+            }
+            break;
+        }
+
+        // Copy, then make sure the record did not change meanwhile
+        record = *pRecord;
+        if (pRecord->sequence != readIndex) {
+
+            lost++;
+            readIndex++;
+            continue;
+        }
+        readIndex++;
+        count++;
+
+        level = (record.info >> 8) & 0xFF;
+        if (((record.info & TRACELOG_NOPREFIX) == 0) && (level < 6)) {
+
+            printf("%s", pPrefixes[level]);
+        }
+        printf((const char *) record.format,
+               record.args[0], record.args[1], record.args[2], record.args[3]);
+    }
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of records overwritten before they could be printed by
+/// TRACELOG_Drain().
+//------------------------------------------------------------------------------
+unsigned int TRACELOG_GetLost(void)
+{
+    return lost;
+}
+
@@ -0,0 +1,172 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Binary trace log with deferred formatting. Instead of formatting and
+/// sending a message, each trace site stores a timestamp, the address of its
+/// format string and up to four raw 32-bit arguments in a ring of fixed-size
+/// records in memory. The messages are formatted later, either on the target
+/// by TRACELOG_Drain() from a low priority context, or on the host from a dump
+/// of the ring (see Host/tracedump).
+///
+/// Recording costs a timestamp read, a few stores and a critical section of
+/// three instructions to claim the slot, so it can be used from interrupt
+/// handlers and the readout path. When the ring is full the oldest records
+/// are overwritten; the reader detects and counts the lost ones.
+///
+/// !Usage
+///
+/// -# Call TRACELOG_Initialize() with the memory area to use, and the
+///    function returning the current timestamp.
+/// -# Record messages with TRACELOG(level, format, ...), or in the board
+///    code with the TRACE_LOG_xxx() macros, or the TRACE_xxx() ones when
+///    TRACE_BINARY is set to 1, which also filter them by level and channel
+///    (see trace.h).
+/// -# Call TRACELOG_Drain() periodically to print the records on the DBGU,
+///    or dump the memory area and decode it on the host.
+///
+/// \note Arguments are stored as 32-bit integers: floating point values are
+/// not supported, and "%s" arguments must point to strings which are still
+/// valid (e.g. constants) when the record is formatted. The format string
+/// must be a literal.
+/// \note This header is also used by the host tools; it must not depend on
+/// the board.
+//------------------------------------------------------------------------------
+
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Identifies a trace log area ("TLOG").
+#define TRACELOG_MAGIC          0x474F4C54
+
+/// Version of the memory layout.
+#define TRACELOG_VERSION        1
+
+/// Maximum number of arguments of a record.
+#define TRACELOG_MAX_ARGS       4
+
+/// Record flag: no level prefix when formatting (TRACE_xxx_WP macros).
+#define TRACELOG_NOPREFIX       (1 << 16)
+
+/// Sequence number of a record slot which was never written.
+#define TRACELOG_EMPTY          0xFFFFFFFF
+
+//------------------------------------------------------------------------------
+//         Global types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Header at the start of the trace log area, followed by the records.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// TRACELOG_MAGIC.
+    unsigned int magic;
+    /// TRACELOG_VERSION.
+    unsigned int version;
+    /// Size of one record in bytes.
+    unsigned int recordSize;
+    /// Number of records in the ring.
+    unsigned int numRecords;
+    /// Total number of records claimed since initialization; the next record
+    /// goes in slot (writeIndex % numRecords).
+    volatile unsigned int writeIndex;
+    /// Frequency of the timestamps, in Hz.
+    unsigned int frequency;
+    /// Reserved, 0.
+    unsigned int reserved[2];
+
+} TraceLogHeader;
+
+//------------------------------------------------------------------------------
+/// One trace record (32 bytes).
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Index of the record since initialization; written last, so that a
+    /// record is valid only if its sequence matches the slot being read.
+    volatile unsigned int sequence;
+    /// Timestamp when the record was claimed.
+    unsigned int timestamp;
+    /// Address of the format string.
+    unsigned int format;
+    /// Number of arguments (bits 0-7), trace level (bits 8-15) and
+    /// TRACELOG_NOPREFIX.
+    unsigned int info;
+    /// Raw arguments.
+    unsigned int args[TRACELOG_MAX_ARGS];
+
+} TraceLogRecord;
+
+//------------------------------------------------------------------------------
+//         Global macros
+//------------------------------------------------------------------------------
+
+/// \exclude
+/// Selects the TRACELOG_n macro matching the number of arguments.
+#define TRACELOG_SELECT(format, a, b, c, d, name, ...) name
+/// \exclude
+#define TRACELOG_0(info, format) \
+    TRACELOG_Record((info), (format), 0, 0, 0, 0)
+/// \exclude
+#define TRACELOG_1(info, format, a) \
+    TRACELOG_Record((info) | 1, (format), (unsigned int) (a), 0, 0, 0)
+/// \exclude
+#define TRACELOG_2(info, format, a, b) \
+    TRACELOG_Record((info) | 2, (format), (unsigned int) (a), (unsigned int) (b), 0, 0)
+/// \exclude
+#define TRACELOG_3(info, format, a, b, c) \
+    TRACELOG_Record((info) | 3, (format), (unsigned int) (a), (unsigned int) (b), \
+                    (unsigned int) (c), 0)
+/// \exclude
+#define TRACELOG_4(info, format, a, b, c, d) \
+    TRACELOG_Record((info) | 4, (format), (unsigned int) (a), (unsigned int) (b), \
+                    (unsigned int) (c), (unsigned int) (d))
+
+//------------------------------------------------------------------------------
+/// Records a message with up to TRACELOG_MAX_ARGS integer arguments; more
+/// arguments do not compile.
+/// \param level  Trace level (TRACE_LEVEL_xxx).
+/// \param ...  Format string literal followed by the arguments.
+//------------------------------------------------------------------------------
+#define TRACELOG(level, ...) \
+    TRACELOG_SELECT(__VA_ARGS__, TRACELOG_4, TRACELOG_3, TRACELOG_2, \
+                    TRACELOG_1, TRACELOG_0, -)((level) << 8, __VA_ARGS__)
+
+//------------------------------------------------------------------------------
+/// Same as TRACELOG() but formatted without the level prefix.
+//------------------------------------------------------------------------------
+#define TRACELOG_WP(level, ...) \
+    TRACELOG_SELECT(__VA_ARGS__, TRACELOG_4, TRACELOG_3, TRACELOG_2, \
+                    TRACELOG_1, TRACELOG_0, -)(((level) << 8) | TRACELOG_NOPREFIX, \
+                                               __VA_ARGS__)
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void TRACELOG_Initialize(
+    void *pMemory,
+    unsigned int size,
+    unsigned int (*getTimestamp)(void),
+    unsigned int frequency);
+
+extern void TRACELOG_Record(
+    unsigned int info,
+    const char *format,
+    unsigned int a,
+    unsigned int b,
+    unsigned int c,
+    unsigned int d);
+
+extern unsigned int TRACELOG_Drain(unsigned int maxRecords);
+
+extern unsigned int TRACELOG_GetLost(void);
+
+#endif //#ifndef TRACELOG_H
+
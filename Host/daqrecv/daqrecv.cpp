@@ -0,0 +1,1401 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// DAQ PC receiver of the UDP data link (ARM/TWTDCEmbedded/udplink/udplink.h),
+/// made to keep up with the board at line rate. The datagrams are taken in
+/// batches with recvmmsg(), put back in sequence order and the missing ones
+/// asked again as "netsim rx" does; those in order, the common case, are
+/// used straight from the receive buffers. The event records are then
+/// checked (header, CRC, continuity of the event numbers) and the valid ones
+/// written to disk through large aligned buffers with O_DIRECT, by a writer
+/// thread so that a slow disk never stalls the socket.
+///
+/// The spills are rebuilt from the run, spill and event numbers of the
+/// records: a line per spill goes to "<output>.spills" with its events,
+/// records, missing events, bad records and where it starts in the output
+/// file. Throughput, losses (on the link, and in the socket buffer as
+/// reported by SO_RXQ_OVFL) and the CPU time of the receiving thread are
+/// printed every second.
+///
+/// The loopback test runs the firmware UDP link code in a sender thread on a
+/// UDP socket, in place of the IP stack of the board, with generated records
+/// and optional losses, against the receiver, and checks that every record
+/// arrived intact. The sender is not paced, so the printed rate is what the
+/// receiver sustains.
+///
+/// !Usage
+///
+/// -# Build the firmware modules as C, then the receiver:
+///    gcc -O2 -c -I../../ARM/at91lib -I../../ARM/TWTDCEmbedded
+///    ../../ARM/TWTDCEmbedded/udplink/udplink.c
+///    ../../ARM/TWTDCEmbedded/evrec/evrec.c ../../ARM/at91lib/utility/crc32.c
+///    g++ -O2 -Wall -std=c++17 -pthread -I../../ARM/at91lib
+///    -I../../ARM/TWTDCEmbedded -o daqrecv daqrecv.cpp udplink.o evrec.o crc32.o
+/// -# Receive: ./daqrecv rx <output file> [port]
+///    The port defaults to UDPLINK_PORT. Stop with Ctrl-C; the output can be
+///    checked with Host/evdump. On a file system without O_DIRECT, the output
+///    is written through the page cache.
+/// -# Loopback test: ./daqrecv test <output file> [records] [words per record]
+///    [loss in percent]
+///    Exits with 0 if all the records arrived intact.
+//------------------------------------------------------------------------------
+
+extern "C" {
+#include <udplink/udplink.h>
+#include <evrec/evrec.h>
+#include <utility/crc32.h>
+}
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Datagrams taken by one recvmmsg() call, and size of their buffers.
+#define BATCH               64
+#define DATAGRAM_SIZE       2048
+
+/// Socket receive buffer size, in bytes.
+#define SOCKET_BUFFER       (32 * 1024 * 1024)
+
+/// Write buffers: number, size, and alignment required by O_DIRECT.
+#define WRITE_BUFFERS       4
+#define WRITE_BUFFER_SIZE   (8 * 1024 * 1024)
+#define DIRECT_ALIGN        4096
+
+/// Number of datagrams kept until the ones before them arrive; half of them
+/// is given to the board as window, for the partly filled datagrams.
+#define SLOTS               UDPLINK_HISTORY
+
+/// Timings in seconds: control messages at most every CONTROL_PERIOD while
+/// datagrams come and every KEEPALIVE otherwise, a NACK repeated after
+/// NACK_PERIOD, a datagram lost after GIVE_UP, statistics every
+/// REPORT_PERIOD.
+#define CONTROL_PERIOD      0.01
+#define KEEPALIVE           0.5
+#define NACK_PERIOD         0.03
+#define GIVE_UP             2.0
+#define REPORT_PERIOD       1.0
+
+/// Datagrams received since the last control message after which one is
+/// sent at once.
+#define CONTROL_BATCH       32
+
+/// Largest record accepted, in words; larger ones are taken as corrupted.
+#define MAX_RECORD          (1024 * 1024)
+
+/// Records per spill of the loopback test.
+#define TEST_SPILL          100
+
+/// One record out of TEST_REJECT of the loopback test is rejected by the
+/// level-2 filter, whose mode switches between mark and drop every
+/// TEST_MODE_PERIOD records, while the previous ones are still held.
+#define TEST_REJECT         7
+#define TEST_MODE_PERIOD    1000
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Set by SIGINT.
+static volatile sig_atomic_t stop = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Stops the receiver on Ctrl-C.
+//------------------------------------------------------------------------------
+static void OnSignal(int signal)
+{
+    stop = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time in seconds.
+//------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the CPU time used by the calling thread, in seconds.
+//------------------------------------------------------------------------------
+static double ThreadCpu(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+           + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+//------------------------------------------------------------------------------
+/// Reads little-endian words.
+//------------------------------------------------------------------------------
+static unsigned int Word(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned int Half(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+//------------------------------------------------------------------------------
+//         Writer
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Writes a file through WRITE_BUFFERS aligned buffers, filled by the caller
+/// and written by a thread, with O_DIRECT when the file system supports it.
+//------------------------------------------------------------------------------
+class Writer {
+
+public:
+
+    Writer() : fd(-1), direct(false), failed(false), closing(false), pCurrent(0), used(0),
+               offset(0), stalls(0) {}
+
+    //--------------------------------------------------------------------------
+    /// Creates the file and starts the writer thread.
+    /// \return false on error.
+    //--------------------------------------------------------------------------
+    bool Open(const char *pPath)
+    {
+        void *pBuffer;
+        int i;
+
+        fd = open(pPath, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        direct = (fd >= 0);
+        if ((fd < 0) && (errno == EINVAL)) {
+
+            fd = open(pPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd < 0) {
+
+            perror(pPath);
+            return false;
+        }
+        for (i = 0; i < WRITE_BUFFERS; i++) {
+
+            if (posix_memalign(&pBuffer, DIRECT_ALIGN, WRITE_BUFFER_SIZE) != 0) {
+
+                fprintf(stderr, "Out of memory\n");
+                return false;
+            }
+            freeBuffers.push_back((unsigned char *) pBuffer);
+        }
+        pCurrent = freeBuffers.front();
+        freeBuffers.pop_front();
+        thread = std::thread(&Writer::Run, this);
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Appends bytes to the file.
+    //--------------------------------------------------------------------------
+    void Write(const void *pData, size_t size)
+    {
+        size_t chunk;
+
+        while (size != 0) {
+
+            chunk = WRITE_BUFFER_SIZE - used;
+            if (chunk > size) {
+
+                chunk = size;
+            }
+            memcpy(pCurrent + used, pData, chunk);
+            used += chunk;
+            offset += chunk;
+            pData = (const unsigned char *) pData + chunk;
+            size -= chunk;
+            if (used == WRITE_BUFFER_SIZE) {
+
+                Hand();
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    /// Writes what is left, and waits for the writer thread. With O_DIRECT,
+    /// the last buffer is written padded to DIRECT_ALIGN and the file cut
+    /// back to its size.
+    /// \return false if a write failed.
+    //--------------------------------------------------------------------------
+    bool Close(void)
+    {
+        if (fd < 0) {
+
+            return false;
+        }
+        if (used != 0) {
+
+            if (direct) {
+
+                memset(pCurrent + used, 0, (DIRECT_ALIGN - used % DIRECT_ALIGN) % DIRECT_ALIGN);
+                used = (used + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+            }
+            Hand();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        filled.notify_one();
+        thread.join();
+        if (ftruncate(fd, offset) != 0) {
+
+            failed = true;
+        }
+        close(fd);
+        fd = -1;
+        for (unsigned char *pBuffer : freeBuffers) {
+
+            free(pBuffer);
+        }
+        freeBuffers.clear();
+        free(pCurrent);
+        pCurrent = 0;
+        return !failed;
+    }
+
+    /// Returns the number of bytes written so far.
+    unsigned long long GetOffset(void) const { return offset; }
+
+    /// Returns whether the file is written with O_DIRECT.
+    bool IsDirect(void) const { return direct; }
+
+    /// Returns the number of times the caller waited for a free buffer.
+    unsigned long long GetStalls(void) const { return stalls; }
+
+private:
+
+    //--------------------------------------------------------------------------
+    /// Hands the current buffer to the writer thread and takes a free one,
+    /// waiting if there is none.
+    //--------------------------------------------------------------------------
+    void Hand(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        fullBuffers.push_back(Full{pCurrent, used});
+        filled.notify_one();
+        if (freeBuffers.empty()) {
+
+            stalls++;
+            freed.wait(lock, [this] { return !freeBuffers.empty(); });
+        }
+        pCurrent = freeBuffers.front();
+        freeBuffers.pop_front();
+        used = 0;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Writer thread.
+    //--------------------------------------------------------------------------
+    void Run(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Full full;
+        size_t done;
+        ssize_t n;
+
+        while (true) {
+
+            filled.wait(lock, [this] { return closing || !fullBuffers.empty(); });
+            if (fullBuffers.empty()) {
+
+                return;
+            }
+            full = fullBuffers.front();
+            fullBuffers.pop_front();
+            lock.unlock();
+
+            for (done = 0; !failed && (done < full.size); done += n) {
+
+                // With O_DIRECT, the rest of a short write would start at an
+                // unaligned offset and fail
+                n = write(fd, full.pData + done, full.size - done);
+                if (n <= 0) {
+
+                    perror("write");
+                    failed = true;
+                    n = 0;
+                }
+                else if (direct && ((n % DIRECT_ALIGN) != 0)) {
+
+                    fprintf(stderr, "write: short write with O_DIRECT\n");
+                    failed = true;
+                }
+            }
+
+            lock.lock();
+            freeBuffers.push_back(full.pData);
+            freed.notify_one();
+        }
+    }
+
+    /// Buffer waiting to be written.
+    struct Full {
+
+        unsigned char *pData;
+        size_t size;
+    };
+
+    int fd;
+    bool direct;
+    std::atomic<bool> failed;
+    bool closing;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable filled;
+    std::condition_variable freed;
+    std::deque<unsigned char *> freeBuffers;
+    std::deque<Full> fullBuffers;
+    /// Buffer being filled, and bytes in it.
+    unsigned char *pCurrent;
+    size_t used;
+    unsigned long long offset;
+    unsigned long long stalls;
+};
+
+//------------------------------------------------------------------------------
+//         Record checker
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Statistics of a spill.
+//------------------------------------------------------------------------------
+struct Spill {
+
+    unsigned int run;
+    unsigned int spill;
+    unsigned int firstEvent;
+    unsigned int lastEvent;
+    unsigned long long firstTime;
+    unsigned long long lastTime;
+    unsigned int records;
+    unsigned int missing;
+    unsigned int bad;
+    unsigned long long offset;
+    unsigned long long bytes;
+};
+
+//------------------------------------------------------------------------------
+/// Cuts the stream into event records, checks them, writes the valid ones
+/// and follows the spills.
+//------------------------------------------------------------------------------
+class Checker {
+
+public:
+
+    Checker(Writer &writer) : writer(writer), pIndex(0), start(0), end(0), haveLast(false),
+                              inSpill(false), numRecords(0), numBytes(0), numBadCrc(0),
+                              numSkippedWords(0), numMissingEvents(0), numSpills(0)
+    {
+        buffer.resize(2 * MAX_RECORD);
+    }
+
+    //--------------------------------------------------------------------------
+    /// Opens the spill index.
+    //--------------------------------------------------------------------------
+    bool Open(const char *pPath)
+    {
+        pIndex = fopen(pPath, "w");
+        if (pIndex == 0) {
+
+            perror(pPath);
+            return false;
+        }
+        fprintf(pIndex, "# run spill first_event last_event records missing bad offset bytes ms\n");
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Takes stream bytes.
+    //--------------------------------------------------------------------------
+    void Append(const unsigned char *pData, unsigned int size)
+    {
+        unsigned int chunk;
+
+        while (size != 0) {
+
+            // Room at the end of the buffer
+            if ((end + size > buffer.size() * 4) && (start != 0)) {
+
+                memmove(buffer.data(), (unsigned char *) buffer.data() + start, end - start);
+                end -= start;
+                start = 0;
+            }
+            chunk = buffer.size() * 4 - end;
+            if (chunk > size) {
+
+                chunk = size;
+            }
+            memcpy((unsigned char *) buffer.data() + end, pData, chunk);
+            end += chunk;
+            pData += chunk;
+            size -= chunk;
+            Decode();
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    /// Drops the partial record after a loss in the stream.
+    //--------------------------------------------------------------------------
+    void Gap(void)
+    {
+        numSkippedWords += (end - start) / 4;
+        start = 0;
+        end = 0;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Ends the last spill and closes the index.
+    //--------------------------------------------------------------------------
+    void Close(void)
+    {
+        Gap();
+        EndSpill();
+        if (pIndex != 0) {
+
+            fclose(pIndex);
+            pIndex = 0;
+        }
+    }
+
+    Writer &writer;
+    FILE *pIndex;
+    std::vector<unsigned int> buffer;
+    /// Bytes of the buffer not decoded yet.
+    size_t start;
+    size_t end;
+    /// Last record, to check the event numbers.
+    EvRecInfo last;
+    bool haveLast;
+    /// Current spill.
+    Spill current;
+    bool inSpill;
+    /// Statistics.
+    unsigned long long numRecords;
+    unsigned long long numBytes;
+    unsigned long long numBadCrc;
+    unsigned long long numSkippedWords;
+    unsigned long long numMissingEvents;
+    unsigned long long numSpills;
+
+private:
+
+    //--------------------------------------------------------------------------
+    /// Decodes the complete records in the buffer.
+    //--------------------------------------------------------------------------
+    void Decode(void)
+    {
+        const unsigned int *pRecord;
+        unsigned int length;
+        unsigned char status;
+        EvRecInfo info;
+
+        while ((end - start) >= EVREC_HEADER_WORDS * 4) {
+
+            pRecord = buffer.data() + start / 4;
+            status = EVREC_Decode(pRecord, (end - start) / 4, &info, &length);
+            if ((status != EVREC_BAD_HEADER) && (length > MAX_RECORD)) {
+
+                status = EVREC_BAD_HEADER;
+            }
+            if (status == EVREC_INCOMPLETE) {
+
+                return;
+            }
+            if (status == EVREC_BAD_HEADER) {
+
+                numSkippedWords++;
+                start += 4;
+                continue;
+            }
+            start += length * 4;
+            if (status == EVREC_BAD_CRC) {
+
+                fprintf(stderr, "run %u event %u: bad CRC\n", info.run, info.event);
+                numBadCrc++;
+                if (inSpill) {
+
+                    current.bad++;
+                }
+                continue;
+            }
+            OnRecord(pRecord, length, info);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    /// Writes a valid record, and follows the event numbers and the spills.
+    //--------------------------------------------------------------------------
+    void OnRecord(const unsigned int *pRecord, unsigned int length, const EvRecInfo &info)
+    {
+        unsigned int missing = 0;
+
+        if (haveLast && (info.run == last.run) && (info.event != last.event + 1)) {
+
+            if ((int) (info.event - last.event) > 0) {
+
+                missing = info.event - last.event - 1;
+                numMissingEvents += missing;
+            }
+        }
+        if (!inSpill || (info.run != current.run) || (info.spill != current.spill)) {
+
+            EndSpill();
+            memset(&current, 0, sizeof(current));
+            current.run = info.run;
+            current.spill = info.spill;
+            current.firstEvent = info.event;
+            current.firstTime = info.timestamp;
+            current.offset = writer.GetOffset();
+            inSpill = true;
+            missing = 0;
+        }
+        current.lastEvent = info.event;
+        current.lastTime = info.timestamp;
+        current.records++;
+        current.missing += missing;
+        current.bytes += length * 4;
+
+        writer.Write(pRecord, length * 4);
+        numRecords++;
+        numBytes += length * 4;
+        last = info;
+        haveLast = true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Writes the line of the current spill in the index.
+    //--------------------------------------------------------------------------
+    void EndSpill(void)
+    {
+        if (!inSpill) {
+
+            return;
+        }
+        if (pIndex != 0) {
+
+            fprintf(pIndex, "%u %u %u %u %u %u %u %llu %llu %.3f\n", current.run, current.spill,
+                    current.firstEvent, current.lastEvent, current.records, current.missing,
+                    current.bad, current.offset, current.bytes,
+                    (current.lastTime - current.firstTime) / 1000.0);
+        }
+        numSpills++;
+        inSpill = false;
+    }
+};
+
+//------------------------------------------------------------------------------
+//         Stream reassembly
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Puts the datagrams back in sequence order, asks the missing ones again
+/// and acknowledges the board.
+//------------------------------------------------------------------------------
+class Stream {
+
+public:
+
+    Stream(Checker &checker) : checker(checker), numDatagrams(0), numRetransmits(0),
+                               numDuplicates(0), numLost(0), numControls(0), numNacks(0),
+                               numBad(0), slots(SLOTS), expected(0), highest(0), acked(0),
+                               synchronized(false), known(false), received(0), control(0) {}
+
+    //--------------------------------------------------------------------------
+    /// Takes a datagram from the board.
+    //--------------------------------------------------------------------------
+    void Accept(const unsigned char *pDatagram, unsigned int size, const struct sockaddr_in &source)
+    {
+        unsigned int sequence;
+        unsigned int offset;
+        unsigned int flags;
+        Slot *pSlot;
+
+        if ((size < UDPLINK_HEADER_SIZE) || (Word(pDatagram) != UDPLINK_MAGIC)
+            || (Half(pDatagram + 14) > size - UDPLINK_HEADER_SIZE)) {
+
+            numBad++;
+            return;
+        }
+        sequence = Word(pDatagram + 4);
+        offset = Word(pDatagram + 8);
+        flags = Half(pDatagram + 16);
+        board = source;
+        known = true;
+        received++;
+
+        // Join the stream where it is, or the board started a new one
+        if ((numDatagrams == 0)
+            || ((sequence == 0) && (offset == 0) && !(flags & UDPLINK_FLAG_RETRANSMIT))) {
+
+            if (numDatagrams != 0) {
+
+                fprintf(stderr, "Stream restarted\n");
+                checker.Gap();
+            }
+            expected = sequence;
+            highest = sequence;
+            acked = offset;
+            synchronized = false;
+            for (Slot &slot : slots) {
+
+                slot.present = false;
+            }
+        }
+
+        numDatagrams++;
+        if (flags & UDPLINK_FLAG_RETRANSMIT) {
+
+            numRetransmits++;
+        }
+        if ((int) (sequence - expected) < 0) {
+
+            numDuplicates++;
+            return;
+        }
+
+        // Too far ahead: give up the oldest missing datagrams
+        while ((sequence - expected) >= SLOTS) {
+
+            pSlot = &slots[expected % SLOTS];
+            if (expected == highest) {
+
+                pSlot->present = false;
+                highest++;
+            }
+            if (!pSlot->present) {
+
+                pSlot->missing = 0;
+            }
+            Deliver();
+        }
+
+        // In order: used at once, without a copy
+        if ((sequence == expected) && (highest == expected)) {
+
+            Use(pDatagram, flags);
+            highest++;
+            expected++;
+            return;
+        }
+
+        // Missing from the highest so far
+        for (; (int) (highest - sequence) <= 0; highest++) {
+
+            pSlot = &slots[highest % SLOTS];
+            pSlot->present = false;
+            pSlot->missing = Now();
+            pSlot->nacked = 0;
+        }
+        pSlot = &slots[sequence % SLOTS];
+        if (pSlot->present) {
+
+            numDuplicates++;
+            return;
+        }
+        pSlot->present = true;
+        memcpy(pSlot->pDatagram, pDatagram, size);
+        Deliver();
+    }
+
+    //--------------------------------------------------------------------------
+    /// Gives up the datagrams missing for too long, and sends a control
+    /// message when due.
+    /// \param fd  Socket.
+    //--------------------------------------------------------------------------
+    void Service(int fd)
+    {
+        double now = Now();
+
+        Deliver();
+        if (known && ((received >= CONTROL_BATCH)
+                      || (now - control >= ((received != 0) ? CONTROL_PERIOD : KEEPALIVE))
+                      || ((expected != highest) && (now - control >= CONTROL_PERIOD)))) {
+
+            Control(fd, now);
+            control = now;
+            received = 0;
+        }
+    }
+
+    /// Returns true when all the datagrams received so far were used.
+    bool IsComplete(void) const { return expected == highest; }
+
+    Checker &checker;
+    /// Statistics.
+    unsigned long long numDatagrams;
+    unsigned long long numRetransmits;
+    unsigned long long numDuplicates;
+    unsigned long long numLost;
+    unsigned long long numControls;
+    unsigned long long numNacks;
+    unsigned long long numBad;
+
+private:
+
+    /// Datagram waiting for the ones before it; otherwise missing since the
+    /// given time, and last asked again at nacked (0 if never).
+    struct Slot {
+
+        bool present;
+        double missing;
+        double nacked;
+        unsigned char pDatagram[UDPLINK_HEADER_SIZE + UDPLINK_PAYLOAD];
+    };
+
+    //--------------------------------------------------------------------------
+    /// Hands the bytes of the next datagram in sequence to the checker,
+    /// skipping to the next block start after a loss.
+    //--------------------------------------------------------------------------
+    void Use(const unsigned char *pDatagram, unsigned int flags)
+    {
+        unsigned int size = Half(pDatagram + 14);
+        unsigned int first = synchronized ? 0 : Half(pDatagram + 12);
+
+        if (flags & UDPLINK_FLAG_GONE) {
+
+            fprintf(stderr, "Datagram %u no longer on the board\n", expected);
+            Lose();
+            return;
+        }
+        if (first <= size) {
+
+            checker.Append(pDatagram + UDPLINK_HEADER_SIZE + first, size - first);
+            synchronized = true;
+        }
+        acked = Word(pDatagram + 8) + size;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Counts the next datagram in sequence as lost.
+    //--------------------------------------------------------------------------
+    void Lose(void)
+    {
+        numLost++;
+        if (synchronized) {
+
+            checker.Gap();
+        }
+        synchronized = false;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Uses the datagrams which are in sequence, skipping the lost ones.
+    //--------------------------------------------------------------------------
+    void Deliver(void)
+    {
+        Slot *pSlot;
+
+        while (expected != highest) {
+
+            pSlot = &slots[expected % SLOTS];
+            if (pSlot->present) {
+
+                Use(pSlot->pDatagram, Half(pSlot->pDatagram + 16));
+            }
+            else if (Now() - pSlot->missing >= GIVE_UP) {
+
+                fprintf(stderr, "Datagram %u lost\n", expected);
+                Lose();
+            }
+            else {
+
+                return;
+            }
+            pSlot->present = false;
+            expected++;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    /// Sends a control message to the board: acknowledgement, window and
+    /// NACKs of the missing datagrams not asked for NACK_PERIOD.
+    //--------------------------------------------------------------------------
+    void Control(int fd, double now)
+    {
+        unsigned int pMessage[UDPLINK_CONTROL_SIZE / 4 + UDPLINK_MAX_NACKS];
+        unsigned int count = 0;
+        unsigned int sequence;
+        Slot *pSlot;
+
+        for (sequence = expected; (sequence != highest) && (count < UDPLINK_MAX_NACKS); sequence++) {
+
+            pSlot = &slots[sequence % SLOTS];
+            if (!pSlot->present && (now - pSlot->nacked >= NACK_PERIOD)) {
+
+                pSlot->nacked = now;
+                pMessage[UDPLINK_CONTROL_SIZE / 4 + count++] = htole32(sequence);
+            }
+        }
+        pMessage[0] = htole32(UDPLINK_CONTROL_MAGIC);
+        pMessage[1] = htole32(acked);
+        pMessage[2] = htole32(SLOTS / 2 * UDPLINK_PAYLOAD);
+        pMessage[3] = htole32(count);
+        sendto(fd, pMessage, UDPLINK_CONTROL_SIZE + count * 4, 0,
+               (const struct sockaddr *) &board, sizeof(board));
+        numControls++;
+        numNacks += count;
+    }
+
+    std::vector<Slot> slots;
+    /// Datagrams from expected to highest - 1 by sequence number.
+    unsigned int expected;
+    unsigned int highest;
+    /// Stream offset following the last datagram used.
+    unsigned int acked;
+    /// Cleared after a loss, until the next block start.
+    bool synchronized;
+    /// Source of the datagrams, where the control messages go.
+    struct sockaddr_in board;
+    bool known;
+    /// Datagrams since the last control message, and its time.
+    unsigned int received;
+    double control;
+};
+
+//------------------------------------------------------------------------------
+//         Receiver
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Opens the receiving socket.
+/// \param port  UDP port, 0 for any; set to the one bound.
+/// \return The socket, -1 on error.
+//------------------------------------------------------------------------------
+static int OpenSocket(unsigned short *pPort)
+{
+    struct sockaddr_in address;
+    socklen_t size = sizeof(address);
+    struct timeval timeout;
+    int bufferSize = SOCKET_BUFFER;
+    int on = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(*pPort);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0)
+        || (getsockname(fd, (struct sockaddr *) &address, &size) < 0)) {
+
+        perror("socket");
+        return -1;
+    }
+    *pPort = ntohs(address.sin_port);
+
+    // Room for bursts (beyond rmem_max when allowed), datagrams dropped by
+    // the kernel reported with each datagram, and wake up often enough for
+    // the control messages
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufferSize, sizeof(bufferSize)) < 0) {
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+    timeout.tv_sec = 0;
+    timeout.tv_usec = CONTROL_PERIOD * 1000000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+//------------------------------------------------------------------------------
+/// Receives the stream until Ctrl-C, or until done is set and everything
+/// received was used.
+/// \return The number of datagrams dropped by the kernel.
+//------------------------------------------------------------------------------
+static unsigned long long Receive(int fd, Stream &stream, const std::atomic<bool> &done)
+{
+    static unsigned char pBuffers[BATCH][DATAGRAM_SIZE];
+    static unsigned char pControls[BATCH][CMSG_SPACE(sizeof(unsigned int))];
+    struct mmsghdr pMessages[BATCH];
+    struct iovec pVectors[BATCH];
+    struct sockaddr_in pSources[BATCH];
+    struct cmsghdr *pCmsg;
+    Checker &checker = stream.checker;
+    unsigned long long drops = 0;
+    unsigned long long lastBytes = 0;
+    unsigned long long lastDatagrams = 0;
+    double start = Now();
+    double report = start;
+    double cpu = ThreadCpu();
+    double now;
+    int n;
+    int i;
+
+    while (!stop && !(done && stream.IsComplete())) {
+
+        for (i = 0; i < BATCH; i++) {
+
+            pVectors[i].iov_base = pBuffers[i];
+            pVectors[i].iov_len = DATAGRAM_SIZE;
+            memset(&pMessages[i].msg_hdr, 0, sizeof(pMessages[i].msg_hdr));
+            pMessages[i].msg_hdr.msg_iov = &pVectors[i];
+            pMessages[i].msg_hdr.msg_iovlen = 1;
+            pMessages[i].msg_hdr.msg_name = &pSources[i];
+            pMessages[i].msg_hdr.msg_namelen = sizeof(pSources[i]);
+            pMessages[i].msg_hdr.msg_control = pControls[i];
+            pMessages[i].msg_hdr.msg_controllen = sizeof(pControls[i]);
+        }
+
+        // Blocks until one datagram, then takes what is there
+        n = recvmmsg(fd, pMessages, BATCH, MSG_WAITFORONE, 0);
+        if ((n < 0) && (errno != EINTR) && (errno != EAGAIN)) {
+
+            perror("recvmmsg");
+        }
+        for (i = 0; i < n; i++) {
+
+            for (pCmsg = CMSG_FIRSTHDR(&pMessages[i].msg_hdr); pCmsg != 0;
+                 pCmsg = CMSG_NXTHDR(&pMessages[i].msg_hdr, pCmsg)) {
+
+                if ((pCmsg->cmsg_level == SOL_SOCKET) && (pCmsg->cmsg_type == SO_RXQ_OVFL)) {
+
+                    memcpy(&drops, CMSG_DATA(pCmsg), sizeof(unsigned int));
+                }
+            }
+            stream.Accept(pBuffers[i], pMessages[i].msg_len, pSources[i]);
+        }
+        stream.Service(fd);
+
+        // While datagrams come
+        now = Now();
+        if ((now - report >= REPORT_PERIOD) && (stream.numDatagrams != lastDatagrams)) {
+
+            fprintf(stderr, "%.1f MB/s, %.0f datagrams/s, %llu records, %llu spills, %llu lost, "
+                    "%llu sent again, %llu dropped by the socket, CPU %.0f%%\n",
+                    (checker.numBytes - lastBytes) / (now - report) / 1e6,
+                    (stream.numDatagrams - lastDatagrams) / (now - report), checker.numRecords,
+                    checker.numSpills, stream.numLost, stream.numRetransmits, drops,
+                    (ThreadCpu() - cpu) / (now - report) * 100);
+            lastBytes = checker.numBytes;
+            lastDatagrams = stream.numDatagrams;
+        }
+        if (now - report >= REPORT_PERIOD) {
+
+            report = now;
+            cpu = ThreadCpu();
+        }
+    }
+    return drops;
+}
+
+//------------------------------------------------------------------------------
+/// Prints the statistics of a whole run.
+//------------------------------------------------------------------------------
+static void Summarize(const Stream &stream, const Writer &writer, double seconds, double cpu,
+                      unsigned long long drops)
+{
+    const Checker &checker = stream.checker;
+
+    fprintf(stderr, "%llu datagrams, %llu sent again, %llu duplicates, %llu lost, %llu malformed, "
+            "%llu dropped by the socket\n", stream.numDatagrams, stream.numRetransmits,
+            stream.numDuplicates, stream.numLost, stream.numBad, drops);
+    fprintf(stderr, "%llu control messages, %llu NACKs\n", stream.numControls, stream.numNacks);
+    fprintf(stderr, "%llu records in %llu spills, %llu bad CRC, %llu events missing, "
+            "%llu words skipped\n", checker.numRecords, checker.numSpills, checker.numBadCrc,
+            checker.numMissingEvents, checker.numSkippedWords);
+    fprintf(stderr, "%llu bytes in %.2f s (%.1f MB/s), CPU %.0f%%, %s, waited %llu times for the disk\n",
+            checker.numBytes, seconds, seconds ? checker.numBytes / seconds / 1e6 : 0.0,
+            seconds ? cpu / seconds * 100 : 0.0, writer.IsDirect() ? "O_DIRECT" : "page cache",
+            writer.GetStalls());
+}
+
+//------------------------------------------------------------------------------
+//         Loopback sender
+//------------------------------------------------------------------------------
+
+/// Socket of the sender, destination, datagram being built and handler of
+/// the control messages bound by the UDP link.
+static int senderFd = -1;
+static struct sockaddr_in senderDestination;
+static unsigned int pSenderDatagram[NET_UDP_PAYLOAD / 4 + 1];
+static NetHandler senderHandler = 0;
+
+/// Share of the datagrams the sender drops, in percent.
+static unsigned int senderLoss = 0;
+
+/// Record size of the sender in words, and record rebuilt for the
+/// retransmissions.
+static unsigned int senderWords;
+static std::vector<unsigned int> senderRecord;
+
+/// Level-2 filter mode of the sender: set to drop the rejected records.
+static bool senderDrop = false;
+
+/// Flags of the records processed by the sender, decided once as on the
+/// board, and their offsets in the stream.
+static std::vector<unsigned int> senderFlags;
+static std::vector<unsigned int> senderOffsets;
+
+//------------------------------------------------------------------------------
+/// Stand-ins of the IP stack of the board for the UDP link code, on the
+/// sender socket (see net.h).
+//------------------------------------------------------------------------------
+unsigned char * NET_BeginUdp(unsigned int address, unsigned short port, unsigned short sourcePort)
+{
+    memset(&senderDestination, 0, sizeof(senderDestination));
+    senderDestination.sin_family = AF_INET;
+    senderDestination.sin_port = htons(port);
+    senderDestination.sin_addr.s_addr = htonl(address);
+    return (unsigned char *) pSenderDatagram;
+}
+
+void NET_EndUdp(unsigned int size)
+{
+    if ((unsigned int) (rand() % 100) >= senderLoss) {
+
+        sendto(senderFd, pSenderDatagram, size, 0, (const struct sockaddr *) &senderDestination,
+               sizeof(senderDestination));
+    }
+}
+
+unsigned char NET_Bind(unsigned short port, NetHandler handler)
+{
+    senderHandler = handler;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Builds a record of the sender, with a payload depending on its number.
+//------------------------------------------------------------------------------
+static void BuildRecord(unsigned int *pRecord, unsigned int record, unsigned int flags)
+{
+    unsigned int *pPayload = EVREC_GetPayload(pRecord);
+    EvRecInfo info;
+    unsigned int i;
+
+    memset(&info, 0, sizeof(info));
+    info.boardId = 0xFF;
+    info.run = 1;
+    info.spill = record / TEST_SPILL;
+    info.event = record;
+    info.timestamp = (unsigned long long) record * 100;
+    info.flags = flags;
+    info.size = senderWords;
+    for (i = 0; i < senderWords; i++) {
+
+        pPayload[i] = record * senderWords + i;
+    }
+    EVREC_Encode(pRecord, &info);
+    EVREC_Seal(pRecord);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of bytes of a record in the stream, from its own flags
+/// only: none for the records dropped by the level-2 filter.
+//------------------------------------------------------------------------------
+static unsigned int StreamLength(unsigned int flags)
+{
+    return (flags & EVREC_FLAGS_DROPPED) ? 0 : (EVREC_HEADER_WORDS + senderWords) * 4;
+}
+
+//------------------------------------------------------------------------------
+/// Processes the next record of the sender as the processing task of the
+/// board does: runs the level-2 filter on it with the current mode, switching
+/// the mode every TEST_MODE_PERIOD records.
+/// \return Number of bytes of the record in the stream.
+//------------------------------------------------------------------------------
+static unsigned int ProcessRecord(unsigned int *pRecord)
+{
+    unsigned int record = senderFlags.size();
+    unsigned int flags = EVREC_FLAGS_RAW;
+
+    if ((record % TEST_MODE_PERIOD) == 0) {
+
+        senderDrop = !senderDrop;
+    }
+    if ((record % TEST_REJECT) == TEST_REJECT - 1) {
+
+        flags |= EVREC_FLAGS_REJECTED | (senderDrop ? EVREC_FLAGS_DROPPED : 0);
+    }
+    senderOffsets.push_back(senderFlags.empty() ? 0 : senderOffsets.back() + StreamLength(senderFlags.back()));
+    senderFlags.push_back(flags);
+    BuildRecord(pRecord, record, flags);
+
+    return StreamLength(flags);
+}
+
+//------------------------------------------------------------------------------
+/// Copies stream bytes of the sender for a retransmission (see
+/// UdpLinkFetch), building the records again with their flags, whatever the
+/// current mode.
+//------------------------------------------------------------------------------
+static unsigned char FetchRecords(unsigned int offset, unsigned char *pData, unsigned int size)
+{
+    unsigned int record;
+    unsigned int recordSize;
+    unsigned int position;
+    unsigned int chunk;
+
+    // Last record starting at or before the offset, which is not a dropped one
+    record = std::upper_bound(senderOffsets.begin(), senderOffsets.end(), offset)
+             - senderOffsets.begin() - 1;
+    while (size != 0) {
+
+        recordSize = StreamLength(senderFlags[record]);
+        BuildRecord(senderRecord.data(), record, senderFlags[record]);
+        position = offset - senderOffsets[record];
+        record++;
+        chunk = recordSize - position;
+        if (chunk > size) {
+
+            chunk = size;
+        }
+        memcpy(pData, (unsigned char *) senderRecord.data() + position, chunk);
+        pData += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Passes the control messages of the receiver to the UDP link, waiting up
+/// to the given time for the first one.
+//------------------------------------------------------------------------------
+static void PollControls(int timeout)
+{
+    unsigned char pMessage[DATAGRAM_SIZE];
+    struct sockaddr_in source;
+    socklen_t size = sizeof(source);
+    struct pollfd pfd = {senderFd, POLLIN, 0};
+    ssize_t n;
+
+    if ((timeout != 0) && (poll(&pfd, 1, timeout) <= 0)) {
+
+        return;
+    }
+    while ((n = recvfrom(senderFd, pMessage, sizeof(pMessage), MSG_DONTWAIT,
+                         (struct sockaddr *) &source, &size)) > 0) {
+
+        senderHandler(ntohl(source.sin_addr.s_addr), ntohs(source.sin_port), pMessage, n);
+        size = sizeof(source);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sender thread of the loopback test: streams the records with the
+/// firmware UDP link code, serves the retransmissions and sets done once the
+/// receiver has acknowledged everything, or after GIVE_UP seconds more.
+//------------------------------------------------------------------------------
+static void Send(unsigned short port, unsigned int numRecords, std::atomic<bool> *pDone)
+{
+    std::vector<unsigned int> record(EVREC_HEADER_WORDS + senderWords);
+    unsigned int length = 0;
+    unsigned int sent = 0;
+    double tick = Now();
+    double end = 0;
+    double start;
+
+    senderFd = socket(AF_INET, SOCK_DGRAM, 0);
+    senderRecord.resize(record.size());
+    UDPLINK_Initialize(FetchRecords);
+    UDPLINK_Configure(NET_ADDRESS(127, 0, 0, 1), port);
+
+    // The receiver runs before the board streams: wait for it to speak
+    start = Now();
+    length = ProcessRecord(record.data());
+    UDPLINK_Send(record.data(), length);
+    UDPLINK_Flush();
+    sent = 1;
+    while (!UDPLINK_IsReliable() && (Now() - start < 1)) {
+
+        PollControls(10);
+    }
+
+    while (!stop) {
+
+        PollControls(0);
+        if (Now() - tick >= 1) {
+
+            tick = Now();
+            UDPLINK_Tick();
+        }
+
+        // Retransmissions first, then new records within the window
+        if (!UDPLINK_Service()) {
+
+            PollControls(1);
+            continue;
+        }
+        // The dropped records are not sent; a record is processed once, even
+        // if the window is full
+        if (sent < numRecords) {
+
+            if (senderFlags.size() == sent) {
+
+                length = ProcessRecord(record.data());
+            }
+            if ((length == 0) || UDPLINK_Send(record.data(), length)) {
+
+                sent++;
+            }
+            else {
+
+                PollControls(1);
+            }
+            continue;
+        }
+
+        UDPLINK_Flush();
+        if (end == 0) {
+
+            end = Now();
+        }
+        if ((UDPLINK_GetAcked() == senderOffsets.back() + length) || (Now() - end >= GIVE_UP)) {
+
+            break;
+        }
+        PollControls(10);
+    }
+
+    const UdpLinkStats *pStats = UDPLINK_GetStats();
+    fprintf(stderr, "Sender: %u datagrams, %u sent again, %u control messages, %u NACKs, "
+            "%u missed, window full %u times\n", pStats->datagrams, pStats->retransmits,
+            pStats->controls, pStats->nacks, pStats->misses, pStats->windowFull);
+    *pDone = true;
+    close(senderFd);
+}
+
+//------------------------------------------------------------------------------
+/// Receives into the output file and its spill index.
+/// \param port  UDP port, 0 for any.
+/// \param numRecords  Records of the loopback test, 0 to receive from the
+///                    board until Ctrl-C.
+//------------------------------------------------------------------------------
+static int Run(const char *pOutput, unsigned short port, unsigned int numRecords)
+{
+    static Writer writer;
+    static Checker checker(writer);
+    static Stream stream(checker);
+    std::atomic<bool> done(false);
+    std::thread sender;
+    std::string index = std::string(pOutput) + ".spills";
+    unsigned long long drops;
+    unsigned int recordSize = (EVREC_HEADER_WORDS + senderWords) * 4;
+    unsigned int kept = 0;
+    unsigned int dropped = 0;
+    unsigned int missing = 0;
+    unsigned int i;
+    double start;
+    double cpu;
+    bool written;
+    int fd;
+
+    fd = OpenSocket(&port);
+    if ((fd < 0) || !writer.Open(pOutput) || !checker.Open(index.c_str())) {
+
+        return 1;
+    }
+    if (numRecords != 0) {
+
+        sender = std::thread(Send, port, numRecords, &done);
+    }
+    else {
+
+        fprintf(stderr, "Listening on UDP port %u\n", port);
+    }
+
+    start = Now();
+    cpu = ThreadCpu();
+    drops = Receive(fd, stream, done);
+    cpu = ThreadCpu() - cpu;
+    checker.Close();
+    written = writer.Close();
+    Summarize(stream, writer, Now() - start, cpu, drops);
+    close(fd);
+    if (numRecords == 0) {
+
+        return written ? 0 : 1;
+    }
+
+    // The records dropped by the level-2 filter show as missing events, but
+    // after the last one sent
+    sender.join();
+    for (i = 0; i < senderFlags.size(); i++) {
+
+        if (senderFlags[i] & EVREC_FLAGS_DROPPED) {
+
+            dropped++;
+        }
+        else {
+
+            kept++;
+            missing = dropped;
+        }
+    }
+    fprintf(stderr, "%u records dropped by the level-2 filter\n", dropped);
+    if (!written || (kept + dropped != numRecords) || (checker.numRecords != kept)
+        || (checker.numBadCrc != 0) || (checker.numMissingEvents != missing)
+        || (checker.numSkippedWords != 0)
+        || (checker.numSpills != (numRecords + TEST_SPILL - 1) / TEST_SPILL)
+        || (writer.GetOffset() != (unsigned long long) kept * recordSize)) {
+
+        fprintf(stderr, "Loopback test failed\n");
+        return 1;
+    }
+    fprintf(stderr, "Loopback test passed\n");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    signal(SIGINT, OnSignal);
+    CRC32_Initialize();
+
+    if ((argc >= 3) && (argc <= 4) && (strcmp(argv[1], "rx") == 0)) {
+
+        return Run(argv[2], (argc > 3) ? atoi(argv[3]) : UDPLINK_PORT, 0);
+    }
+    if ((argc >= 3) && (argc <= 6) && (strcmp(argv[1], "test") == 0)) {
+
+        senderWords = (argc > 4) ? atoi(argv[4]) : 256;
+        senderLoss = (argc > 5) ? atoi(argv[5]) : 0;
+        return Run(argv[2], 0, (argc > 3) ? atoi(argv[3]) : 100000);
+    }
+
+    fprintf(stderr, "Usage: %s rx <output file> [port]\n"
+                    "       %s test <output file> [records] [words per record] [loss in percent]\n",
+            argv[0], argv[0]);
+    return 1;
+}
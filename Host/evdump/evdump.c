@@ -0,0 +1,412 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Decodes a stream of event records (ARM/TWTDCEmbedded/evrec/evrec.h), as
+/// stored by "serlink rx", "usbrecv" or "sdlog extract": checks the header and
+/// CRC of each record, the continuity of the event numbers, decompresses the
+/// compressed payloads (see ARM/TWTDCEmbedded/codec/codec.h), and prints a
+/// summary per run and spill. Also writes test streams with the firmware
+/// encoder.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -I../../ARM/at91lib -I../../ARM/TWTDCEmbedded -o evdump
+///    evdump.c ../../ARM/TWTDCEmbedded/evrec/evrec.c
+///    ../../ARM/TWTDCEmbedded/codec/codec.c ../../ARM/at91lib/utility/crc32.c
+/// -# Decode: ./evdump [-v] [-o <output>] <file|->
+///    With -v, prints the header of every record. With -o, writes the valid
+///    records to the output file, with their payloads decompressed. The
+///    stream may start or be interrupted in the middle of a record: the
+///    decoder then looks for the next valid header and counts the skipped
+///    words.
+/// -# Test stream: ./evdump gen <file> [records] [words per record] [codec]
+///    Without codec, the payloads are random words; with a codec (see
+///    codec.h), they are sorted TDC hits, compressed.
+//------------------------------------------------------------------------------
+
+#include <evrec/evrec.h>
+#include <codec/codec.h>
+#include <tdc/tdc.h>
+#include <utility/crc32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Largest record accepted, in words; larger ones are taken as corrupted.
+#define MAX_RECORD      (4 * 1024 * 1024)
+
+/// Size of the read buffer in words.
+#define BUFFER_WORDS    (2 * MAX_RECORD)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Statistics of the stream.
+static unsigned long long numRecords = 0;
+static unsigned long long numPayloadWords = 0;
+static unsigned long long numStoredWords = 0;
+static unsigned long long numBadCrc = 0;
+static unsigned long long numBadPayloads = 0;
+static unsigned long long numSkippedWords = 0;
+static unsigned long long numMissingEvents = 0;
+
+/// Last record decoded, to check the event numbers and print the summaries.
+static EvRecInfo last;
+static unsigned int haveLast = 0;
+
+/// Records of the current spill, and time of its first record.
+static unsigned int spillRecords = 0;
+static unsigned long long spillStart = 0;
+
+/// Output of the decompressed records, and record being written.
+static FILE *pOutput = NULL;
+static unsigned int *pOutputRecord;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Prints the summary of the current spill, if any.
+//------------------------------------------------------------------------------
+static void EndSpill(void)
+{
+    if (spillRecords != 0) {
+
+        printf("board %u run %u spill %u: %u records, %.3f ms\n",
+               last.boardId, last.run, last.spill, spillRecords,
+               (last.timestamp - spillStart) / 1000.0);
+        spillRecords = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Decompresses the payload of a valid record if needed, and writes the
+/// record to the output.
+/// \return 0 if the compressed payload is corrupted.
+//------------------------------------------------------------------------------
+static int Expand(const unsigned int *pRecord, EvRecInfo *pInfo)
+{
+    unsigned int codec = EVREC_GET_CODEC(pInfo->flags);
+    unsigned int size;
+
+    numStoredWords += pInfo->size;
+    if (codec != CODEC_NONE) {
+
+        if (!CODEC_Decode(codec, pRecord + EVREC_HEADER_WORDS, pInfo->size,
+                          EVREC_GetPayload(pOutputRecord), MAX_RECORD, &size)) {
+
+            fprintf(stderr, "run %u event %u: bad %s payload\n", pInfo->run, pInfo->event,
+                    CODEC_GetName(codec) ? CODEC_GetName(codec) : "unknown codec");
+            numBadPayloads++;
+            return 0;
+        }
+        pInfo->size = size;
+        pInfo->flags &= ~EVREC_FLAGS_CODEC_MASK;
+    }
+    else if (pOutput != NULL) {
+
+        memcpy(EVREC_GetPayload(pOutputRecord), pRecord + EVREC_HEADER_WORDS, pInfo->size * 4);
+    }
+
+    if (pOutput != NULL) {
+
+        EVREC_Encode(pOutputRecord, pInfo);
+        EVREC_Seal(pOutputRecord);
+        if (fwrite(pOutputRecord, 4, EVREC_HEADER_WORDS + pInfo->size, pOutput)
+            != EVREC_HEADER_WORDS + pInfo->size) {
+
+            perror("output");
+            exit(1);
+        }
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Accounts for a valid record.
+//------------------------------------------------------------------------------
+static void OnRecord(const EvRecInfo *pInfo, int verbose)
+{
+    if (verbose) {
+
+        printf("board %u run %u spill %u event %u: %llu us, flags %X, %u words\n",
+               pInfo->boardId, pInfo->run, pInfo->spill, pInfo->event,
+               pInfo->timestamp, pInfo->flags, pInfo->size);
+    }
+
+    if (haveLast && (pInfo->boardId == last.boardId) && (pInfo->run == last.run)) {
+
+        if (pInfo->event != last.event + 1) {
+
+            fprintf(stderr, "run %u: event %u follows event %u\n",
+                    pInfo->run, pInfo->event, last.event);
+            if (pInfo->event > last.event) {
+
+                numMissingEvents += pInfo->event - last.event - 1;
+            }
+        }
+        if (pInfo->spill != last.spill) {
+
+            EndSpill();
+        }
+    }
+    else {
+
+        EndSpill();
+    }
+
+    if (spillRecords == 0) {
+
+        spillStart = pInfo->timestamp;
+    }
+    spillRecords++;
+    last = *pInfo;
+    haveLast = 1;
+    numRecords++;
+    numPayloadWords += pInfo->size;
+}
+
+//------------------------------------------------------------------------------
+/// Decodes a stream.
+//------------------------------------------------------------------------------
+static int Decode(const char *pPath, int verbose)
+{
+    FILE *pFile = stdin;
+    unsigned int *pBuffer;
+    unsigned int start = 0;
+    unsigned int end = 0;
+    unsigned int length;
+    unsigned char status;
+    size_t n;
+    int eof = 0;
+    EvRecInfo info;
+
+    if (strcmp(pPath, "-") != 0) {
+
+        pFile = fopen(pPath, "rb");
+        if (pFile == NULL) {
+
+            perror(pPath);
+            return 1;
+        }
+    }
+    pBuffer = malloc(BUFFER_WORDS * 4);
+    if (pBuffer == NULL) {
+
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    while ((start != end) || !eof) {
+
+        // Refill the buffer
+        if (!eof && ((end - start) < MAX_RECORD)) {
+
+            memmove(pBuffer, pBuffer + start, (end - start) * 4);
+            end -= start;
+            start = 0;
+            n = fread(pBuffer + end, 4, BUFFER_WORDS - end, pFile);
+            end += n;
+            if (n == 0) {
+
+                eof = 1;
+            }
+            continue;
+        }
+
+        status = EVREC_Decode(pBuffer + start, end - start, &info, &length);
+        if ((status != EVREC_BAD_HEADER) && (length > MAX_RECORD)) {
+
+            status = EVREC_BAD_HEADER;
+        }
+        if (status == EVREC_INCOMPLETE) {
+
+            // Truncated record at the end of the stream
+            numSkippedWords += end - start;
+            break;
+        }
+        else if (status == EVREC_BAD_HEADER) {
+
+            // Look for the next header
+            numSkippedWords++;
+            start++;
+        }
+        else if (status == EVREC_BAD_CRC) {
+
+            fprintf(stderr, "run %u event %u: bad CRC\n", info.run, info.event);
+            numBadCrc++;
+            start += length;
+        }
+        else {
+
+            if (Expand(pBuffer + start, &info)) {
+
+                OnRecord(&info, verbose);
+            }
+            start += length;
+        }
+    }
+    EndSpill();
+
+    printf("%llu records, %llu payload words (%llu stored), %llu bad CRC, %llu bad payloads, "
+           "%llu events missing, %llu words skipped\n",
+           numRecords, numPayloadWords, numStoredWords, numBadCrc, numBadPayloads,
+           numMissingEvents, numSkippedWords);
+
+    free(pBuffer);
+    if (pFile != stdin) {
+
+        fclose(pFile);
+    }
+    return ((numBadCrc != 0) || (numBadPayloads != 0) || (numSkippedWords != 0)) ? 2 : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Orders hit words by channel, then time, as the firmware sorts them.
+//------------------------------------------------------------------------------
+static int CompareHits(const void *pA, const void *pB)
+{
+    unsigned int a = *(const unsigned int *) pA;
+    unsigned int b = *(const unsigned int *) pB;
+    unsigned int keyA = (TDC_GET_CHANNEL(a) << TDC_TIME_BITS) | TDC_GET_TIME(a);
+    unsigned int keyB = (TDC_GET_CHANNEL(b) << TDC_TIME_BITS) | TDC_GET_TIME(b);
+
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+//------------------------------------------------------------------------------
+/// Writes a test stream: one run, ten records per spill, random payloads, or
+/// compressed sorted hits when a codec is given.
+//------------------------------------------------------------------------------
+static int Generate(const char *pPath, unsigned int records, unsigned int words, unsigned int codec)
+{
+    FILE *pFile;
+    unsigned int *pRecord;
+    unsigned int *pPayload;
+    unsigned int *pHits;
+    EvRecInfo info;
+    unsigned int size;
+    unsigned int i;
+    unsigned int j;
+
+    pFile = fopen(pPath, "wb");
+    pRecord = malloc((EVREC_HEADER_WORDS + words) * 4);
+    pHits = malloc(words * 4 + 4);
+    if ((pFile == NULL) || (pRecord == NULL) || (pHits == NULL) || (CODEC_GetName(codec) == NULL)) {
+
+        perror(pPath);
+        return 1;
+    }
+
+    pPayload = EVREC_GetPayload(pRecord);
+    info.boardId = 1;
+    info.run = 1;
+    for (i = 0; i < records; i++) {
+
+        info.spill = i / 10;
+        info.event = i;
+        info.timestamp = (unsigned long long) i * 100000;
+        info.flags = EVREC_FLAGS_RAW;
+        info.size = words;
+        if (codec == CODEC_NONE) {
+
+            for (j = 0; j < words; j++) {
+
+                pPayload[j] = (unsigned int) rand();
+            }
+        }
+        else {
+
+            for (j = 0; j < words; j++) {
+
+                pHits[j] = ((rand() % TDC_NUM_CHANNELS) << TDC_CHANNEL_SHIFT) | (1000 + rand() % 2000);
+            }
+            qsort(pHits, words, 4, CompareHits);
+            size = CODEC_Encode(codec, pHits, words, pPayload, words);
+            if (size == 0) {
+
+                memcpy(pPayload, pHits, words * 4);
+            }
+            else {
+
+                info.flags = codec << EVREC_FLAGS_CODEC_SHIFT;
+                info.size = size;
+            }
+        }
+        EVREC_Encode(pRecord, &info);
+        EVREC_Seal(pRecord);
+        if (fwrite(pRecord, 4, EVREC_HEADER_WORDS + info.size, pFile)
+            != EVREC_HEADER_WORDS + info.size) {
+
+            perror(pPath);
+            return 1;
+        }
+    }
+
+    free(pHits);
+    free(pRecord);
+    fclose(pFile);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int verbose = 0;
+    int i = 1;
+    int status;
+
+    CRC32_Initialize();
+    if ((argc >= 3) && (argc <= 6) && (strcmp(argv[1], "gen") == 0)) {
+
+        return Generate(argv[2], (argc > 3) ? atoi(argv[3]) : 100,
+                        (argc > 4) ? atoi(argv[4]) : 1024, (argc > 5) ? atoi(argv[5]) : CODEC_NONE);
+    }
+
+    for (; (i < argc - 1) && (argv[i][0] == '-') && (argv[i][1] != 0); i++) {
+
+        if (strcmp(argv[i], "-v") == 0) {
+
+            verbose = 1;
+        }
+        else if ((strcmp(argv[i], "-o") == 0) && (i < argc - 2) && (pOutput == NULL)) {
+
+            pOutput = fopen(argv[++i], "wb");
+            if (pOutput == NULL) {
+
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else {
+
+            break;
+        }
+    }
+    pOutputRecord = malloc((EVREC_HEADER_WORDS + MAX_RECORD) * 4);
+    if ((i == argc - 1) && (pOutputRecord != NULL)) {
+
+        status = Decode(argv[i], verbose);
+        if (pOutput != NULL) {
+
+            fclose(pOutput);
+        }
+        return status;
+    }
+
+    fprintf(stderr, "Usage: %s [-v] [-o <output>] <file|->\n"
+                    "       %s gen <file> [records] [words per record] [codec]\n",
+            argv[0], argv[0]);
+    return 1;
+}
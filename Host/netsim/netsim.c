@@ -0,0 +1,671 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Host side of the UDP data link (ARM/TWTDCEmbedded/udplink/udplink.h).
+/// Receives the datagrams, puts them back in sequence order and stores the
+/// stream in a file. Missing datagrams are asked again with control messages
+/// to the board, which also carry the acknowledgement and the window; a
+/// datagram still missing after RX_GIVE_UP seconds, or whose bytes the board
+/// no longer has, is lost and the stream resynchronizes on the next block
+/// start. Also provides a stand-in for the board on a Linux TAP interface,
+/// running the firmware IP stack (ARM/TWTDCEmbedded/net/net.h) and UDP link
+/// code: it answers ARP and ping and streams generated event records, to
+/// test the receiver, the network setup and the DAQ scripts without hardware.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -I../../ARM/at91lib -I../../ARM/TWTDCEmbedded -o netsim
+///    netsim.c ../../ARM/TWTDCEmbedded/net/net.c
+///    ../../ARM/TWTDCEmbedded/udplink/udplink.c
+///    ../../ARM/TWTDCEmbedded/evrec/evrec.c ../../ARM/at91lib/utility/crc32.c
+/// -# Receive: ./netsim rx [port] [output file]
+///    The port defaults to UDPLINK_PORT. Stop with Ctrl-C; the output can be
+///    checked with Host/evdump.
+/// -# Stand-in: ./netsim sim <tap> <board address> <destination address>
+///    [records] [words per record] [loss in percent]
+///    Needs CAP_NET_ADMIN to create the TAP interface; give the interface an
+///    address on the same subnet (ip addr add 192.168.7.1/24 dev tap0; ip
+///    link set tap0 up), then ping the board address or receive the records
+///    with "netsim rx". The loss drops that share of the sent datagrams, to
+///    exercise the retransmissions. Keeps answering ping and the receiver
+///    after the records until Ctrl-C.
+//------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <net/net.h>
+#include <udplink/udplink.h>
+#include <evrec/evrec.h>
+#include <utility/crc32.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Number of frames in the transmit queue of the stand-in.
+#define TX_FRAMES       16
+
+/// Socket receive buffer size of the receiver, in bytes.
+#define RX_BUFFER_SIZE  (8 * 1024 * 1024)
+
+/// Number of datagrams the receiver keeps until the ones before them arrive.
+/// Half of them is given to the board as window, for the partly filled
+/// datagrams.
+#define RX_SLOTS        UDPLINK_HISTORY
+
+/// Receiver timings in seconds: control messages at most every
+/// RX_CONTROL_PERIOD while datagrams come and every RX_KEEPALIVE otherwise,
+/// a NACK repeated after RX_NACK_PERIOD, a datagram lost after RX_GIVE_UP.
+#define RX_CONTROL_PERIOD   0.01
+#define RX_KEEPALIVE        0.5
+#define RX_NACK_PERIOD      0.1
+#define RX_GIVE_UP          2.0
+
+/// Datagrams received since the last control message after which the
+/// receiver sends one at once.
+#define RX_CONTROL_BATCH    32
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// Datagram waiting in the receiver.
+typedef struct {
+
+    /// Set once received; otherwise missing since the given time, and last
+    /// asked again at nacked (0 if never).
+    int present;
+    double missing;
+    double nacked;
+    unsigned int offset;
+    unsigned int first;
+    unsigned int size;
+    unsigned int flags;
+    unsigned char pData[UDPLINK_PAYLOAD];
+
+} Slot;
+
+/// State of the receiver.
+typedef struct {
+
+    /// Datagrams from expected to highest - 1 by sequence number.
+    Slot pSlots[RX_SLOTS];
+    unsigned int expected;
+    unsigned int highest;
+    /// Stream offset following the last datagram written.
+    unsigned int acked;
+    /// Clear after a loss, until the next block start.
+    int synchronized;
+    FILE *pFile;
+    /// Statistics.
+    unsigned long long numBytes;
+    unsigned long long numDatagrams;
+    unsigned long long numRetransmits;
+    unsigned long long numDuplicates;
+    unsigned long long numLost;
+    unsigned long long numControls;
+    unsigned long long numNacks;
+
+} Receiver;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Set by SIGINT.
+static volatile sig_atomic_t stop = 0;
+
+/// TAP interface of the stand-in.
+static int tapFd = -1;
+
+/// Transmit frames of the stand-in, 2 bytes past a word boundary as on the
+/// board.
+static unsigned int pTxFrames[TX_FRAMES][(NET_FRAME_SIZE + 2 + 3) / 4];
+static unsigned int txNext = 0;
+
+/// Share of the UDP frames the stand-in drops, in percent.
+static unsigned int txLoss = 0;
+
+/// Record size of the stand-in in words, and record rebuilt for the
+/// retransmissions.
+static unsigned int simWords;
+static unsigned int *pSimRecord;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Stops the receiver or the stand-in on Ctrl-C.
+//------------------------------------------------------------------------------
+static void OnSignal(int signal)
+{
+    stop = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time in seconds.
+//------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//------------------------------------------------------------------------------
+/// Reads a little-endian 32-bit word.
+//------------------------------------------------------------------------------
+static unsigned int Word(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+//------------------------------------------------------------------------------
+/// Stand-in driver: the frames are written at once, so a buffer is always
+/// free.
+//------------------------------------------------------------------------------
+static unsigned char * TapAllocate(void)
+{
+    txNext = (txNext + 1) % TX_FRAMES;
+    return (unsigned char *) pTxFrames[txNext] + 2;
+}
+
+static void TapTransmit(unsigned char *pFrame, unsigned int size)
+{
+    // Lose some of the IPv4 UDP frames
+    if ((txLoss != 0) && (size > 23) && (pFrame[12] == 0x08) && (pFrame[13] == 0x00)
+        && (pFrame[23] == 17) && ((unsigned int) (rand() % 100) < txLoss)) {
+
+        return;
+    }
+    if (write(tapFd, pFrame, size) != (ssize_t) size) {
+
+        perror("tap write");
+    }
+}
+
+static unsigned int TapReceive(unsigned char *pFrame, unsigned int size)
+{
+    ssize_t n = read(tapFd, pFrame, size);
+
+    return (n > 0) ? n : 0;
+}
+
+static const NetDriver tapDriver = {TapAllocate, TapTransmit, TapReceive};
+
+//------------------------------------------------------------------------------
+/// Opens a TAP interface, non-blocking.
+//------------------------------------------------------------------------------
+static int OpenTap(const char *pName)
+{
+    struct ifreq ifr;
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+
+    if (fd < 0) {
+
+        perror("/dev/net/tun");
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, pName, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+
+        perror(pName);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//------------------------------------------------------------------------------
+/// Parses an IP address in dotted decimal notation.
+//------------------------------------------------------------------------------
+static int ParseAddress(const char *pString, unsigned int *pAddress)
+{
+    struct in_addr address;
+
+    if (inet_aton(pString, &address) == 0) {
+
+        fprintf(stderr, "%s: bad address\n", pString);
+        return 0;
+    }
+    *pAddress = ntohl(address.s_addr);
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Writes the datagrams of the receiver which are in sequence, skipping the
+/// lost ones.
+//------------------------------------------------------------------------------
+static void Deliver(Receiver *pReceiver)
+{
+    Slot *pSlot;
+    unsigned int first;
+
+    while (pReceiver->expected != pReceiver->highest) {
+
+        pSlot = &pReceiver->pSlots[pReceiver->expected % RX_SLOTS];
+        if (!pSlot->present) {
+
+            if (Now() - pSlot->missing < RX_GIVE_UP) {
+
+                return;
+            }
+            fprintf(stderr, "Datagram %u lost\n", pReceiver->expected);
+            pReceiver->numLost++;
+            pReceiver->synchronized = 0;
+        }
+        else if (pSlot->flags & UDPLINK_FLAG_GONE) {
+
+            fprintf(stderr, "Datagram %u no longer on the board\n", pReceiver->expected);
+            pReceiver->numLost++;
+            pReceiver->synchronized = 0;
+        }
+        else {
+
+            // After a loss, skip to the next block start
+            first = pReceiver->synchronized ? 0 : pSlot->first;
+            if (first <= pSlot->size) {
+
+                fwrite(pSlot->pData + first, 1, pSlot->size - first, pReceiver->pFile);
+                pReceiver->numBytes += pSlot->size - first;
+                pReceiver->synchronized = 1;
+            }
+            pReceiver->acked = pSlot->offset + pSlot->size;
+        }
+        pSlot->present = 0;
+        pReceiver->expected++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Takes a datagram in the receiver.
+/// \return 0 if malformed.
+//------------------------------------------------------------------------------
+static int Accept(Receiver *pReceiver, const unsigned char *pDatagram, unsigned int size)
+{
+    unsigned int sequence;
+    unsigned int flags;
+    unsigned int offset;
+    Slot *pSlot;
+
+    if ((size < UDPLINK_HEADER_SIZE) || (Word(pDatagram) != UDPLINK_MAGIC)
+        || ((pDatagram[14] | (pDatagram[15] << 8)) > size - UDPLINK_HEADER_SIZE)) {
+
+        fprintf(stderr, "Bad datagram of %u bytes\n", size);
+        return 0;
+    }
+    sequence = Word(pDatagram + 4);
+    offset = Word(pDatagram + 8);
+    flags = pDatagram[16] | (pDatagram[17] << 8);
+
+    // Join the stream where it is, or the board started a new one
+    if ((pReceiver->numDatagrams == 0)
+        || ((sequence == 0) && (offset == 0) && !(flags & UDPLINK_FLAG_RETRANSMIT))) {
+
+        if (pReceiver->numDatagrams != 0) {
+
+            fprintf(stderr, "Stream restarted\n");
+        }
+        pReceiver->expected = sequence;
+        pReceiver->highest = sequence;
+        pReceiver->acked = offset;
+        pReceiver->synchronized = 0;
+        memset(pReceiver->pSlots, 0, sizeof(pReceiver->pSlots));
+    }
+
+    pReceiver->numDatagrams++;
+    if (flags & UDPLINK_FLAG_RETRANSMIT) {
+
+        pReceiver->numRetransmits++;
+    }
+    if ((int) (sequence - pReceiver->expected) < 0) {
+
+        pReceiver->numDuplicates++;
+        return 1;
+    }
+
+    // Too far ahead: give up the oldest missing datagrams
+    while ((sequence - pReceiver->expected) >= RX_SLOTS) {
+
+        pSlot = &pReceiver->pSlots[pReceiver->expected % RX_SLOTS];
+        if (pReceiver->expected == pReceiver->highest) {
+
+            pSlot->present = 0;
+            pReceiver->highest++;
+        }
+        if (!pSlot->present) {
+
+            pSlot->missing = 0;
+        }
+        Deliver(pReceiver);
+    }
+
+    // Missing from the highest so far
+    for (; (int) (pReceiver->highest - sequence) <= 0; pReceiver->highest++) {
+
+        pSlot = &pReceiver->pSlots[pReceiver->highest % RX_SLOTS];
+        pSlot->present = 0;
+        pSlot->missing = Now();
+        pSlot->nacked = 0;
+    }
+
+    pSlot = &pReceiver->pSlots[sequence % RX_SLOTS];
+    if (pSlot->present) {
+
+        pReceiver->numDuplicates++;
+        return 1;
+    }
+    pSlot->present = 1;
+    pSlot->offset = offset;
+    pSlot->first = pDatagram[12] | (pDatagram[13] << 8);
+    pSlot->size = pDatagram[14] | (pDatagram[15] << 8);
+    pSlot->flags = flags;
+    memcpy(pSlot->pData, pDatagram + UDPLINK_HEADER_SIZE, pSlot->size);
+    Deliver(pReceiver);
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Sends a control message to the board: acknowledgement, window and NACKs
+/// of the missing datagrams not asked for RX_NACK_PERIOD.
+//------------------------------------------------------------------------------
+static void Control(Receiver *pReceiver, int fd, const struct sockaddr_in *pBoard)
+{
+    unsigned int pMessage[UDPLINK_CONTROL_SIZE / 4 + UDPLINK_MAX_NACKS];
+    unsigned int count = 0;
+    unsigned int sequence;
+    double now = Now();
+    Slot *pSlot;
+
+    for (sequence = pReceiver->expected;
+         (sequence != pReceiver->highest) && (count < UDPLINK_MAX_NACKS); sequence++) {
+
+        pSlot = &pReceiver->pSlots[sequence % RX_SLOTS];
+        if (!pSlot->present && (now - pSlot->nacked >= RX_NACK_PERIOD)) {
+
+            pSlot->nacked = now;
+            pMessage[UDPLINK_CONTROL_SIZE / 4 + count++] = htole32(sequence);
+        }
+    }
+    pMessage[0] = htole32(UDPLINK_CONTROL_MAGIC);
+    pMessage[1] = htole32(pReceiver->acked);
+    pMessage[2] = htole32(RX_SLOTS / 2 * UDPLINK_PAYLOAD);
+    pMessage[3] = htole32(count);
+    sendto(fd, pMessage, UDPLINK_CONTROL_SIZE + count * 4, 0,
+           (const struct sockaddr *) pBoard, sizeof(*pBoard));
+    pReceiver->numControls++;
+    pReceiver->numNacks += count;
+}
+
+//------------------------------------------------------------------------------
+/// Receives the datagrams and writes the stream to a file.
+//------------------------------------------------------------------------------
+static int Receive(unsigned short port, const char *output)
+{
+    static Receiver receiver;
+    struct sockaddr_in address;
+    struct sockaddr_in source;
+    struct sockaddr_in board;
+    socklen_t sourceSize;
+    unsigned char pDatagram[65536];
+    unsigned int received = 0;
+    double start = 0;
+    double control = 0;
+    struct timeval timeout;
+    int bufferSize = RX_BUFFER_SIZE;
+    int known = 0;
+    ssize_t n;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0)) {
+
+        perror("socket");
+        return 1;
+    }
+
+    // Room for bursts, and wake up often enough for the control messages
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    timeout.tv_sec = 0;
+    timeout.tv_usec = RX_CONTROL_PERIOD * 1000000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    receiver.pFile = stdout;
+    if ((output != NULL) && ((receiver.pFile = fopen(output, "wb")) == NULL)) {
+
+        perror(output);
+        return 1;
+    }
+    fprintf(stderr, "Listening on UDP port %u\n", port);
+
+    while (!stop) {
+
+        sourceSize = sizeof(source);
+        n = recvfrom(fd, pDatagram, sizeof(pDatagram), 0, (struct sockaddr *) &source, &sourceSize);
+        if (n >= 0) {
+
+            if (Accept(&receiver, pDatagram, n)) {
+
+                if (receiver.numDatagrams == 1) {
+
+                    start = Now();
+                }
+                board = source;
+                known = 1;
+                received++;
+            }
+        }
+        else if ((errno != EINTR) && (errno != EAGAIN)) {
+
+            perror("recv");
+        }
+        Deliver(&receiver);
+
+        // Acknowledge the board, which streams to the port it sends from
+        if (known && ((received >= RX_CONTROL_BATCH)
+                      || (Now() - control >= ((received != 0) ? RX_CONTROL_PERIOD : RX_KEEPALIVE))
+                      || ((receiver.expected != receiver.highest) && (Now() - control >= RX_CONTROL_PERIOD)))) {
+
+            Control(&receiver, fd, &board);
+            control = Now();
+            received = 0;
+        }
+    }
+
+    fprintf(stderr, "%llu datagrams, %llu sent again, %llu duplicates, %llu lost, %llu bytes in %.1f s\n",
+            receiver.numDatagrams, receiver.numRetransmits, receiver.numDuplicates, receiver.numLost,
+            receiver.numBytes, receiver.numDatagrams ? Now() - start : 0.0);
+    fprintf(stderr, "%llu control messages, %llu NACKs\n", receiver.numControls, receiver.numNacks);
+    if (receiver.pFile != stdout) {
+
+        fclose(receiver.pFile);
+    }
+    close(fd);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Builds a record of the stand-in, with a payload depending on its number.
+//------------------------------------------------------------------------------
+static void BuildRecord(unsigned int *pRecord, unsigned int record)
+{
+    unsigned int *pPayload = EVREC_GetPayload(pRecord);
+    EvRecInfo info;
+    unsigned int i;
+
+    memset(&info, 0, sizeof(info));
+    info.boardId = 0xFF;
+    info.run = 1;
+    info.spill = record / 10;
+    info.event = record;
+    info.timestamp = (unsigned long long) record * 100000;
+    info.flags = EVREC_FLAGS_RAW;
+    info.size = simWords;
+    for (i = 0; i < simWords; i++) {
+
+        pPayload[i] = record * simWords + i;
+    }
+    EVREC_Encode(pRecord, &info);
+    EVREC_Seal(pRecord);
+}
+
+//------------------------------------------------------------------------------
+/// Copies stream bytes of the stand-in for a retransmission (see
+/// UdpLinkFetch): the records are built again, the stream being kept
+/// nowhere.
+//------------------------------------------------------------------------------
+static unsigned char FetchRecords(unsigned int offset, unsigned char *pData, unsigned int size)
+{
+    unsigned int recordSize = (EVREC_HEADER_WORDS + simWords) * 4;
+    unsigned int position;
+    unsigned int chunk;
+
+    while (size != 0) {
+
+        BuildRecord(pSimRecord, offset / recordSize);
+        position = offset % recordSize;
+        chunk = recordSize - position;
+        if (chunk > size) {
+
+            chunk = size;
+        }
+        memcpy(pData, (unsigned char *) pSimRecord + position, chunk);
+        pData += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Board stand-in: answers ARP and ping on a TAP interface, and streams
+/// event records with random payloads to the destination.
+//------------------------------------------------------------------------------
+static int Simulate(
+    const char *pTap,
+    unsigned int address,
+    unsigned int destination,
+    unsigned int numRecords,
+    unsigned int numWords)
+{
+    static const unsigned char pMac[6] = {0x02, 0x00, 0xE9, 0x06, 0x00, 0xFF};
+    unsigned int *pRecord = malloc((EVREC_HEADER_WORDS + numWords) * 4);
+    unsigned int record = 0;
+    int waiting = 0;
+    double tick = Now();
+    struct timeval timeout;
+    const UdpLinkStats *pStats = UDPLINK_GetStats();
+    fd_set fds;
+
+    simWords = numWords;
+    pSimRecord = malloc((EVREC_HEADER_WORDS + numWords) * 4);
+    tapFd = OpenTap(pTap);
+    if ((tapFd < 0) || (pRecord == NULL) || (pSimRecord == NULL)) {
+
+        return 1;
+    }
+    NET_Initialize(&tapDriver, pMac, address, NET_ADDRESS(255, 255, 255, 0), 0);
+    UDPLINK_Initialize(FetchRecords);
+    UDPLINK_Configure(destination, UDPLINK_PORT);
+
+    while (!stop) {
+
+        FD_ZERO(&fds);
+        FD_SET(tapFd, &fds);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = ((record < numRecords) && !waiting) ? 0 : 10000;
+        select(tapFd + 1, &fds, NULL, NULL, &timeout);
+        NET_Poll(16);
+        if (Now() - tick >= 1) {
+
+            tick = Now();
+            NET_Tick();
+            UDPLINK_Tick();
+        }
+
+        // Retransmissions first, then one record per loop, retried until the
+        // destination is resolved and while the window is full
+        waiting = !UDPLINK_Service();
+        if (!waiting && (record < numRecords)) {
+
+            BuildRecord(pRecord, record);
+            waiting = !UDPLINK_Send(pRecord, (EVREC_HEADER_WORDS + numWords) * 4);
+            if (!waiting) {
+
+                record++;
+                if (record == numRecords) {
+
+                    UDPLINK_Flush();
+                    fprintf(stderr, "%u records sent, answering ping until Ctrl-C\n", numRecords);
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "%u datagrams, %u sent again, %u control messages, %u NACKs, %u missed, "
+            "window full %u times\n", pStats->datagrams, pStats->retransmits, pStats->controls,
+            pStats->nacks, pStats->misses, pStats->windowFull);
+    free(pRecord);
+    free(pSimRecord);
+    close(tapFd);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    unsigned int address;
+    unsigned int destination;
+
+    signal(SIGINT, OnSignal);
+    CRC32_Initialize();
+
+    if ((argc >= 2) && (argc <= 4) && (strcmp(argv[1], "rx") == 0)) {
+
+        return Receive((argc > 2) ? atoi(argv[2]) : UDPLINK_PORT, (argc > 3) ? argv[3] : NULL);
+    }
+    if ((argc >= 5) && (argc <= 8) && (strcmp(argv[1], "sim") == 0)) {
+
+        if (!ParseAddress(argv[3], &address) || !ParseAddress(argv[4], &destination)) {
+
+            return 1;
+        }
+        txLoss = (argc > 7) ? atoi(argv[7]) : 0;
+        return Simulate(argv[2], address, destination, (argc > 5) ? atoi(argv[5]) : 1000,
+                        (argc > 6) ? atoi(argv[6]) : 256);
+    }
+
+    fprintf(stderr, "Usage: %s rx [port] [output file]\n"
+                    "       %s sim <tap> <board address> <destination address> [records] [words per record]"
+                    " [loss in percent]\n",
+            argv[0], argv[0]);
+    return 1;
+}
+
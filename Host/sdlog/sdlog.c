@@ -0,0 +1,439 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Host side of the SD card event log (ARM/TWTDCEmbedded/sdlog/sdlog.h).
+/// Lists and extracts the sessions of a card read with a card reader (or of
+/// an image of it), and tests the firmware log code itself on an image file
+/// used as block device.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -o sdlog sdlog.c ../../ARM/TWTDCEmbedded/sdlog/sdlog.c
+///    (the log code is the firmware one).
+/// -# List the sessions: ./sdlog list <device or image>
+/// -# Replay a session to a file (payloads back to back):
+///    ./sdlog extract <device or image> <session> <output file>
+/// -# Start a new log: ./sdlog format <device or image> [size in MB]
+///    The size creates or resizes an image file.
+/// -# Test: ./sdlog test <image> [records] [words per record]
+///    Formats the image, appends records in two sessions, drops the last
+///    index update as a power loss would, then checks that the records are
+///    found again and read back intact. Then formats it again and checks the
+///    same for a first session which was never indexed.
+//------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "../../ARM/TWTDCEmbedded/sdlog/sdlog.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Device or image file.
+static int fd = -1;
+
+/// Number of failed writes.
+static unsigned int errors = 0;
+
+/// Block device on the file.
+static unsigned char FileWrite(unsigned int block, const void *pFirst,
+                               const void *pNext, unsigned int count);
+static unsigned char FileRead(unsigned int block, void *pData, unsigned int count);
+static unsigned char FileIsBusy(void);
+static unsigned int FileGetErrors(void);
+static SdLogDevice device = {0, FileWrite, FileRead, FileIsBusy, FileGetErrors};
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Writes blocks to the file, synchronously.
+//------------------------------------------------------------------------------
+static unsigned char FileWrite(unsigned int block, const void *pFirst,
+                               const void *pNext, unsigned int count)
+{
+    off_t offset = (off_t) block * SDLOG_BLOCK_SIZE;
+    size_t size = (size_t) (count - 1) * SDLOG_BLOCK_SIZE;
+
+    if ((pwrite(fd, pFirst, SDLOG_BLOCK_SIZE, offset) != SDLOG_BLOCK_SIZE)
+        || ((count > 1) && (pwrite(fd, pNext, size, offset + SDLOG_BLOCK_SIZE) != size))) {
+
+        errors++;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Reads blocks from the file.
+//------------------------------------------------------------------------------
+static unsigned char FileRead(unsigned int block, void *pData, unsigned int count)
+{
+    size_t size = (size_t) count * SDLOG_BLOCK_SIZE;
+
+    return pread(fd, pData, size, (off_t) block * SDLOG_BLOCK_SIZE) == size;
+}
+
+//------------------------------------------------------------------------------
+/// The file writes are synchronous.
+//------------------------------------------------------------------------------
+static unsigned char FileIsBusy(void)
+{
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of failed writes.
+//------------------------------------------------------------------------------
+static unsigned int FileGetErrors(void)
+{
+    return errors;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time in seconds.
+//------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//------------------------------------------------------------------------------
+/// Opens a device or image file as block device.
+/// \param pName  File name.
+/// \param sizeMB  Size to give to the file in MB, 0 to keep it.
+/// \return 1 on success.
+//------------------------------------------------------------------------------
+static int Open(const char *pName, unsigned int sizeMB)
+{
+    off_t size;
+
+    fd = open(pName, O_RDWR | (sizeMB ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+
+        perror(pName);
+        return 0;
+    }
+    if (sizeMB && (ftruncate(fd, (off_t) sizeMB * 1024 * 1024) != 0)) {
+
+        perror(pName);
+        return 0;
+    }
+    size = lseek(fd, 0, SEEK_END);
+    device.numBlocks = size / SDLOG_BLOCK_SIZE;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Mounts the log of the open device.
+/// \return 1 on success.
+//------------------------------------------------------------------------------
+static int Mount(const char *pName)
+{
+    if (!SDLOG_Mount(&device)) {
+
+        fprintf(stderr, "%s: no valid log\n", pName);
+        return 0;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Prints the sessions of a log.
+//------------------------------------------------------------------------------
+static int List(const char *pName)
+{
+    const SdLogSuper *pSuper;
+    const SdLogSession *pSession;
+    unsigned int i;
+
+    if (!Open(pName, 0) || !Mount(pName)) {
+
+        return 1;
+    }
+    pSuper = SDLOG_GetSuper();
+    printf("Volume %08X, %u blocks, index generation %u, %u sessions\n",
+           pSuper->volume, pSuper->numBlocks, pSuper->generation, pSuper->numSessions);
+    for (i = 0; i < pSuper->numSessions; i++) {
+
+        pSession = &pSuper->pSessions[i];
+        printf("  session %u: blocks %u to %u (%.1f MB), records %u to %u\n", i,
+               pSession->firstBlock, pSession->endBlock,
+               (pSession->endBlock - pSession->firstBlock) * (SDLOG_BLOCK_SIZE / 1048576.0),
+               pSession->firstRecord, pSession->firstRecord + pSession->numRecords);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Writes the payloads of the records of a session to a file.
+//------------------------------------------------------------------------------
+static int Extract(const char *pName, unsigned int session, const char *pOutput)
+{
+    const SdLogSession *pSession;
+    SdLogRecord record;
+    unsigned int *pData;
+    unsigned int size;
+    unsigned int block;
+    unsigned int next;
+    unsigned int i;
+    FILE *pFile;
+
+    if (!Open(pName, 0) || !Mount(pName)) {
+
+        return 1;
+    }
+    if (session >= SDLOG_GetSuper()->numSessions) {
+
+        fprintf(stderr, "%s: no session %u\n", pName, session);
+        return 1;
+    }
+    pSession = &SDLOG_GetSuper()->pSessions[session];
+    pFile = fopen(pOutput, "wb");
+    if (!pFile) {
+
+        perror(pOutput);
+        return 1;
+    }
+
+    pData = 0;
+    size = 0;
+    block = pSession->firstBlock;
+    for (i = 0; i < pSession->numRecords; i++) {
+
+        // Header first, to size the buffer
+        next = block;
+        if (SDLOG_ReadRecord(&next, &record, 0, 0) && (record.size + SDLOG_BLOCK_SIZE > size)) {
+
+            size = record.size + SDLOG_BLOCK_SIZE;
+            pData = realloc(pData, size);
+        }
+        if (!SDLOG_ReadRecord(&block, &record, pData, size)
+            || (record.sequence != pSession->firstRecord + i)) {
+
+            fprintf(stderr, "%s: bad record at block %u\n", pName, block);
+            return 1;
+        }
+        if (fwrite(pData, 1, record.size, pFile) != record.size) {
+
+            perror(pOutput);
+            return 1;
+        }
+    }
+    fclose(pFile);
+    fprintf(stderr, "%u records extracted\n", pSession->numRecords);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Starts a new log.
+//------------------------------------------------------------------------------
+static int Format(const char *pName, unsigned int sizeMB)
+{
+    if (!Open(pName, sizeMB)) {
+
+        return 1;
+    }
+    if (!SDLOG_Format(&device, (unsigned int) time(0))) {
+
+        fprintf(stderr, "%s: cannot format (%u blocks)\n", pName, device.numBlocks);
+        return 1;
+    }
+    printf("%s: log of %u blocks\n", pName, device.numBlocks);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Fills a test record.
+//------------------------------------------------------------------------------
+static void Fill(unsigned int *pData, unsigned int words, unsigned int record)
+{
+    unsigned int i;
+
+    for (i = 0; i < words; i++) {
+
+        pData[i] = (record << 20) ^ (i * 2654435761u);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Appends records as the transmit task does, syncing the index from time to
+/// time.
+/// \return 1 on success.
+//------------------------------------------------------------------------------
+static int AppendRecords(unsigned int *pData, unsigned int words,
+                         unsigned int first, unsigned int count, int lastSync)
+{
+    unsigned int i;
+
+    for (i = first; i < first + count; i++) {
+
+        // Some records are shorter, to exercise the padding
+        Fill(pData, words - (i % 3) * 100, i);
+        if (!SDLOG_Append(pData, words - (i % 3) * 100)) {
+
+            fprintf(stderr, "append %u failed, state %u\n", i, SDLOG_GetState());
+            return 0;
+        }
+        if (((i % 10) == 9) && (lastSync || (i < first + count - 5))) {
+
+            SDLOG_Sync();
+        }
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Tests the log code on an image file.
+//------------------------------------------------------------------------------
+static int Test(const char *pName, unsigned int records, unsigned int words)
+{
+    const SdLogSuper *pSuper;
+    SdLogRecord record;
+    unsigned int *pData;
+    unsigned int *pExpected;
+    unsigned int block;
+    unsigned int total;
+    unsigned int i;
+    unsigned int sizeMB;
+    double start;
+
+    if ((records < 10) || (words < 300)) {
+
+        fprintf(stderr, "at least 10 records of 300 words\n");
+        return 1;
+    }
+    sizeMB = SDLOG_DATA_BLOCK / 2048 + (unsigned int) ((2.0 * records * (words * 4 + 512)) / 1048576) + 1;
+    if (Format(pName, sizeMB) != 0) {
+
+        return 1;
+    }
+    pData = malloc(words * 4 + SDLOG_BLOCK_SIZE);
+    pExpected = malloc(words * 4);
+
+    // Two sessions; the last records of the second one are not in the index
+    start = Now();
+    if (!AppendRecords(pData, words, 0, records, 1)) {
+
+        return 1;
+    }
+    SDLOG_Close();
+    SDLOG_Sync();
+    if (!AppendRecords(pData, words, records, records, 0)) {
+
+        return 1;
+    }
+    printf("%u records of up to %u words written in %.3f s\n", 2 * records, words, Now() - start);
+
+    // Power loss: mount again from the index on the image
+    if (!Mount(pName)) {
+
+        return 1;
+    }
+    pSuper = SDLOG_GetSuper();
+    total = 0;
+    for (i = 0; i < pSuper->numSessions; i++) {
+
+        total += pSuper->pSessions[i].numRecords;
+    }
+    if ((pSuper->numSessions != 2) || (total != 2 * records)) {
+
+        fprintf(stderr, "FAILED: %u sessions, %u records found\n", pSuper->numSessions, total);
+        return 1;
+    }
+
+    // Read everything back
+    block = pSuper->pSessions[0].firstBlock;
+    for (i = 0; i < 2 * records; i++) {
+
+        if (!SDLOG_ReadRecord(&block, &record, pData, words * 4 + SDLOG_BLOCK_SIZE)
+            || (record.sequence != i) || (record.size != (words - (i % 3) * 100) * 4)) {
+
+            fprintf(stderr, "FAILED: record %u unreadable\n", i);
+            return 1;
+        }
+        Fill(pExpected, record.size / 4, i);
+        if (memcmp(pData, pExpected, record.size) != 0) {
+
+            fprintf(stderr, "FAILED: record %u corrupted\n", i);
+            return 1;
+        }
+    }
+    if (SDLOG_ReadRecord(&block, &record, 0, 0)) {
+
+        fprintf(stderr, "FAILED: record after the end of the log\n");
+        return 1;
+    }
+
+    // A new format must not see the old records
+    if (!SDLOG_Format(&device, pSuper->volume + 1) || !Mount(pName)
+        || (SDLOG_GetSuper()->numSessions != 0)) {
+
+        fprintf(stderr, "FAILED: old records after format\n");
+        return 1;
+    }
+
+    // The first session after a format, before any index update
+    if (!AppendRecords(pData, words, 0, 5, 0) || !Mount(pName)
+        || (SDLOG_GetSuper()->numSessions != 1)
+        || (SDLOG_GetSuper()->pSessions[0].numRecords != 5)) {
+
+        fprintf(stderr, "FAILED: first session not recovered\n");
+        return 1;
+    }
+    printf("OK: %u records recovered and verified\n", 2 * records + 5);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    if ((argc == 3) && (strcmp(argv[1], "list") == 0)) {
+
+        return List(argv[2]);
+    }
+    if ((argc == 5) && (strcmp(argv[1], "extract") == 0)) {
+
+        return Extract(argv[2], strtoul(argv[3], 0, 0), argv[4]);
+    }
+    if ((argc >= 3) && (argc <= 4) && (strcmp(argv[1], "format") == 0)) {
+
+        return Format(argv[2], (argc == 4) ? strtoul(argv[3], 0, 0) : 0);
+    }
+    if ((argc >= 3) && (argc <= 5) && (strcmp(argv[1], "test") == 0)) {
+
+        return Test(argv[2], (argc >= 4) ? strtoul(argv[3], 0, 0) : 100,
+                    (argc == 5) ? strtoul(argv[4], 0, 0) : 32 * 1024);
+    }
+
+    fprintf(stderr, "Usage: %s list <device or image>\n"
+                    "       %s extract <device or image> <session> <output file>\n"
+                    "       %s format <device or image> [size in MB]\n"
+                    "       %s test <image> [records] [words per record]\n",
+            argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+}
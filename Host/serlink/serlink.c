@@ -0,0 +1,387 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Host side of the USART data link (ARM/TWTDCEmbedded/serlink/serlink.h).
+/// Receives the frames from a serial port, checks their sequence numbers and
+/// stores the payloads in a file. Also provides a stand-in for the board,
+/// which sends frames in the same format on a pseudo-terminal, to test the
+/// receiver and the DAQ scripts without hardware.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -o serlink serlink.c
+/// -# Receive: ./serlink rx /dev/ttyUSB0 [baudrate] [output file]
+///    The port is set to raw mode with RTS/CTS flow control; the baudrate
+///    defaults to 3000000. Stop with Ctrl-C.
+/// -# Stand-in: ./serlink sim [frames] [words per frame]
+///    Prints the pseudo-terminal to give to "serlink rx", then sends the
+///    frames once it is opened (the baudrate does not matter on a pty).
+//------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "../../ARM/TWTDCEmbedded/serlink/serlink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Largest accepted payload, to resynchronize on corrupted headers.
+#define MAX_PAYLOAD     (16 * 1024 * 1024)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Set by SIGINT.
+static volatile sig_atomic_t stop = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Stops the receiver on Ctrl-C.
+//------------------------------------------------------------------------------
+static void OnSignal(int signal)
+{
+    stop = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time in seconds.
+//------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//------------------------------------------------------------------------------
+/// Reads a little-endian 32-bit word.
+//------------------------------------------------------------------------------
+static unsigned int Word(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+//------------------------------------------------------------------------------
+/// Writes a little-endian 32-bit word.
+//------------------------------------------------------------------------------
+static void PutWord(unsigned char *p, unsigned int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+//------------------------------------------------------------------------------
+/// Reads exactly size bytes. Returns 0 at the end of the stream.
+//------------------------------------------------------------------------------
+static int ReadFull(int fd, unsigned char *pData, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0) {
+
+        n = read(fd, pData, size);
+        if (n < 0 && errno == EINTR && !stop) {
+
+            continue;
+        }
+        if (n <= 0) {
+
+            return 0;
+        }
+        pData += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Writes exactly size bytes. Returns 0 on error.
+//------------------------------------------------------------------------------
+static int WriteFull(int fd, const unsigned char *pData, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0) {
+
+        n = write(fd, pData, size);
+        if (n < 0 && errno == EINTR) {
+
+            continue;
+        }
+        if (n <= 0) {
+
+            return 0;
+        }
+        pData += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Converts a baudrate to a termios speed, 0 if not supported.
+//------------------------------------------------------------------------------
+static speed_t Speed(unsigned int baudrate)
+{
+    static const struct {unsigned int baudrate; speed_t speed;} speeds[] = {
+
+        {115200, B115200}, {230400, B230400}, {460800, B460800},
+        {921600, B921600}, {1000000, B1000000}, {1500000, B1500000},
+        {2000000, B2000000}, {3000000, B3000000}, {4000000, B4000000}
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+
+        if (speeds[i].baudrate == baudrate) {
+
+            return speeds[i].speed;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Puts a terminal in raw mode with RTS/CTS flow control.
+//------------------------------------------------------------------------------
+static int ConfigurePort(int fd, speed_t speed)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) < 0) {
+
+        return 0;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CRTSCTS | CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (speed) {
+
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+
+    return (tcsetattr(fd, TCSANOW, &tio) == 0);
+}
+
+//------------------------------------------------------------------------------
+/// Receives frames until the end of the stream or Ctrl-C.
+//------------------------------------------------------------------------------
+static int Receive(const char *device, unsigned int baudrate, const char *output)
+{
+    unsigned char header[sizeof(SerLinkHeader)];
+    unsigned char *pPayload;
+    unsigned int size, sequence, expected = 0;
+    unsigned long long frames = 0, bytes = 0, missing = 0, skipped = 0;
+    double start = 0;
+    FILE *pOutput = 0;
+    int fd;
+
+    fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+
+        perror(device);
+        return 1;
+    }
+    if (!ConfigurePort(fd, Speed(baudrate))) {
+
+        fprintf(stderr, "%s: cannot set raw mode at %u baud\n", device, baudrate);
+        return 1;
+    }
+    if (output) {
+
+        pOutput = fopen(output, "wb");
+        if (!pOutput) {
+
+            perror(output);
+            return 1;
+        }
+    }
+    pPayload = malloc(MAX_PAYLOAD);
+    if (!pPayload) {
+
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    signal(SIGINT, OnSignal);
+
+    if (!ReadFull(fd, header, sizeof(header))) {
+
+        fprintf(stderr, "%s: no data\n", device);
+        return 1;
+    }
+    while (!stop) {
+
+        // Slide one byte at a time until a plausible header is found
+        size = Word(header + 8);
+        if ((Word(header) != SERLINK_MAGIC) || (size > MAX_PAYLOAD)) {
+
+            memmove(header, header + 1, sizeof(header) - 1);
+            skipped++;
+            if (!ReadFull(fd, header + sizeof(header) - 1, 1)) {
+
+                break;
+            }
+            continue;
+        }
+
+        sequence = Word(header + 4);
+        if (!ReadFull(fd, pPayload, size)) {
+
+            fprintf(stderr, "frame %u truncated\n", sequence);
+            break;
+        }
+        if (frames == 0) {
+
+            start = Now();
+        }
+        else if (sequence < expected) {
+
+            fprintf(stderr, "sequence restarted at %u (board reset?)\n", sequence);
+        }
+        else if (sequence != expected) {
+
+            fprintf(stderr, "frames %u to %u missing\n", expected, sequence - 1);
+            missing += sequence - expected;
+        }
+        expected = sequence + 1;
+        frames++;
+        bytes += size;
+        if (pOutput && (fwrite(pPayload, 1, size, pOutput) != size)) {
+
+            perror(output);
+            break;
+        }
+        printf("frame %u: %u bytes\n", sequence, size);
+        fflush(stdout);
+
+        if (!ReadFull(fd, header, sizeof(header))) {
+
+            break;
+        }
+    }
+
+    fprintf(stderr, "%llu frames, %llu bytes, %llu missing, %llu bytes skipped",
+            frames, bytes, missing, skipped);
+    if ((frames > 1) && (Now() > start)) {
+
+        fprintf(stderr, ", %.0f bytes/s", bytes / (Now() - start));
+    }
+    fprintf(stderr, "\n");
+    if (pOutput) {
+
+        fclose(pOutput);
+    }
+    close(fd);
+
+    return (missing || skipped) ? 2 : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Board stand-in: sends frames on a new pseudo-terminal.
+//------------------------------------------------------------------------------
+static int Simulate(unsigned int numFrames, unsigned int numWords)
+{
+    unsigned char *pFrame;
+    unsigned int size = sizeof(SerLinkHeader) + numWords * 4;
+    unsigned int frame, i;
+    struct termios tio;
+    char *slave;
+    char c;
+    int fd, flags;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((fd < 0) || (grantpt(fd) < 0) || (unlockpt(fd) < 0) || !(slave = ptsname(fd))) {
+
+        perror("pseudo-terminal");
+        return 1;
+    }
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    printf("%s\n", slave);
+    fflush(stdout);
+
+    // Wait for the receiver: reading the master fails with EIO as long as
+    // the slave is not open
+    flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    while ((read(fd, &c, 1) < 0) && (errno == EIO)) {
+
+        usleep(100000);
+    }
+    fcntl(fd, F_SETFL, flags);
+
+    pFrame = malloc(size);
+    if (!pFrame) {
+
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (frame = 0; frame < numFrames; frame++) {
+
+        PutWord(pFrame, SERLINK_MAGIC);
+        PutWord(pFrame + 4, frame);
+        PutWord(pFrame + 8, numWords * 4);
+        for (i = 0; i < numWords; i++) {
+
+            PutWord(pFrame + sizeof(SerLinkHeader) + 4 * i, 0xDEAD0000 + ((frame + i) & 0xFFFF));
+        }
+        if (!WriteFull(fd, pFrame, size)) {
+
+            perror("write");
+            return 1;
+        }
+    }
+
+    // Let the receiver drain the pty before hanging up
+    tcdrain(fd);
+    sleep(1);
+    close(fd);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    if ((argc >= 3) && (argc <= 5) && (strcmp(argv[1], "rx") == 0)) {
+
+        return Receive(argv[2], (argc >= 4) ? strtoul(argv[3], 0, 0) : SERLINK_BAUDRATE,
+                       (argc == 5) ? argv[4] : 0);
+    }
+    if ((argc >= 2) && (argc <= 4) && (strcmp(argv[1], "sim") == 0)) {
+
+        return Simulate((argc >= 3) ? strtoul(argv[2], 0, 0) : 100,
+                        (argc == 4) ? strtoul(argv[3], 0, 0) : 32 * 1024);
+    }
+
+    fprintf(stderr, "Usage: %s rx <device> [baudrate] [output file]\n"
+                    "       %s sim [frames] [words per frame]\n", argv[0], argv[0]);
+    return 1;
+}
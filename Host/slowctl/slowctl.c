@@ -0,0 +1,583 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Host side of the slow-control protocol (ARM/TWTDCEmbedded/slowctl/slowctl.h).
+/// Sends a batch of register operations to the board on its console serial
+/// port, as one request, and prints the response. Also provides a stand-in
+/// for the board, which runs the firmware protocol code on memory arrays
+/// behind a pseudo-terminal, to test the tool and the DAQ scripts without
+/// hardware.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -I../../ARM/at91lib -I../../ARM/TWTDCEmbedded -o slowctl
+///    slowctl.c ../../ARM/TWTDCEmbedded/slowctl/slowctl.c
+///    ../../ARM/at91lib/utility/crc32.c
+/// -# Send: ./slowctl tx <device> [baudrate] <operation>...
+///    with the operations, applied in order and all or none:
+///    - r <address> [words]: read;
+///    - w <address> <value>...: write;
+///    - m <address> <mask> <value> [words]: read-modify-write, prints the
+///      old values;
+///    - rf, wf, mf: same on a single address (FIFO).
+///    The baudrate defaults to 115200. The console text of the board is
+///    printed on stderr. The request is sent again, with the same tag, if the
+///    response does not come within a second.
+/// -# Stand-in: ./slowctl sim
+///    Prints the pseudo-terminal to give to "slowctl tx", then serves the
+///    requests, echoing the other characters as the shell does. It has the
+///    DPRAM (0x50000000, 128 KB) and the SMC (0xFFFFEC00, 256 bytes)
+///    writable, and a read-only chip ID at 0xFFFFF240. Stop with Ctrl-C.
+//------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <slowctl/slowctl.h>
+#include <utility/crc32.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Time to wait for a response, in milliseconds, and number of tries.
+#define TIMEOUT         1000
+#define TRIES           3
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Set by SIGINT.
+static volatile sig_atomic_t stop = 0;
+
+/// Pseudo-terminal of the stand-in.
+static int simFd;
+
+/// Memories of the stand-in.
+static unsigned int pDpram[32 * 1024];
+static unsigned int pSmc[64];
+static unsigned int chipId = 0x019803A0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Stops the stand-in on Ctrl-C.
+//------------------------------------------------------------------------------
+static void OnSignal(int signal)
+{
+    stop = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns a nanosecond count, the tick counter of the stand-in.
+//------------------------------------------------------------------------------
+static unsigned int GetTicks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned int) (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the frequency of GetTicks().
+//------------------------------------------------------------------------------
+static unsigned int GetFrequency(void)
+{
+    return 1000000000;
+}
+
+//------------------------------------------------------------------------------
+/// Writes exactly size bytes. Returns 0 on error.
+//------------------------------------------------------------------------------
+static int WriteFull(int fd, const unsigned char *pData, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0) {
+
+        n = write(fd, pData, size);
+        if (n < 0 && errno == EINTR) {
+
+            continue;
+        }
+        if (n <= 0) {
+
+            return 0;
+        }
+        pData += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Port output of the stand-in (see SlowCtlPort).
+//------------------------------------------------------------------------------
+static unsigned int WritePty(const unsigned char *pData, unsigned int size)
+{
+    return WriteFull(simFd, pData, size) ? size : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Converts a baudrate to a termios speed, 0 if not supported.
+//------------------------------------------------------------------------------
+static speed_t Speed(unsigned int baudrate)
+{
+    static const struct {unsigned int baudrate; speed_t speed;} speeds[] = {
+
+        {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+        {115200, B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600}
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+
+        if (speeds[i].baudrate == baudrate) {
+
+            return speeds[i].speed;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Puts a terminal in raw mode, without flow control as the console.
+//------------------------------------------------------------------------------
+static int ConfigurePort(int fd, speed_t speed)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) < 0) {
+
+        return 0;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (speed) {
+
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+
+    return (tcsetattr(fd, TCSANOW, &tio) == 0);
+}
+
+//------------------------------------------------------------------------------
+/// Converts an argument to a number, in decimal or hexadecimal.
+/// \return 1 if the whole argument is a number.
+//------------------------------------------------------------------------------
+static int Number(const char *pString, unsigned int *pValue)
+{
+    char *pEnd;
+
+    if ((*pString < '0') || (*pString > '9')) {
+
+        return 0;
+    }
+    *pValue = strtoul(pString, &pEnd, 0);
+
+    return (*pEnd == 0);
+}
+
+//------------------------------------------------------------------------------
+/// Builds a request from the command line operations.
+/// \param argc  Number of arguments.
+/// \param argv  Operations and their numbers.
+/// \param tag  Tag of the request.
+/// \param pRequest  Request, SLOWCTL_MAX_PACKET bytes.
+/// \return Size of the request in bytes, 0 if the operations are wrong.
+//------------------------------------------------------------------------------
+static unsigned int Build(int argc, char **argv, unsigned short tag, unsigned int *pRequest)
+{
+    SlowCtlRequest *pHeader = (SlowCtlRequest *) pRequest;
+    SlowCtlOperation *pOperation;
+    unsigned int pNumbers[SLOWCTL_MAX_PACKET / 4];
+    unsigned int position = sizeof(SlowCtlRequest) / 4;
+    unsigned int numNumbers;
+    unsigned int code;
+    unsigned int i;
+    int arg = 0;
+
+    pHeader->magic = SLOWCTL_REQUEST_MAGIC;
+    pHeader->tag = tag;
+    pHeader->count = 0;
+    while (arg < argc) {
+
+        code = (argv[arg][0] == 'r') ? SLOWCTL_OP_READ
+               : (argv[arg][0] == 'w') ? SLOWCTL_OP_WRITE
+               : (argv[arg][0] == 'm') ? SLOWCTL_OP_RMW : 0;
+        if ((code == 0) || ((argv[arg][1] != 0) && strcmp(argv[arg] + 1, "f"))) {
+
+            fprintf(stderr, "Unknown operation '%s'\n", argv[arg]);
+            return 0;
+        }
+        if (argv[arg][1] == 'f') {
+
+            code |= SLOWCTL_OP_FIFO;
+        }
+        arg++;
+        for (numNumbers = 0; (arg < argc) && (numNumbers < SLOWCTL_MAX_PACKET / 4)
+                             && Number(argv[arg], &pNumbers[numNumbers]); numNumbers++) {
+
+            arg++;
+        }
+
+        // Room for the operation and its data
+        if (position + sizeof(SlowCtlOperation) / 4 + numNumbers > SLOWCTL_MAX_PACKET / 4) {
+
+            fprintf(stderr, "Request too large\n");
+            return 0;
+        }
+        pOperation = (SlowCtlOperation *) (pRequest + position);
+        position += sizeof(SlowCtlOperation) / 4;
+        pOperation->op = code;
+        pOperation->reserved = 0;
+        pOperation->address = pNumbers[0];
+        switch (code & ~SLOWCTL_OP_FIFO) {
+
+            case SLOWCTL_OP_READ:
+                if ((numNumbers < 1) || (numNumbers > 2)) {
+
+                    fprintf(stderr, "Usage: r <address> [words]\n");
+                    return 0;
+                }
+                pOperation->count = (numNumbers == 2) ? pNumbers[1] : 1;
+                break;
+
+            case SLOWCTL_OP_WRITE:
+                if (numNumbers < 2) {
+
+                    fprintf(stderr, "Usage: w <address> <value>...\n");
+                    return 0;
+                }
+                pOperation->count = numNumbers - 1;
+                for (i = 1; i < numNumbers; i++) {
+
+                    pRequest[position++] = pNumbers[i];
+                }
+                break;
+
+            default:
+                if ((numNumbers < 3) || (numNumbers > 4)) {
+
+                    fprintf(stderr, "Usage: m <address> <mask> <value> [words]\n");
+                    return 0;
+                }
+                pOperation->count = (numNumbers == 4) ? pNumbers[3] : 1;
+                pRequest[position++] = pNumbers[1];
+                pRequest[position++] = pNumbers[2];
+                break;
+        }
+        pHeader->count++;
+    }
+
+    return position * 4;
+}
+
+//------------------------------------------------------------------------------
+/// Prints a response.
+/// \param pRequest  Request.
+/// \param pResponse  Response.
+/// \param size  Size of the response in bytes.
+/// \return 0 if the request was applied.
+//------------------------------------------------------------------------------
+static int Print(const unsigned int *pRequest, const unsigned int *pResponse, unsigned int size)
+{
+    static const char *pStatus[] = {"OK", "bad frame", "bad request", "bad address", "too large"};
+    const SlowCtlRequest *pHeader = (const SlowCtlRequest *) pRequest;
+    const SlowCtlResponse *pAnswer = (const SlowCtlResponse *) pResponse;
+    const SlowCtlOperation *pOperation;
+    const unsigned int *pValue = pResponse + sizeof(SlowCtlResponse) / 4;
+    unsigned int position = sizeof(SlowCtlRequest) / 4;
+    unsigned int code;
+    unsigned int i;
+    unsigned int j;
+
+    if (pAnswer->status != SLOWCTL_OK) {
+
+        printf("Rejected: %s", (pAnswer->status < 5) ? pStatus[pAnswer->status] : "unknown");
+        if (pAnswer->index != SLOWCTL_NO_INDEX) {
+
+            printf(" at operation %u", pAnswer->index);
+        }
+        printf("\n");
+        return 1;
+    }
+
+    for (i = 0; i < pHeader->count; i++) {
+
+        pOperation = (const SlowCtlOperation *) (pRequest + position);
+        position += sizeof(SlowCtlOperation) / 4;
+        code = pOperation->op & ~SLOWCTL_OP_FIFO;
+        if (code == SLOWCTL_OP_WRITE) {
+
+            position += pOperation->count;
+            continue;
+        }
+        if (code == SLOWCTL_OP_RMW) {
+
+            position += 2;
+        }
+        for (j = 0; j < pOperation->count; j++) {
+
+            if ((unsigned int) ((const unsigned char *) pValue - (const unsigned char *) pResponse) + 4 > size) {
+
+                fprintf(stderr, "Response truncated\n");
+                return 1;
+            }
+            printf("0x%08X: 0x%08X%s\n",
+                   pOperation->address + ((pOperation->op & SLOWCTL_OP_FIFO) ? 0 : 4 * j),
+                   *pValue++, (code == SLOWCTL_OP_RMW) ? " (before)" : "");
+        }
+    }
+    if (pAnswer->frequency != 0) {
+
+        printf("%u operations applied in %.3f us\n", pAnswer->count,
+               pAnswer->duration * 1e6 / pAnswer->frequency);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Sends a request and waits for its response, sending it again if needed.
+//------------------------------------------------------------------------------
+static int Transact(const char *device, unsigned int baudrate, int argc, char **argv)
+{
+    static unsigned int pRequest[SLOWCTL_MAX_PACKET / 4];
+    static unsigned int pResponse[(SLOWCTL_MAX_PACKET + 4) / 4];
+    static unsigned char pFrame[SLOWCTL_MAX_FRAME];
+    unsigned char *pBytes = (unsigned char *) pResponse;
+    unsigned int requestSize;
+    unsigned int frameSize;
+    unsigned int length = 0;
+    unsigned int crc;
+    unsigned short tag;
+    struct pollfd pfd;
+    unsigned char c;
+    int inFrame = 0;
+    int escape = 0;
+    int tries;
+    int fd;
+
+    tag = (unsigned short) (getpid() ^ time(0));
+    requestSize = Build(argc, argv, tag, pRequest);
+    if (requestSize == 0) {
+
+        return 1;
+    }
+    fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+
+        perror(device);
+        return 1;
+    }
+    if (!ConfigurePort(fd, Speed(baudrate)) && isatty(fd)) {
+
+        fprintf(stderr, "%s: cannot set raw mode at %u baud\n", device, baudrate);
+        return 1;
+    }
+    frameSize = SLOWCTL_Encode(pRequest, requestSize, pFrame);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    for (tries = 0; tries < TRIES; tries++) {
+
+        if (!WriteFull(fd, pFrame, frameSize)) {
+
+            perror(device);
+            return 1;
+        }
+        while (poll(&pfd, 1, TIMEOUT) > 0) {
+
+            if (read(fd, &c, 1) != 1) {
+
+                fprintf(stderr, "%s: closed\n", device);
+                return 1;
+            }
+
+            // Console text between the frames
+            if (!inFrame) {
+
+                if (c == SLOWCTL_SLIP_END) {
+
+                    inFrame = 1;
+                    length = 0;
+                }
+                else {
+
+                    fputc(c, stderr);
+                }
+                continue;
+            }
+            if (c == SLOWCTL_SLIP_END) {
+
+                if (length == 0) {
+
+                    continue;
+                }
+                inFrame = 0;
+                length -= 4;
+                crc = pBytes[length] | (pBytes[length + 1] << 8) | (pBytes[length + 2] << 16)
+                      | ((unsigned int) pBytes[length + 3] << 24);
+                if ((length < sizeof(SlowCtlResponse)) || (crc != CRC32_Update(0, pBytes, length))
+                    || (pResponse[0] != SLOWCTL_RESPONSE_MAGIC)) {
+
+                    fprintf(stderr, "Bad response frame\n");
+                    continue;
+                }
+                if (((SlowCtlResponse *) pResponse)->status == SLOWCTL_BAD_FRAME) {
+
+                    fprintf(stderr, "The board got a bad frame\n");
+                    break;
+                }
+                if (((SlowCtlResponse *) pResponse)->tag != tag) {
+
+                    continue;
+                }
+                close(fd);
+                return Print(pRequest, pResponse, length);
+            }
+            if (escape) {
+
+                escape = 0;
+                c = (c == SLOWCTL_SLIP_ESC_END) ? SLOWCTL_SLIP_END
+                    : (c == SLOWCTL_SLIP_ESC_ESC) ? SLOWCTL_SLIP_ESC : c;
+            }
+            else if (c == SLOWCTL_SLIP_ESC) {
+
+                escape = 1;
+                continue;
+            }
+            if (length < sizeof(pResponse)) {
+
+                pBytes[length++] = c;
+            }
+        }
+        fprintf(stderr, "No response, sending again\n");
+    }
+
+    fprintf(stderr, "No response from %s\n", device);
+    close(fd);
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Board stand-in: serves requests on a new pseudo-terminal.
+//------------------------------------------------------------------------------
+static int Simulate(void)
+{
+    static const SlowCtlRegion pRegions[] = {
+
+        {0x50000000, sizeof(pDpram), pDpram, 1},
+        {0xFFFFEC00, sizeof(pSmc), pSmc, 1},
+        {0xFFFFF240, sizeof(chipId), &chipId, 0}
+    };
+    static SlowCtlPort port;
+    const SlowCtlStats *pStats;
+    struct sigaction action;
+    struct termios tio;
+    unsigned char pData[256];
+    char *slave;
+    ssize_t n;
+    ssize_t i;
+
+    simFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((simFd < 0) || (grantpt(simFd) < 0) || (unlockpt(simFd) < 0) || !(slave = ptsname(simFd))) {
+
+        perror("pseudo-terminal");
+        return 1;
+    }
+    tcgetattr(simFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(simFd, TCSANOW, &tio);
+    printf("%s\n", slave);
+    fflush(stdout);
+
+    // Keep the master readable across the openings of the slave
+    open(slave, O_RDWR | O_NOCTTY);
+
+    CRC32_Initialize();
+    SLOWCTL_Initialize(pRegions, sizeof(pRegions) / sizeof(pRegions[0]), GetTicks, GetFrequency);
+    SLOWCTL_InitializePort(&port, WritePty);
+
+    // Without SA_RESTART, for Ctrl-C to interrupt the read
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, 0);
+
+    while (!stop) {
+
+        n = read(simFd, pData, sizeof(pData));
+        if ((n < 0) && (errno == EINTR)) {
+
+            continue;
+        }
+        if (n <= 0) {
+
+            break;
+        }
+        for (i = 0; i < n; i++) {
+
+            if (!SLOWCTL_Input(&port, pData[i])) {
+
+                WritePty(&pData[i], 1);
+            }
+        }
+    }
+
+    pStats = SLOWCTL_GetStats();
+    fprintf(stderr, "%u requests, %u operations, %u words, %u rejected, %u bad frames, %u truncated\n",
+            pStats->requests, pStats->operations, pStats->words, pStats->rejected, pStats->badFrames,
+            pStats->truncated);
+    close(simFd);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    unsigned int baudrate = 115200;
+    int first = 3;
+
+    if ((argc >= 4) && (strcmp(argv[1], "tx") == 0)) {
+
+        if (Number(argv[3], &baudrate)) {
+
+            first = 4;
+        }
+        CRC32_Initialize();
+        return Transact(argv[2], baudrate, argc - first, argv + first);
+    }
+    if ((argc == 2) && (strcmp(argv[1], "sim") == 0)) {
+
+        return Simulate();
+    }
+
+    fprintf(stderr, "Usage: %s tx <device> [baudrate] <r|w|m|rf|wf|mf> <address> [...]...\n"
+                    "       %s sim\n", argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,267 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Host decoder for the binary trace log (ARM/at91lib/utility/tracelog.h).
+/// Reads a raw dump of the trace log area and the firmware binary image, and
+/// prints the records in order, with the format strings taken from the image.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -o tracedump tracedump.c
+/// -# Dump the trace log area from the board, e.g. with J-Link Commander:
+///    savebin tlog.bin 0x22000000 0x100000
+/// -# Decode: ./tracedump tlog.bin TWTDCEmbedded.bin [image load address]
+///    The load address defaults to 0x20200000 (SDRAM build).
+//------------------------------------------------------------------------------
+
+#include "../../ARM/at91lib/utility/tracelog.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Default load address of the firmware image.
+#define DEFAULT_IMAGE_BASE  0x20200000
+
+/// Level prefixes, as printed by TRACELOG_Drain().
+static const char * const prefixes[] = {"", "-F- ", "-E- ", "-W- ", "-I- ", "-D- "};
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Firmware image.
+static unsigned char *pImage;
+static size_t imageSize;
+static unsigned int imageBase;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Loads a whole file in memory.
+//------------------------------------------------------------------------------
+static unsigned char * LoadFile(const char *name, size_t *pSize)
+{
+    FILE *pFile = fopen(name, "rb");
+    unsigned char *pData;
+    long size;
+
+    if (!pFile) {
+
+        perror(name);
+        exit(1);
+    }
+    fseek(pFile, 0, SEEK_END);
+    size = ftell(pFile);
+    fseek(pFile, 0, SEEK_SET);
+    pData = malloc(size + 1);
+    if (!pData || (fread(pData, 1, size, pFile) != (size_t) size)) {
+
+        fprintf(stderr, "%s: read error\n", name);
+        exit(1);
+    }
+    pData[size] = 0;
+    fclose(pFile);
+    *pSize = size;
+
+    return pData;
+}
+
+//------------------------------------------------------------------------------
+/// Reads a little-endian 32-bit word.
+//------------------------------------------------------------------------------
+static unsigned int Word(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the string at a target address in the image, or 0 if outside.
+//------------------------------------------------------------------------------
+static const char * ImageString(unsigned int address)
+{
+    if ((address < imageBase) || ((address - imageBase) >= imageSize)) {
+
+        return 0;
+    }
+
+    return (const char *) &pImage[address - imageBase];
+}
+
+//------------------------------------------------------------------------------
+/// Prints a record, formatting each conversion with its own argument since
+/// the target ones are all 32-bit integers.
+//------------------------------------------------------------------------------
+static void PrintRecord(const char *format, const unsigned int *pArgs, unsigned int numArgs)
+{
+    char spec[32];
+    unsigned int arg = 0;
+    unsigned int value;
+    const char *pString;
+    size_t length;
+
+    while (*format) {
+
+        if (*format != '%') {
+
+            if (*format != '\r') {
+
+                putchar(*format);
+            }
+            format++;
+            continue;
+        }
+        if (format[1] == '%') {
+
+            putchar('%');
+            format += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision; drop the length modifiers
+        length = 0;
+        spec[length++] = *format++;
+        while (*format && strchr("-+ #0123456789.", *format) && (length < sizeof(spec) - 3)) {
+
+            spec[length++] = *format++;
+        }
+        while (*format && strchr("hlLqjzt", *format)) {
+
+            format++;
+        }
+        if (!*format) {
+
+            break;
+        }
+        spec[length++] = *format;
+        spec[length] = 0;
+
+        value = (arg < numArgs) ? pArgs[arg] : 0;
+        arg++;
+        switch (*format++) {
+
+            case 's':
+                pString = ImageString(value);
+                if (pString) {
+
+                    printf(spec, pString);
+                }
+                else {
+
+                    printf("<0x%08X>", value);
+                }
+                break;
+            case 'd': case 'i':
+                printf(spec, (int) value);
+                break;
+            case 'p':
+                printf("0x%08X", value);
+                break;
+            default:
+                spec[length - 1] = strchr("ouxXc", spec[length - 1]) ? spec[length - 1] : 'X';
+                printf(spec, value);
+                break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    unsigned char *pDump;
+    size_t dumpSize;
+    const unsigned char *pRecord;
+    unsigned int numRecords, recordSize, writeIndex, frequency;
+    unsigned int index, first, lost = 0, printed = 0;
+    unsigned int start = 0, info, level, args[TRACELOG_MAX_ARGS], i;
+    const char *format;
+
+    if ((argc < 3) || (argc > 4)) {
+
+        fprintf(stderr, "Usage: %s <trace log dump> <firmware image> [load address]\n", argv[0]);
+        return 1;
+    }
+    pDump = LoadFile(argv[1], &dumpSize);
+    pImage = LoadFile(argv[2], &imageSize);
+    imageBase = (argc == 4) ? strtoul(argv[3], 0, 0) : DEFAULT_IMAGE_BASE;
+
+    if ((dumpSize < sizeof(TraceLogHeader))
+        || (Word(pDump + offsetof(TraceLogHeader, magic)) != TRACELOG_MAGIC)) {
+
+        fprintf(stderr, "%s: not a trace log dump\n", argv[1]);
+        return 1;
+    }
+    if (Word(pDump + offsetof(TraceLogHeader, version)) != TRACELOG_VERSION) {
+
+        fprintf(stderr, "%s: unsupported version %u\n", argv[1],
+                Word(pDump + offsetof(TraceLogHeader, version)));
+        return 1;
+    }
+    recordSize = Word(pDump + offsetof(TraceLogHeader, recordSize));
+    numRecords = Word(pDump + offsetof(TraceLogHeader, numRecords));
+    writeIndex = Word(pDump + offsetof(TraceLogHeader, writeIndex));
+    frequency = Word(pDump + offsetof(TraceLogHeader, frequency));
+    if ((recordSize < sizeof(TraceLogRecord)) || (frequency == 0)
+        || (dumpSize < sizeof(TraceLogHeader) + (size_t) numRecords * recordSize)) {
+
+        fprintf(stderr, "%s: truncated or corrupted dump\n", argv[1]);
+        return 1;
+    }
+
+    // Oldest record still in the ring
+    first = (writeIndex > numRecords) ? writeIndex - numRecords : 0;
+    for (index = first; index != writeIndex; index++) {
+
+        pRecord = pDump + sizeof(TraceLogHeader) + (size_t) (index % numRecords) * recordSize;
+        if (Word(pRecord + offsetof(TraceLogRecord, sequence)) != index) {
+
+            // Being written when the dump was taken
+            lost++;
+            continue;
+        }
+
+        info = Word(pRecord + offsetof(TraceLogRecord, info));
+        for (i = 0; i < TRACELOG_MAX_ARGS; i++) {
+
+            args[i] = Word(pRecord + offsetof(TraceLogRecord, args) + 4 * i);
+        }
+        if (printed++ == 0) {
+
+            start = Word(pRecord + offsetof(TraceLogRecord, timestamp));
+        }
+        printf("[%12.6f] ", (double) (Word(pRecord + offsetof(TraceLogRecord, timestamp)) - start)
+                            / frequency);
+
+        level = (info >> 8) & 0xFF;
+        if (((info & TRACELOG_NOPREFIX) == 0) && (level < 6)) {
+
+            fputs(prefixes[level], stdout);
+        }
+        format = ImageString(Word(pRecord + offsetof(TraceLogRecord, format)));
+        if (format) {
+
+            PrintRecord(format, args, info & 0xFF);
+        }
+        else {
+
+            printf("<format 0x%08X>\n", Word(pRecord + offsetof(TraceLogRecord, format)));
+        }
+    }
+
+    fprintf(stderr, "%u records, %u incomplete, %u overwritten\n",
+            printed, lost, first);
+
+    return 0;
+}
+
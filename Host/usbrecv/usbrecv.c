@@ -0,0 +1,256 @@
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Host receiver of the USB event stream (ARM/TWTDCEmbedded/usbstream).
+/// Keeps several bulk-IN transfers queued so that the device always finds a
+/// pending IN token, checks the transfer headers and sequence numbers,
+/// optionally stores the payloads, and prints the sustained throughput.
+///
+/// !Usage
+///
+/// -# Build: gcc -O2 -Wall -o usbrecv usbrecv.c -lusb-1.0
+///    (needs the libusb-1.0 development package).
+/// -# Give the user access to the device, e.g. with a udev rule on the
+///    vendor and product IDs of usbstream.h, or run as root.
+/// -# Run: ./usbrecv [seconds] [output file]
+///    Runs until Ctrl-C when no duration is given.
+//------------------------------------------------------------------------------
+
+#include "../../ARM/TWTDCEmbedded/usbstream/usbstream.h"
+#include <libusb-1.0/libusb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Number of transfers kept queued.
+#define NUM_TRANSFERS       4
+
+/// Size of each transfer buffer; larger than the biggest block, so that each
+/// transfer receives exactly one block.
+#define TRANSFER_SIZE       (256 * 1024)
+
+/// Period of the throughput printouts, in seconds.
+#define REPORT_PERIOD       1.0
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Set by SIGINT or at the end of the run.
+static volatile sig_atomic_t stop = 0;
+
+/// Output file, 0 if none.
+static FILE *pOutput = 0;
+
+/// Statistics.
+static unsigned int expected = 0;
+static unsigned long long blocks = 0, bytes = 0, missing = 0, errors = 0;
+
+/// Number of transfers still submitted.
+static int active = 0;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Stops the run on Ctrl-C.
+//------------------------------------------------------------------------------
+static void OnSignal(int signal)
+{
+    stop = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time in seconds.
+//------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+//------------------------------------------------------------------------------
+/// Reads a little-endian 32-bit word.
+//------------------------------------------------------------------------------
+static unsigned int Word(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+//------------------------------------------------------------------------------
+/// Checks and stores a received block, then queues the transfer again.
+//------------------------------------------------------------------------------
+static void LIBUSB_CALL OnTransfer(struct libusb_transfer *pTransfer)
+{
+    const unsigned char *pData = pTransfer->buffer;
+    unsigned int length = pTransfer->actual_length;
+    unsigned int sequence, size;
+
+    if (pTransfer->status == LIBUSB_TRANSFER_COMPLETED) {
+
+        size = (length >= sizeof(UsbStreamHeader)) ? Word(pData + 8) : 0;
+        if ((length < sizeof(UsbStreamHeader)) || (Word(pData) != USBSTREAM_MAGIC)
+            || (size != length - sizeof(UsbStreamHeader))) {
+
+            fprintf(stderr, "bad transfer: %u bytes\n", length);
+            errors++;
+        }
+        else {
+
+            sequence = Word(pData + 4);
+            if (blocks && (sequence != expected)) {
+
+                if (sequence > expected) {
+
+                    fprintf(stderr, "blocks %u to %u missing\n", expected, sequence - 1);
+                    missing += sequence - expected;
+                }
+                else {
+
+                    fprintf(stderr, "sequence restarted at %u (board reset?)\n", sequence);
+                }
+            }
+            expected = sequence + 1;
+            blocks++;
+            bytes += size;
+            if (pOutput && (fwrite(pData + sizeof(UsbStreamHeader), 1, size, pOutput) != size)) {
+
+                perror("output");
+                stop = 1;
+            }
+        }
+    }
+    else if (pTransfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+
+        fprintf(stderr, "transfer error %d\n", pTransfer->status);
+        errors++;
+        if (pTransfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+
+            stop = 1;
+        }
+    }
+
+    if (stop || (libusb_submit_transfer(pTransfer) != 0)) {
+
+        active--;
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    libusb_context *pContext;
+    libusb_device_handle *pDevice;
+    struct libusb_transfer *pTransfers[NUM_TRANSFERS];
+    struct timeval tv = {0, 100000};
+    double duration, start, last, now;
+    unsigned long long lastBytes = 0;
+    int i;
+
+    if (argc > 3) {
+
+        fprintf(stderr, "Usage: %s [seconds] [output file]\n", argv[0]);
+        return 1;
+    }
+    duration = (argc >= 2) ? atof(argv[1]) : 0;
+    if (argc == 3) {
+
+        pOutput = fopen(argv[2], "wb");
+        if (!pOutput) {
+
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    if (libusb_init(&pContext) != 0) {
+
+        fprintf(stderr, "cannot initialize libusb\n");
+        return 1;
+    }
+    pDevice = libusb_open_device_with_vid_pid(pContext, USBSTREAM_VID, USBSTREAM_PID);
+    if (!pDevice) {
+
+        fprintf(stderr, "device %04X:%04X not found (or no permission)\n",
+                USBSTREAM_VID, USBSTREAM_PID);
+        return 1;
+    }
+    if (libusb_claim_interface(pDevice, 0) != 0) {
+
+        fprintf(stderr, "cannot claim the interface\n");
+        return 1;
+    }
+    libusb_clear_halt(pDevice, 0x80 | USBSTREAM_EP);
+
+    for (i = 0; i < NUM_TRANSFERS; i++) {
+
+        pTransfers[i] = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(pTransfers[i], pDevice, 0x80 | USBSTREAM_EP,
+                                  malloc(TRANSFER_SIZE), TRANSFER_SIZE, OnTransfer, 0, 1000);
+        if (libusb_submit_transfer(pTransfers[i]) != 0) {
+
+            fprintf(stderr, "cannot submit transfer\n");
+            return 1;
+        }
+        active++;
+    }
+
+    signal(SIGINT, OnSignal);
+    start = last = Now();
+    while (active > 0) {
+
+        libusb_handle_events_timeout(pContext, &tv);
+        now = Now();
+        if ((duration > 0) && (now - start >= duration)) {
+
+            stop = 1;
+        }
+        if (stop) {
+
+            for (i = 0; i < NUM_TRANSFERS; i++) {
+
+                libusb_cancel_transfer(pTransfers[i]);
+            }
+        }
+        else if (now - last >= REPORT_PERIOD) {
+
+            printf("%llu blocks, %.3f MB/s\n", blocks, (bytes - lastBytes) / (now - last) / 1e6);
+            fflush(stdout);
+            last = now;
+            lastBytes = bytes;
+        }
+    }
+
+    now = Now();
+    fprintf(stderr, "%llu blocks, %llu bytes in %.1f s: %.3f MB/s, %llu missing, %llu errors\n",
+            blocks, bytes, now - start, bytes / (now - start) / 1e6, missing, errors);
+
+    for (i = 0; i < NUM_TRANSFERS; i++) {
+
+        free(pTransfers[i]->buffer);
+        libusb_free_transfer(pTransfers[i]);
+    }
+    libusb_release_interface(pDevice, 0);
+    libusb_close(pDevice);
+    libusb_exit(pContext);
+    if (pOutput) {
+
+        fclose(pOutput);
+    }
+
+    return (missing || errors) ? 2 : 0;
+}